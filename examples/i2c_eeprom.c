@@ -0,0 +1,78 @@
+/**
+ * @file i2c_eeprom.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses serbus to fill an I2C EEPROM (e.g. 24LC32) with a test pattern
+ *        then reads it back.
+ * 
+ * Requires an I2C Kernel driver be loaded to expose a /dev/i2c-N interface
+ * and a 24Cxx EEPROM without write protection be connected on the I2C bus.
+ * The EEPROM's contents are overwritten!
+ */
+
+#include "i2cdriver.h"
+#include "eeprom.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define EEPROM_BUS       1    // Connected to /dev/i2c-1
+#define EEPROM_ADDR      0x50 // EEPROM slave address
+#define EEPROM_SIZE      4096 // 24C32: 4KB,
+#define EEPROM_PAGE_SIZE 32   //  32 byte pages,
+#define EEPROM_ADDR_BYTES 2   //  2 address bytes
+
+/**
+ * @brief Returns the time in seconds since an arbitrary point.
+ */
+double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main() {
+  int i2c_fd, i, errors;
+  double start;
+  uint8_t tx_buffer[EEPROM_SIZE], rx_buffer[EEPROM_SIZE];
+  EEPROM_config config = {0};
+
+  config.addr = EEPROM_ADDR;
+  config.size = EEPROM_SIZE;
+  config.page_size = EEPROM_PAGE_SIZE;
+  config.addr_bytes = EEPROM_ADDR_BYTES;
+
+  i2c_fd = I2C_open(EEPROM_BUS);
+  if (i2c_fd < 0) {
+    printf("*Could not open I2C bus %d\n", EEPROM_BUS);
+    exit(0);
+  }
+
+  for (i=0; i<EEPROM_SIZE; i++) tx_buffer[i] = i * 7;
+
+  // Writes are split into pages, and each page's write cycle is waited for
+  // by ACK polling:
+  start = now();
+  if (EEPROM_write(i2c_fd, &config, 0, tx_buffer, EEPROM_SIZE) < 0) {
+    printf("*Could not write to EEPROM, is WP enabled?\n");
+    exit(0);
+  }
+  printf("Wrote %d bytes in %.3fs\n", EEPROM_SIZE, now() - start);
+
+  start = now();
+  if (EEPROM_read(i2c_fd, &config, 0, rx_buffer, EEPROM_SIZE) < 0) {
+    printf("*Could not read from EEPROM\n");
+    exit(0);
+  }
+  printf("Read %d bytes in %.3fs\n", EEPROM_SIZE, now() - start);
+
+  errors = 0;
+  for (i=0; i<EEPROM_SIZE; i++) {
+    if (rx_buffer[i] != tx_buffer[i]) errors++;
+  }
+  printf("%d bytes differ\n", errors);
+
+  I2C_close(i2c_fd);
+  return 0;
+}
@@ -18,6 +18,9 @@
 #define HTU21D_CMD_TEMP 0xe3 // Command to read temperature
 #define HTU21D_CMD_RH   0xe5 // Command to read relative humidity
 
+/// The HTU21D's CRC: one byte after each 2 byte measurement
+static const I2C_crc_check htu21d_crc = { I2C_CRC8, CRC8_HTU21D_INIT, 2 };
+
 /**
  * @brief Reads and returns the current temperature from the HUT21D
  *
@@ -33,10 +36,12 @@ float getTemp(int i2c_fd) {
     printf("*Could set slave address to %d\n", HTU21D_ADDR);
     exit(0);
   }
-  // Read the 3 bytes of data:
-  I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, (void*) rx_buffer, 3);
-  // The crc (cyclic redundancy check) can be used to verify the data was 
-  // received without error - ignore it here
+  // Read the 2 bytes of data and the crc (cyclic redundancy check), which 
+  // the driver uses to verify the data was received without error:
+  if (I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, (void*) rx_buffer, 3) < 0) {
+    printf("*Could not read temperature\n");
+    exit(0);
+  }
   // Combine the high and low bytes:
   raw_value = (rx_buffer[0]<<8) | rx_buffer[1];
   // Clear the two status bits (see datasheet):
@@ -59,7 +64,10 @@ float getRH(int i2c_fd) {
     printf("*Could set slave address to %d\n", HTU21D_ADDR);
     exit(0);
   }
-  I2C_readTransaction(i2c_fd, HTU21D_CMD_RH, (void*) rx_buffer, 3);
+  if (I2C_readTransaction(i2c_fd, HTU21D_CMD_RH, (void*) rx_buffer, 3) < 0) {
+    printf("*Could not read humidity\n");
+    exit(0);
+  }
   raw_value = (rx_buffer[0]<<8) | rx_buffer[1];
   raw_value &= ~0b11;
   // Convert to %RH and return (conversion from datasheet):
@@ -75,6 +83,11 @@ int main() {
     printf("*Could not open I2C bus %d\n", HTU21D_BUS);
     exit(0);
   }
+  // Each measurement is followed by a CRC-8 of its 2 bytes:
+  if (I2C_setCRCCheck(i2c_fd, &htu21d_crc) < 0) {
+    printf("*Could not enable CRC checking\n");
+    exit(0);
+  }
   // Read and print the current temp and rh:
   temp = getTemp(i2c_fd);
   rh = getRH(i2c_fd);
@@ -0,0 +1,107 @@
+/**
+ * @file i2c_htu21d_sched.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses the serbus I2C scheduler to poll an HTU21D without holding the
+ *        bus during its conversions.
+ * 
+ * Requires an I2C Kernel driver be loaded to expose a /dev/i2c-N interface
+ * and an HTU21D be connected on the I2C bus. Unlike i2c_htu21d.c, this uses
+ * the HTU21D's no-hold commands, so the bus is free for other devices while
+ * each measurement is converting.
+ */
+
+#include "i2cdriver.h"
+#include "i2csched.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define HTU21D_BUS         1      // Connected to /dev/i2c-1
+#define HTU21D_ADDR        0x40   // HTU21D slave address
+#define HTU21D_CMD_TEMP    0xf3   // Command to measure temperature, no hold
+#define HTU21D_CMD_RH      0xf5   // Command to measure humidity, no hold
+#define HTU21D_TEMP_US     50000  // Max temperature conversion time
+#define HTU21D_RH_US       16000  // Max humidity conversion time
+#define HTU21D_PERIOD_US   1000000 // Time between measurements
+#define N_READINGS         5      // Number of readings of each to print
+
+static int n_temp, n_rh;
+
+/**
+ * @brief Called by the scheduler with each temperature measurement.
+ */
+void onTemp(void *context, const uint8_t *result, int n_bytes, int error) {
+  int raw_value;
+  n_temp++;
+  if (error) {
+    printf("*Temperature measurement failed: %d\n", error);
+    return;
+  }
+  // Combine the high and low bytes and clear the two status bits:
+  raw_value = ((result[0]<<8) | result[1]) & ~0b11;
+  printf("Temp : %5.2fC\n", -46.85 + 175.72 * (((float)raw_value)/65536.0));
+}
+
+/**
+ * @brief Called by the scheduler with each humidity measurement.
+ */
+void onRH(void *context, const uint8_t *result, int n_bytes, int error) {
+  int raw_value;
+  n_rh++;
+  if (error) {
+    printf("*Humidity measurement failed: %d\n", error);
+    return;
+  }
+  raw_value = ((result[0]<<8) | result[1]) & ~0b11;
+  printf("RH   : %5.2f%%\n", -6.0 + 125.0 * (raw_value/65536.0));
+}
+
+int main() {
+  int i2c_fd;
+  I2C_scheduler *sched;
+  I2C_sched_task task = {0};
+  uint8_t temp_cmd = HTU21D_CMD_TEMP;
+  uint8_t rh_cmd = HTU21D_CMD_RH;
+
+  i2c_fd = I2C_open(HTU21D_BUS);
+  if (i2c_fd < 0) {
+    printf("*Could not open I2C bus %d\n", HTU21D_BUS);
+    exit(0);
+  }
+  sched = I2C_schedCreate(i2c_fd);
+  if (!sched) {
+    printf("*Could not create scheduler\n");
+    exit(0);
+  }
+
+  // Both measurements read 2 data bytes and a CRC. The HTU21D NAKs reads 
+  // until a conversion is done, so retry a few times if it's slow:
+  task.addr = HTU21D_ADDR;
+  task.n_trigger_bytes = 1;
+  task.n_result_bytes = 3;
+  task.period_us = HTU21D_PERIOD_US;
+  task.retry_us = 2000;
+  task.max_retries = 5;
+
+  task.trigger = &temp_cmd;
+  task.conversion_us = HTU21D_TEMP_US;
+  task.callback = onTemp;
+  I2C_schedAdd(sched, &task);
+
+  task.trigger = &rh_cmd;
+  task.conversion_us = HTU21D_RH_US;
+  task.callback = onRH;
+  I2C_schedAdd(sched, &task);
+
+  while (n_temp < N_READINGS || n_rh < N_READINGS) {
+    if (I2C_schedRun(sched, -1) < 0) {
+      printf("*Scheduler failed\n");
+      break;
+    }
+  }
+
+  I2C_schedDestroy(sched);
+  I2C_close(i2c_fd);
+  return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file i2c_mux_sim.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses serbus to read identical HTU21D sensors behind the channels of
+ *        a simulated PCA9548 I2C mux.
+ *
+ * Runs on the simulated bus (see simbus.h), so no hardware is needed. All
+ * the sensors share address 0x40 and are told apart by the mux channel
+ * they're on. Each mux select is only sent when the channel changes, and the
+ * simulated mux, like the real one, only switches at a stop condition.
+ */
+
+#include "i2cdriver.h"
+#include "i2cmux.h"
+#include "simbus.h"
+#include "transport.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MUX_BUS         1    // Simulated /dev/i2c-1
+#define MUX_ADDR        0x70 // PCA9548 slave address
+#define MUX_SENSORS     4    // Sensors on channels 0 to 3
+#define HTU21D_ADDR     0x40 // HTU21D slave address
+#define HTU21D_CMD_TEMP 0xe3 // Command to read temperature
+
+int main() {
+  SimDevice *mux_device;
+  I2C_mux_tree *tree;
+  uint8_t rx_buffer[3];
+  int i2c_fd, mux, channel, raw_value;
+
+  // Replace the default topology with the mux and a sensor on each of its
+  // first channels, each at a different temperature:
+  Transport_select(&Transport_sim);
+  Sim_reset();
+  mux_device = SimDevice_pca9548();
+  Sim_attachI2C(MUX_BUS, MUX_ADDR, mux_device);
+  for (channel=0; channel<MUX_SENSORS; channel++) {
+    Sim_attachI2CMuxed(MUX_BUS, mux_device, channel, HTU21D_ADDR,
+                       SimDevice_htu21d(20.0 + channel * 2.5, 50.0));
+  }
+
+  i2c_fd = I2C_open(MUX_BUS);
+  if (i2c_fd < 0) {
+    printf("*Could not open I2C bus %d\n", MUX_BUS);
+    exit(0);
+  }
+  tree = I2C_muxTreeCreate(i2c_fd);
+  mux = tree ? I2C_muxAdd(tree, I2C_MUX_ROOT, 0, MUX_ADDR, I2C_MUX_PCA9548)
+             : -1;
+  if (mux < 0) {
+    printf("*Could not set up the mux\n");
+    I2C_muxTreeDestroy(tree);
+    I2C_close(i2c_fd);
+    exit(0);
+  }
+
+  for (channel=0; channel<MUX_SENSORS; channel++) {
+    if (I2C_muxReadTransaction(tree, mux, channel, HTU21D_ADDR,
+                               HTU21D_CMD_TEMP, rx_buffer, 3) < 0) {
+      printf("*Could not read the sensor on channel %d\n", channel);
+      continue;
+    }
+    raw_value = ((rx_buffer[0]<<8) | rx_buffer[1]) & ~0b11;
+    printf("Channel %d: %0.2fC\n", channel,
+           -46.85 + 175.72 * (raw_value/65536.0));
+  }
+
+  I2C_muxTreeDestroy(tree);
+  I2C_close(i2c_fd);
+  return 0;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file i2c_regmap_sim.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses a serbus register map to access a simulated I2C device,
+ *        showing which accesses the cache saves.
+ *
+ * Runs on the simulated bus (see simbus.h), so no hardware is needed. A
+ * 24C02 EEPROM stands in for a device with 256 8-bit registers, with its
+ * write cycle time set to 0 so it behaves like a register file.
+ */
+
+#include "i2cdriver.h"
+#include "regmap.h"
+#include "simbus.h"
+#include "transport.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define REGMAP_BUS       1    // Simulated /dev/i2c-1
+#define REGMAP_ADDR      0x50 // Device slave address
+#define REGMAP_STATUS    0x00 // Status register, treated as volatile
+#define REGMAP_CTRL      0x01 // Control register
+#define REGMAP_TABLE     0x10 // First of a table of registers
+#define REGMAP_TABLE_LEN 8    // Registers in the table
+
+/**
+ * @brief Prints the map's counters after the given step.
+ */
+void printStats(Regmap *map, const char *step) {
+  Regmap_stats stats;
+  Regmap_getStats(map, &stats);
+  printf("%-28s hits: %2llu  misses: %2llu  skipped writes: %2llu  "
+         "bus reads: %2llu  bus writes: %2llu\n", step,
+         (unsigned long long) stats.hits,
+         (unsigned long long) stats.misses,
+         (unsigned long long) stats.skipped_writes,
+         (unsigned long long) stats.bus_reads,
+         (unsigned long long) stats.bus_writes);
+}
+
+int main() {
+  Regmap_range ranges[] = {
+    { REGMAP_STATUS, REGMAP_STATUS, REGMAP_VOLATILE },
+  };
+  Regmap_config config = {0};
+  Regmap *map;
+  uint32_t table[REGMAP_TABLE_LEN], value;
+  int i2c_fd, i, errors;
+
+  // Replace the default topology with just the register device:
+  Transport_select(&Transport_sim);
+  Sim_reset();
+  Sim_attachI2C(REGMAP_BUS, REGMAP_ADDR, SimDevice_eeprom24c(256, 8, 0));
+
+  i2c_fd = I2C_open(REGMAP_BUS);
+  if (i2c_fd < 0) {
+    printf("*Could not open I2C bus %d\n", REGMAP_BUS);
+    exit(0);
+  }
+
+  config.reg_bytes = 1;
+  config.val_bytes = 1;
+  config.max_register = 0xff;
+  config.ranges = ranges;
+  config.n_ranges = 1;
+  map = Regmap_createI2C(i2c_fd, REGMAP_ADDR, &config);
+  if (!map) {
+    printf("*Could not create register map\n");
+    I2C_close(i2c_fd);
+    exit(0);
+  }
+
+  // The first read of the control register goes to the device, the rest
+  // come from the cache:
+  for (i=0; i<3; i++) Regmap_read(map, REGMAP_CTRL, &value);
+  printStats(map, "3 control reads:");
+
+  // Setting bits that are already set doesn't need a write:
+  Regmap_update(map, REGMAP_CTRL, 0x0f, 0x05);
+  Regmap_update(map, REGMAP_CTRL, 0x0f, 0x05);
+  printStats(map, "2 identical updates:");
+
+  // Volatile registers are read from the device every time:
+  for (i=0; i<3; i++) Regmap_read(map, REGMAP_STATUS, &value);
+  printStats(map, "3 status reads:");
+
+  // The table is written in one transfer, then read back from the cache:
+  for (i=0; i<REGMAP_TABLE_LEN; i++) table[i] = i * 7;
+  Regmap_bulkWrite(map, REGMAP_TABLE, table, REGMAP_TABLE_LEN);
+  Regmap_bulkRead(map, REGMAP_TABLE, table, REGMAP_TABLE_LEN);
+  printStats(map, "table write and read:");
+
+  // Check what actually reached the device:
+  Regmap_invalidate(map, REGMAP_TABLE, REGMAP_TABLE + REGMAP_TABLE_LEN - 1);
+  Regmap_bulkRead(map, REGMAP_TABLE, table, REGMAP_TABLE_LEN);
+  printStats(map, "table read after invalidate:");
+  errors = 0;
+  for (i=0; i<REGMAP_TABLE_LEN; i++) {
+    if (table[i] != (uint32_t) (i * 7)) errors++;
+  }
+  Regmap_read(map, REGMAP_CTRL, &value);
+  printf("%d table registers differ, control register is 0x%02x\n", errors,
+         value);
+
+  Regmap_destroy(map);
+  I2C_close(i2c_fd);
+  return 0;
+}
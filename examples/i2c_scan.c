@@ -0,0 +1,47 @@
+/**
+ * @file i2c_scan.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses serbus to list the devices on one or more I2C buses.
+ * 
+ * Requires an I2C Kernel driver be loaded to expose /dev/i2c-N interfaces.
+ * Usage: i2c_scan [bus...], default bus 1. The devices found are cached in
+ * SCAN_CACHE, so later runs only check that they're still there.
+ */
+
+#include "i2cscan.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SCAN_MAX_BUSES 16
+#define SCAN_CACHE     "/tmp/serbus-i2c-scan.cache"
+
+int main(int argc, char *argv[]) {
+  uint8_t buses[SCAN_MAX_BUSES];
+  I2C_scan_result results[SCAN_MAX_BUSES];
+  I2C_scan_options options = {0};
+  int n_buses, i, addr;
+
+  n_buses = 0;
+  for (i=1; i<argc && n_buses<SCAN_MAX_BUSES; i++) {
+    buses[n_buses++] = atoi(argv[i]);
+  }
+  if (n_buses == 0) buses[n_buses++] = 1;
+
+  options.cache_path = SCAN_CACHE;
+  I2C_scanBuses(buses, n_buses, &options, results);
+
+  for (i=0; i<n_buses; i++) {
+    if (results[i].error) {
+      printf("*Could not scan I2C bus %d\n", results[i].bus);
+      continue;
+    }
+    printf("i2c-%d:", results[i].bus);
+    for (addr=0; addr<128; addr++) {
+      if (I2C_SCAN_PRESENT(&results[i], addr)) printf(" 0x%02x", addr);
+    }
+    printf("%s\n", results[i].from_cache ? " (cached)" : "");
+  }
+  return 0;
+}
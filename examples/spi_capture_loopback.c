@@ -0,0 +1,95 @@
+/**
+ * @file spi_capture_loopback.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Uses serbus to stream a continuous capture from an SPI interface in
+ *        loopback mode.
+ * 
+ * Requires an SPI Kernel driver be loaded to expose a /dev/spidevX.Y 
+ * interface whose controller supports loopback mode. Every captured frame
+ * should match the transmitted frame; mismatches and overruns are counted.
+ */
+
+#include "spidriver.h"
+#include "spicapture.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#define CAPTURE_BUS       1        // Capture from /dev/spidev1.X bus
+#define CAPTURE_CS        0        // Using chip select 0 (/dev/spidev1.0)
+#define CAPTURE_FREQ      8000000  // SPI clock frequency in Hz
+#define CAPTURE_BITS      16       // SPI bits per word
+#define CAPTURE_FRAME     4        // Words per frame
+#define CAPTURE_FRAMES    32       // Frames per block
+#define CAPTURE_BLOCKS    32       // Blocks in the ring
+
+static uint8_t running;
+
+/**
+ * @brief Called when Ctrl+C is pressed - triggers the program to stop.
+ */
+void stopHandler(int sig) {
+  running = 0;
+}
+
+int main() {
+  SPI_handle *spi;
+  SPI_capture *capture;
+  SPI_capture_config config;
+  SPI_capture_stats stats;
+  uint16_t tx_frame[CAPTURE_FRAME] = { 0x1234, 0x5678, 0x9abc, 0xdef0 };
+  const uint16_t *block;
+  unsigned long n_blocks, n_mismatched;
+  int i;
+
+  // Open and configure the SPI interface:
+  spi = SPI_openHandle(CAPTURE_BUS, CAPTURE_CS);
+  if (!spi) {
+    printf("*Could not open SPI bus %d\n", CAPTURE_BUS);
+    exit(0);
+  }
+  SPI_setMaxFrequency(SPI_handleFd(spi), CAPTURE_FREQ);
+  SPI_setBitsPerWord(SPI_handleFd(spi), CAPTURE_BITS);
+  SPI_enableLoopback(SPI_handleFd(spi));
+
+  // Set up the capture:
+  config.frame_words = CAPTURE_FRAME;
+  config.frames_per_block = CAPTURE_FRAMES;
+  config.n_blocks = CAPTURE_BLOCKS;
+  config.tx_frame = tx_frame;
+  config.speed_hz = 0;
+  config.delay_usecs = 0;
+  capture = SPI_captureCreate(spi, &config);
+  if (!capture || SPI_captureStart(capture) < 0) {
+    printf("*Could not start capture\n");
+    SPI_closeHandle(spi);
+    exit(0);
+  }
+
+  // Check blocks until Ctrl+C pressed:
+  n_blocks = 0;
+  n_mismatched = 0;
+  running = 1;
+  signal(SIGINT, stopHandler);
+  while(running) {
+    block = SPI_captureAcquire(capture, 1000);
+    if (!block) continue;
+    for (i=0; i<CAPTURE_FRAME*CAPTURE_FRAMES; i++) {
+      if (block[i] != tx_frame[i%CAPTURE_FRAME]) n_mismatched++;
+    }
+    SPI_captureRelease(capture);
+    n_blocks++;
+  }
+
+  SPI_captureStop(capture);
+  SPI_captureGetStats(capture, &stats);
+  printf("%lu blocks checked, %lu words mismatched\n", n_blocks, n_mismatched);
+  printf("%llu blocks captured, %llu overruns\n", 
+         (unsigned long long) stats.blocks, (unsigned long long) stats.overruns);
+  SPI_captureDestroy(capture);
+  SPI_disableLoopback(SPI_handleFd(spi));
+  SPI_closeHandle(spi);
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file crc.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief CRCs used to check sensor data and SMBus transfers.
+ *
+ * All the CRCs are table driven and process 8 bytes per step (slicing-by-8).
+ * CRC-32 is computed with carry-less multiplication instead on x86 CPUs with
+ * PCLMULQDQ, and with the CRC32 instructions on ARMv8 CPUs that have them,
+ * for buffers long enough for that to pay off.
+ *
+ * Each function takes the CRC so far, so long data can be checked in 
+ * pieces; pass the CRC's initial value for the first piece.
+ */
+
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Initial value of the HTU21D's CRC-8
+#define CRC8_HTU21D_INIT    0x00
+/// Initial value of the CRC-8 used by the Sensirion SHT/SGP/SCD families
+#define CRC8_SENSIRION_INIT 0xff
+/// Initial value of the SMBus PEC
+#define CRC8_SMBUS_INIT     0x00
+/// Initial value of CRC-16/CCITT-FALSE
+#define CRC16_CCITT_INIT    0xffff
+/// Initial value of CRC-32
+#define CRC32_INIT          0x00000000
+
+/**
+ * @brief Computes the CRC-8 with polynomial x^8 + x^5 + x^4 + 1 (0x31) used
+ *        by the HTU21D and Sensirion sensors.
+ *
+ * @param crc the CRC of the preceding data, or the initial value
+ * @param data the data
+ * @param n_bytes the number of bytes of data
+ *
+ * @return Returns the CRC
+ */
+uint8_t CRC_crc8(uint8_t crc, const void *data, size_t n_bytes);
+
+/**
+ * @brief Computes the SMBus packet error code, a CRC-8 with polynomial 
+ *        x^8 + x^2 + x + 1 (0x07).
+ *
+ * The PEC covers every byte on the bus including the address bytes, i.e. 
+ * (addr << 1) for writes and (addr << 1) | 1 for reads.
+ *
+ * @param crc the CRC of the preceding data, or #CRC8_SMBUS_INIT
+ * @param data the data
+ * @param n_bytes the number of bytes of data
+ *
+ * @return Returns the CRC
+ */
+uint8_t CRC_smbusPEC(uint8_t crc, const void *data, size_t n_bytes);
+
+/**
+ * @brief Computes the CRC-16 with polynomial x^16 + x^12 + x^5 + 1 (0x1021),
+ *        unreflected and without a final XOR.
+ *
+ * Starting from #CRC16_CCITT_INIT gives CRC-16/CCITT-FALSE, from 0 gives 
+ * CRC-16/XMODEM.
+ *
+ * @param crc the CRC of the preceding data, or the initial value
+ * @param data the data
+ * @param n_bytes the number of bytes of data
+ *
+ * @return Returns the CRC
+ */
+uint16_t CRC_crc16(uint16_t crc, const void *data, size_t n_bytes);
+
+/**
+ * @brief Computes the CRC-32 used by Ethernet and zlib (polynomial 
+ *        0x04c11db7, reflected).
+ *
+ * @param crc the CRC of the preceding data, or #CRC32_INIT
+ * @param data the data
+ * @param n_bytes the number of bytes of data
+ *
+ * @return Returns the CRC
+ */
+uint32_t CRC_crc32(uint32_t crc, const void *data, size_t n_bytes);
+
+#endif // _CRC_H_
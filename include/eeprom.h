@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file eeprom.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Fast reading and writing of 24Cxx-style I2C EEPROMs.
+ *
+ * Writes are split at page boundaries, and the end of each page's write 
+ * cycle is detected by ACK polling (the EEPROM doesn't acknowledge its 
+ * address until the cycle is done) rather than by sleeping for the worst 
+ * case write time. Reads are done as large sequential reads, as many as fit
+ * in a single I2C_RDWR ioctl.
+ *
+ * Common parts:
+ *
+ * | Part           | size   | page_size | addr_bytes |
+ * |----------------|--------|-----------|------------|
+ * | 24C01 - 24C02  | 128-256| 8         | 1          |
+ * | 24C04 - 24C16  | 512-2K | 16        | 1          |
+ * | 24C32 - 24C64  | 4K-8K  | 32        | 2          |
+ * | 24C128- 24C256 | 16K-32K| 64        | 2          |
+ * | 24C512         | 64K    | 128       | 2          |
+ * | 24CM01         | 128K   | 256       | 2          |
+ *
+ * Parts larger than their address bytes can reach (e.g. the 24C16) take the
+ * upper memory address bits in the low bits of the slave address, which is
+ * handled here.
+ */
+
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#include <stdint.h>
+
+/// Write cycle timeout used if an #EEPROM_config gives 0
+#define EEPROM_DEFAULT_TIMEOUT_US 10000
+
+/**
+ * Describes an EEPROM, passed to the EEPROM_* functions.
+ */
+typedef struct {
+  uint16_t addr;             ///< 7-bit slave address, e.g. 0x50
+  uint32_t size;             ///< Memory size in bytes
+  uint16_t page_size;        ///< Write page size in bytes, a power of 2
+  uint8_t addr_bytes;        ///< Memory address bytes, 1 or 2
+  uint32_t write_timeout_us; ///< Longest write cycle, 0 for the default
+} EEPROM_config;
+
+/**
+ * @brief Reads from the given EEPROM.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param config description of the EEPROM
+ * @param mem_addr the memory address to start reading from
+ * @param rx_buffer buffer to read into
+ * @param n_bytes the number of bytes to read
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int EEPROM_read(int i2c_fd, const EEPROM_config *config, uint32_t mem_addr,
+                void *rx_buffer, uint32_t n_bytes);
+
+/**
+ * @brief Writes to the given EEPROM, returning once the data is stored.
+ *
+ * Any number of bytes may be written to any address; the write is split at
+ * page boundaries, and each page waits for the previous one's write cycle.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param config description of the EEPROM
+ * @param mem_addr the memory address to start writing at
+ * @param tx_buffer the bytes to write
+ * @param n_bytes the number of bytes to write
+ *
+ * @return Returns 0 if successful, -1 if error (errno is ETIMEDOUT if a 
+ *         write cycle didn't finish in time)
+ */
+int EEPROM_write(int i2c_fd, const EEPROM_config *config, uint32_t mem_addr,
+                 const void *tx_buffer, uint32_t n_bytes);
+
+/**
+ * @brief Waits for the EEPROM to finish its current write cycle by ACK 
+ *        polling.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param config description of the EEPROM
+ *
+ * @return Returns 0 once the EEPROM responds, or -1 if error (errno is 
+ *         ETIMEDOUT if it didn't respond in time)
+ */
+int EEPROM_waitReady(int i2c_fd, const EEPROM_config *config);
+
+#endif // _EEPROM_H_
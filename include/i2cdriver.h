@@ -38,6 +38,9 @@
 #define _I2C_DRIVER_H_
 
 #include <stdint.h>
+#include <linux/types.h>
+#include <linux/i2c.h>
+#include "crc.h"
 
 /**
  * @brief Opens the /dev/i2c-[bus] interface.
@@ -55,6 +58,202 @@ int I2C_open(uint8_t bus);
  */
 void I2C_close(int i2c_fd);
 
+/**
+ * @brief Gets a page-aligned transfer buffer of at least \p n_bytes bytes.
+ *
+ * Buffers up to one page in size come from a shared pool and are reused 
+ * after being passed to #I2C_releaseBuffer, so allocating them on every 
+ * transfer doesn't cost a malloc and free. Larger buffers are allocated 
+ * individually.
+ *
+ * @param n_bytes the number of bytes needed
+ *
+ * @return Returns the buffer, or NULL if unable to allocate it
+ */
+void *I2C_allocBuffer(uint32_t n_bytes);
+
+/**
+ * @brief Releases a buffer returned by #I2C_allocBuffer.
+ *
+ * @param buffer the buffer to release, or NULL to do nothing
+ */
+void I2C_releaseBuffer(void *buffer);
+
+/**
+ * @brief Gets the capabilities of the given I2C interface's adapter.
+ *
+ * These are read from the adapter once by #I2C_open and cached, so this 
+ * doesn't need an ioctl for interfaces opened that way.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param funcs set to a bitmask of I2C_FUNC_* flags
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_getFunctionality(int i2c_fd, unsigned long *funcs);
+
+/**
+ * @brief Sets how long the adapter waits for a transfer to complete.
+ *
+ * Maps to the I2C_TIMEOUT ioctl, which has a resolution of 10ms, so the 
+ * timeout is rounded up. This is an adapter setting, so applies to every 
+ * interface open on the same bus.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param timeout_ms timeout in milliseconds
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_setTimeout(int i2c_fd, uint32_t timeout_ms);
+
+/**
+ * @brief Sets how many times the adapter retries a transfer that loses 
+ *        arbitration.
+ *
+ * Maps to the I2C_RETRIES ioctl. This is an adapter setting, so applies to 
+ * every interface open on the same bus. Not all adapters use it.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param retries number of retries
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_setRetries(int i2c_fd, uint32_t retries);
+
+/// The most errno values an #I2C_retry_policy can list
+#define I2C_MAX_RETRY_ERRNOS 8
+
+/**
+ * Controls how the driver retries failed transfers, set for an interface 
+ * with #I2C_setRetryPolicy or for a single transfer with #I2C_transferEx.
+ *
+ * A failed transfer is retried if its errno is listed in retry_errnos, fewer
+ * than max_attempts have been made, and the next retry would start within 
+ * budget_us of the first attempt. The worst case time for a transfer is 
+ * then budget_us plus one attempt, whose length is bounded by 
+ * #I2C_setTimeout. Retrying a write can repeat it if the slave NAK'd part
+ * way through, so only list NAK errors for idempotent writes.
+ */
+typedef struct {
+  uint8_t max_attempts;    ///< Attempts including the first, 0 or 1 for none
+  uint32_t backoff_us;     ///< Wait before the first retry
+  uint32_t max_backoff_us; ///< Waits double up to this, or 0 to not grow
+  uint32_t budget_us;      ///< Time after which no retries start, 0 for none
+  int retry_errnos[I2C_MAX_RETRY_ERRNOS]; ///< errnos to retry, 0 terminated
+} I2C_retry_policy;
+
+/**
+ * Counters of an interface's retries, from #I2C_getRetryStats. Only 
+ * transfers made with a policy allowing retries are counted.
+ */
+typedef struct {
+  uint64_t transfers; ///< Transfers made
+  uint64_t retries;   ///< Retry attempts made
+  uint64_t recovered; ///< Transfers that succeeded after retrying
+  uint64_t failed;    ///< Transfers that failed
+} I2C_retry_stats;
+
+/**
+ * @brief Sets the retry policy used for all transfers on the given I2C 
+ *        interface.
+ *
+ * Only available for interfaces opened with #I2C_open; the default policy
+ * makes no retries.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param policy the policy, copied, or NULL for no retries
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_setRetryPolicy(int i2c_fd, const I2C_retry_policy *policy);
+
+/**
+ * @brief Gets the retry counters of the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, opened with #I2C_open
+ * @param stats filled in with the current counters
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_getRetryStats(int i2c_fd, I2C_retry_stats *stats);
+
+/**
+ * @brief Zeroes the retry counters of the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, opened with #I2C_open
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_resetRetryStats(int i2c_fd);
+
+/**
+ * CRC that read transactions are checked with, see #I2C_crc_check.
+ */
+typedef enum {
+  I2C_CRC_NONE,      ///< Reads aren't checked
+  I2C_CRC8,          ///< #CRC_crc8, used by the HTU21D and Sensirion sensors
+  I2C_CRC8_SMBUS     ///< #CRC_smbusPEC polynomial over the data only
+} I2C_crc_type;
+
+/**
+ * Describes the CRC bytes a device puts in the data it returns, set for an
+ * interface with #I2C_setCRCCheck. The data read is taken to be words of 
+ * word_bytes bytes, each followed by its CRC-8, so every read must be a 
+ * whole number of words and CRCs.
+ */
+typedef struct {
+  I2C_crc_type type;   ///< CRC to check with
+  uint8_t init;        ///< Initial CRC value, e.g. #CRC8_SENSIRION_INIT
+  uint16_t word_bytes; ///< Data bytes covered by each CRC byte
+} I2C_crc_check;
+
+/**
+ * Counters of an interface's CRC checks, from #I2C_getCRCStats.
+ */
+typedef struct {
+  uint64_t checked; ///< Reads checked
+  uint64_t errors;  ///< Reads with at least one bad CRC
+} I2C_crc_stats;
+
+/**
+ * @brief Sets how #I2C_readTransaction and #I2C_readRegister check the data
+ *        they read on the given I2C interface.
+ *
+ * A read with a bad CRC fails with errno set to EBADMSG, with the data left
+ * in the buffer; adding EBADMSG to the retry policy's errnos retries it. The
+ * CRC bytes are left in the buffer after each word either way. A read whose
+ * length isn't a whole number of words and CRCs fails with EINVAL without 
+ * touching the bus.
+ *
+ * Only available for interfaces opened with #I2C_open; by default reads
+ * aren't checked.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param check the CRC layout, copied, or NULL to stop checking
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_setCRCCheck(int i2c_fd, const I2C_crc_check *check);
+
+/**
+ * @brief Gets the CRC check counters of the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, opened with #I2C_open
+ * @param stats filled in with the current counters
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_getCRCStats(int i2c_fd, I2C_crc_stats *stats);
+
+/**
+ * @brief Zeroes the CRC check counters of the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, opened with #I2C_open
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_resetCRCStats(int i2c_fd);
+
 /**
  * @brief Enables 10-bit addressing the given I2C interface.
  *
@@ -111,6 +310,11 @@ int I2C_read(int i2c_fd, void *rx_buffer, int n_bytes);
  * slave address on the given I2C interface. Useful for things like reading 
  * register values from memory mapped devices.
  *
+ * On interfaces opened with #I2C_open the write and read are done as one
+ * combined transfer with a repeated start between them, so the bus isn't 
+ * released in the middle. If a CRC check has been set with #I2C_setCRCCheck,
+ * the data read is checked.
+ *
  * @param i2c_fd I2C file descriptor
  * @param byte the byte to write before reading
  * @param rx_buffer pointer to an array, already initialized to the required 
@@ -121,6 +325,25 @@ int I2C_read(int i2c_fd, void *rx_buffer, int n_bytes);
  */
 int I2C_readTransaction(int i2c_fd, uint8_t byte, void *rx_buffer, int n_bytes);
 
+/**
+ * @brief Reads a block starting at a multi-byte register address.
+ *
+ * Like #I2C_readTransaction, but writes a register address of \p reg_bytes
+ * bytes, most significant byte first, before reading. Useful for devices with
+ * 16-bit register or memory addresses, such as larger EEPROMs.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param reg the register address
+ * @param reg_bytes the size of the register address in bytes, 1-4
+ * @param rx_buffer pointer to an array, already initialized to the required 
+ *        size
+ * @param n_bytes the number of bytes to read into rx_buffer
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_readRegister(int i2c_fd, uint32_t reg, int reg_bytes, 
+                     void *rx_buffer, int n_bytes);
+
 /**
  * @brief Writes a block to the given I2C interface.
  *
@@ -135,4 +358,54 @@ int I2C_readTransaction(int i2c_fd, uint8_t byte, void *rx_buffer, int n_bytes);
  */
 int I2C_write(int i2c_fd, void *tx_buffer, int n_bytes);
 
+/**
+ * One message of an #I2C_transfer.
+ */
+typedef struct {
+  uint16_t addr;    ///< The 7- or 10-bit address of the slave device
+  uint16_t flags;   ///< I2C_M_RD, I2C_M_TEN, I2C_M_NOSTART, I2C_M_STOP or 0
+  uint16_t n_bytes; ///< Number of bytes to read or write
+  void *buffer;     ///< Bytes to write, or buffer to read into if I2C_M_RD
+  int status;       ///< Set to 0 if sent, or an errno value if not
+} I2C_message;
+
+/**
+ * @brief Performs a sequence of messages, each to its own slave address, on
+ *        the given I2C interface.
+ *
+ * The messages are submitted in as few I2C_RDWR ioctls as the kernel allows 
+ * (up to 42 each), with a repeated start between messages in the same ioctl
+ * and a stop at the end of each. Doesn't use or change the address set with
+ * #I2C_setSlaveAddress.
+ *
+ * A message flagged I2C_M_NOSTART continues the one before it, so it's never
+ * split into a different ioctl from it. The I2C adapter must support 
+ * I2C_FUNC_NOSTART to use that flag, I2C_FUNC_10BIT_ADDR for I2C_M_TEN, and
+ * I2C_FUNC_PROTOCOL_MANGLING for I2C_M_STOP, which sends a stop in place of
+ * the repeated start after a message.
+ *
+ * If an ioctl fails, every message it contained has its status set to the 
+ * error, since the kernel doesn't say which one failed, and the remaining 
+ * messages aren't sent and get a status of ECANCELED.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param messages array of messages to perform, in order
+ * @param n_messages number of messages in the array
+ *
+ * @return Returns 0 if all the messages were sent, -1 otherwise
+ */
+int I2C_transfer(int i2c_fd, I2C_message *messages, int n_messages);
+
+/**
+ * @brief Same as #I2C_transfer, with the given retry policy in place of the
+ *        interface's.
+ *
+ * Each I2C_RDWR ioctl is retried on its own.
+ *
+ * @param policy retry policy for this transfer, or NULL for the 
+ *        interface's
+ */
+int I2C_transferEx(int i2c_fd, I2C_message *messages, int n_messages,
+                   const I2C_retry_policy *policy);
+
 #endif // _I2C_DRIVER_H_
\ No newline at end of file
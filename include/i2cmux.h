@@ -0,0 +1,175 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2cmux.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Access to I2C devices behind PCA954x/TCA954x multiplexers.
+ *
+ * A mux tree models the muxes on one I2C bus, which may be cascaded, and 
+ * addresses each device by the mux and channel it's behind plus its own 
+ * address. The tree remembers what each mux has selected, so a mux is only
+ * written when an access needs a different channel. Muxes sharing a segment
+ * with the path to a device are disconnected first, so identical devices 
+ * behind different muxes never clash.
+ *
+ * A mux only switches channels at a stop condition, so every select must be
+ * followed by one. If the adapter supports I2C_M_STOP 
+ * (I2C_FUNC_PROTOCOL_MANGLING), the selects are flagged with it and sent in 
+ * the same I2C_RDWR as the access itself; otherwise each select is sent in 
+ * an I2C_RDWR of its own before the access.
+ *
+ * The cached state assumes nothing else changes the muxes; call 
+ * #I2C_muxInvalidate if something might have (e.g. a mux reset).
+ */
+
+#ifndef _I2C_MUX_H_
+#define _I2C_MUX_H_
+
+#include <stdint.h>
+#include "i2cdriver.h"
+
+/// Passed as the mux to address a device directly on the bus
+#define I2C_MUX_ROOT -1
+
+/**
+ * How a mux's control register selects channels.
+ */
+typedef enum {
+  I2C_MUX_PCA9548, ///< One enable bit per channel: PCA9545/6/8, TCA9548A
+  I2C_MUX_PCA9544  ///< Enable bit 0x04 plus channel number: PCA9540/2/4
+} I2C_mux_type;
+
+/**
+ * An opaque mux tree created with #I2C_muxTreeCreate.
+ */
+typedef struct I2C_mux_tree I2C_mux_tree;
+
+/**
+ * @brief Creates an empty mux tree for the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, which must stay open until the tree is
+ *        destroyed; its I2C_FUNCS are read here to choose how to send selects
+ *
+ * @return Returns the tree, or NULL if error
+ */
+I2C_mux_tree *I2C_muxTreeCreate(int i2c_fd);
+
+/**
+ * @brief Frees the given mux tree. The muxes are left as they are.
+ *
+ * @param tree the tree to destroy
+ */
+void I2C_muxTreeDestroy(I2C_mux_tree *tree);
+
+/**
+ * @brief Adds a mux to the tree.
+ *
+ * @param tree the mux tree
+ * @param parent the mux this one is behind, or #I2C_MUX_ROOT if it's on the
+ *        bus itself
+ * @param parent_channel the channel of parent it's on
+ * @param addr the mux's 7-bit address
+ * @param type the kind of mux
+ *
+ * @return Returns the mux's id, or -1 if error
+ */
+int I2C_muxAdd(I2C_mux_tree *tree, int parent, uint8_t parent_channel, 
+               uint16_t addr, I2C_mux_type type);
+
+/**
+ * @brief Performs a sequence of messages to devices behind the given mux
+ *        channel, as #I2C_transfer does.
+ *
+ * Any mux selects needed are sent first, in the same I2C_RDWR ioctl as the
+ * messages if the adapter supports I2C_M_STOP.
+ *
+ * @param tree the mux tree
+ * @param mux the id of the mux the devices are behind, or #I2C_MUX_ROOT
+ * @param channel the channel of mux the devices are on
+ * @param messages array of messages to perform, in order
+ * @param n_messages number of messages in the array
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_muxTransfer(I2C_mux_tree *tree, int mux, uint8_t channel,
+                    I2C_message *messages, int n_messages);
+
+/**
+ * @brief Writes a block to a device behind the given mux channel.
+ *
+ * @param tree the mux tree
+ * @param mux the id of the mux the device is behind, or #I2C_MUX_ROOT
+ * @param channel the channel of mux the device is on
+ * @param addr the device's 7-bit address
+ * @param tx_buffer the bytes to write
+ * @param n_bytes the number of bytes to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_muxWrite(I2C_mux_tree *tree, int mux, uint8_t channel, uint16_t addr,
+                 void *tx_buffer, int n_bytes);
+
+/**
+ * @brief Reads a block from a device behind the given mux channel.
+ *
+ * @param tree the mux tree
+ * @param mux the id of the mux the device is behind, or #I2C_MUX_ROOT
+ * @param channel the channel of mux the device is on
+ * @param addr the device's 7-bit address
+ * @param rx_buffer buffer to read into
+ * @param n_bytes the number of bytes to read
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_muxRead(I2C_mux_tree *tree, int mux, uint8_t channel, uint16_t addr,
+                void *rx_buffer, int n_bytes);
+
+/**
+ * @brief Writes a command byte then reads a block from a device behind the
+ *        given mux channel, with a repeated start in between.
+ *
+ * @param tree the mux tree
+ * @param mux the id of the mux the device is behind, or #I2C_MUX_ROOT
+ * @param channel the channel of mux the device is on
+ * @param addr the device's 7-bit address
+ * @param command the byte to write before reading
+ * @param rx_buffer buffer to read into
+ * @param n_bytes the number of bytes to read
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_muxReadTransaction(I2C_mux_tree *tree, int mux, uint8_t channel, 
+                           uint16_t addr, uint8_t command, void *rx_buffer, 
+                           int n_bytes);
+
+/**
+ * @brief Forgets what every mux has selected, so each is written again 
+ *        before it's next used.
+ *
+ * @param tree the mux tree
+ */
+void I2C_muxInvalidate(I2C_mux_tree *tree);
+
+#endif // _I2C_MUX_H_
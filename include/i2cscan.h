@@ -0,0 +1,129 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2cscan.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Discovery of the devices on I2C buses.
+ *
+ * Probes follow the same rules as i2cdetect: addresses 0x30-0x37 and 
+ * 0x50-0x5f are probed with a 1 byte read, since a quick write can corrupt
+ * some EEPROMs there, and all others with a quick (zero length) write. Each
+ * probe carries its own address in an I2C_RDWR message, so no I2C_SLAVE 
+ * switching is needed; adapters without plain I2C support are probed with
+ * SMBus transfers instead.
+ *
+ * #I2C_scanBuses scans several buses in parallel, and can keep the devices 
+ * found in a cache file. When a bus is in the cache, only the cached devices
+ * are checked for, in as few I2C_RDWR ioctls as possible, and the bus is only
+ * fully probed again if one has gone missing.
+ */
+
+#ifndef _I2C_SCAN_H_
+#define _I2C_SCAN_H_
+
+#include <stdint.h>
+
+/// First address probed by default, below are reserved addresses
+#define I2C_SCAN_FIRST 0x08
+/// Last address probed by default, above are reserved addresses
+#define I2C_SCAN_LAST  0x77
+
+/**
+ * Which transfer is used to probe for a device.
+ */
+typedef enum {
+  I2C_PROBE_AUTO,  ///< Choose by address, as i2cdetect does
+  I2C_PROBE_QUICK, ///< Quick (zero length) write
+  I2C_PROBE_READ   ///< 1 byte read
+} I2C_probe_mode;
+
+/**
+ * Settings for #I2C_scan and #I2C_scanBuses.
+ */
+typedef struct {
+  uint8_t first;          ///< First address to probe, 0 for #I2C_SCAN_FIRST
+  uint8_t last;           ///< Last address to probe, 0 for #I2C_SCAN_LAST
+  I2C_probe_mode mode;    ///< Probe to use
+  const char *cache_path; ///< Topology cache file, or NULL for none
+  int rescan;             ///< Set to probe every address despite the cache
+} I2C_scan_options;
+
+/**
+ * The devices found on one bus by #I2C_scanBuses.
+ */
+typedef struct {
+  uint8_t bus;         ///< Bus number
+  uint8_t present[16]; ///< Bitmap of the 7-bit addresses that responded
+  int n_devices;       ///< Number of devices found
+  int from_cache;      ///< Set if the cached devices were all still there
+  int error;           ///< errno if the bus couldn't be scanned, or 0
+} I2C_scan_result;
+
+/// Checks whether the given address is set in an I2C_scan_result's bitmap
+#define I2C_SCAN_PRESENT(result, addr) \
+  (((result)->present[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+/**
+ * @brief Checks whether a device responds at the given address.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param addr the 7-bit address to probe
+ * @param mode the probe to use
+ *
+ * @return Returns 1 if a device responded, 0 if not, or -1 if error
+ */
+int I2C_probe(int i2c_fd, uint16_t addr, I2C_probe_mode mode);
+
+/**
+ * @brief Probes a range of addresses on one I2C interface.
+ *
+ * The cache_path and rescan options aren't used.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param options probe settings, or NULL for the defaults
+ * @param present bitmap of 16 bytes, set to the addresses that responded
+ *
+ * @return Returns the number of devices found, or -1 if error
+ */
+int I2C_scan(int i2c_fd, const I2C_scan_options *options, uint8_t *present);
+
+/**
+ * @brief Scans the given I2C buses, each in its own thread.
+ *
+ * If options has a cache_path, the cache file is read first and rewritten
+ * with the results afterward, keeping the entries of any buses not scanned.
+ *
+ * @param buses the bus numbers to scan
+ * @param n_buses the number of buses
+ * @param options probe settings, or NULL for the defaults
+ * @param results array of n_buses results to fill in
+ *
+ * @return Returns 0 if every bus was scanned, or -1 if any failed (see each
+ *         result's error)
+ */
+int I2C_scanBuses(const uint8_t *buses, int n_buses, 
+                  const I2C_scan_options *options, I2C_scan_result *results);
+
+#endif // _I2C_SCAN_H_
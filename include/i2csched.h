@@ -0,0 +1,166 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2csched.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Non-blocking scheduler for polling many I2C sensors on one bus.
+ *
+ * Sensors that take a while to convert a measurement are read in three 
+ * steps: a trigger write that starts the conversion, a wait of the 
+ * conversion time, and a readout. Rather than holding the bus for the whole
+ * conversion (e.g. with an HTU21D's hold-master commands), the scheduler 
+ * runs each device's steps as they fall due, so other devices are triggered
+ * and read while one is converting. Timing is driven by a timerfd, which can
+ * be waited on with #I2C_schedRun or added to an existing poll() loop with 
+ * #I2C_schedFd and #I2C_schedDispatch.
+ *
+ * Every transfer carries its device's address, so the scheduler never uses
+ * or changes the address set with #I2C_setSlaveAddress. A device with more 
+ * than one task (e.g. temperature and humidity) only runs one conversion at
+ * a time. A scheduler isn't thread-safe; all calls on it, including from its
+ * callbacks, must be made from the thread running it.
+ */
+
+#ifndef _I2C_SCHED_H_
+#define _I2C_SCHED_H_
+
+#include <stdint.h>
+
+/**
+ * Called with the result of each measurement.
+ *
+ * @param context the task's context pointer
+ * @param result the bytes read, only valid during the call
+ * @param n_bytes the number of bytes in result
+ * @param error 0 if successful, or the errno of the failed step
+ */
+typedef void (*I2C_sched_callback)(void *context, const uint8_t *result, 
+                                   int n_bytes, int error);
+
+/**
+ * Describes a periodic measurement, passed to #I2C_schedAdd.
+ */
+typedef struct {
+  uint16_t addr;               ///< 7-bit address of the device
+  const void *trigger;         ///< Bytes written to start a conversion
+  uint16_t n_trigger_bytes;    ///< Number of trigger bytes, or 0 for none
+  uint32_t conversion_us;      ///< Time from trigger to readout
+  const void *readout;         ///< Bytes written before reading the result
+  uint16_t n_readout_bytes;    ///< Number of readout bytes, or 0 for none
+  uint16_t n_result_bytes;     ///< Number of bytes to read as the result
+  uint32_t period_us;          ///< Time between triggers, 0 for continuous
+  uint32_t retry_us;           ///< Delay before retrying a NAK'd readout
+  uint8_t max_retries;         ///< Times to retry a NAK'd readout
+  I2C_sched_callback callback; ///< Called with each result
+  void *context;               ///< Passed to callback
+} I2C_sched_task;
+
+/**
+ * An opaque scheduler created with #I2C_schedCreate.
+ */
+typedef struct I2C_scheduler I2C_scheduler;
+
+/**
+ * @brief Creates a scheduler for the devices on the given I2C interface.
+ *
+ * @param i2c_fd I2C file descriptor, which must stay open until the 
+ *        scheduler is destroyed
+ *
+ * @return Returns the scheduler, or NULL if error
+ */
+I2C_scheduler *I2C_schedCreate(int i2c_fd);
+
+/**
+ * @brief Frees the given scheduler and closes its timerfd.
+ *
+ * @param sched the scheduler to destroy
+ */
+void I2C_schedDestroy(I2C_scheduler *sched);
+
+/**
+ * @brief Adds a periodic measurement to the scheduler.
+ *
+ * The trigger and readout bytes are copied. The first trigger is due 
+ * immediately.
+ *
+ * @param sched the scheduler
+ * @param task the measurement to add
+ *
+ * @return Returns an id for #I2C_schedRemove, or -1 if error
+ */
+int I2C_schedAdd(I2C_scheduler *sched, const I2C_sched_task *task);
+
+/**
+ * @brief Removes a measurement from the scheduler.
+ *
+ * A conversion in progress is abandoned without calling the callback. May be
+ * called from a callback, including the task's own, in which case its id 
+ * isn't given to a task added before the callback returns.
+ *
+ * @param sched the scheduler
+ * @param id the id returned by #I2C_schedAdd
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int I2C_schedRemove(I2C_scheduler *sched, int id);
+
+/**
+ * @brief Gets the scheduler's timerfd, for waiting with poll() or select().
+ *
+ * The timerfd becomes readable when a step is due, at which point 
+ * #I2C_schedDispatch should be called.
+ *
+ * @param sched the scheduler
+ *
+ * @return Returns the timerfd file descriptor
+ */
+int I2C_schedFd(I2C_scheduler *sched);
+
+/**
+ * @brief Runs every step that is due, then re-arms the timerfd for the next
+ *        one.
+ *
+ * Results and errors are passed to the tasks' callbacks.
+ *
+ * @param sched the scheduler
+ *
+ * @return Returns the number of steps run, or -1 if error
+ */
+int I2C_schedDispatch(I2C_scheduler *sched);
+
+/**
+ * @brief Waits for the next step to fall due then runs it, as 
+ *        #I2C_schedDispatch.
+ *
+ * @param sched the scheduler
+ * @param timeout_ms maximum time to wait in milliseconds, or -1 to wait 
+ *        until a step is due
+ *
+ * @return Returns the number of steps run, 0 if none were due in time, or 
+ *         -1 if error
+ */
+int I2C_schedRun(I2C_scheduler *sched, int timeout_ms);
+
+#endif // _I2C_SCHED_H_
@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file regmap.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Cached register access for I2C and SPI peripherals.
+ *
+ * A register map keeps a write-through cache of a device's registers, so 
+ * reads of registers that don't change on their own are served from memory,
+ * and writes of the value a register already holds are skipped. Registers 
+ * are classed with #Regmap_range entries:
+ *
+ *  - #REGMAP_VOLATILE registers change on their own (status, data), so are
+ *    never cached
+ *  - #REGMAP_READ_ONLY registers can't be written
+ *  - #REGMAP_PRECIOUS registers have side effects when read (e.g. clear on
+ *    read), so are never cached and only read when asked for by themselves
+ *
+ * Multi-register transfers rely on the device auto-incrementing the register
+ * address. On I2C the map addresses its device in every transfer, so several
+ * maps can share one interface without #I2C_setSlaveAddress calls. On SPI 
+ * the interface must be set up for the device (mode, 8 bits per word).
+ */
+
+#ifndef _REGMAP_H_
+#define _REGMAP_H_
+
+#include <stdint.h>
+
+#define REGMAP_VOLATILE  0x01 ///< Value can change without being written
+#define REGMAP_READ_ONLY 0x02 ///< Writes are rejected
+#define REGMAP_PRECIOUS  0x04 ///< Reading has side effects
+
+/**
+ * Applies #REGMAP_VOLATILE, #REGMAP_READ_ONLY and/or #REGMAP_PRECIOUS to a
+ * range of registers. Registers not in any range are cached read/write.
+ */
+typedef struct {
+  uint32_t first; ///< First register in the range
+  uint32_t last;  ///< Last register in the range, inclusive
+  uint8_t flags;  ///< REGMAP_* flags for the range
+} Regmap_range;
+
+/**
+ * Describes a device's registers, passed to #Regmap_createI2C and 
+ * #Regmap_createSPI.
+ */
+typedef struct {
+  uint8_t reg_bytes;           ///< Size of register addresses, 1 or 2
+  uint8_t val_bytes;           ///< Size of register values, 1, 2 or 4
+  uint8_t little_endian;       ///< Set if values are sent LSB first
+  uint32_t max_register;       ///< Highest register address
+  const Regmap_range *ranges;  ///< Register classes, or NULL for none
+  int n_ranges;                ///< Number of entries in ranges
+  uint8_t spi_read_mask;       ///< SPI only, OR'd into the address to read
+  uint8_t spi_write_mask;      ///< SPI only, OR'd into the address to write
+} Regmap_config;
+
+/**
+ * Counters describing how well a register map's cache is doing.
+ */
+typedef struct {
+  uint64_t hits;           ///< Reads served from the cache
+  uint64_t misses;         ///< Cacheable reads that went to the device
+  uint64_t skipped_writes; ///< Writes skipped because nothing changed
+  uint64_t bus_reads;      ///< Read transfers made on the bus
+  uint64_t bus_writes;     ///< Write transfers made on the bus
+} Regmap_stats;
+
+/**
+ * An opaque register map created with #Regmap_createI2C or 
+ * #Regmap_createSPI.
+ */
+typedef struct Regmap Regmap;
+
+/**
+ * @brief Creates a register map for the I2C device at the given address.
+ *
+ * @param i2c_fd I2C file descriptor, which must stay open until the map is
+ *        destroyed
+ * @param addr the 7-bit address of the device
+ * @param config description of the device's registers, copied into the map;
+ *        the ranges are applied when the map is created, so the array 
+ *        needn't outlive the call
+ *
+ * @return Returns the register map, or NULL if error
+ */
+Regmap *Regmap_createI2C(int i2c_fd, uint16_t addr, 
+                         const Regmap_config *config);
+
+/**
+ * @brief Creates a register map for the device on the given SPI interface.
+ *
+ * @param spidev_fd spidev file descriptor, which must stay open until the 
+ *        map is destroyed
+ * @param config description of the device's registers, copied into the map;
+ *        the ranges are applied when the map is created, so the array 
+ *        needn't outlive the call
+ *
+ * @return Returns the register map, or NULL if error
+ */
+Regmap *Regmap_createSPI(int spidev_fd, const Regmap_config *config);
+
+/**
+ * @brief Frees the given register map. Doesn't close its interface.
+ *
+ * @param map the register map to destroy
+ */
+void Regmap_destroy(Regmap *map);
+
+/**
+ * @brief Reads a register, from the cache if possible.
+ *
+ * @param map the register map
+ * @param reg the register address
+ * @param value set to the register's value
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_read(Regmap *map, uint32_t reg, uint32_t *value);
+
+/**
+ * @brief Writes a register, unless the cache shows it already has the value.
+ *
+ * Fails with EINVAL if the value doesn't fit in the config's val_bytes.
+ *
+ * @param map the register map
+ * @param reg the register address
+ * @param value the value to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_write(Regmap *map, uint32_t reg, uint32_t value);
+
+/**
+ * @brief Read-modify-writes the bits of a register selected by \p mask.
+ *
+ * The read comes from the cache if possible, and the write is skipped if the
+ * bits already have the given value. Fails with EINVAL if \p mask selects 
+ * bits that don't fit in the config's val_bytes and \p value sets them.
+ *
+ * @param map the register map
+ * @param reg the register address
+ * @param mask the bits to change
+ * @param value the new value of the bits in \p mask
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_update(Regmap *map, uint32_t reg, uint32_t mask, uint32_t value);
+
+/**
+ * @brief Reads consecutive registers.
+ *
+ * Served from the cache if every register is cached, otherwise read from the
+ * device in as few transfers as possible. Fails with EINVAL if the range
+ * includes a precious register.
+ *
+ * @param map the register map
+ * @param reg the first register address
+ * @param values array to read the \p n_registers values into
+ * @param n_registers number of registers to read
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_bulkRead(Regmap *map, uint32_t reg, uint32_t *values, 
+                    int n_registers);
+
+/**
+ * @brief Writes consecutive registers.
+ *
+ * Skipped if the cache shows every register already has its value. Fails 
+ * with EINVAL if the range includes a read-only register, or if any value 
+ * doesn't fit in the config's val_bytes.
+ *
+ * @param map the register map
+ * @param reg the first register address
+ * @param values the \p n_registers values to write
+ * @param n_registers number of registers to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_bulkWrite(Regmap *map, uint32_t reg, const uint32_t *values, 
+                     int n_registers);
+
+/**
+ * @brief Puts the map in or out of cache-only mode.
+ *
+ * In cache-only mode, e.g. while the device is powered down, writes only 
+ * update the cache and mark the registers dirty for #Regmap_sync, and reads
+ * that can't be served from the cache fail with EBUSY.
+ *
+ * @param map the register map
+ * @param enable 1 to enable cache-only mode, 0 to disable it
+ */
+void Regmap_setCacheOnly(Regmap *map, int enable);
+
+/**
+ * @brief Marks every cached register dirty, e.g. after the device has been 
+ *        reset, so the next #Regmap_sync writes them all back.
+ *
+ * @param map the register map
+ */
+void Regmap_markDirty(Regmap *map);
+
+/**
+ * @brief Writes every dirty register back to the device.
+ *
+ * Runs of consecutive dirty registers are written in single transfers.
+ *
+ * @param map the register map
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int Regmap_sync(Regmap *map);
+
+/**
+ * @brief Drops a range of registers from the cache, so they're next read 
+ *        from the device. Dirty values in the range are discarded.
+ *
+ * @param map the register map
+ * @param first first register to drop
+ * @param last last register to drop, inclusive
+ */
+void Regmap_invalidate(Regmap *map, uint32_t first, uint32_t last);
+
+/**
+ * @brief Gets the cache counters of the given register map.
+ *
+ * @param map the register map
+ * @param stats filled in with the current counters
+ */
+void Regmap_getStats(Regmap *map, Regmap_stats *stats);
+
+#endif // _REGMAP_H_
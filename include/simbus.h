@@ -0,0 +1,250 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file simbus.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief An in-process simulated SPI and I2C bus for testing and profiling.
+ *
+ * Files opened with #Transport_sim (see transport.h) are connected to 
+ * simulated devices instead of hardware. /dev/spidevB.C is the SPI device
+ * attached to bus B with chip select C, and /dev/i2c-B is I2C bus B with 
+ * whatever devices are attached to it. The spidev and i2c-dev ioctls are 
+ * emulated closely enough for the whole library to run unmodified, 
+ * including the kernel's limits (the spidev bufsiz, 42 I2C_RDWR messages) and
+ * SMBus transfers, which are emulated with plain I2C messages like the kernel
+ * does for adapters without native SMBus support. Delays are not simulated.
+ *
+ * Devices are implemented as #SimDevice models. Models are provided for an 
+ * SPI loopback device, a streaming SPI ADC, a 24C-series I2C EEPROM, an 
+ * HTU21D temperature/humidity sensor and a PCA9548 I2C mux, and other 
+ * models can be written by filling in a #SimDevice. Devices can be attached
+ * behind a mux's channels with #Sim_attachI2CMuxed. If no devices have been
+ * attached when the first simulated file is opened, the default topology is
+ * loaded (see #Sim_loadDefaultTopology).
+ *
+ * All simulated I/O is serialized on a single lock, and models are only ever
+ * called with it held.
+ */
+
+#ifndef _SIMBUS_H_
+#define _SIMBUS_H_
+
+#include <stdint.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+#include <linux/i2c.h>
+#include "transport.h"
+
+typedef struct SimDevice SimDevice;
+
+/**
+ * A simulated device model. Models put this first in their own state struct
+ * and fill in the callbacks for the bus they're on; unused callbacks can be 
+ * left NULL.
+ */
+struct SimDevice {
+  /// SPI: called when CS is asserted (\p selected = 1) or released (0)
+  void (*spi_select)(SimDevice *device, int selected);
+  /// SPI: called for each transfer; \p tx or \p rx may be NULL
+  void (*spi_transfer)(SimDevice *device, const uint8_t *tx, uint8_t *rx, 
+                       uint32_t n_bytes, uint8_t bits_per_word);
+  /// I2C: called for each write message, returns 0 for ACK or -1 for NAK
+  int (*i2c_write)(SimDevice *device, const uint8_t *data, uint32_t n_bytes);
+  /// I2C: called for each read message, returns 0 for ACK or -1 for NAK
+  int (*i2c_read)(SimDevice *device, uint8_t *data, uint32_t n_bytes);
+  /// I2C: called at the stop condition ending a transfer to the device
+  void (*i2c_stop)(SimDevice *device);
+  /// I2C muxes: returns the mask of channels currently connected
+  uint8_t (*i2c_channels)(SimDevice *device);
+  /// Frees the device, called when it's detached
+  void (*destroy)(SimDevice *device);
+};
+
+/**
+ * Callbacks for observing the traffic on the simulated buses, e.g. to check
+ * the transfer descriptors the drivers generate. Either may be NULL.
+ */
+typedef struct {
+  /// Called with each SPI_IOC_MESSAGE and the interface's current mode
+  void (*spi_message)(void *context, uint8_t bus, uint8_t cs, uint32_t mode,
+                      const struct spi_ioc_transfer *transfers, 
+                      int n_transfers);
+  /// Called with each I2C transfer, after it's been carried out
+  void (*i2c_transfer)(void *context, uint8_t bus, 
+                       const struct i2c_msg *messages, int n_messages);
+  void *context; ///< Passed to the callbacks
+} SimRecorder;
+
+/**
+ * @brief Attaches a device to the given SPI bus and chip select.
+ *
+ * The simulated bus takes ownership of the device, replacing and destroying
+ * any device already attached there.
+ *
+ * @param bus SPI bus number
+ * @param cs chip select number
+ * @param device the device model
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int Sim_attachSPI(uint8_t bus, uint8_t cs, SimDevice *device);
+
+/**
+ * @brief Attaches a device to the given I2C bus at the given address.
+ *
+ * The simulated bus takes ownership of the device, replacing and destroying
+ * any device already attached there.
+ *
+ * @param bus I2C bus number
+ * @param addr the device's 7- or 10-bit address
+ * @param device the device model
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int Sim_attachI2C(uint8_t bus, uint16_t addr, SimDevice *device);
+
+/**
+ * @brief Attaches a device behind one channel of a simulated I2C mux.
+ *
+ * The device only answers while \p channel is connected and the mux itself
+ * is reachable, so devices with the same address can sit behind different 
+ * channels. The simulated bus takes ownership of the device, replacing and 
+ * destroying any device already attached at the same place.
+ *
+ * @param bus I2C bus number
+ * @param mux the mux the device is behind, e.g. from #SimDevice_pca9548, 
+ *        already attached to the bus directly or behind another mux
+ * @param channel the mux channel the device is on, from 0 to 7
+ * @param addr the device's 7- or 10-bit address
+ * @param device the device model
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int Sim_attachI2CMuxed(uint8_t bus, SimDevice *mux, uint8_t channel,
+                       uint16_t addr, SimDevice *device);
+
+/**
+ * @brief Sets the I2C_FUNCS flags reported by the simulated I2C buses.
+ *
+ * E.g. clearing I2C_FUNC_PROTOCOL_MANGLING tests the fallbacks for adapters
+ * that can't honour I2C_M_STOP, which the simulated bus then rejects with 
+ * EOPNOTSUPP. The I2C driver reads the flags once when a file is opened, so
+ * set them first. #Sim_reset restores the defaults.
+ *
+ * @param funcs the I2C_FUNC_* flags to report
+ */
+void Sim_setI2CFunctionality(unsigned long funcs);
+
+/**
+ * @brief Detaches and destroys all simulated devices.
+ *
+ * Must not be called while any simulated files are open.
+ */
+void Sim_reset(void);
+
+/**
+ * @brief Attaches the default set of simulated devices.
+ *
+ *  - /dev/spidev0.0 and /dev/spidev1.0: loopback devices
+ *  - /dev/spidev0.1: a 12-bit streaming ADC
+ *  - /dev/i2c-1 address 0x40: an HTU21D reading 25C and 50%RH
+ *  - /dev/i2c-1 address 0x50: a 24C32 EEPROM (4 KiB, 32 byte pages, 5 ms
+ *    write cycle)
+ */
+void Sim_loadDefaultTopology(void);
+
+/**
+ * @brief Sets the recorder that's called with the simulated bus traffic.
+ *
+ * @param recorder the callbacks to use, copied, or NULL to stop recording
+ */
+void Sim_setRecorder(const SimRecorder *recorder);
+
+/**
+ * @brief Creates an SPI device that sends back whatever it receives.
+ *
+ * @return Returns the device, or NULL if unable to allocate it
+ */
+SimDevice *SimDevice_spiLoopback(void);
+
+/**
+ * @brief Creates a streaming SPI ADC.
+ *
+ * Every sample is the next value of a ramp counting up from 0 and wrapping
+ * at 2^\p bits, restarting each time CS is asserted. With 8 bits per word 
+ * the samples are sent back to back as a bitstream, most significant bit 
+ * first; with larger words each word holds one sample.
+ *
+ * @param bits the resolution of the ADC, from 1 to 32
+ *
+ * @return Returns the device, or NULL if error
+ */
+SimDevice *SimDevice_adc(uint8_t bits);
+
+/**
+ * @brief Creates a 24C-series I2C EEPROM.
+ *
+ * Devices up to 256 bytes take a single address byte, larger ones two. 
+ * Writes wrap within their page and take effect at the stop condition, 
+ * after which the device doesn't acknowledge anything for the write cycle 
+ * time. Memory starts out erased (0xff).
+ *
+ * @param size memory size in bytes
+ * @param page_size write page size in bytes, a power of 2
+ * @param write_cycle_us write cycle time in microseconds
+ *
+ * @return Returns the device, or NULL if error
+ */
+SimDevice *SimDevice_eeprom24c(uint32_t size, uint16_t page_size, 
+                               uint32_t write_cycle_us);
+
+/**
+ * @brief Creates an HTU21D temperature and relative humidity sensor.
+ *
+ * Supports the hold and no hold measurement commands, soft reset and the 
+ * user register, and sends the CRC after each measurement. Measurements are
+ * always ready immediately.
+ *
+ * @param temperature the temperature to report in degrees Celsius
+ * @param humidity the relative humidity to report in %
+ *
+ * @return Returns the device, or NULL if unable to allocate it
+ */
+SimDevice *SimDevice_htu21d(float temperature, float humidity);
+
+/**
+ * @brief Creates a PCA9548 8-channel I2C mux.
+ *
+ * Writing the control register sets which channels are connected, one bit 
+ * each, but like the real part the new value only takes effect at the stop
+ * condition; reads return the current value. All channels start out 
+ * disconnected. Attach devices behind it with #Sim_attachI2CMuxed.
+ *
+ * @return Returns the device, or NULL if unable to allocate it
+ */
+SimDevice *SimDevice_pca9548(void);
+
+#endif // _SIMBUS_H_
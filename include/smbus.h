@@ -0,0 +1,222 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file smbus.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief SMBus protocol transfers on Linux I2C interfaces.
+ *
+ * Wraps the i2c-dev I2C_SMBUS ioctl, so SMBus devices can be driven through
+ * the adapter's own SMBus support (or the kernel's emulation of it on plain 
+ * I2C adapters) instead of hand-built byte sequences. All transfers go to the
+ * slave address set with #I2C_setSlaveAddress.
+ *
+ * Each call checks the adapter's capabilities, cached by #I2C_open, before 
+ * making any ioctl, and fails with errno set to EOPNOTSUPP if the adapter 
+ * can't do the transfer.
+ */
+
+#ifndef _SMBUS_H_
+#define _SMBUS_H_
+
+#include <stdint.h>
+#include "i2cdriver.h"
+
+/// The most data bytes an SMBus block transfer can carry
+#define SMBUS_BLOCK_MAX I2C_SMBUS_BLOCK_MAX
+
+/**
+ * @brief Enables or disables packet error checking on the given interface.
+ *
+ * With PEC enabled, a CRC-8 byte is appended to every SMBus transfer except
+ * quick commands and I2C block transfers, and checked on reads.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param enable 1 to enable PEC, 0 to disable it
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_setPEC(int i2c_fd, int enable);
+
+/**
+ * @brief Sends an SMBus quick command.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param read_write the bit to send in place of data, I2C_SMBUS_READ or 
+ *        I2C_SMBUS_WRITE
+ *
+ * @return Returns 0 if the slave acknowledged, -1 otherwise
+ */
+int SMBus_quick(int i2c_fd, uint8_t read_write);
+
+/**
+ * @brief Receives a byte from the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ *
+ * @return Returns the byte read, or -1 if error
+ */
+int SMBus_readByte(int i2c_fd);
+
+/**
+ * @brief Sends a byte to the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param value the byte to send
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_writeByte(int i2c_fd, uint8_t value);
+
+/**
+ * @brief Reads a byte from the given command (register) of the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ *
+ * @return Returns the byte read, or -1 if error
+ */
+int SMBus_readByteData(int i2c_fd, uint8_t command);
+
+/**
+ * @brief Writes a byte to the given command (register) of the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param value the byte to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_writeByteData(int i2c_fd, uint8_t command, uint8_t value);
+
+/**
+ * @brief Reads a 16-bit word from the given command (register) of the slave.
+ *
+ * SMBus words are sent least significant byte first.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ *
+ * @return Returns the word read, or -1 if error
+ */
+int SMBus_readWordData(int i2c_fd, uint8_t command);
+
+/**
+ * @brief Writes a 16-bit word to the given command (register) of the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param value the word to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_writeWordData(int i2c_fd, uint8_t command, uint16_t value);
+
+/**
+ * @brief Writes a word to the slave then reads a word back, with a repeated
+ *        start in between.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param value the word to write
+ *
+ * @return Returns the word read, or -1 if error
+ */
+int SMBus_processCall(int i2c_fd, uint8_t command, uint16_t value);
+
+/**
+ * @brief Reads a block whose length is given by the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param rx_buffer buffer of at least #SMBUS_BLOCK_MAX bytes to read into
+ *
+ * @return Returns the number of bytes read, or -1 if error
+ */
+int SMBus_readBlockData(int i2c_fd, uint8_t command, void *rx_buffer);
+
+/**
+ * @brief Writes a block, preceded by its length, to the slave.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param tx_buffer the bytes to write
+ * @param n_bytes the number of bytes to write, at most #SMBUS_BLOCK_MAX
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_writeBlockData(int i2c_fd, uint8_t command, const void *tx_buffer,
+                         int n_bytes);
+
+/**
+ * @brief Writes a block to the slave then reads a block back, with a 
+ *        repeated start in between.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param tx_buffer the bytes to write
+ * @param n_bytes the number of bytes to write, at most #SMBUS_BLOCK_MAX
+ * @param rx_buffer buffer of at least #SMBUS_BLOCK_MAX bytes to read into
+ *
+ * @return Returns the number of bytes read, or -1 if error
+ */
+int SMBus_blockProcessCall(int i2c_fd, uint8_t command, const void *tx_buffer,
+                           int n_bytes, void *rx_buffer);
+
+/**
+ * @brief Reads a fixed length block from the given command (register) of 
+ *        the slave, without a length byte.
+ *
+ * Blocks of up to #SMBUS_BLOCK_MAX bytes use the adapter's SMBus support if
+ * it has it. Longer blocks, or adapters without it, use a combined I2C 
+ * transfer as #I2C_readTransaction does.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param rx_buffer buffer to read into
+ * @param n_bytes the number of bytes to read
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_readI2CBlockData(int i2c_fd, uint8_t command, void *rx_buffer,
+                           int n_bytes);
+
+/**
+ * @brief Writes a block to the given command (register) of the slave, 
+ *        without a length byte.
+ *
+ * Blocks of up to #SMBUS_BLOCK_MAX bytes use the adapter's SMBus support if
+ * it has it. Longer blocks, or adapters without it, use a plain I2C write.
+ *
+ * @param i2c_fd I2C file descriptor
+ * @param command the command code
+ * @param tx_buffer the bytes to write
+ * @param n_bytes the number of bytes to write
+ *
+ * @return Returns 0 if successful, -1 if error
+ */
+int SMBus_writeI2CBlockData(int i2c_fd, uint8_t command, const void *tx_buffer,
+                            int n_bytes);
+
+#endif // _SMBUS_H_
@@ -0,0 +1,199 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file spicapture.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Background continuous capture from SPI devices.
+ *
+ * A capture runs a dedicated thread that reads blocks of frames from an SPI
+ * interface back to back, one SPI_IOC_MESSAGE per block, into a preallocated
+ * ring of blocks. The ring is lock-free with a single producer (the capture
+ * thread) and a single consumer: the consumer gets pointers straight into the
+ * ring with #SPI_captureAcquire and hands each block back with 
+ * #SPI_captureRelease, so no data is copied after it leaves the kernel.
+ *
+ * If the consumer falls behind and the ring fills up, the capture thread 
+ * keeps the bus running into a scratch block and counts each block it drops
+ * as an overrun, so gaps in the data can always be detected.
+ *
+ * Received words are in the spidev layout, see spipack.h for converting them.
+ * A capture can be tested without hardware by enabling the interface's 
+ * loopback mode with #SPI_enableLoopback and passing a tx_frame, which will
+ * then be returned as every frame.
+ */
+
+#ifndef _SPI_CAPTURE_H_
+#define _SPI_CAPTURE_H_
+
+#include <stdint.h>
+#include "spidriver.h"
+
+/**
+ * Settings for a capture, passed to #SPI_captureCreate.
+ */
+typedef struct {
+  uint32_t frame_words;      ///< Words per frame (CS is toggled between frames)
+  uint32_t frames_per_block; ///< Frames read in each SPI_IOC_MESSAGE
+  uint32_t n_blocks;         ///< Number of blocks in the ring, at least 2
+  void *tx_frame;            ///< Words to send in each frame, or NULL for 0s
+  uint32_t speed_hz;         ///< Clock frequency, or 0 for the interface's
+  uint16_t delay_usecs;      ///< Delay after each frame
+} SPI_capture_config;
+
+/**
+ * Counters describing the progress of a capture.
+ */
+typedef struct {
+  uint64_t blocks;   ///< Blocks placed in the ring
+  uint64_t overruns; ///< Blocks dropped because the ring was full
+  int error;         ///< errno of the read that stopped the capture, or 0
+} SPI_capture_stats;
+
+/**
+ * An opaque capture created with #SPI_captureCreate.
+ */
+typedef struct SPI_capture SPI_capture;
+
+/**
+ * @brief Creates a capture on the given SPI interface.
+ *
+ * Allocates the ring of blocks and the capture's eventfd. The capture isn't
+ * started until #SPI_captureStart is called. The interface's bits per word 
+ * are read when the capture is created; the handle must stay open and its
+ * bits per word must not be changed until the capture is destroyed.
+ *
+ * Each block must fit in a single SPI_IOC_MESSAGE, so frames_per_block can
+ * be at most #SPI_MAX_SEGMENTS, and the frames must fit in the spidev bufsiz
+ * (see #SPI_getBufferSize) with each one's size rounded up to 
+ * #SPI_DMA_ALIGN bytes.
+ *
+ * @param handle the SPI interface to capture from
+ * @param config the capture settings, copied into the capture
+ *
+ * @return Returns the capture, or NULL if error, with errno set to EMSGSIZE
+ *         if a block won't fit in one message
+ */
+SPI_capture *SPI_captureCreate(SPI_handle *handle, 
+                               const SPI_capture_config *config);
+
+/**
+ * @brief Stops the given capture if running, and frees it.
+ *
+ * Any block pointers returned by #SPI_captureAcquire are invalid after this.
+ *
+ * @param capture the capture to destroy
+ */
+void SPI_captureDestroy(SPI_capture *capture);
+
+/**
+ * @brief Starts the capture thread.
+ *
+ * Blocks left in the ring from a previous run are kept, and the block and
+ * overrun counters are not reset. Fails with EBUSY if already running.
+ *
+ * @param capture the capture to start
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_captureStart(SPI_capture *capture);
+
+/**
+ * @brief Stops the capture thread, waiting for its current block to finish.
+ *
+ * Blocks already in the ring remain available to #SPI_captureAcquire.
+ *
+ * @param capture the capture to stop
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_captureStop(SPI_capture *capture);
+
+/**
+ * @brief Gets the oldest captured block without removing it from the ring.
+ *
+ * If the ring is empty waits up to \p timeout_ms for a block, or forever if
+ * \p timeout_ms is negative. The block stays valid until it's passed to 
+ * #SPI_captureRelease. Must only be called from one thread at a time.
+ *
+ * @param capture the capture to get a block from
+ * @param timeout_ms maximum time to wait in milliseconds
+ *
+ * @return Returns a pointer to the block of frames_per_block * frame_words 
+ *         words, or NULL with errno set to EAGAIN if no block was available 
+ *         in time, or to the capture's error if it stopped on an error
+ */
+const void *SPI_captureAcquire(SPI_capture *capture, int timeout_ms);
+
+/**
+ * @brief Returns the block last given by #SPI_captureAcquire to the ring.
+ *
+ * @param capture the capture the block came from
+ */
+void SPI_captureRelease(SPI_capture *capture);
+
+/**
+ * @brief Discards all blocks currently in the ring.
+ *
+ * Used by the consumer to resynchronise after an overrun. Must not be called
+ * while holding a block from #SPI_captureAcquire.
+ *
+ * @param capture the capture to drain
+ *
+ * @return Returns the number of blocks discarded
+ */
+int SPI_captureDrain(SPI_capture *capture);
+
+/**
+ * @brief Gets the size of each captured block.
+ *
+ * @param capture the capture
+ *
+ * @return Returns the size of each block in bytes
+ */
+uint32_t SPI_captureBlockSize(SPI_capture *capture);
+
+/**
+ * @brief Gets the capture's eventfd, for waiting on blocks with poll() or 
+ *        select().
+ *
+ * The eventfd becomes readable whenever a block is added to the ring or the
+ * capture thread stops. It's cleared by #SPI_captureAcquire.
+ *
+ * @param capture the capture
+ *
+ * @return Returns the eventfd file descriptor
+ */
+int SPI_captureFd(SPI_capture *capture);
+
+/**
+ * @brief Gets the capture's counters.
+ *
+ * @param capture the capture
+ * @param stats filled in with the current counters
+ */
+void SPI_captureGetStats(SPI_capture *capture, SPI_capture_stats *stats);
+
+#endif
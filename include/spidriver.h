@@ -30,6 +30,10 @@
  * which provide the standard Linux SPI ioctls. This driver is really just an 
  * ioctl wrapper.
  *
+ * Word buffers passed to the transfer functions use the spidev layout, where
+ * each word takes 1, 2 or 4 bytes for up to 8, 16 or 32 bits per word; see 
+ * spipack.h for converting them to and from other formats.
+ *
  * @see 
  *  `examples/spi_ad7390.c` @include spi_ad7390.c
  */
@@ -56,6 +60,39 @@ int SPI_open(uint8_t bus, uint8_t cs);
  */
 void SPI_close(int spidev_fd);
 
+/**
+ * @brief Gets the spidev driver's per-message buffer size.
+ *
+ * This is the spidev `bufsiz` module parameter, read once from sysfs. 
+ * spidev counts each transfer against it rounded up to #SPI_DMA_ALIGN bytes,
+ * and transfers that don't fit are split into multiple messages 
+ * automatically.
+ *
+ * @return Returns the buffer size in bytes
+ */
+uint32_t SPI_getBufferSize(void);
+
+/**
+ * @brief Gets a page-aligned transfer buffer of at least \p n_bytes bytes.
+ *
+ * Buffers up to #SPI_getBufferSize bytes come from a shared pool and are 
+ * reused after being passed to #SPI_releaseBuffer, so allocating them on 
+ * every transfer doesn't cost a malloc and free. Larger buffers are 
+ * allocated individually.
+ *
+ * @param n_bytes the number of bytes needed, see #SPI_bufferSize
+ *
+ * @return Returns the buffer, or NULL if unable to allocate it
+ */
+void *SPI_allocBuffer(uint32_t n_bytes);
+
+/**
+ * @brief Releases a buffer returned by #SPI_allocBuffer.
+ *
+ * @param buffer the buffer to release, or NULL to do nothing
+ */
+void SPI_releaseBuffer(void *buffer);
+
 /**
  * @brief Reads from the given spidev interface.
  *
@@ -67,7 +104,7 @@ void SPI_close(int spidev_fd);
  *        size
  * @param n_words the number of words to read into tx_buffer
  *
- * @return Returns the number of bytes read, or -1 if unable to read from 
+ * @return Returns the number of words read, or -1 if unable to read from 
  *         interface 
  */
 int SPI_read(int spidev_fd, void *rx_buffer, int n_words);
@@ -81,7 +118,7 @@ int SPI_read(int spidev_fd, void *rx_buffer, int n_words);
  * @param tx_buffer pointer to an array containing the words to be transmitted
  * @param n_words the number of words to be transmitted from tx_buffer
  *
- * @return Returns the number of bytes written, or -1 if unable to write 
+ * @return Returns the number of words written, or -1 if unable to write 
  *         interface 
  */
 int SPI_write(int spidev_fd, void *tx_buffer, int n_words);
@@ -100,7 +137,7 @@ int SPI_write(int spidev_fd, void *tx_buffer, int n_words);
  *        size
  * @param n_rx_words the number of words to read into tx_buffer
  *
- * @return Returns the number of bytes read, or -1 if unable to read or write
+ * @return Returns the number of words read, or -1 if unable to read or write
  *         interface
  */
 int SPI_transaction(int spidev_fd, void *tx_buffer, int n_tx_words, 
@@ -118,11 +155,240 @@ int SPI_transaction(int spidev_fd, void *tx_buffer, int n_tx_words,
  *        size
  * @param n_words the number of words to be transferred
  *
- * @return Returns the number of bytes transferred, or -1 if unable to write 
+ * @return Returns the number of words transferred, or -1 if unable to write 
  *         interface 
  */
 int SPI_transfer(int spidev_fd, void *tx_buffer, void *rx_buffer, int n_words);
 
+/**
+ * Per-transfer overrides of an interface's settings, passed to the SPI_*Ex 
+ * transfer functions. These go straight into the SPI_IOC_MESSAGE and leave
+ * the interface's own settings untouched, so devices with different settings
+ * can share a bus without reconfiguring it between transfers.
+ */
+typedef struct {
+  uint32_t speed_hz;        ///< Clock frequency, or 0 for the interface's max
+  uint8_t bits_per_word;    ///< Bits per word, or 0 for the interface's
+  uint8_t word_delay_usecs; ///< Delay between words, if the controller can
+  uint8_t tx_nbits;         ///< Lanes used to transmit, or 0 for 1
+  uint8_t rx_nbits;         ///< Lanes used to receive, or 0 for 1
+} SPI_options;
+
+/**
+ * @brief Same as #SPI_read, with the given per-transfer overrides.
+ *
+ * @param options overrides for this transfer, or NULL for none
+ */
+int SPI_readEx(int spidev_fd, void *rx_buffer, int n_words, 
+               const SPI_options *options);
+
+/**
+ * @brief Same as #SPI_write, with the given per-transfer overrides.
+ *
+ * @param options overrides for this transfer, or NULL for none
+ */
+int SPI_writeEx(int spidev_fd, void *tx_buffer, int n_words, 
+                const SPI_options *options);
+
+/**
+ * @brief Same as #SPI_transaction, with the given per-transfer overrides
+ *        applied to both the write and the read.
+ *
+ * @param options overrides for this transfer, or NULL for none
+ */
+int SPI_transactionEx(int spidev_fd, void *tx_buffer, int n_tx_words, 
+                      void *rx_buffer, int n_rx_words, 
+                      const SPI_options *options);
+
+/**
+ * @brief Same as #SPI_transfer, with the given per-transfer overrides.
+ *
+ * @param options overrides for this transfer, or NULL for none
+ */
+int SPI_transferEx(int spidev_fd, void *tx_buffer, void *rx_buffer, 
+                   int n_words, const SPI_options *options);
+
+/**
+ * The maximum number of transfers the kernel accepts in a single 
+ * SPI_IOC_MESSAGE, limited by the size field of the ioctl number. The size
+ * must fit in _IOC_SIZEBITS bits, so a full 16 KiB of transfers (512) 
+ * would encode as 0, which spidev takes as an empty message.
+ */
+#define SPI_MAX_SEGMENTS \
+  ((int) (((1 << _IOC_SIZEBITS) - 1) / sizeof(struct spi_ioc_transfer)))
+
+/**
+ * The alignment spidev rounds each transfer's length up to when totalling a
+ * message against the bufsiz. This is the kernel's ARCH_DMA_MINALIGN, taken
+ * as 128 bytes, the largest any common architecture (arm64) uses.
+ */
+#define SPI_DMA_ALIGN 128
+
+/**
+ * One segment of an #SPI_message.
+ *
+ * Zero-initialize any fields that aren't needed; a 0 value uses the 
+ * interface's current setting.
+ *
+ * A segment of 0 words still gets its delay and CS change, e.g. to wait or
+ * toggle CS between the other segments.
+ *
+ * Dual and quad transfers (tx_nbits or rx_nbits of 2 or 4) must be half 
+ * duplex, and the interface must have the matching SPI_TX_DUAL, SPI_RX_QUAD,
+ * etc. mode flags set, e.g. with #SPI_setLanes.
+ */
+typedef struct {
+  void *tx_buffer;          ///< Words to transmit, or NULL to transmit zeros
+  void *rx_buffer;          ///< Buffer to read into, or NULL to discard input
+  uint32_t n_words;         ///< Number of words to transfer
+  uint32_t speed_hz;        ///< Clock frequency, or 0 for the interface's max
+  uint16_t delay_usecs;     ///< Delay after this segment before the next one
+  uint8_t bits_per_word;    ///< Bits per word, or 0 for the interface's
+  uint8_t cs_change;        ///< Set to 1 to deselect CS after this segment
+  uint8_t word_delay_usecs; ///< Delay between words, if the controller can
+  uint8_t tx_nbits;         ///< Transmit lanes (1, 2 or 4), or 0 for 1
+  uint8_t rx_nbits;         ///< Receive lanes (1, 2 or 4), or 0 for 1
+} SPI_segment;
+
+/**
+ * @brief Performs a sequence of transfers on the given spidev interface.
+ *
+ * Submits all the segments to the kernel as a single SPI_IOC_MESSAGE when 
+ * they fit within the spidev bufsiz (see #SPI_getBufferSize), so the whole 
+ * sequence runs without returning to userspace in between. Longer sequences
+ * are split into as few messages as possible. CS stays active across all the
+ * segments unless a segment sets cs_change.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param segments array of segments to transfer in order
+ * @param n_segments the number of segments
+ *
+ * @return Returns the total number of words transferred, or -1 if error
+ */
+int SPI_message(int spidev_fd, const SPI_segment *segments, int n_segments);
+
+/**
+ * @brief Reads a series of frames from the given spidev interface.
+ *
+ * Each frame is \p n_words words read with CS active, and CS is deselected 
+ * between frames, e.g. to start the next conversion of an ADC. The frames 
+ * are submitted with #SPI_message, so as many as fit run in a single 
+ * SPI_IOC_MESSAGE. For reading frames continuously see spicapture.h.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param rx_buffer buffer of at least \p n_words * \p n_frames words to read
+ *        the frames into one after another
+ * @param n_words the number of words in each frame
+ * @param n_frames the number of frames to read
+ *
+ * @return Returns the total number of words read, or -1 if error
+ */
+int SPI_readFrames(int spidev_fd, void *rx_buffer, int n_words, int n_frames);
+
+/**
+ * Opaque handle to an spidev interface.
+ *
+ * Every interface opened with #SPI_open keeps a shadow copy of its mode, bits
+ * per word and clock frequency, read once when it's opened and only updated 
+ * by the SPI_set* functions, so transfers need just the one SPI_IOC_MESSAGE
+ * ioctl. A handle gives direct access to the shadow without looking it up by
+ * fd on each call. The SPI_set* and SPI_get* functions can be used on a 
+ * handle's interface by passing them the fd returned by #SPI_handleFd.
+ */
+typedef struct SPI_handle SPI_handle;
+
+/**
+ * @brief Opens the /dev/spidev[bus].[cs] interface and returns a handle to it.
+ *
+ * @param bus SPI bus number
+ * @param cs chip select number
+ *
+ * @return Returns a new handle, or NULL if unable to open the interface
+ */
+SPI_handle *SPI_openHandle(uint8_t bus, uint8_t cs);
+
+/**
+ * @brief Closes the given handle's interface and frees the handle.
+ *
+ * @param handle handle returned by #SPI_openHandle
+ */
+void SPI_closeHandle(SPI_handle *handle);
+
+/**
+ * @brief Gets the spidev file descriptor of the given handle.
+ *
+ * @param handle handle returned by #SPI_openHandle
+ *
+ * @return Returns the spidev file descriptor
+ */
+int SPI_handleFd(SPI_handle *handle);
+
+/**
+ * @brief Same as #SPI_read, using the handle's cached bits per word.
+ */
+int SPI_handleRead(SPI_handle *handle, void *rx_buffer, int n_words);
+
+/**
+ * @brief Same as #SPI_write, using the handle's cached bits per word.
+ */
+int SPI_handleWrite(SPI_handle *handle, void *tx_buffer, int n_words);
+
+/**
+ * @brief Same as #SPI_transaction, using the handle's cached bits per word.
+ */
+int SPI_handleTransaction(SPI_handle *handle, void *tx_buffer, int n_tx_words,
+                          void *rx_buffer, int n_rx_words);
+
+/**
+ * @brief Same as #SPI_transfer, using the handle's cached bits per word.
+ */
+int SPI_handleTransfer(SPI_handle *handle, void *tx_buffer, void *rx_buffer, 
+                       int n_words);
+
+/**
+ * @brief Same as #SPI_message, using the handle's cached bits per word.
+ */
+int SPI_handleMessage(SPI_handle *handle, const SPI_segment *segments, 
+                      int n_segments);
+
+/**
+ * @brief Builds the given segments into the transfers of a single 
+ *        SPI_IOC_MESSAGE, for sending repeatedly with #SPI_handleSendMessage.
+ *
+ * The segments are split into transfers the same way as by #SPI_message,
+ * using the handle's cached bits per word for segments that don't set 
+ * their own. Building the message once saves redoing it for every send, 
+ * e.g. for continuous capture; the transfers' tx_buf and rx_buf can be 
+ * changed between sends.
+ *
+ * @param handle the interface handle
+ * @param segments array of segments to transfer in order
+ * @param n_segments the number of segments
+ * @param transfers array to build the transfers in
+ * @param max_transfers room in \p transfers; no more than #SPI_MAX_SEGMENTS
+ *        are used
+ *
+ * @return Returns the number of transfers, or -1 if error, with errno set 
+ *         to EMSGSIZE if the segments don't fit in a single message
+ */
+int SPI_handleBuildMessage(SPI_handle *handle, const SPI_segment *segments,
+                           int n_segments, struct spi_ioc_transfer *transfers,
+                           int max_transfers);
+
+/**
+ * @brief Sends transfers built by #SPI_handleBuildMessage as one 
+ *        SPI_IOC_MESSAGE.
+ *
+ * @param handle the interface handle
+ * @param transfers the transfers to send
+ * @param n_transfers the number of transfers
+ *
+ * @return Returns the total number of bytes transferred, or -1 if error
+ */
+int SPI_handleSendMessage(SPI_handle *handle, 
+                          const struct spi_ioc_transfer *transfers,
+                          int n_transfers);
+
 /**
  * Passed to #SPI_setBitOrder to specify the bit order to use for subsequent
  * SPI transfers.
@@ -132,6 +398,18 @@ typedef enum {
   SPI_LSBFIRST  ///< Least significant bit first
 } SPI_bit_order;
 
+/**
+ * The full configuration of an spidev interface, for reading and writing in 
+ * one call with #SPI_getConfig and #SPI_setConfig.
+ */
+typedef struct {
+  uint8_t mode;            ///< Clock mode, one of SPI_MODE_0 - SPI_MODE_3
+  uint32_t mode_flags;     ///< Other SPI mode flags, e.g. SPI_CS_HIGH|SPI_LOOP
+  uint32_t speed_hz;       ///< Max clock frequency
+  uint8_t bits_per_word;   ///< Bits per word
+  SPI_bit_order bit_order; ///< Bit order
+} SPI_config;
+
 /**
  * @brief Sets the bit order of the given spidev interface.
  *
@@ -297,4 +575,77 @@ int SPI_setMode(int spidev_fd, uint8_t mode);
  */
 int SPI_getMode(int spidev_fd);
 
+/**
+ * @brief Sets the full 32-bit SPI mode for the given spidev interface.
+ *
+ * Same as #SPI_setMode, but can also set the flags above the first 8 bits, 
+ * e.g. SPI_TX_DUAL or SPI_RX_QUAD, which requires a kernel with the 
+ * SPI_IOC_WR_MODE32 ioctl.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param mode SPI mode flags
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_setMode32(int spidev_fd, uint32_t mode);
+
+/**
+ * @brief Gets the full 32-bit SPI mode for the given spidev interface.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param mode set to the SPI mode flags
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_getMode32(int spidev_fd, uint32_t *mode);
+
+/**
+ * @brief Sets the number of data lanes the given spidev interface may use.
+ *
+ * Sets the SPI_TX_DUAL/SPI_TX_QUAD and SPI_RX_DUAL/SPI_RX_QUAD mode flags, 
+ * which allow transfers to be done over multiple lanes by setting the 
+ * tx_nbits and rx_nbits fields of #SPI_options or #SPI_segment. Transfers 
+ * still use a single lane by default.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param tx_lanes maximum transmit lanes, one of 1, 2 or 4
+ * @param rx_lanes maximum receive lanes, one of 1, 2 or 4
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_setLanes(int spidev_fd, uint8_t tx_lanes, uint8_t rx_lanes);
+
+/**
+ * @brief Gets the full configuration of the given spidev interface.
+ *
+ * Interfaces opened with #SPI_open are read from their shadow copy without 
+ * any ioctls.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param config filled in with the current configuration
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int SPI_getConfig(int spidev_fd, SPI_config *config);
+
+/**
+ * @brief Applies the given configuration to the given spidev interface.
+ *
+ * Only the settings that differ from the interface's current configuration 
+ * are written, so this takes at most three ioctls (mode, bits per word and
+ * clock frequency) and none if nothing changed. For interfaces opened with 
+ * #SPI_open the whole configuration is applied atomically with respect to 
+ * the other SPI_set* functions. Mode flags above the first 8 bits (e.g. 
+ * SPI_TX_DUAL) require a kernel with the 32-bit mode ioctl.
+ *
+ * Typically used as read-modify-write with #SPI_getConfig.
+ *
+ * @param spidev_fd spidev file descriptor
+ * @param config the configuration to apply
+ *
+ * @return Returns 0 if successful, or -1 if error, in which case some of the
+ *         settings may have been applied
+ */
+int SPI_setConfig(int spidev_fd, const SPI_config *config);
+
 #endif // _SPI_DRIVER_H_
\ No newline at end of file
@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file spipack.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Conversion between SPI bus buffers and native word arrays.
+ *
+ * SPI words can be laid out in a transfer buffer in one of two ways:
+ *
+ *  - The spidev layout, used when the interface is set to the word size 
+ *    itself: each word is stored right-justified in 1, 2 or 4 bytes (for up 
+ *    to 8, 16 or 32 bits per word respectively), in host byte order.
+ *  - A packed bitstream (#SPI_PACK_BITSTREAM), as received when the 
+ *    interface is left at 8 bits per word and the device sends its words 
+ *    back to back, e.g. 12- or 24-bit ADC samples, most significant bit first.
+ *
+ * #SPI_unpack and #SPI_pack convert between either layout and arrays of 
+ * uint16_t, uint32_t, int32_t or float for any word size from 1 to 32 bits.
+ * The common cases are vectorized with SSSE3/AVX2 on x86 (selected at 
+ * runtime) and NEON on ARM, falling back to portable C otherwise.
+ */
+
+#ifndef _SPI_PACK_H_
+#define _SPI_PACK_H_
+
+#include <stdint.h>
+
+/**
+ * The native word types supported by #SPI_unpack and #SPI_pack.
+ */
+typedef enum {
+  SPI_WORD_UINT16, ///< uint16_t, only for up to 16 bits per word
+  SPI_WORD_UINT32, ///< uint32_t
+  SPI_WORD_INT32,  ///< int32_t, always sign extended
+  SPI_WORD_FLOAT   ///< float, holding the integer value of each word
+} SPI_word_type;
+
+/// The bus buffer is a packed bitstream rather than the spidev layout
+#define SPI_PACK_BITSTREAM    0x01
+/// Words are two's complement and are sign extended to the native type
+#define SPI_PACK_SIGNED       0x02
+/// Bitstream words are sent least significant byte first (multiples of 8 bits)
+#define SPI_PACK_LSBYTE_FIRST 0x04
+
+/**
+ * @brief Gets the number of bytes spidev uses to store one word.
+ *
+ * @param bits_per_word bits per word, from 1 to 32
+ *
+ * @return Returns 1, 2 or 4, or 0 if \p bits_per_word is out of range
+ */
+uint32_t SPI_wordBytes(uint8_t bits_per_word);
+
+/**
+ * @brief Gets the exact size of the bus buffer needed for \p n_words words.
+ *
+ * @param bits_per_word bits per word, from 1 to 32
+ * @param n_words number of words
+ * @param flags #SPI_PACK_BITSTREAM to get the packed size, 0 for the spidev 
+ *        layout
+ *
+ * @return Returns the buffer size in bytes
+ */
+uint32_t SPI_bufferSize(uint8_t bits_per_word, uint32_t n_words, int flags);
+
+/**
+ * @brief Unpacks words from an SPI bus buffer into a native array.
+ *
+ * @param bus_buffer the received data
+ * @param words array of \p n_words elements of the given type
+ * @param type the type of the elements of \p words
+ * @param n_words the number of words to unpack
+ * @param bits_per_word bits per word, from 1 to 32
+ * @param flags any combination of the SPI_PACK_* flags
+ *
+ * @return Returns 0 if successful, or -1 if the arguments are invalid
+ */
+int SPI_unpack(const void *bus_buffer, void *words, SPI_word_type type,
+               uint32_t n_words, uint8_t bits_per_word, int flags);
+
+/**
+ * @brief Packs words from a native array into an SPI bus buffer.
+ *
+ * Only the low \p bits_per_word bits of each word are used. Float words are
+ * rounded to the nearest integer first.
+ *
+ * @param words array of \p n_words elements of the given type
+ * @param type the type of the elements of \p words
+ * @param bus_buffer buffer of at least #SPI_bufferSize bytes to pack into
+ * @param n_words the number of words to pack
+ * @param bits_per_word bits per word, from 1 to 32
+ * @param flags any combination of the SPI_PACK_* flags
+ *
+ * @return Returns 0 if successful, or -1 if the arguments are invalid
+ */
+int SPI_pack(const void *words, SPI_word_type type, void *bus_buffer,
+             uint32_t n_words, uint8_t bits_per_word, int flags);
+
+#endif // _SPI_PACK_H_
@@ -0,0 +1,126 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file transport.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Pluggable backends for the file operations behind the bus drivers.
+ *
+ * The SPI and I2C drivers never call open, close, ioctl, read or write 
+ * directly; they go through the Transport_* functions here, which pass each 
+ * call on to the #Transport the file was opened with. The default transport,
+ * #Transport_dev, uses the real /dev files. #Transport_sim instead runs an 
+ * in-process simulated bus with pluggable device models (see simbus.h), so 
+ * the library can be tested and profiled without any hardware.
+ *
+ * The transport is chosen when a file is opened, from the one most recently
+ * passed to #Transport_select. If #Transport_select hasn't been called, the 
+ * SERBUS_TRANSPORT environment variable can be set to "sim" to start out 
+ * with #Transport_sim instead of #Transport_dev.
+ */
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * The set of file operations implemented by a transport. They follow the 
+ * semantics of the system calls of the same names, returning -1 and setting
+ * errno on error.
+ */
+typedef struct {
+  const char *name; ///< Short name, e.g. "dev" or "sim"
+  int (*open)(const char *path, int flags);
+  int (*close)(int fd);
+  int (*ioctl)(int fd, unsigned long request, void *arg);
+  ssize_t (*read)(int fd, void *buffer, size_t n_bytes);
+  ssize_t (*write)(int fd, const void *buffer, size_t n_bytes);
+} Transport;
+
+/// The real /dev files
+extern const Transport Transport_dev;
+
+/// The in-process simulated bus, see simbus.h
+extern const Transport Transport_sim;
+
+/**
+ * @brief Sets the transport used by subsequently opened files.
+ *
+ * Files that are already open keep using the transport they were opened 
+ * with.
+ *
+ * @param transport the transport to use, or NULL for the default
+ */
+void Transport_select(const Transport *transport);
+
+/**
+ * @brief Gets the transport that newly opened files will use.
+ *
+ * @return Returns the selected transport
+ */
+const Transport *Transport_selected(void);
+
+/**
+ * @brief Opens the given file with the selected transport.
+ *
+ * @return Returns the file descriptor, or -1 if error
+ */
+int Transport_open(const char *path, int flags);
+
+/**
+ * @brief Closes the given file with the transport it was opened with.
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int Transport_close(int fd);
+
+/**
+ * @brief Performs an ioctl on the given file with the transport it was 
+ *        opened with.
+ *
+ * Like ioctl(), takes a single optional argument, either a pointer or an 
+ * integer value depending on the request.
+ *
+ * @return Returns the ioctl's result, or -1 if error
+ */
+int Transport_ioctl(int fd, unsigned long request, ...);
+
+/**
+ * @brief Reads from the given file with the transport it was opened with.
+ *
+ * @return Returns the number of bytes read, or -1 if error
+ */
+ssize_t Transport_read(int fd, void *buffer, size_t n_bytes);
+
+/**
+ * @brief Writes to the given file with the transport it was opened with.
+ *
+ * @return Returns the number of bytes written, or -1 if error
+ */
+ssize_t Transport_write(int fd, const void *buffer, size_t n_bytes);
+
+#endif // _TRANSPORT_H_
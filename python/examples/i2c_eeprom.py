@@ -12,7 +12,7 @@ data_to_write = range(10)
 bus = serbus.I2CDev(2)
 bus.open()
 
-print "Writing data: {}".format(data_to_write)
+print("Writing data: {}".format(data_to_write))
 # Write the data to the EEPROM:
 bus.write(eeprom_addr, [start_msb, start_lsb] + data_to_write)
 # The I2C write is asynchronous - give it a bit of time to complete:
@@ -21,11 +21,11 @@ time.sleep(0.01) # 10ms should be more than enough
 # Read the data from the EEPROM:
 bus.write(eeprom_addr, [start_msb, start_lsb])
 read_data = bus.read(0x50, len(data_to_write))
-print "Data read: {}".format(read_data)
+print("Data read: {}".format(read_data))
 
 if read_data == data_to_write:
-  print "EEPROM write successful!"
+  print("EEPROM write successful!")
 else:
-  print "EEPROM write failed, is WP enabled?"
+  print("EEPROM write failed, is WP enabled?")
 
 bus.close()
\ No newline at end of file
@@ -31,9 +31,9 @@ def getRH():
 
 try:
   while True:
-    print
-    print "Temperature:       {:0.2f}C".format(getTemp())
-    print "Relative humidity: {:0.2f}%".format(getRH())
+    print()
+    print("Temperature:       {:0.2f}C".format(getTemp()))
+    print("Relative humidity: {:0.2f}%".format(getRH()))
     time.sleep(1)
 
 except KeyboardInterrupt:
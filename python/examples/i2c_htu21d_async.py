@@ -0,0 +1,37 @@
+# i2c_htu21d_async.py
+# Example of reading the HTU21D I2C temp/humidity sensor from asyncio
+import asyncio, serbus
+
+htu21d_bus      = 1    # Connected to /dev/i2c-1
+htu21d_addr     = 0x40 # HTU21D slave address
+htu21d_cmd_temp = 0xe3 # Command to read temperature
+htu21d_cmd_rh   = 0xe5 # Command to read relative humidity
+
+bus = serbus.I2CDev(htu21d_bus)
+bus.open()
+
+async def getTemp():
+  # The read runs in the bus's worker thread while the event loop carries on:
+  msb, lsb, crc = await bus.areadTransaction(htu21d_addr, htu21d_cmd_temp, 3)
+  raw_value = ((msb<<8) | lsb) & ~0b11
+  return -46.85 + 175.72 * (raw_value/65536.0)
+
+async def getRH():
+  msb, lsb, crc = await bus.areadTransaction(htu21d_addr, htu21d_cmd_rh, 3)
+  raw_value = ((msb<<8) | lsb) & ~0b11
+  return -6.0 + 125.0 * (raw_value/65536.0)
+
+async def main():
+  while True:
+    # Both reads are queued at once and done back to back:
+    temp, rh = await asyncio.gather(getTemp(), getRH())
+    print()
+    print("Temperature:       {:0.2f}C".format(temp))
+    print("Relative humidity: {:0.2f}%".format(rh))
+    await asyncio.sleep(1)
+
+try:
+  asyncio.run(main())
+
+except KeyboardInterrupt:
+  bus.close()
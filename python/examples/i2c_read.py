@@ -8,6 +8,6 @@ bus.open()
 
 # Read a single byte from the slave device with address 0x50:
 data = bus.read(0x50, 1)
-print "byte received: {:x}".format(data[0])
+print("byte received: {:x}".format(data[0]))
 
 bus.close()
\ No newline at end of file
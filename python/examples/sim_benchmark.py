@@ -0,0 +1,35 @@
+# sim_benchmark.py
+# Measures the per-call overhead of the serbus methods. The buses are
+# simulated in memory, so no hardware is needed and the times are mostly
+# argument parsing, locking and result building rather than bus transfers.
+import os, sys, timeit
+
+# Must be set before the first bus is opened:
+os.environ["SERBUS_TRANSPORT"] = "sim"
+import serbus
+
+n_calls = 200000
+
+i2c = serbus.I2CDev(1) # Simulated HTU21D at 0x40
+i2c.open()
+spi = serbus.SPIDev(0) # Simulated loopback on /dev/spidev0.0
+spi.open()
+
+rx = bytearray(3)
+tx = b"\x01\x02"
+
+benchmarks = [
+  "i2c.readTransaction(0x40, 0xe3, 3)",
+  "i2c.readTransactionInto(0x40, 0xe3, rx)",
+  "spi.transfer(0, tx)",
+  "spi.setMaxFrequency(0, 1000000)",
+]
+
+print("Python {}, {} calls each".format(sys.version.split()[0], n_calls))
+for stmt in benchmarks:
+  # Take the best of a few runs to skip over scheduling noise:
+  t = min(timeit.repeat(stmt, number=n_calls, repeat=5, globals=globals()))
+  print("{:42s} {:6.0f} ns/call".format(stmt, t / n_calls * 1e9))
+
+i2c.close()
+spi.close()
@@ -18,6 +18,6 @@ bus.setMSBFirst(cs)
 
 # Read a single 8-bit word from the device:
 data = bus.read(cs, 1)
-print "word received: {:x}".format(data[0])
+print("word received: {:x}".format(data[0]))
 
 bus.close()
\ No newline at end of file
@@ -1,4 +1,4 @@
 # __init__.py file for serpus package
 
-from i2cdev import I2CDev
-from spidev import SPIDev
\ No newline at end of file
+from .i2cdev import I2CDev
+from .spidev import SPIDev
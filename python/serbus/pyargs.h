@@ -0,0 +1,165 @@
+/* pyargs.h
+ *
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Argument parsing for the serbus extension methods. The methods use the
+ * METH_FASTCALL convention, getting their positional arguments as a C array
+ * instead of a tuple, and convert each one directly with the helpers below
+ * rather than interpreting a PyArg_ParseTuple format string on every call.
+ * The conversions match the format units they replace.
+ */
+
+#ifndef _PY_ARGS_H_
+#define _PY_ARGS_H_
+
+#include "Python.h"
+#include <stdint.h>
+
+/**
+ * Checks that a method called \p name was given between \p min and \p max
+ * positional arguments. Returns -1 with a TypeError set if it wasn't.
+ */
+static inline int SerBus_checkArgs(const char *name, Py_ssize_t nargs, 
+                                   Py_ssize_t min, Py_ssize_t max) {
+  if (nargs >= min && nargs <= max) return 0;
+  if (min == max) {
+    PyErr_Format(PyExc_TypeError, 
+                 "%s() takes exactly %zd argument%s (%zd given)", name, min,
+                 min == 1 ? "" : "s", nargs);
+  }
+  else if (nargs < min) {
+    PyErr_Format(PyExc_TypeError, 
+                 "%s() takes at least %zd argument%s (%zd given)", name, min,
+                 min == 1 ? "" : "s", nargs);
+  }
+  else {
+    PyErr_Format(PyExc_TypeError, 
+                 "%s() takes at most %zd argument%s (%zd given)", name, max,
+                 max == 1 ? "" : "s", nargs);
+  }
+  return -1;
+}
+
+/**
+ * Gathers the arguments of a METH_FASTCALL | METH_KEYWORDS method called 
+ * \p name into \p values, in the order of \p keywords, the NULL terminated 
+ * list of its parameter names. The first \p min parameters are required; 
+ * optional ones that weren't given are set to NULL. Returns -1 with a 
+ * TypeError set if the arguments don't match the parameters.
+ */
+static inline int SerBus_getArgs(const char *name, PyObject *const *args,
+                                 Py_ssize_t nargs, PyObject *kwnames,
+                                 const char *const *keywords, Py_ssize_t min,
+                                 PyObject **values) {
+  Py_ssize_t n_params, n_kwargs, i, j;
+  PyObject *keyword;
+  for (n_params=0; keywords[n_params]; n_params++);
+  if (SerBus_checkArgs(name, nargs, 0, n_params) < 0) return -1;
+  for (i=0; i<n_params; i++) values[i] = i < nargs ? args[i] : NULL;
+
+  // Keyword argument values follow the positional ones in args:
+  n_kwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+  for (j=0; j<n_kwargs; j++) {
+    keyword = PyTuple_GET_ITEM(kwnames, j);
+    for (i=0; i<n_params; i++) {
+      if (PyUnicode_CompareWithASCIIString(keyword, keywords[i]) == 0) break;
+    }
+    if (i == n_params) {
+      PyErr_Format(PyExc_TypeError, 
+                   "'%U' is an invalid keyword argument for %s()", keyword,
+                   name);
+      return -1;
+    }
+    if (values[i]) {
+      PyErr_Format(PyExc_TypeError, 
+                   "argument for %s() given by name ('%s') and position (%zd)",
+                   name, keywords[i], i + 1);
+      return -1;
+    }
+    values[i] = args[nargs + j];
+  }
+
+  for (i=0; i<min; i++) {
+    if (!values[i]) {
+      PyErr_Format(PyExc_TypeError, 
+                   "%s() missing required argument '%s' (pos %zd)", name,
+                   keywords[i], i + 1);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Converts \p obj to a C long in the range [\p min, \p max], rejecting 
+ * floats. Returns -1 with an exception set if unable to.
+ */
+static inline int SerBus_longArg(PyObject *obj, long min, long max, 
+                                 long *value) {
+  if (PyFloat_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError, "integer argument expected, got float");
+    return -1;
+  }
+  *value = PyLong_AsLong(obj);
+  if (*value == -1 && PyErr_Occurred()) return -1;
+  if (*value < min) {
+    PyErr_Format(PyExc_OverflowError, "integer argument is less than %ld",
+                 min);
+    return -1;
+  }
+  if (*value > max) {
+    PyErr_Format(PyExc_OverflowError, 
+                 "integer argument is greater than %ld", max);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Converts \p obj to an unsigned char, like the "b" format unit. Returns -1
+ * with an exception set if unable to.
+ */
+static inline int SerBus_uint8Arg(PyObject *obj, uint8_t *value) {
+  long v;
+  if (SerBus_longArg(obj, 0, 255, &v) < 0) return -1;
+  *value = (uint8_t) v;
+  return 0;
+}
+
+/**
+ * Converts \p obj to an unsigned int without overflow checking, like the 
+ * "I" format unit. Returns -1 with an exception set if unable to.
+ */
+static inline int SerBus_uint32Arg(PyObject *obj, uint32_t *value) {
+  unsigned long v;
+  if (PyFloat_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError, "integer argument expected, got float");
+    return -1;
+  }
+  v = PyLong_AsUnsignedLongMask(obj);
+  if (v == (unsigned long) -1 && PyErr_Occurred()) return -1;
+  *value = (uint32_t) v;
+  return 0;
+}
+
+#endif /* _PY_ARGS_H_ */
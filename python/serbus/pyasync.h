@@ -0,0 +1,360 @@
+/* pyasync.h
+ *
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * asyncio support for the serbus extension types. Each object gets a worker
+ * thread, started the first time an async method is called, which runs the
+ * bus transfers queued by the async methods one after another without the
+ * GIL. Completed jobs are signalled through an eventfd that the running 
+ * event loop watches with add_reader(), and their futures are resolved from
+ * the loop's thread, so any number of transfers can be outstanding without
+ * using any Python threads.
+ *
+ * The eventfd is only registered with the loop while jobs are outstanding. 
+ * The registered callback and each queued job hold references to the object,
+ * keeping it alive until all its jobs are done. If the loop is closed with
+ * jobs still outstanding, e.g. after their futures were cancelled, the next
+ * loop to submit a job takes over the eventfd, and the jobs of the closed 
+ * loop are freed as they complete without resolving their futures.
+ */
+
+#ifndef _PY_ASYNC_H_
+#define _PY_ASYNC_H_
+
+#include "Python.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/**
+ * A queued transfer. Types embed this as the first member of their own job
+ * structs, which hold the transfer's arguments and buffers.
+ */
+typedef struct SerBus_job {
+  struct SerBus_job *next;
+  /// Does the transfer in the worker thread, without the GIL. Returns -1 
+  /// with errno set if unable to.
+  int (*run)(struct SerBus_job *job);
+  /// Builds the result of a successful transfer, with the GIL. Returns NULL
+  /// with an exception set if unable to.
+  PyObject *(*result)(struct SerBus_job *job);
+  /// Releases the job's resources, with the GIL, after it's completed.
+  void (*release)(struct SerBus_job *job);
+  PyObject *future; ///< The future for the transfer's result
+  int ret;          ///< The return value of run
+  int error;        ///< errno if run failed
+} SerBus_job;
+
+/**
+ * An object's worker thread and its queues.
+ */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;   ///< Protects the queues and stop
+  pthread_cond_t cond;    ///< Signalled when a job is queued or on stop
+  SerBus_job *queue;      ///< Jobs waiting to be run, oldest first
+  SerBus_job *queue_tail;
+  SerBus_job *done;       ///< Completed jobs, oldest first
+  SerBus_job *done_tail;
+  int stop;               ///< Set to stop the thread
+  int efd;                ///< The completion eventfd, or -1 if not started
+  Py_ssize_t n_jobs;      ///< Outstanding jobs, only used with the GIL
+  Py_ssize_t n_stale;     ///< The oldest n_jobs that belong to closed loops
+  PyObject *loop;         ///< The loop the eventfd is registered with
+} SerBus_worker;
+
+/// The asyncio module, imported the first time it's needed
+static PyObject *SerBus_asyncio;
+
+/**
+ * Initializes a worker, without starting its thread.
+ */
+static void SerBus_workerInit(SerBus_worker *worker) {
+  memset(worker, 0, sizeof(SerBus_worker));
+  worker->efd = -1;
+}
+
+static void SerBus_pushJob(SerBus_job **head, SerBus_job **tail, 
+                           SerBus_job *job) {
+  job->next = NULL;
+  if (*tail) (*tail)->next = job;
+  else *head = job;
+  *tail = job;
+}
+
+static void *SerBus_workerThread(void *arg) {
+  SerBus_worker *worker = (SerBus_worker *) arg;
+  SerBus_job *job;
+  uint64_t one = 1;
+  sigset_t signals;
+  // Leave signals to the interpreter's threads:
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  pthread_mutex_lock(&worker->lock);
+  while (1) {
+    while (!worker->queue && !worker->stop) {
+      pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+    if (worker->stop) break;
+    job = worker->queue;
+    worker->queue = job->next;
+    if (!worker->queue) worker->queue_tail = NULL;
+    pthread_mutex_unlock(&worker->lock);
+
+    errno = 0;
+    job->ret = job->run(job);
+    job->error = errno;
+
+    pthread_mutex_lock(&worker->lock);
+    SerBus_pushJob(&worker->done, &worker->done_tail, job);
+    if (write(worker->efd, &one, sizeof(one)) < 0) {
+      // Only fails if the counter would overflow, i.e. it's already set
+    }
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+/**
+ * Starts the worker's thread if it isn't running. Returns -1 with an 
+ * exception set if unable to.
+ */
+static int SerBus_workerStart(SerBus_worker *worker) {
+  int error;
+  if (worker->efd >= 0) return 0;
+  worker->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (worker->efd < 0) {
+    PyErr_SetFromErrno(PyExc_OSError);
+    return -1;
+  }
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->cond, NULL);
+  error = pthread_create(&worker->thread, NULL, SerBus_workerThread, worker);
+  if (error) {
+    pthread_mutex_destroy(&worker->lock);
+    pthread_cond_destroy(&worker->cond);
+    close(worker->efd);
+    worker->efd = -1;
+    errno = error;
+    PyErr_SetFromErrno(PyExc_OSError);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Stops the worker's thread if running, waiting for any transfer in 
+ * progress to finish. Only called once the object has no outstanding jobs,
+ * as they keep it alive.
+ */
+static void SerBus_workerStop(SerBus_worker *worker) {
+  if (worker->efd < 0) return;
+  pthread_mutex_lock(&worker->lock);
+  worker->stop = 1;
+  pthread_cond_signal(&worker->cond);
+  pthread_mutex_unlock(&worker->lock);
+  Py_BEGIN_ALLOW_THREADS
+  pthread_join(worker->thread, NULL);
+  Py_END_ALLOW_THREADS
+  pthread_mutex_destroy(&worker->lock);
+  pthread_cond_destroy(&worker->cond);
+  close(worker->efd);
+  worker->efd = -1;
+  Py_CLEAR(worker->loop);
+}
+
+/**
+ * Checks the outstanding jobs can be left to the given loop. They can if 
+ * they're in that loop already, or if the loop they're in has been closed,
+ * in which case the eventfd is unregistered so \p loop can take it over.
+ * Returns -1 with an exception set if not.
+ */
+static int SerBus_adoptJobs(SerBus_worker *worker, PyObject *loop) {
+  PyObject *closed;
+  int is_closed;
+  if (!worker->n_jobs || loop == worker->loop) return 0;
+  closed = PyObject_CallMethod(worker->loop, "is_closed", NULL);
+  if (!closed) return -1;
+  is_closed = PyObject_IsTrue(closed);
+  Py_DECREF(closed);
+  if (is_closed < 0) return -1;
+  if (!is_closed) {
+    PyErr_SetString(PyExc_RuntimeError, 
+      "object has transfers outstanding in another event loop");
+    return -1;
+  }
+  // Closing the loop dropped its readers, so there's nothing to remove:
+  worker->n_stale = worker->n_jobs;
+  Py_CLEAR(worker->loop);
+  return 0;
+}
+
+/**
+ * Queues \p job on the worker of \p self, registering the worker's eventfd
+ * with the running event loop if needed, with \p complete, which must call
+ * #SerBus_complete, as the callback. Returns a new reference to the job's 
+ * future, or NULL with an exception set if unable to queue it, in which 
+ * case the job is left to the caller to free.
+ */
+static PyObject *SerBus_submit(SerBus_worker *worker, SerBus_job *job, 
+                               PyObject *self, PyMethodDef *complete) {
+  PyObject *loop, *callback, *ret;
+  if (!SerBus_asyncio) {
+    SerBus_asyncio = PyImport_ImportModule("asyncio");
+    if (!SerBus_asyncio) return NULL;
+  }
+  // Raises a RuntimeError if not called from a coroutine or callback:
+  loop = PyObject_CallMethod(SerBus_asyncio, "get_running_loop", NULL);
+  if (!loop) return NULL;
+  if (SerBus_adoptJobs(worker, loop) < 0) {
+    Py_DECREF(loop);
+    return NULL;
+  }
+  if (SerBus_workerStart(worker) < 0) {
+    Py_DECREF(loop);
+    return NULL;
+  }
+
+  job->future = PyObject_CallMethod(loop, "create_future", NULL);
+  if (!job->future) {
+    Py_DECREF(loop);
+    return NULL;
+  }
+  if (!worker->loop) {
+    callback = PyCFunction_New(complete, self);
+    if (!callback) {
+      Py_CLEAR(job->future);
+      Py_DECREF(loop);
+      return NULL;
+    }
+    ret = PyObject_CallMethod(loop, "add_reader", "iO", worker->efd, 
+                              callback);
+    Py_DECREF(callback);
+    if (!ret) {
+      Py_CLEAR(job->future);
+      Py_DECREF(loop);
+      return NULL;
+    }
+    Py_DECREF(ret);
+    Py_XSETREF(worker->loop, loop);
+  }
+  else Py_DECREF(loop);
+
+  worker->n_jobs++;
+  pthread_mutex_lock(&worker->lock);
+  SerBus_pushJob(&worker->queue, &worker->queue_tail, job);
+  pthread_cond_signal(&worker->cond);
+  pthread_mutex_unlock(&worker->lock);
+  Py_INCREF(job->future);
+  return job->future;
+}
+
+/**
+ * Sets the result or exception of a completed job's future, unless it was
+ * cancelled.
+ */
+static void SerBus_resolve(SerBus_job *job) {
+  PyObject *done, *value, *ret;
+  done = PyObject_CallMethod(job->future, "done", NULL);
+  if (!done) {
+    PyErr_WriteUnraisable(job->future);
+    return;
+  }
+  if (PyObject_IsTrue(done)) {
+    Py_DECREF(done);
+    return;
+  }
+  Py_DECREF(done);
+
+  if (job->ret < 0) {
+    value = PyObject_CallFunction(PyExc_OSError, "is", job->error, 
+                                  strerror(job->error));
+    ret = value ? PyObject_CallMethod(job->future, "set_exception", "O", 
+                                      value) : NULL;
+  }
+  else {
+    value = job->result(job);
+    ret = value ? PyObject_CallMethod(job->future, "set_result", "O", 
+                                      value) : NULL;
+  }
+  if (!value) {
+    // Pass the exception from building the result on to the awaiter:
+    PyObject *type, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    Py_XDECREF(type);
+    Py_XDECREF(traceback);
+    ret = PyObject_CallMethod(job->future, "set_exception", "O", value);
+  }
+  Py_DECREF(value);
+  if (!ret) PyErr_WriteUnraisable(job->future);
+  Py_XDECREF(ret);
+}
+
+/**
+ * Resolves the futures of all the worker's completed jobs and frees them,
+ * unregistering the eventfd once there are no outstanding jobs. This is the
+ * body of the eventfd's reader callback. Futures of closed loops are left
+ * as they are, as nothing can await them.
+ */
+static PyObject *SerBus_complete(SerBus_worker *worker) {
+  SerBus_job *job, *next;
+  PyObject *ret;
+  uint64_t count;
+  if (worker->efd < 0) Py_RETURN_NONE;
+  pthread_mutex_lock(&worker->lock);
+  if (read(worker->efd, &count, sizeof(count)) < 0) {
+    // EAGAIN if there are no new completions
+  }
+  job = worker->done;
+  worker->done = NULL;
+  worker->done_tail = NULL;
+  pthread_mutex_unlock(&worker->lock);
+
+  for (; job; job=next) {
+    next = job->next;
+    if (worker->n_stale) worker->n_stale--;
+    else SerBus_resolve(job);
+    job->release(job);
+    Py_DECREF(job->future);
+    free(job);
+    worker->n_jobs--;
+  }
+
+  if (!worker->n_jobs && worker->loop) {
+    ret = PyObject_CallMethod(worker->loop, "remove_reader", "i", 
+                              worker->efd);
+    Py_CLEAR(worker->loop);
+    if (!ret) return NULL;
+    Py_DECREF(ret);
+  }
+  Py_RETURN_NONE;
+}
+
+#endif /* _PY_ASYNC_H_ */
@@ -0,0 +1,49 @@
+/* pybuffer.h
+ *
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Buffer protocol helpers shared by the serbus extension modules. Data 
+ * arguments can be any object exporting a contiguous buffer (bytes, 
+ * bytearray, memoryview, array.array, numpy arrays...), which the drivers 
+ * then read from or write into in place.
+ */
+
+#ifndef _PY_BUFFER_H_
+#define _PY_BUFFER_H_
+
+#include "Python.h"
+
+/**
+ * Gets a view of the contiguous memory of the given object, writable if 
+ * \p writable is set. Release it with PyBuffer_Release when done. Returns -1
+ * with an exception set if the object doesn't provide such a buffer.
+ *
+ * The view keeps the memory in place until it's released, so it can be used
+ * with the GIL released.
+ */
+static int SerBus_getBuffer(PyObject *obj, Py_buffer *view, int writable) {
+  return PyObject_GetBuffer(obj, view, 
+                            writable ? PyBUF_WRITABLE : PyBUF_SIMPLE);
+}
+
+#endif /* _PY_BUFFER_H_ */
@@ -25,6 +25,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "i2cdriver.h"
+#include "pyargs.h"
+#include "pyasync.h"
+#include "pybuffer.h"
+#include "pylock.h"
 
 PyDoc_STRVAR(I2CDev_module__doc__,
   "This module provides the I2CDev class for controlling I2C interfaces on\n"
@@ -37,17 +41,28 @@ PyDoc_STRVAR(I2CDev_module__doc__,
    int i2c_fd;
    int slave_addr;
    uint8_t bus_num;
+   PyThread_type_lock lock;
+   SerBus_worker worker;
 } I2CDev;
 
 
 static PyObject *I2CDev_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
   I2CDev *self;
   self = (I2CDev *)type->tp_alloc(type, 0);
+  if (!self) return NULL;
+  SerBus_workerInit(&self->worker);
+  self->lock = PyThread_allocate_lock();
+  if (!self->lock) {
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
   return (PyObject *)self;
 }
 
 static void I2CDev_dealloc(I2CDev *self) {
-  self->ob_type->tp_free((PyObject*)self);
+  SerBus_workerStop(&self->worker);
+  if (self->lock) PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
 PyDoc_STRVAR(I2CDev_init__doc__,
@@ -56,16 +71,15 @@ PyDoc_STRVAR(I2CDev_init__doc__,
   ":param bus: The bus number to use, e.g. 0 for `/dev/i2c-0`\n"
   ":type bus: int\n"
   );
-static PyObject *I2CDev_init(I2CDev *self, PyObject *args, PyObject *kwds) {
+static int I2CDev_init(I2CDev *self, PyObject *args, PyObject *kwds) {
   uint8_t bus;
   if(!PyArg_ParseTuple(args, "b", &bus)) {
-    return NULL;
+    return -1;
   }
   self->bus_num = bus;
-  self->i2c_fd = 0;
+  self->i2c_fd = -1;
   self->slave_addr = -1;
-  Py_INCREF(Py_None);
-  return Py_None;
+  return 0;
 }
 
 PyDoc_STRVAR(I2CDev_open__doc__,
@@ -79,17 +93,24 @@ PyDoc_STRVAR(I2CDev_open__doc__,
   "slave addresses or the standard 7-bit addresses. Must be called before any\n"
   "other methods.\n"
   );
-static PyObject *I2CDev_open(I2CDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *I2CDev_openLocked(I2CDev *self, PyObject *const *args,
+                                   Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const keywords[] = {"use_10bit_address", NULL};
+  PyObject *use_10bit_obj;
   uint8_t use_10bit_address;
-  static char *kwlist[] = {"use_10bit_address", NULL};
+  if (SerBus_getArgs("open", args, nargs, kwnames, keywords, 0, 
+                     &use_10bit_obj) < 0) {
+    return NULL;
+  }
   use_10bit_address = 0;
-  if(!PyArg_ParseTupleAndKeywords(args, kwds, "|b", kwlist, 
-                                  &use_10bit_address)) {
+  if (use_10bit_obj && SerBus_uint8Arg(use_10bit_obj, 
+                                       &use_10bit_address) < 0) {
     return NULL;
   }
 
-  if (self->i2c_fd > 0) I2C_close(self->i2c_fd);
+  if (self->i2c_fd >= 0) I2C_close(self->i2c_fd);
   self->i2c_fd = I2C_open(self->bus_num);
+  self->slave_addr = -1;
   if (self->i2c_fd < 0) {
     PyErr_SetString(PyExc_IOError, "could not open I2C interface");
     return NULL;
@@ -113,18 +134,91 @@ static PyObject *I2CDev_open(I2CDev *self, PyObject *args, PyObject *kwds) {
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED_KEYWORDS(I2CDev, open)
 
 PyDoc_STRVAR(I2CDev_close__doc__,
   "I2CDev.close()\n"
   "\n"
   "Close the I2C bus interface.\n"
   );\
-static PyObject *I2CDev_close(I2CDev *self, PyObject *args, PyObject *kwds) {
-  if (self->i2c_fd > 0) I2C_close(self->i2c_fd);
+static PyObject *I2CDev_closeLocked(I2CDev *self, PyObject *const *args,
+                                    Py_ssize_t nargs) {
+  if (SerBus_checkArgs("close", nargs, 0, 0) < 0) return NULL;
+  if (self->i2c_fd >= 0) I2C_close(self->i2c_fd);
+  self->i2c_fd = -1;
+  self->slave_addr = -1;
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(I2CDev, close)
+
+
+/**
+ * Sets the slave address if it isn't already the given one. Doesn't need the
+ * GIL, but must be called with the object's lock held. Returns -1 with errno
+ * set if unable to.
+ */
+static int I2CDev_selectSlave(I2CDev *self, uint32_t addr) {
+  if (self->slave_addr != (int) addr) {
+    if (I2C_setSlaveAddress(self->i2c_fd, addr) < 0) return -1;
+    self->slave_addr = addr;
+  }
+  return 0;
+}
+
+/**
+ * Sets the slave address if it isn't already the given one. Returns -1 with
+ * an exception set if unable to.
+ */
+static int I2CDev_setAddress(I2CDev *self, uint32_t addr) {
+  if (I2CDev_selectSlave(self, addr) < 0) {
+    PyErr_SetString(PyExc_IOError, "could not configure I2C interface");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Packs a list of ints into a newly allocated buffer, setting \p n_bytes to
+ * the length of the list. Returns NULL with an exception set if unable to.
+ */
+static uint8_t *I2CDev_packBytes(PyObject *data, uint32_t *n_bytes) {
+  uint32_t i;
+  long byte;
+  PyObject *byte_obj;
+  uint8_t *txbuf;
 
+  *n_bytes = PyList_Size(data);
+  txbuf = I2C_allocBuffer(*n_bytes);
+  if (!txbuf) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  for (i=0; i<*n_bytes; i++) {
+    byte_obj = PyList_GetItem(data, i);
+    if (!PyLong_Check(byte_obj)) {
+      PyErr_SetString(PyExc_ValueError, 
+        "data list to transmit can only contain integers");
+      I2C_releaseBuffer(txbuf);
+      return NULL;
+    }
+    byte = PyLong_AsLong(byte_obj);
+    if (byte < 0) {
+      // Check for error from PyLong_AsLong:
+      if (PyErr_Occurred() != NULL) {
+        I2C_releaseBuffer(txbuf);
+        return NULL;
+      }
+      // Negative numbers are set to 0:
+      byte = 0;
+    }
+    // Just send the LSB if value longer than 1 byte:
+    byte &= 255;
+    txbuf[i] = (uint8_t) byte;
+  }
+  return txbuf;
+}
 
 PyDoc_STRVAR(I2CDev_read__doc__,
   "I2CDev.read(slave_addr, n_bytes)\n"
@@ -134,43 +228,80 @@ PyDoc_STRVAR(I2CDev_read__doc__,
   ":param n_bytes: The number of bytes to read\n"
   ":type n_bytes: int\n"
   "\n"
-  ":return: A list of ints of the bytes read\n"
+  ":return: The bytes read, as `bytes`\n"
   "\n"
   "Reads and returns n_bytes words from the I2C slave device with the given\n"
   "address.\n"
   );
-static PyObject *I2CDev_read(I2CDev *self, PyObject *args, PyObject *kwds) {
-  uint32_t n_bytes, i, addr;
-  PyObject *data, *byte_obj;
-  uint8_t *rxbuf; 
-  if(!PyArg_ParseTuple(args, "II", &addr, &n_bytes)) {
+static PyObject *I2CDev_readLocked(I2CDev *self, PyObject *const *args,
+                                   Py_ssize_t nargs) {
+  uint32_t n_bytes, addr;
+  int ret;
+  PyObject *data;
+  if (SerBus_checkArgs("read", nargs, 2, 2) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0 ||
+      SerBus_uint32Arg(args[1], &n_bytes) < 0) {
     return NULL;
   }
 
-  if (self->slave_addr != addr) {
-    if (I2C_setSlaveAddress(self->i2c_fd, addr) < 0) {
-      PyErr_SetString(PyExc_IOError, "could not configure I2C interface");
-      return NULL;
-    }
-    self->slave_addr = addr;
-  }
+  if (I2CDev_setAddress(self, addr) < 0) return NULL;
 
-  rxbuf = malloc(n_bytes);
-  if (I2C_read(self->i2c_fd, (void *) rxbuf, n_bytes) < 0) {
+  data = PyBytes_FromStringAndSize(NULL, n_bytes);
+  if (!data) return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  ret = I2C_read(self->i2c_fd, PyBytes_AS_STRING(data), n_bytes);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not read from I2C device");
-    free(rxbuf);
+    Py_DECREF(data);
     return NULL;
   }
+  return data;
+}
+SERBUS_LOCKED(I2CDev, read)
 
-  data = PyList_New(0);
-  for (i=0; i<n_bytes; i++) {
-    byte_obj = PyInt_FromLong((long) rxbuf[i]);
-    PyList_Append(data, byte_obj);
-    Py_DECREF(byte_obj);
+PyDoc_STRVAR(I2CDev_readinto__doc__,
+  "I2CDev.readinto(slave_addr, buffer)\n"
+  "\n"
+  ":param slave_addr: The address of the slave to read from\n"
+  ":type slave_addr: int\n"
+  ":param buffer: A writable buffer to read into, e.g. a bytearray\n"
+  ":type buffer: writable buffer\n"
+  "\n"
+  ":return: The number of bytes read\n"
+  "\n"
+  "Reads enough bytes to fill `buffer` from the I2C slave device with the\n"
+  "given address, storing them in place.\n"
+  );
+static PyObject *I2CDev_readintoLocked(I2CDev *self, PyObject *const *args,
+                                       Py_ssize_t nargs) {
+  uint32_t addr;
+  int ret;
+  Py_ssize_t n_bytes;
+  PyObject *data;
+  Py_buffer view;
+  if (SerBus_checkArgs("readinto", nargs, 2, 2) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0) {
+    return NULL;
   }
-  free(rxbuf);
-  return data;
+  data = args[1];
+
+  if (I2CDev_setAddress(self, addr) < 0) return NULL;
+
+  if (SerBus_getBuffer(data, &view, 1) < 0) return NULL;
+  n_bytes = view.len;
+  Py_BEGIN_ALLOW_THREADS
+  ret = I2C_read(self->i2c_fd, view.buf, n_bytes);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
+    PyErr_SetString(PyExc_IOError, "could not read from I2C device");
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  PyBuffer_Release(&view);
+  return Py_BuildValue("n", n_bytes);
 }
+SERBUS_LOCKED(I2CDev, readinto)
 
 PyDoc_STRVAR(I2CDev_readTransaction__doc__,
   "I2CDev.readTransaction(slave_addr, tx_byte, n_bytes)\n"
@@ -182,119 +313,359 @@ PyDoc_STRVAR(I2CDev_readTransaction__doc__,
   ":param n_bytes: The number of bytes to read\n"
   ":type n_bytes: int\n"
   "\n"
-  ":return: A list of ints of the bytes read\n"
+  ":return: The bytes read, as `bytes`\n"
   "\n"
   "Writes `tx_byte` then immediately reads `n_bytes` bytes from the I2C slave\n"
-  "device with the given address and returns them as a list. This is useful\n"
-  "for things like reading register values from memory mapped devices.\n"
+  "device with the given address and returns them. This is useful for\n"
+  "things like reading register values from memory mapped devices.\n"
   );
-static PyObject *I2CDev_readTransaction(I2CDev *self, PyObject *args, 
-                                        PyObject *kwds) {
-  uint32_t n_bytes, i, addr;
+static PyObject *I2CDev_readTransactionLocked(I2CDev *self,
+                                              PyObject *const *args,
+                                              Py_ssize_t nargs) {
+  uint32_t n_bytes, addr;
+  int ret;
   uint8_t byte;
-  PyObject *data, *byte_obj;
-  uint8_t *rxbuf; 
-  if(!PyArg_ParseTuple(args, "IbI", &addr, &byte, &n_bytes)) {
+  PyObject *data;
+  if (SerBus_checkArgs("readTransaction", nargs, 3, 3) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0 ||
+      SerBus_uint8Arg(args[1], &byte) < 0 ||
+      SerBus_uint32Arg(args[2], &n_bytes) < 0) {
     return NULL;
   }
 
-  if (self->slave_addr != addr) {
-    if (I2C_setSlaveAddress(self->i2c_fd, addr) < 0) {
-      PyErr_SetString(PyExc_IOError, "could not configure I2C interface");
-      return NULL;
-    }
-    self->slave_addr = addr;
-  }
-
-  rxbuf = malloc(n_bytes);
+  if (I2CDev_setAddress(self, addr) < 0) return NULL;
 
-  if (I2C_write(self->i2c_fd, (void *) &byte, 1) < 0) {
-    PyErr_SetString(PyExc_IOError, "could not write to I2C device");
-    free(rxbuf);
+  data = PyBytes_FromStringAndSize(NULL, n_bytes);
+  if (!data) return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  ret = I2C_readTransaction(self->i2c_fd, byte, PyBytes_AS_STRING(data), 
+                            n_bytes);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
+    PyErr_SetString(PyExc_IOError, "could not read from I2C device");
+    Py_DECREF(data);
     return NULL;
   }
-  if (I2C_read(self->i2c_fd, (void *) rxbuf, n_bytes) < 0) {
-    PyErr_SetString(PyExc_IOError, "could not read from I2C device");
-    free(rxbuf);
+  return data;
+}
+SERBUS_LOCKED(I2CDev, readTransaction)
+
+PyDoc_STRVAR(I2CDev_readTransactionInto__doc__,
+  "I2CDev.readTransactionInto(slave_addr, tx_byte, buffer)\n"
+  "\n"
+  ":param slave_addr: The address of the slave to read from\n"
+  ":type slave_addr: int\n"
+  ":param tx_byte: The byte to write before reading\n"
+  ":type tx_byte: int\n"
+  ":param buffer: A writable buffer to read into, e.g. a bytearray\n"
+  ":type buffer: writable buffer\n"
+  "\n"
+  ":return: The number of bytes read\n"
+  "\n"
+  "Like :func:`readTransaction`, but reads enough bytes to fill `buffer`,\n"
+  "storing them in place.\n"
+  );
+static PyObject *I2CDev_readTransactionIntoLocked(I2CDev *self,
+                                                  PyObject *const *args,
+                                                  Py_ssize_t nargs) {
+  uint32_t addr;
+  int ret;
+  Py_ssize_t n_bytes;
+  uint8_t byte;
+  PyObject *data;
+  Py_buffer view;
+  if (SerBus_checkArgs("readTransactionInto", nargs, 3, 3) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0 ||
+      SerBus_uint8Arg(args[1], &byte) < 0) {
     return NULL;
   }
+  data = args[2];
+
+  if (I2CDev_setAddress(self, addr) < 0) return NULL;
 
-  data = PyList_New(0);
-  for (i=0; i<n_bytes; i++) {
-    byte_obj = PyInt_FromLong((long) rxbuf[i]);
-    PyList_Append(data, byte_obj);
-    Py_DECREF(byte_obj);
+  if (SerBus_getBuffer(data, &view, 1) < 0) return NULL;
+  n_bytes = view.len;
+  Py_BEGIN_ALLOW_THREADS
+  ret = I2C_readTransaction(self->i2c_fd, byte, view.buf, n_bytes);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
+    PyErr_SetString(PyExc_IOError, "could not read from I2C device");
+    PyBuffer_Release(&view);
+    return NULL;
   }
-  free(rxbuf);
-  return data;
+  PyBuffer_Release(&view);
+  return Py_BuildValue("n", n_bytes);
 }
+SERBUS_LOCKED(I2CDev, readTransactionInto)
 
 PyDoc_STRVAR(I2CDev_write__doc__,
   "I2CDev.write(slave_addr, bytes)\n"
   "\n"
   ":param slave_addr: The address of the slave to write to\n"
   ":type slave_addr: int\n"
-  ":param n_bytes: A list of bytes to write\n"
-  ":type n_bytes: list\n"
+  ":param bytes: The bytes to write, as a list of ints or any buffer\n"
+  "              (e.g. bytes, bytearray or memoryview)\n"
+  ":type bytes: list or buffer\n"
   "\n"
-  "Writes the given list of bytes to the I2C slave device with the\n"
-  "given address.\n"
+  "Writes the given bytes to the I2C slave device with the given address.\n"
   );
-static PyObject *I2CDev_write(I2CDev *self, PyObject *args, PyObject *kwds) {
-  uint32_t n_bytes, i, addr;
-  long byte;
-  PyObject *data, *byte_obj;
-  uint8_t *txbuf; 
-  if(!PyArg_ParseTuple(args, "IO!", &addr, &PyList_Type, &data)) {
+static PyObject *I2CDev_writeLocked(I2CDev *self, PyObject *const *args,
+                                    Py_ssize_t nargs) {
+  uint32_t n_bytes, addr;
+  int ret;
+  PyObject *data;
+  uint8_t *txbuf;
+  Py_buffer view;
+  if (SerBus_checkArgs("write", nargs, 2, 2) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0) {
     return NULL;
   }
-
-  if (self->slave_addr != addr) {
-    if (I2C_setSlaveAddress(self->i2c_fd, addr) < 0) {
-      PyErr_SetString(PyExc_IOError, "could not configure I2C interface");
+  data = args[1];
+
+  if (I2CDev_setAddress(self, addr) < 0) return NULL;
+
+  if (!PyList_Check(data)) {
+    // Write straight from the buffer:
+    if (SerBus_getBuffer(data, &view, 0) < 0) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    ret = I2C_write(self->i2c_fd, view.buf, view.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if (ret < 0) {
+      PyErr_SetString(PyExc_IOError, "could not write to I2C device");
       return NULL;
     }
-    self->slave_addr = addr;
+    Py_INCREF(Py_None);
+    return Py_None;
   }
 
-  n_bytes = PyList_Size(data);
-  txbuf = malloc(n_bytes);
-
-  for (i=0; i<n_bytes; i++) {
-    byte_obj = PyList_GetItem(data, i);
-    if (!PyInt_Check(byte_obj)) {
-      PyErr_SetString(PyExc_ValueError, 
-        "data list to transmit can only contain integers");
-      free(txbuf);
-      return NULL;
-    }
-    byte = PyInt_AsLong(byte_obj);
-    if (byte < 0) {
-      // Check for error from PyInt_AsLong:
-      if (PyErr_Occurred() != NULL) return NULL;
-      // Negative numbers are set to 0:
-      byte = 0;
-    }
-    // Just send the LSB if value longer than 1 byte:
-    byte &= 255;
-    txbuf[i] = (uint8_t) byte;
-  }
+  txbuf = I2CDev_packBytes(data, &n_bytes);
+  if (!txbuf) return NULL;
 
-  if (I2C_write(self->i2c_fd, (void *) txbuf, n_bytes) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = I2C_write(self->i2c_fd, (void *) txbuf, n_bytes);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not write to I2C device");
-    free(txbuf);
+    I2C_releaseBuffer(txbuf);
     return NULL;
   }
-  free(txbuf);
+  I2C_releaseBuffer(txbuf);
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(I2CDev, write)
+
+/**
+ * The transfers an #I2CDev_job can do.
+ */
+typedef enum {
+  I2CDev_READ,
+  I2CDev_READ_TRANSACTION,
+  I2CDev_WRITE
+} I2CDev_op;
+
+/**
+ * A transfer queued by one of the async methods.
+ */
+typedef struct {
+  SerBus_job job;
+  I2CDev *self;      ///< The object, referenced until the job is released
+  I2CDev_op op;
+  uint32_t addr;     ///< Slave address
+  uint8_t byte;      ///< Byte written first by I2CDev_READ_TRANSACTION
+  void *buf;         ///< The bytes to read into or write
+  uint32_t n_bytes;  ///< Number of bytes to read or write
+  PyObject *data;    ///< bytes being read into
+  uint8_t *txbuf;    ///< Packed list being written
+  Py_buffer view;    ///< Buffer being written, if view.obj is set
+} I2CDev_job;
+
+static int I2CDev_runJob(SerBus_job *job) {
+  I2CDev_job *i2c_job = (I2CDev_job *) job;
+  I2CDev *self = i2c_job->self;
+  int ret;
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  // The interface may have been closed since the job was queued:
+  ret = -1;
+  errno = EBADF;
+  if (self->i2c_fd >= 0) ret = I2CDev_selectSlave(self, i2c_job->addr);
+  if (ret == 0) {
+    switch (i2c_job->op) {
+    case I2CDev_READ:
+      ret = I2C_read(self->i2c_fd, i2c_job->buf, i2c_job->n_bytes);
+      break;
+    case I2CDev_READ_TRANSACTION:
+      ret = I2C_readTransaction(self->i2c_fd, i2c_job->byte, i2c_job->buf, 
+                                i2c_job->n_bytes);
+      break;
+    case I2CDev_WRITE:
+      ret = I2C_write(self->i2c_fd, i2c_job->buf, i2c_job->n_bytes);
+      break;
+    }
+  }
+  PyThread_release_lock(self->lock);
+  return ret;
+}
+
+static PyObject *I2CDev_jobResult(SerBus_job *job) {
+  I2CDev_job *i2c_job = (I2CDev_job *) job;
+  if (i2c_job->op == I2CDev_WRITE) Py_RETURN_NONE;
+  Py_INCREF(i2c_job->data);
+  return i2c_job->data;
+}
+
+static void I2CDev_releaseJob(SerBus_job *job) {
+  I2CDev_job *i2c_job = (I2CDev_job *) job;
+  Py_XDECREF(i2c_job->data);
+  if (i2c_job->txbuf) I2C_releaseBuffer(i2c_job->txbuf);
+  if (i2c_job->view.obj) PyBuffer_Release(&i2c_job->view);
+  Py_DECREF(i2c_job->self);
+}
+
+static PyObject *I2CDev_complete(I2CDev *self, PyObject *unused) {
+  return SerBus_complete(&self->worker);
+}
+
+/// The eventfd reader callback, bound to the object when registered
+static PyMethodDef I2CDev_completeDef = {
+  "_complete", (PyCFunction)I2CDev_complete, METH_NOARGS, NULL
+};
+
+/**
+ * Creates a job for the given transfer. Returns NULL with an exception set 
+ * if unable to.
+ */
+static I2CDev_job *I2CDev_newJob(I2CDev *self, I2CDev_op op, uint32_t addr) {
+  I2CDev_job *job;
+  job = calloc(1, sizeof(I2CDev_job));
+  if (!job) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  job->job.run = I2CDev_runJob;
+  job->job.result = I2CDev_jobResult;
+  job->job.release = I2CDev_releaseJob;
+  job->op = op;
+  job->addr = addr;
+  Py_INCREF(self);
+  job->self = self;
+  return job;
+}
+
+/**
+ * Sets up a new job to read \p n_bytes bytes into a new bytes object.
+ */
+static I2CDev_job *I2CDev_newReadJob(I2CDev *self, I2CDev_op op, 
+                                     uint32_t addr, uint32_t n_bytes) {
+  I2CDev_job *job;
+  job = I2CDev_newJob(self, op, addr);
+  if (!job) return NULL;
+  job->data = PyBytes_FromStringAndSize(NULL, n_bytes);
+  if (!job->data) {
+    I2CDev_releaseJob(&job->job);
+    free(job);
+    return NULL;
+  }
+  job->buf = PyBytes_AS_STRING(job->data);
+  job->n_bytes = n_bytes;
+  return job;
+}
+
+/**
+ * Queues the given job, returning its future. The job is freed if it can't
+ * be queued.
+ */
+static PyObject *I2CDev_submitJob(I2CDev *self, I2CDev_job *job) {
+  PyObject *future;
+  future = SerBus_submit(&self->worker, &job->job, (PyObject *) self,
+                         &I2CDev_completeDef);
+  if (!future) {
+    I2CDev_releaseJob(&job->job);
+    free(job);
+  }
+  return future;
+}
+
+PyDoc_STRVAR(I2CDev_aread__doc__,
+  "I2CDev.aread(slave_addr, n_bytes)\n"
+  "\n"
+  "Like :func:`read`, but returns an awaitable future of the bytes read.\n"
+  "The transfer is run by the object's worker thread, and the future is\n"
+  "resolved in the running asyncio event loop. Async transfers are done in\n"
+  "the order they're requested. A failed transfer raises an OSError.\n"
+  );
+static PyObject *I2CDev_aread(I2CDev *self, PyObject *const *args,
+                              Py_ssize_t nargs) {
+  uint32_t addr, n_bytes;
+  I2CDev_job *job;
+  if (SerBus_checkArgs("aread", nargs, 2, 2) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0 ||
+      SerBus_uint32Arg(args[1], &n_bytes) < 0) {
+    return NULL;
+  }
+  job = I2CDev_newReadJob(self, I2CDev_READ, addr, n_bytes);
+  if (!job) return NULL;
+  return I2CDev_submitJob(self, job);
+}
+
+PyDoc_STRVAR(I2CDev_areadTransaction__doc__,
+  "I2CDev.areadTransaction(slave_addr, tx_byte, n_bytes)\n"
+  "\n"
+  "Like :func:`readTransaction`, but returns an awaitable future of the\n"
+  "bytes read, as for :func:`aread`.\n"
+  );
+static PyObject *I2CDev_areadTransaction(I2CDev *self, PyObject *const *args,
+                                         Py_ssize_t nargs) {
+  uint32_t addr, n_bytes;
+  uint8_t byte;
+  I2CDev_job *job;
+  if (SerBus_checkArgs("areadTransaction", nargs, 3, 3) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0 ||
+      SerBus_uint8Arg(args[1], &byte) < 0 ||
+      SerBus_uint32Arg(args[2], &n_bytes) < 0) {
+    return NULL;
+  }
+  job = I2CDev_newReadJob(self, I2CDev_READ_TRANSACTION, addr, n_bytes);
+  if (!job) return NULL;
+  job->byte = byte;
+  return I2CDev_submitJob(self, job);
+}
+
+PyDoc_STRVAR(I2CDev_awrite__doc__,
+  "I2CDev.awrite(slave_addr, bytes)\n"
+  "\n"
+  "Like :func:`write`, but returns an awaitable future, as for\n"
+  ":func:`aread`. A buffer must not be modified until the write is done.\n"
+  );
+static PyObject *I2CDev_awrite(I2CDev *self, PyObject *const *args,
+                               Py_ssize_t nargs) {
+  uint32_t addr;
+  I2CDev_job *job;
+  if (SerBus_checkArgs("awrite", nargs, 2, 2) < 0 ||
+      SerBus_uint32Arg(args[0], &addr) < 0) {
+    return NULL;
+  }
+  job = I2CDev_newJob(self, I2CDev_WRITE, addr);
+  if (!job) return NULL;
+  if (PyList_Check(args[1])) {
+    job->txbuf = I2CDev_packBytes(args[1], &job->n_bytes);
+    job->buf = job->txbuf;
+  }
+  else if (SerBus_getBuffer(args[1], &job->view, 0) == 0) {
+    job->buf = job->view.buf;
+    job->n_bytes = job->view.len;
+  }
+  if (!job->buf) {
+    I2CDev_releaseJob(&job->job);
+    free(job);
+    return NULL;
+  }
+  return I2CDev_submitJob(self, job);
+}
 
 static PyObject *I2CDev_get_i2c_fd(I2CDev *self, void *closure) {
-    PyObject *i2c_fd;
-    i2c_fd = Py_BuildValue("i", self->i2c_fd);
-    Py_INCREF(i2c_fd);
-    return i2c_fd;
+  return PyLong_FromLong(self->i2c_fd);
 }
 
 static int I2CDev_set_i2c_fd(I2CDev *self, PyObject *value, void *closure) {
@@ -302,10 +673,7 @@ static int I2CDev_set_i2c_fd(I2CDev *self, PyObject *value, void *closure) {
 }
 
 static PyObject *I2CDev_get_bus_num(I2CDev *self, void *closure) {
-    PyObject *bus_num;
-    bus_num = Py_BuildValue("b", self->bus_num);
-    Py_INCREF(bus_num);
-    return bus_num;
+  return PyLong_FromLong(self->bus_num);
 }
 
 static int I2CDev_set_bus_num(I2CDev *self, PyObject *value, void *closure) {
@@ -314,12 +682,12 @@ static int I2CDev_set_bus_num(I2CDev *self, PyObject *value, void *closure) {
     PyErr_SetString(PyExc_TypeError, "Cannot delete bus_num attribute");
     return -1;
   }
-  if (!PyInt_Check(value)) {
+  if (!PyLong_Check(value)) {
     PyErr_SetString(PyExc_TypeError, "bus_num must be an integer");
     return -1;
   }
 
-  bus_num = PyInt_AsLong(value);
+  bus_num = PyLong_AsLong(value);
   if (bus_num < 0 || bus_num > 255) {
     PyErr_SetString(PyExc_TypeError, "bus_num must be in range [0,255]");
     return -1;
@@ -340,32 +708,42 @@ static PyGetSetDef I2CDev_getseters[] = {
 };
 
 static PyMethodDef I2CDev_methods[] = {
-  {"open", (PyCFunction)I2CDev_open, METH_KEYWORDS,
+  {"open", (PyCFunction)I2CDev_open, METH_FASTCALL | METH_KEYWORDS,
     I2CDev_open__doc__},
-  {"close", (PyCFunction)I2CDev_close, METH_NOARGS,
+  {"close", (PyCFunction)I2CDev_close, METH_FASTCALL,
     I2CDev_close__doc__},
 
-  {"read", (PyCFunction)I2CDev_read, METH_VARARGS,
+  {"read", (PyCFunction)I2CDev_read, METH_FASTCALL,
     I2CDev_read__doc__},
-  {"readTransaction", (PyCFunction)I2CDev_readTransaction, METH_VARARGS,
+  {"readinto", (PyCFunction)I2CDev_readinto, METH_FASTCALL,
+    I2CDev_readinto__doc__},
+  {"readTransaction", (PyCFunction)I2CDev_readTransaction, METH_FASTCALL,
     I2CDev_readTransaction__doc__},
-  {"write", (PyCFunction)I2CDev_write, METH_VARARGS,
+  {"readTransactionInto", (PyCFunction)I2CDev_readTransactionInto, 
+    METH_FASTCALL, I2CDev_readTransactionInto__doc__},
+  {"write", (PyCFunction)I2CDev_write, METH_FASTCALL,
     I2CDev_write__doc__},
 
+  {"aread", (PyCFunction)I2CDev_aread, METH_FASTCALL,
+    I2CDev_aread__doc__},
+  {"areadTransaction", (PyCFunction)I2CDev_areadTransaction, METH_FASTCALL,
+    I2CDev_areadTransaction__doc__},
+  {"awrite", (PyCFunction)I2CDev_awrite, METH_FASTCALL,
+    I2CDev_awrite__doc__},
+
   {NULL},
 };
 
 static PyTypeObject I2CDev_type = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                        /*ob_size*/
+  PyVarObject_HEAD_INIT(NULL, 0)
   "i2cdev.I2CDev",                          /*tp_name*/
   sizeof(I2CDev),                           /*tp_basicsize*/
   0,                                        /*tp_itemsize*/
   (destructor)I2CDev_dealloc,               /*tp_dealloc*/
-  0,                                        /*tp_print*/
+  0,                                        /*tp_vectorcall_offset*/
   0,                                        /*tp_getattr*/
   0,                                        /*tp_setattr*/
-  0,                                        /*tp_compare*/
+  0,                                        /*tp_as_async*/
   0,                                        /*tp_repr*/
   0,                                        /*tp_as_number*/
   0,                                        /*tp_as_sequence*/
@@ -398,16 +776,26 @@ static PyTypeObject I2CDev_type = {
 };
 
 
-#ifndef PyMODINIT_FUNC  /* declarations for DLL import/export */
-#define PyMODINIT_FUNC void
-#endif
-PyMODINIT_FUNC initi2cdev(void) {
+static struct PyModuleDef I2CDev_module = {
+  PyModuleDef_HEAD_INIT,
+  "i2cdev",                                 /* m_name */
+  I2CDev_module__doc__,                     /* m_doc */
+  -1,                                       /* m_size */
+  NULL,                                     /* m_methods */
+};
+
+PyMODINIT_FUNC PyInit_i2cdev(void) {
   PyObject* m;
 
-  I2CDev_type.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&I2CDev_type) < 0) return;
+  if (PyType_Ready(&I2CDev_type) < 0) return NULL;
 
-  m = Py_InitModule3("i2cdev", I2CDev_methods, I2CDev_module__doc__);
+  m = PyModule_Create(&I2CDev_module);
+  if (!m) return NULL;
   Py_INCREF(&I2CDev_type);
-  PyModule_AddObject(m, "I2CDev", (PyObject *)&I2CDev_type);
-}
\ No newline at end of file
+  if (PyModule_AddObject(m, "I2CDev", (PyObject *)&I2CDev_type) < 0) {
+    Py_DECREF(&I2CDev_type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
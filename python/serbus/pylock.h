@@ -0,0 +1,77 @@
+/* pylock.h
+ *
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Per-object locking for the serbus extension types. Each method runs with
+ * its object's lock held, and releases the GIL around the driver calls that
+ * can block on the bus. Threads using different objects then run in 
+ * parallel, while calls on the same object are serialised so one can't 
+ * reconfigure or close an interface another is in the middle of using.
+ */
+
+#ifndef _PY_LOCK_H_
+#define _PY_LOCK_H_
+
+#include "Python.h"
+#include "pythread.h"
+
+/**
+ * Takes the given lock. If another thread holds it the GIL is released 
+ * while waiting, since that thread may need the GIL to finish.
+ */
+static void SerBus_lock(PyThread_type_lock lock) {
+  if (!PyThread_acquire_lock(lock, NOWAIT_LOCK)) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+  }
+}
+
+/**
+ * Defines the METH_FASTCALL method type_name, which calls type_nameLocked 
+ * with the object's lock held.
+ */
+#define SERBUS_LOCKED(type, name)                                           \
+  static PyObject *type##_##name(type *self, PyObject *const *args,         \
+                                 Py_ssize_t nargs) {                        \
+    PyObject *ret;                                                          \
+    SerBus_lock(self->lock);                                                \
+    ret = type##_##name##Locked(self, args, nargs);                         \
+    PyThread_release_lock(self->lock);                                      \
+    return ret;                                                             \
+  }
+
+/**
+ * Like #SERBUS_LOCKED, for METH_FASTCALL | METH_KEYWORDS methods.
+ */
+#define SERBUS_LOCKED_KEYWORDS(type, name)                                  \
+  static PyObject *type##_##name(type *self, PyObject *const *args,         \
+                                 Py_ssize_t nargs, PyObject *kwnames) {     \
+    PyObject *ret;                                                          \
+    SerBus_lock(self->lock);                                                \
+    ret = type##_##name##Locked(self, args, nargs, kwnames);                \
+    PyThread_release_lock(self->lock);                                      \
+    return ret;                                                             \
+  }
+
+#endif /* _PY_LOCK_H_ */
@@ -22,9 +22,15 @@
  */
 
 #include "Python.h"
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include "spidriver.h"
+#include "spipack.h"
+#include "pyargs.h"
+#include "pyasync.h"
+#include "pybuffer.h"
+#include "pylock.h"
 
 PyDoc_STRVAR(SPIDev_module__doc__,
   "This module provides the SPIDev class for controlling SPI interfaces on\n"
@@ -35,25 +41,48 @@ PyDoc_STRVAR(SPIDev_module__doc__,
 
 #define SPIDev_MAX_CS_PER_BUS 8
 
+/// The array module's array type, for returning words wider than 8 bits
+static PyObject *SPIDev_array_type;
+
+/// The numpy module, imported the first time #SPIDev_capture needs it
+static PyObject *SPIDev_numpy;
+
+/// The struct module prefix for the native byte order, e.g. for "<H"
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SPIDev_NATIVE_ORDER '<'
+#else
+#define SPIDev_NATIVE_ORDER '>'
+#endif
+
 typedef struct {
    PyObject_HEAD
    int *spidev_fd;
    uint8_t bus;
    uint8_t bits_per_word;
-   uint8_t bytes_per_word;
    uint8_t mode_3wire;
+   PyThread_type_lock lock;
+   SerBus_worker worker;
 } SPIDev;
 
 
 static PyObject *SPIDev_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
   SPIDev *self;
   self = (SPIDev *)type->tp_alloc(type, 0);
+  if (!self) return NULL;
+  SerBus_workerInit(&self->worker);
+  self->lock = PyThread_allocate_lock();
+  if (!self->lock) {
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
   return (PyObject *)self;
 }
 
 static void SPIDev_dealloc(SPIDev* self) {
+  SerBus_workerStop(&self->worker);
+  if (self->lock) PyThread_free_lock(self->lock);
   free(self->spidev_fd);
-  self->ob_type->tp_free((PyObject*)self);
+  Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
 PyDoc_STRVAR(SPIDev_init__doc__,
@@ -65,13 +94,13 @@ PyDoc_STRVAR(SPIDev_init__doc__,
   "                   standard 4-wire mode (default).\n"
   ":type mode_3wire: bool, optional\n"
   );
-static PyObject *SPIDev_init(SPIDev *self, PyObject *args, PyObject *kwds) {
+static int SPIDev_init(SPIDev *self, PyObject *args, PyObject *kwds) {
   uint8_t bus, mode_3wire, i;
   mode_3wire = 0;
   static char *kwlist[] = {"bus", "mode_3wire", NULL};
   if(!PyArg_ParseTupleAndKeywords(args, kwds, "b|b", kwlist, &bus,
                                   &mode_3wire)) {
-    return NULL;
+    return -1;
   }
   self->spidev_fd = malloc(sizeof(int) * SPIDev_MAX_CS_PER_BUS);
   for (i=0; i<SPIDev_MAX_CS_PER_BUS; i++) {
@@ -79,8 +108,7 @@ static PyObject *SPIDev_init(SPIDev *self, PyObject *args, PyObject *kwds) {
   }
   self->mode_3wire = mode_3wire ? 1 : 0;
   self->bus = bus;
-  Py_INCREF(Py_None);
-  return Py_None;
+  return 0;
 }
 
 PyDoc_STRVAR(SPIDev_open__doc__,
@@ -88,28 +116,22 @@ PyDoc_STRVAR(SPIDev_open__doc__,
   "\n"
   "Initialize the SPI interface - must be called before any other methods.\n"
   );
-static PyObject *SPIDev_open(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_openLocked(SPIDev *self, PyObject *const *args,
+                                   Py_ssize_t nargs) {
+  if (SerBus_checkArgs("open", nargs, 0, 0) < 0) return NULL;
   self->spidev_fd[0] = SPI_open(self->bus, 0);
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, "could not open spidev");
     return NULL;
   }
   self->bits_per_word = SPI_getBitsPerWord(self->spidev_fd[0]);
-  if (self->bits_per_word <= 8) {
-    self->bytes_per_word = 1;
-  }
-  else if (self->bits_per_word <= 16) {
-    self->bytes_per_word = 2;
-  }
-  else if (self->bits_per_word <= 32) {
-    self->bytes_per_word = 4;
-  }
   if (self->mode_3wire) {
     SPI_enable3Wire(self->spidev_fd[0]);
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, open)
 
 PyDoc_STRVAR(SPIDev_close__doc__,
   "SPIDev.close()\n"
@@ -117,8 +139,10 @@ PyDoc_STRVAR(SPIDev_close__doc__,
   "Close the SPI interface.\n"
   );
 
-static PyObject *SPIDev_close(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_closeLocked(SPIDev *self, PyObject *const *args,
+                                    Py_ssize_t nargs) {
   int i;
+  if (SerBus_checkArgs("close", nargs, 0, 0) < 0) return NULL;
   for (i=0; i<SPIDev_MAX_CS_PER_BUS; i++) {
     if (self->spidev_fd[i] > 0) {
       SPI_close(self->spidev_fd[i]);
@@ -128,6 +152,7 @@ static PyObject *SPIDev_close(SPIDev *self, PyObject *args, PyObject *kwds) {
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, close)
 
 int SPIDev_activateCS(SPIDev *self, uint8_t cs) {
   if (cs > SPIDev_MAX_CS_PER_BUS) {
@@ -149,6 +174,169 @@ int SPIDev_activateCS(SPIDev *self, uint8_t cs) {
   return 0;
 }
 
+/**
+ * Packs a list of ints into a newly allocated transmit buffer, setting 
+ * \p n_words to the length of the list. Returns NULL with an exception set if
+ * unable to.
+ */
+static void *SPIDev_packWords(SPIDev *self, PyObject *data, uint32_t *n_words) {
+  uint32_t i, *words;
+  long word;
+  PyObject *word_obj;
+  void *txbuf;
+
+  *n_words = PyList_Size(data);
+  words = SPI_allocBuffer(*n_words * sizeof(uint32_t));
+  txbuf = SPI_allocBuffer(SPI_bufferSize(self->bits_per_word, *n_words, 0));
+  if (!words || !txbuf) {
+    SPI_releaseBuffer(words);
+    SPI_releaseBuffer(txbuf);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  for (i=0; i<*n_words; i++) {
+    word_obj = PyList_GetItem(data, i);
+    if (!PyLong_Check(word_obj)) {
+      PyErr_SetString(PyExc_ValueError, 
+        "data list to transmit can only contain integers");
+      SPI_releaseBuffer(words);
+      SPI_releaseBuffer(txbuf);
+      return NULL;
+    }
+    word = PyLong_AsLong(word_obj);
+    if (word < 0) {
+      if (PyErr_Occurred() != NULL) {
+        SPI_releaseBuffer(words);
+        SPI_releaseBuffer(txbuf);
+        return NULL;
+      }
+      word = 0;
+    }
+    words[i] = (uint32_t) word;
+  }
+  SPI_pack(words, SPI_WORD_UINT32, txbuf, *n_words, self->bits_per_word, 0);
+  SPI_releaseBuffer(words);
+  return txbuf;
+}
+
+/**
+ * Words to transmit, taken from either a list or a buffer.
+ */
+typedef struct {
+  void *txbuf;      ///< The words in the spidev layout
+  uint32_t n_words; ///< Number of words
+  int packed;       ///< Set if txbuf was packed from a list
+  Py_buffer view;   ///< The buffer txbuf points into if not packed
+} SPIDev_tx;
+
+/**
+ * Gets the number of words that fit in a buffer, setting an exception and
+ * returning -1 if its size isn't a whole number of words.
+ */
+static int SPIDev_bufferWords(SPIDev *self, Py_buffer *view, 
+                              uint32_t *n_words) {
+  uint32_t word_bytes;
+  word_bytes = SPI_wordBytes(self->bits_per_word);
+  if (view->len % word_bytes) {
+    PyErr_Format(PyExc_ValueError, 
+      "buffer size must be a multiple of the %u byte word size", word_bytes);
+    return -1;
+  }
+  *n_words = view->len / word_bytes;
+  return 0;
+}
+
+/**
+ * Gets the words to transmit from \p data. A list of ints is packed into a 
+ * new buffer; any other object must provide a buffer of words in the spidev
+ * layout (e.g. bytes for up to 8 bits per word, array('H') for up to 16), 
+ * which is used in place. Returns -1 with an exception set if unable to.
+ */
+static int SPIDev_getTx(SPIDev *self, PyObject *data, SPIDev_tx *tx) {
+  tx->packed = PyList_Check(data);
+  if (tx->packed) {
+    tx->txbuf = SPIDev_packWords(self, data, &tx->n_words);
+    return tx->txbuf ? 0 : -1;
+  }
+  if (SerBus_getBuffer(data, &tx->view, 0) < 0) return -1;
+  if (SPIDev_bufferWords(self, &tx->view, &tx->n_words) < 0) {
+    PyBuffer_Release(&tx->view);
+    return -1;
+  }
+  tx->txbuf = tx->view.buf;
+  return 0;
+}
+
+/**
+ * Releases the words from #SPIDev_getTx.
+ */
+static void SPIDev_releaseTx(SPIDev_tx *tx) {
+  if (tx->packed) SPI_releaseBuffer(tx->txbuf);
+  else PyBuffer_Release(&tx->view);
+}
+
+/**
+ * Clears the unused high bits of words received in the spidev layout.
+ */
+static void SPIDev_maskWords(uint8_t bpw, void *rxbuf, uint32_t n_words) {
+  uint32_t i, mask;
+  if (bpw == 8 || bpw == 16 || bpw == 32) return;
+  mask = (1u << bpw) - 1;
+  switch (SPI_wordBytes(bpw)) {
+  case 1:
+    for (i=0; i<n_words; i++) ((uint8_t *) rxbuf)[i] &= mask;
+    break;
+  case 2:
+    for (i=0; i<n_words; i++) ((uint16_t *) rxbuf)[i] &= mask;
+    break;
+  default:
+    for (i=0; i<n_words; i++) ((uint32_t *) rxbuf)[i] &= mask;
+    break;
+  }
+}
+
+/**
+ * Creates the storage for \p n_words received words of \p bits_per_word bits
+ * in the spidev layout, 
+ * setting \p rxbuf to point to it so they can be read straight in. Pass it 
+ * to #SPIDev_finishRx once they have been. Returns NULL with an exception 
+ * set if unable to.
+ */
+static PyObject *SPIDev_newRx(uint8_t bits_per_word, uint32_t n_words, 
+                              void **rxbuf) {
+  PyObject *data;
+  uint32_t n_bytes;
+  // Nothing else can see the bytes object until it's returned, so it can 
+  // be filled in place:
+  n_bytes = SPI_bufferSize(bits_per_word, n_words, 0);
+  data = PyBytes_FromStringAndSize(NULL, n_bytes);
+  if (data) *rxbuf = PyBytes_AS_STRING(data);
+  return data;
+}
+
+/**
+ * Turns the storage from #SPIDev_newRx into the words returned once 
+ * \p n_read words have been read into it: bytes for up to 8 bits per 
+ * word, otherwise an array.array of 16- or 32-bit unsigned ints. The 
+ * reference to \p data is stolen. Returns NULL with an exception set if 
+ * unable to.
+ */
+static PyObject *SPIDev_finishRx(uint8_t bits_per_word, PyObject *data, 
+                                 uint32_t n_read) {
+  PyObject *words;
+  uint32_t n_bytes, word_bytes;
+  word_bytes = SPI_wordBytes(bits_per_word);
+  n_bytes = n_read * word_bytes;
+  SPIDev_maskWords(bits_per_word, PyBytes_AS_STRING(data), n_read);
+  if (_PyBytes_Resize(&data, n_bytes) < 0) return NULL;
+  if (word_bytes == 1) return data;
+  words = PyObject_CallFunction(SPIDev_array_type, "sO", 
+                                word_bytes == 2 ? "H" : "I", data);
+  Py_DECREF(data);
+  return words;
+}
+
 PyDoc_STRVAR(SPIDev_read__doc__,
   "SPIDev.read(cs, n_words)\n"
   "\n"
@@ -157,231 +345,249 @@ PyDoc_STRVAR(SPIDev_read__doc__,
   ":param n_words: The number of words to read\n"
   ":type n_words: int\n" 
   "\n"
-  ":returns: A list of the words read as integers, in the order they were read.\n"
+  ":returns: The words read, in the order they were read, as `bytes` for\n"
+  "          up to 8 bits per word or an `array.array` of unsigned ints for\n"
+  "          up to 16 (type 'H') or 32 (type 'I').\n"
   "\n"
   "Reads `n_words` words from the SPI device using the given chip select."
   );
-static PyObject *SPIDev_read(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_readLocked(SPIDev *self, PyObject *const *args,
+                                   Py_ssize_t nargs) {
   uint8_t cs;
-  uint32_t n_bytes, n_words, i, word;
-  PyObject *data, *word_obj;
+  uint32_t n_words;
+  int n_read;
+  PyObject *data;
   void *rxbuf; 
-  if(!PyArg_ParseTuple(args, "bI", &cs, &n_words)) {
+  if (SerBus_checkArgs("read", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint32Arg(args[1], &n_words) < 0) {
     return NULL;
   }
 
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  n_bytes = (uint32_t) (((float) (self->bits_per_word * n_words)) / 8.0 + 0.5);
-  rxbuf = malloc(n_bytes);
+  data = SPIDev_newRx(self->bits_per_word, n_words, &rxbuf);
+  if (!data) return NULL;
 
-  SPI_read(self->spidev_fd[cs], rxbuf, n_words);
+  Py_BEGIN_ALLOW_THREADS
+  n_read = SPI_read(self->spidev_fd[cs], rxbuf, n_words);
+  Py_END_ALLOW_THREADS
+  if (n_read < 0) n_read = 0;
 
-  data = PyList_New(0);
-  for (i=0; i<n_words; i++) {
-    switch(self->bytes_per_word) {
-    case 1:
-      word = ((uint8_t*)rxbuf)[i];
-      break;
-    case 2:
-      word = ((uint16_t*)rxbuf)[i];
-      break;
-    case 4:
-      word = ((uint32_t*)rxbuf)[i];
-      break;
-    default:
-      word = 0;
-      break;
-    }
-    word_obj = PyInt_FromLong(word);
-    PyList_Append(data, word_obj);
-    Py_DECREF(word_obj);
+  return SPIDev_finishRx(self->bits_per_word, data, n_read);
+}
+SERBUS_LOCKED(SPIDev, read)
+
+PyDoc_STRVAR(SPIDev_readinto__doc__,
+  "SPIDev.readinto(cs, buffer)\n"
+  "\n"
+  ":param cs: The chip select to use for reading\n"
+  ":type cs: int\n" 
+  ":param buffer: A writable buffer to read into, e.g. a `bytearray` for up\n"
+  "               to 8 bits per word or an `array.array('H')` for up to 16\n"
+  ":type buffer: writable buffer\n" 
+  "\n"
+  ":returns: The number of words read, or -1 if unable to read.\n"
+  "\n"
+  "Reads as many words as fit in `buffer` from the SPI device using the\n"
+  "given chip select, storing them in place.\n"
+  );
+static PyObject *SPIDev_readintoLocked(SPIDev *self, PyObject *const *args,
+                                       Py_ssize_t nargs) {
+  uint8_t cs;
+  uint32_t n_words;
+  int n_read;
+  PyObject *data;
+  Py_buffer view;
+  if (SerBus_checkArgs("readinto", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
+    return NULL;
   }
-  free(rxbuf);
-  return data;
+  data = args[1];
+
+  if (SPIDev_activateCS(self, cs) < 0) return NULL;
+
+  if (SerBus_getBuffer(data, &view, 1) < 0) return NULL;
+  if (SPIDev_bufferWords(self, &view, &n_words) < 0) {
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  Py_BEGIN_ALLOW_THREADS
+  n_read = SPI_read(self->spidev_fd[cs], view.buf, n_words);
+  Py_END_ALLOW_THREADS
+  if (n_read > 0) SPIDev_maskWords(self->bits_per_word, view.buf, n_read);
+  PyBuffer_Release(&view);
+  return Py_BuildValue("i", n_read);
 }
+SERBUS_LOCKED(SPIDev, readinto)
 
 PyDoc_STRVAR(SPIDev_write__doc__,
   "SPIDev.write(cs, words)\n"
   "\n"
   ":param cs: The chip select to use for writing\n"
   ":type cs: int\n"
-  ":param words: The words to be written\n"
-  ":type words: list\n"
+  ":param words: The words to be written, either as a list of ints or as a\n"
+  "              buffer holding one word per 1, 2 or 4 bytes for up to 8,\n"
+  "              16 or 32 bits per word (e.g. `bytes` or `array.array('H')`)\n"
+  ":type words: list or buffer\n"
   "\n"
   ":returns: The number of bytes written, or -1 if unable to write interface.\n"
   "\n"
-  "Writes the given list of words to the SPI interface using the given chip\n"
+  "Writes the given words to the SPI interface using the given chip\n"
   "select.\n"
-  "\n"
-  ":note: Will only write up to a maximum of 4096 bytes.\n"
   );
-static PyObject *SPIDev_write(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_writeLocked(SPIDev *self, PyObject *const *args,
+                                    Py_ssize_t nargs) {
   uint8_t cs;
-  uint32_t n_bytes, n_words, i, word;
-  PyObject *data, *word_obj;
-  void *txbuf;
+  int n_written;
+  PyObject *data;
+  SPIDev_tx tx;
 
-  if(!PyArg_ParseTuple(args, "bO!", &cs, &PyList_Type, &data)) {
+  if (SerBus_checkArgs("write", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
+  data = args[1];
   
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  n_words = PyList_Size(data);
-  n_bytes = (uint32_t) (((float) (self->bits_per_word * n_words)) / 8.0 + 0.5);
-  txbuf = malloc(n_bytes);
-
-  for (i=0; i<n_words; i++) {
-    word_obj = PyList_GetItem(data, i);
-    if (!PyInt_Check(word_obj)) {
-      PyErr_SetString(PyExc_ValueError, 
-        "data list to transmit can only contain integers");
-      free(txbuf);
-      return NULL;
-    }
-    word = PyInt_AsLong(word_obj);
-    if (word < 0) {
-      if (PyErr_Occurred() != NULL) return NULL;
-      word = 0;
-    }
-    switch(self->bytes_per_word) {
-    case 1:
-      ((uint8_t*)txbuf)[i] = (uint8_t) word;
-      break;
-    case 2:
-      ((uint16_t*)txbuf)[i] = (uint16_t) word;
-      break;
-    case 4:
-      ((uint32_t*)txbuf)[i] = (uint32_t) word;
-      break;
-    default:
-      break;
-    }
-  }
-  n_words = SPI_write(self->spidev_fd[cs], txbuf, n_words);
-  free(txbuf);
-  return Py_BuildValue("i", n_words);
+  if (SPIDev_getTx(self, data, &tx) < 0) return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  n_written = SPI_write(self->spidev_fd[cs], tx.txbuf, tx.n_words);
+  Py_END_ALLOW_THREADS
+  SPIDev_releaseTx(&tx);
+  return Py_BuildValue("i", n_written);
 }
+SERBUS_LOCKED(SPIDev, write)
 
 PyDoc_STRVAR(SPIDev_transaction__doc__,
   "SPIDev.transaction(cs, tx_words, n_rx_words)\n"
   "\n"
   ":param cs: The chip select to use\n"
   ":type cs: int\n"
-  ":param tx_words: The words to be written\n"
-  ":type tx_words: list\n"
+  ":param tx_words: The words to be written, as for :func:`write`\n"
+  ":type tx_words: list or buffer\n"
   ":param n_rx_words: The number of words to read\n"
   ":type n_rx_words: int\n"
   "\n"
   "\n"
-  ":returns: A list of the words read as integers, in the order they were read.\n"
+  ":returns: The words read, in the order they were read, as for\n"
+  "          :func:`read`.\n"
   "\n"
-  "Writes the given list of words to the SPI interface using the given chip\n"
+  "Writes the given words to the SPI interface using the given chip\n"
   "select, then reads words from the SPI interface using the given chip select.\n"
   "CS remains unchanged.\n"
-  "\n"
-  ":note: Will only write/read up to a maximum of 4096 bytes.\n"
   );
-static PyObject *SPIDev_transaction(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_transactionLocked(SPIDev *self, PyObject *const *args,
+                                          Py_ssize_t nargs) {
   uint8_t cs;
-  uint32_t n_tx_bytes, n_rx_bytes, n_tx_words, n_rx_words, i, word;
-  PyObject *txdata, *rxdata, *word_obj;
-  void *txbuf, *rxbuf;
+  uint32_t n_rx_words;
+  int n_read;
+  PyObject *txdata, *rxdata;
+  SPIDev_tx tx;
+  void *rxbuf;
 
   cs = 0;
-  if(!PyArg_ParseTuple(args, "bO!b", &cs, &PyList_Type, &txdata, &n_rx_words)) {
+  if (SerBus_checkArgs("transaction", nargs, 3, 3) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint32Arg(args[2], &n_rx_words) < 0) {
     return NULL;
   }
+  txdata = args[1];
 
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  n_tx_words = PyList_Size(txdata);
-  n_tx_bytes = (uint32_t) (((float) (self->bits_per_word * n_tx_words)) / 8.0 + 0.5);
-  n_rx_bytes = (uint32_t) (((float) (self->bits_per_word * n_rx_words)) / 8.0 + 0.5);
-  txbuf = malloc(n_tx_bytes);
-  rxbuf = malloc(n_rx_bytes);
+  if (SPIDev_getTx(self, txdata, &tx) < 0) return NULL;
+  rxdata = SPIDev_newRx(self->bits_per_word, n_rx_words, &rxbuf);
+  if (!rxdata) {
+    SPIDev_releaseTx(&tx);
+    return NULL;
+  }
 
-  for (i=0; i<n_tx_words; i++) {
-    word_obj = PyList_GetItem(txdata, i);
-    if (!PyInt_Check(word_obj)) {
-      PyErr_SetString(PyExc_ValueError,
-        "data list to transmit can only contain integers");
-      free(rxbuf);
-      free(txbuf);
-      return NULL;
-    }
-    word = PyInt_AsLong(word_obj);
-    if (word < 0) {
-      if (PyErr_Occurred() != NULL) {
-          free(rxbuf);
-          free(txbuf);
-          return NULL;
-      }
-      word = 0;
-    }
-    switch(self->bytes_per_word) {
-    case 1:
-      ((uint8_t*)txbuf)[i] = (uint8_t) word;
-      break;
-    case 2:
-      ((uint16_t*)txbuf)[i] = (uint16_t) word;
-      break;
-    case 4:
-      ((uint32_t*)txbuf)[i] = (uint32_t) word;
-      break;
-    default:
-      break;
-    }
+  Py_BEGIN_ALLOW_THREADS
+  n_read = SPI_transaction(self->spidev_fd[cs], tx.txbuf, tx.n_words, rxbuf,
+                           n_rx_words);
+  Py_END_ALLOW_THREADS
+  if (n_read < 0) n_read = 0;
+  SPIDev_releaseTx(&tx);
+  return SPIDev_finishRx(self->bits_per_word, rxdata, n_read);
+}
+SERBUS_LOCKED(SPIDev, transaction)
+
+PyDoc_STRVAR(SPIDev_transactionInto__doc__,
+  "SPIDev.transactionInto(cs, tx_words, buffer)\n"
+  "\n"
+  ":param cs: The chip select to use\n"
+  ":type cs: int\n"
+  ":param tx_words: The words to be written, as for :func:`write`\n"
+  ":type tx_words: list or buffer\n"
+  ":param buffer: A writable buffer to read into, as for :func:`readinto`\n"
+  ":type buffer: writable buffer\n"
+  "\n"
+  ":returns: The number of words read, or -1 if unable to.\n"
+  "\n"
+  "Like :func:`transaction`, but reads as many words as fit in `buffer`,\n"
+  "storing them in place.\n"
+  );
+static PyObject *SPIDev_transactionIntoLocked(SPIDev *self,
+                                              PyObject *const *args,
+                                              Py_ssize_t nargs) {
+  uint8_t cs;
+  uint32_t n_rx_words;
+  int n_read;
+  PyObject *txdata, *rxdata;
+  SPIDev_tx tx;
+  Py_buffer view;
+
+  if (SerBus_checkArgs("transactionInto", nargs, 3, 3) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
+    return NULL;
   }
-  n_rx_words = SPI_transaction(self->spidev_fd[cs], txbuf, n_tx_words, rxbuf, 
-                               n_rx_words);
-  rxdata = PyList_New(0);
-  for (i=0; i<n_rx_words; i++) {
-    switch(self->bytes_per_word) {
-    case 1:
-      word = ((uint8_t*)rxbuf)[i];
-      break;
-    case 2:
-      word = ((uint16_t*)rxbuf)[i];
-      break;
-    case 4:
-      word = ((uint32_t*)rxbuf)[i];
-      break;
-    default:
-      word = 0;
-      break;
-    }
-    word_obj = PyInt_FromLong(word);
-    PyList_Append(rxdata, word_obj);
-    Py_DECREF(word_obj);
+  txdata = args[1];
+  rxdata = args[2];
+
+  if (SPIDev_activateCS(self, cs) < 0) return NULL;
+
+  if (SerBus_getBuffer(rxdata, &view, 1) < 0) return NULL;
+  if (SPIDev_bufferWords(self, &view, &n_rx_words) < 0 ||
+      SPIDev_getTx(self, txdata, &tx) < 0) {
+    PyBuffer_Release(&view);
+    return NULL;
   }
-  free(txbuf);
-  free(rxbuf);
-  return rxdata;
+
+  Py_BEGIN_ALLOW_THREADS
+  n_read = SPI_transaction(self->spidev_fd[cs], tx.txbuf, tx.n_words, 
+                           view.buf, n_rx_words);
+  Py_END_ALLOW_THREADS
+  if (n_read > 0) SPIDev_maskWords(self->bits_per_word, view.buf, n_read);
+  SPIDev_releaseTx(&tx);
+  PyBuffer_Release(&view);
+  return Py_BuildValue("i", n_read);
 }
+SERBUS_LOCKED(SPIDev, transactionInto)
 
 PyDoc_STRVAR(SPIDev_transfer__doc__,
   "SPIDev.transfer(cs, words)\n"
   "\n"
   ":param cs: The chip select to use\n"
   ":type cs: int\n"
-  ":param words: The words to be written\n"
-  ":type words: list\n"
+  ":param words: The words to be written, as for :func:`write`\n"
+  ":type words: list or buffer\n"
   "\n" 
   "\n"
-  ":returns: The words read as a list of ints, the same length as `words`.\n"
+  ":returns: The words read as for :func:`read`, the same number as were\n"
+  "          written.\n"
   "\n"
-  "Writes the given list of words to the SPI interface using the given chip\n"
+  "Writes the given words to the SPI interface using the given chip\n"
   "select while simultaneously reading bytes.\n"
-  "\n"
-  ":note: Will only write/read up to a maximum of 4096 bytes.\n"
   );
-static PyObject *SPIDev_transfer(SPIDev *self, PyObject *args, PyObject *kwds) {
+static PyObject *SPIDev_transferLocked(SPIDev *self, PyObject *const *args,
+                                       Py_ssize_t nargs) {
   uint8_t cs;
-  uint32_t n_bytes, n_words, i, word;
-  PyObject *txdata, *rxdata, *word_obj;
-  void *txbuf, *rxbuf;
+  int n_transferred;
+  PyObject *txdata, *rxdata;
+  SPIDev_tx tx;
+  void *rxbuf;
 
   if (self->mode_3wire) {
     PyErr_SetString(PyExc_IOError, 
@@ -389,70 +595,496 @@ static PyObject *SPIDev_transfer(SPIDev *self, PyObject *args, PyObject *kwds) {
     return NULL;
   }
   cs = 0;
-  if(!PyArg_ParseTuple(args, "bO!", &cs, &PyList_Type, &txdata)) {
+  if (SerBus_checkArgs("transfer", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
+  txdata = args[1];
   
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  n_words = PyList_Size(txdata);
-  n_bytes = (uint32_t) (((float) (self->bits_per_word * n_words)) / 8.0 + 0.5);
-  txbuf = malloc(n_bytes);
-  rxbuf = malloc(n_bytes);
+  if (SPIDev_getTx(self, txdata, &tx) < 0) return NULL;
+  rxdata = SPIDev_newRx(self->bits_per_word, tx.n_words, &rxbuf);
+  if (!rxdata) {
+    SPIDev_releaseTx(&tx);
+    return NULL;
+  }
 
-  for (i=0; i<n_words; i++) {
-    word_obj = PyList_GetItem(txdata, i);
-    if (!PyInt_Check(word_obj)) {
-      PyErr_SetString(PyExc_ValueError, 
-        "data list to transmit can only contain integers");
-      free(txbuf);
-      return NULL;
-    }
-    word = PyInt_AsLong(word_obj);
-    if (word < 0) {
-      if (PyErr_Occurred() != NULL) return NULL;
-      word = 0;
-    }
-    switch(self->bytes_per_word) {
-    case 1:
-      ((uint8_t*)txbuf)[i] = (uint8_t) word;
-      break;
-    case 2:
-      ((uint16_t*)txbuf)[i] = (uint16_t) word;
-      break;
-    case 4:
-      ((uint32_t*)txbuf)[i] = (uint32_t) word;
+  Py_BEGIN_ALLOW_THREADS
+  n_transferred = SPI_transfer(self->spidev_fd[cs], tx.txbuf, rxbuf, 
+                               tx.n_words);
+  Py_END_ALLOW_THREADS
+  if (n_transferred < 0) n_transferred = 0;
+  SPIDev_releaseTx(&tx);
+  return SPIDev_finishRx(self->bits_per_word, rxdata, n_transferred);
+}
+SERBUS_LOCKED(SPIDev, transfer)
+
+PyDoc_STRVAR(SPIDev_transferInto__doc__,
+  "SPIDev.transferInto(cs, words, buffer)\n"
+  "\n"
+  ":param cs: The chip select to use\n"
+  ":type cs: int\n"
+  ":param words: The words to be written, as for :func:`write`\n"
+  ":type words: list or buffer\n"
+  ":param buffer: A writable buffer to read into, as for :func:`readinto`,\n"
+  "               with room for at least as many words as are written\n"
+  ":type buffer: writable buffer\n"
+  "\n" 
+  ":returns: The number of words transferred, or -1 if unable to.\n"
+  "\n"
+  "Like :func:`transfer`, but stores the words read in `buffer`. `buffer`\n"
+  "may be the same object as `words` to transfer in place.\n"
+  );
+static PyObject *SPIDev_transferIntoLocked(SPIDev *self, PyObject *const *args,
+                                           Py_ssize_t nargs) {
+  uint8_t cs;
+  uint32_t n_rx_words;
+  int n_transferred;
+  PyObject *txdata, *rxdata;
+  SPIDev_tx tx;
+  Py_buffer view;
+
+  if (self->mode_3wire) {
+    PyErr_SetString(PyExc_IOError, 
+      "SPIDev.transferInto not supported in 3 wire mode");
+    return NULL;
+  }
+  if (SerBus_checkArgs("transferInto", nargs, 3, 3) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
+    return NULL;
+  }
+  txdata = args[1];
+  rxdata = args[2];
+  
+  if (SPIDev_activateCS(self, cs) < 0) return NULL;
+
+  if (SerBus_getBuffer(rxdata, &view, 1) < 0) return NULL;
+  if (SPIDev_bufferWords(self, &view, &n_rx_words) < 0 ||
+      SPIDev_getTx(self, txdata, &tx) < 0) {
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  if (n_rx_words < tx.n_words) {
+    PyErr_SetString(PyExc_ValueError, 
+      "buffer is too small for the number of words written");
+    SPIDev_releaseTx(&tx);
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  n_transferred = SPI_transfer(self->spidev_fd[cs], tx.txbuf, view.buf, 
+                               tx.n_words);
+  Py_END_ALLOW_THREADS
+  if (n_transferred > 0) {
+    SPIDev_maskWords(self->bits_per_word, view.buf, n_transferred);
+  }
+  SPIDev_releaseTx(&tx);
+  PyBuffer_Release(&view);
+  return Py_BuildValue("i", n_transferred);
+}
+SERBUS_LOCKED(SPIDev, transferInto)
+
+/**
+ * Creates a new numpy array of \p n_frames rows of \p n_words words of the 
+ * given dtype, or if \p dtype is NULL the smallest unsigned integer type the
+ * words fit in. Returns NULL with an exception set if unable to.
+ */
+static PyObject *SPIDev_newArray(SPIDev *self, uint32_t n_frames, 
+                                 uint32_t n_words, PyObject *dtype) {
+  uint32_t word_bytes;
+  if (!SPIDev_numpy) {
+    SPIDev_numpy = PyImport_ImportModule("numpy");
+    if (!SPIDev_numpy) return NULL;
+  }
+  if (dtype) {
+    return PyObject_CallMethod(SPIDev_numpy, "empty", "(II)O", n_frames, 
+                               n_words, dtype);
+  }
+  word_bytes = SPI_wordBytes(self->bits_per_word);
+  return PyObject_CallMethod(SPIDev_numpy, "empty", "(II)s", n_frames, 
+                             n_words, word_bytes == 1 ? "uint8" : 
+                                      word_bytes == 2 ? "uint16" : "uint32");
+}
+
+/**
+ * Works out how to store captured words in the items of a buffer. Returns 1
+ * if the items are in the spidev layout, so words can be read straight into
+ * them, or 0 if words must be unpacked into them with #SPI_unpack using the 
+ * given type and flags. Returns -1 with an exception set if the items can't
+ * hold words of the current size.
+ */
+static int SPIDev_captureType(SPIDev *self, Py_buffer *view, 
+                              SPI_word_type *type, int *flags) {
+  const char *format;
+  uint32_t word_bytes;
+  format = view->format ? view->format : "B";
+  // Skip the byte order prefix if it's the native one:
+  if (*format == '@' || *format == '=' || *format == SPIDev_NATIVE_ORDER) {
+    format++;
+  }
+  word_bytes = SPI_wordBytes(self->bits_per_word);
+  *flags = 0;
+  if (format[0] && !format[1]) {
+    switch (format[0]) {
+    case 'B':
+      if (word_bytes == 1) return 1;
       break;
-    default:
+    case 'H':
+      if (word_bytes == 2) return 1;
+      *type = SPI_WORD_UINT16;
+      if (word_bytes == 1) return 0;
       break;
+    case 'I':
+    case 'L':
+      if (view->itemsize != 4) break;
+      if (word_bytes == 4) return 1;
+      *type = SPI_WORD_UINT32;
+      return 0;
+    case 'i':
+    case 'l':
+      if (view->itemsize != 4) break;
+      if (self->bits_per_word == 32) return 1;
+      *type = SPI_WORD_INT32;
+      *flags = SPI_PACK_SIGNED;
+      return 0;
+    case 'f':
+      *type = SPI_WORD_FLOAT;
+      return 0;
     }
   }
-  n_words = SPI_transfer(self->spidev_fd[cs], txbuf, rxbuf, n_words);
-  rxdata = PyList_New(0);
-  for (i=0; i<n_words; i++) {
-    switch(self->bytes_per_word) {
-    case 1:
-      word = ((uint8_t*)rxbuf)[i];
-      break;
-    case 2:
-      word = ((uint16_t*)rxbuf)[i];
+  PyErr_Format(PyExc_ValueError, 
+    "cannot capture %u-bit words into items of format '%s'", 
+    self->bits_per_word, view->format ? view->format : "B");
+  return -1;
+}
+
+/**
+ * Captures \p n_frames frames of \p n_words words into \p out. Returns -1 
+ * with an exception set if unable to.
+ */
+static int SPIDev_captureInto(SPIDev *self, uint8_t cs, uint32_t n_words, 
+                              uint32_t n_frames, PyObject *out) {
+  uint32_t n_total;
+  int raw, flags, n_read;
+  SPI_word_type type;
+  Py_buffer view;
+  void *rxbuf;
+
+  n_total = n_words * n_frames;
+  if (PyObject_GetBuffer(out, &view, PyBUF_WRITABLE | PyBUF_FORMAT | 
+                                     PyBUF_C_CONTIGUOUS) < 0) {
+    return -1;
+  }
+  if (view.len != (Py_ssize_t) n_total * view.itemsize) {
+    PyErr_SetString(PyExc_ValueError, 
+      "out must have exactly n_words * n_frames items");
+    PyBuffer_Release(&view);
+    return -1;
+  }
+  raw = SPIDev_captureType(self, &view, &type, &flags);
+  if (raw < 0 || !n_total) {
+    PyBuffer_Release(&view);
+    return raw;
+  }
+
+  rxbuf = view.buf;
+  if (!raw) {
+    rxbuf = SPI_allocBuffer(SPI_bufferSize(self->bits_per_word, n_total, 0));
+    if (!rxbuf) {
+      PyBuffer_Release(&view);
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  n_read = SPI_readFrames(self->spidev_fd[cs], rxbuf, n_words, n_frames);
+  if (n_read == (int) n_total) {
+    if (raw) SPIDev_maskWords(self->bits_per_word, rxbuf, n_total);
+    else {
+      SPI_unpack(rxbuf, view.buf, type, n_total, self->bits_per_word, flags);
+    }
+  }
+  Py_END_ALLOW_THREADS
+
+  if (!raw) SPI_releaseBuffer(rxbuf);
+  PyBuffer_Release(&view);
+  if (n_read != (int) n_total) {
+    PyErr_SetString(PyExc_IOError, "could not read from SPI interface");
+    return -1;
+  }
+  return 0;
+}
+
+PyDoc_STRVAR(SPIDev_capture__doc__,
+  "SPIDev.capture(cs, n_words, n_frames[, dtype=None][, out=None])\n"
+  "\n"
+  ":param cs: The chip select to use\n"
+  ":type cs: int\n"
+  ":param n_words: The number of words in each frame\n"
+  ":type n_words: int\n"
+  ":param n_frames: The number of frames to read\n"
+  ":type n_frames: int\n"
+  ":param dtype: The numpy dtype of the returned array, by default the\n"
+  "              smallest unsigned integer type that fits the current bits\n"
+  "              per word\n"
+  ":type dtype: numpy dtype, optional\n"
+  ":param out: An array to capture into instead of a new one\n"
+  ":type out: writable buffer, optional\n"
+  "\n"
+  ":returns: A numpy array of shape (n_frames, n_words), or `out`\n"
+  "\n"
+  "Reads `n_frames` frames of `n_words` words from the slave device on the\n"
+  "given chip select, deselecting it between frames, e.g. to read blocks of\n"
+  "ADC samples. The frames are read and converted in C without holding the\n"
+  "GIL. The words are unpacked to the dtype of the array, which can be\n"
+  "uint8 (up to 8 bits per word), uint16 (up to 16), uint32, int32 (sign\n"
+  "extended) or float32.\n"
+  "\n"
+  "`out` can be any C-contiguous writable buffer of one of those types with\n"
+  "exactly `n_words` * `n_frames` items, e.g. a numpy array or array.array,\n"
+  "and numpy is only needed if it isn't given.\n"
+  );
+static PyObject *SPIDev_captureLocked(SPIDev *self, PyObject *const *args,
+                                      Py_ssize_t nargs, PyObject *kwnames) {
+  static const char *const keywords[] = {"cs", "n_words", "n_frames", 
+                                         "dtype", "out", NULL};
+  PyObject *values[5], *dtype, *out;
+  uint8_t cs;
+  uint32_t n_words, n_frames;
+
+  if (SerBus_getArgs("capture", args, nargs, kwnames, keywords, 3, 
+                     values) < 0 ||
+      SerBus_uint8Arg(values[0], &cs) < 0 ||
+      SerBus_uint32Arg(values[1], &n_words) < 0 ||
+      SerBus_uint32Arg(values[2], &n_frames) < 0) {
+    return NULL;
+  }
+  dtype = values[3] == Py_None ? NULL : values[3];
+  out = values[4] == Py_None ? NULL : values[4];
+  if (dtype && out) {
+    PyErr_SetString(PyExc_ValueError, 
+      "capture() takes either dtype or out, not both");
+    return NULL;
+  }
+  if (n_frames && n_words > INT_MAX / n_frames) {
+    PyErr_SetString(PyExc_ValueError, "too many words to capture");
+    return NULL;
+  }
+
+  if (SPIDev_activateCS(self, cs) < 0) return NULL;
+
+  if (out) Py_INCREF(out);
+  else {
+    out = SPIDev_newArray(self, n_frames, n_words, dtype);
+    if (!out) return NULL;
+  }
+  if (SPIDev_captureInto(self, cs, n_words, n_frames, out) < 0) {
+    Py_DECREF(out);
+    return NULL;
+  }
+  return out;
+}
+SERBUS_LOCKED_KEYWORDS(SPIDev, capture)
+
+/**
+ * The transfers an #SPIDev_job can do.
+ */
+typedef enum {
+  SPIDev_READ,
+  SPIDev_WRITE,
+  SPIDev_TRANSFER
+} SPIDev_op;
+
+/**
+ * A transfer queued by one of the async methods. It's done with the bits per
+ * word set when it was queued, which its buffers are laid out for.
+ */
+typedef struct {
+  SerBus_job job;
+  SPIDev *self;          ///< The object, referenced until the job is released
+  SPIDev_op op;
+  uint8_t cs;            ///< Chip select
+  uint8_t bits_per_word; ///< Bits per word when queued
+  uint32_t n_words;      ///< Number of words to transfer
+  SPIDev_tx tx;          ///< Words to write, if tx.txbuf is set
+  PyObject *rxdata;      ///< Storage from #SPIDev_newRx being read into
+  void *rxbuf;
+} SPIDev_job;
+
+static int SPIDev_runJob(SerBus_job *job) {
+  SPIDev_job *spi_job = (SPIDev_job *) job;
+  SPIDev *self = spi_job->self;
+  SPI_options options;
+  int fd, ret;
+  memset(&options, 0, sizeof(options));
+  options.bits_per_word = spi_job->bits_per_word;
+  PyThread_acquire_lock(self->lock, WAIT_LOCK);
+  // The interface may have been closed since the job was queued:
+  fd = self->spidev_fd[spi_job->cs];
+  ret = -1;
+  errno = EBADF;
+  if (fd >= 0) {
+    switch (spi_job->op) {
+    case SPIDev_READ:
+      ret = SPI_readEx(fd, spi_job->rxbuf, spi_job->n_words, &options);
       break;
-    case 4:
-      word = ((uint32_t*)rxbuf)[i];
+    case SPIDev_WRITE:
+      ret = SPI_writeEx(fd, spi_job->tx.txbuf, spi_job->n_words, &options);
       break;
-    default:
-      word = 0;
+    case SPIDev_TRANSFER:
+      ret = SPI_transferEx(fd, spi_job->tx.txbuf, spi_job->rxbuf, 
+                           spi_job->n_words, &options);
       break;
     }
-    word_obj = PyInt_FromLong(word);
-    PyList_Append(rxdata, word_obj);
-    Py_DECREF(word_obj);
   }
-  free(txbuf);
-  free(rxbuf);
-  return rxdata;
+  PyThread_release_lock(self->lock);
+  return ret;
 }
 
+static PyObject *SPIDev_jobResult(SerBus_job *job) {
+  SPIDev_job *spi_job = (SPIDev_job *) job;
+  PyObject *data;
+  if (spi_job->op == SPIDev_WRITE) return PyLong_FromLong(job->ret);
+  // SPIDev_finishRx takes the reference:
+  data = spi_job->rxdata;
+  spi_job->rxdata = NULL;
+  return SPIDev_finishRx(spi_job->bits_per_word, data, job->ret);
+}
+
+static void SPIDev_releaseJob(SerBus_job *job) {
+  SPIDev_job *spi_job = (SPIDev_job *) job;
+  Py_XDECREF(spi_job->rxdata);
+  if (spi_job->tx.txbuf) SPIDev_releaseTx(&spi_job->tx);
+  Py_DECREF(spi_job->self);
+}
+
+static PyObject *SPIDev_complete(SPIDev *self, PyObject *unused) {
+  return SerBus_complete(&self->worker);
+}
+
+/// The eventfd reader callback, bound to the object when registered
+static PyMethodDef SPIDev_completeDef = {
+  "_complete", (PyCFunction)SPIDev_complete, METH_NOARGS, NULL
+};
+
+/**
+ * Sets up the buffers of a new job: the words to write from \p txdata if not
+ * NULL, and the storage for the words read unless it's an SPIDev_WRITE. 
+ * Returns -1 with an exception set if unable to.
+ */
+static int SPIDev_setupJob(SPIDev_job *job, PyObject *txdata) {
+  if (txdata) {
+    if (SPIDev_getTx(job->self, txdata, &job->tx) < 0) return -1;
+    job->n_words = job->tx.n_words;
+  }
+  if (job->op != SPIDev_WRITE) {
+    job->rxdata = SPIDev_newRx(job->bits_per_word, job->n_words, 
+                               &job->rxbuf);
+    if (!job->rxdata) return -1;
+  }
+  return 0;
+}
+
+/**
+ * Queues the given transfer on chip select \p cs, writing \p txdata if not
+ * NULL, otherwise reading \p n_words words. Returns its future, or NULL with
+ * an exception set if unable to.
+ */
+static PyObject *SPIDev_submitJob(SPIDev *self, SPIDev_op op, uint8_t cs,
+                                  PyObject *txdata, uint32_t n_words) {
+  SPIDev_job *job;
+  PyObject *future;
+  if (SPIDev_activateCS(self, cs) < 0) return NULL;
+  job = calloc(1, sizeof(SPIDev_job));
+  if (!job) return PyErr_NoMemory();
+  job->job.run = SPIDev_runJob;
+  job->job.result = SPIDev_jobResult;
+  job->job.release = SPIDev_releaseJob;
+  job->op = op;
+  job->cs = cs;
+  job->bits_per_word = self->bits_per_word;
+  job->n_words = n_words;
+  Py_INCREF(self);
+  job->self = self;
+
+  future = NULL;
+  if (SPIDev_setupJob(job, txdata) == 0) {
+    future = SerBus_submit(&self->worker, &job->job, (PyObject *) self,
+                           &SPIDev_completeDef);
+  }
+  if (!future) {
+    SPIDev_releaseJob(&job->job);
+    free(job);
+  }
+  return future;
+}
+
+PyDoc_STRVAR(SPIDev_aread__doc__,
+  "SPIDev.aread(cs, n_words)\n"
+  "\n"
+  "Like :func:`read`, but returns an awaitable future of the words read.\n"
+  "The transfer is run by the object's worker thread, and the future is\n"
+  "resolved in the running asyncio event loop. Async transfers are done in\n"
+  "the order they're requested, with the bits per word set at the time. A\n"
+  "failed transfer raises an OSError.\n"
+  );
+static PyObject *SPIDev_areadLocked(SPIDev *self, PyObject *const *args,
+                                    Py_ssize_t nargs) {
+  uint8_t cs;
+  uint32_t n_words;
+  if (SerBus_checkArgs("aread", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint32Arg(args[1], &n_words) < 0) {
+    return NULL;
+  }
+  return SPIDev_submitJob(self, SPIDev_READ, cs, NULL, n_words);
+}
+SERBUS_LOCKED(SPIDev, aread)
+
+PyDoc_STRVAR(SPIDev_awrite__doc__,
+  "SPIDev.awrite(cs, words)\n"
+  "\n"
+  "Like :func:`write`, but returns an awaitable future of the number of\n"
+  "words written, as for :func:`aread`. A buffer must not be modified until\n"
+  "the write is done.\n"
+  );
+static PyObject *SPIDev_awriteLocked(SPIDev *self, PyObject *const *args,
+                                     Py_ssize_t nargs) {
+  uint8_t cs;
+  if (SerBus_checkArgs("awrite", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
+    return NULL;
+  }
+  return SPIDev_submitJob(self, SPIDev_WRITE, cs, args[1], 0);
+}
+SERBUS_LOCKED(SPIDev, awrite)
+
+PyDoc_STRVAR(SPIDev_atransfer__doc__,
+  "SPIDev.atransfer(cs, words)\n"
+  "\n"
+  "Like :func:`transfer`, but returns an awaitable future of the words\n"
+  "read, as for :func:`aread`. A buffer must not be modified until the\n"
+  "transfer is done.\n"
+  );
+static PyObject *SPIDev_atransferLocked(SPIDev *self, PyObject *const *args,
+                                        Py_ssize_t nargs) {
+  uint8_t cs;
+  if (self->mode_3wire) {
+    PyErr_SetString(PyExc_IOError, 
+      "SPIDev.atransfer not supported in 3 wire mode");
+    return NULL;
+  }
+  if (SerBus_checkArgs("atransfer", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
+    return NULL;
+  }
+  return SPIDev_submitJob(self, SPIDev_TRANSFER, cs, args[1], 0);
+}
+SERBUS_LOCKED(SPIDev, atransfer)
+
 PyDoc_STRVAR(SPIDev_setMSBFirst__doc__,
   "SPIDev.setMSBFirst(cs)\n"
   "\n"
@@ -464,26 +1096,32 @@ PyDoc_STRVAR(SPIDev_setMSBFirst__doc__,
   "\n"
   ":raises: `IOError` if unable to set the bit order.\n"
   );
-static PyObject *SPIDev_setMSBFirst(SPIDev *self, PyObject *args, 
-                                    PyObject *kwds) {
+static PyObject *SPIDev_setMSBFirstLocked(SPIDev *self, PyObject *const *args,
+                                          Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("setMSBFirst", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setBitOrder(self->spidev_fd[cs], SPI_MSBFIRST) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setBitOrder(self->spidev_fd[cs], SPI_MSBFIRST);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI bit order");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setMSBFirst)
 
 PyDoc_STRVAR(SPIDev_setLSBFirst__doc__,
   "SPIDev.setLSBFirst(cs)\n"
@@ -496,26 +1134,32 @@ PyDoc_STRVAR(SPIDev_setLSBFirst__doc__,
   "\n"
   ":raises: `IOError` if unable to set the bit order.\n"
   );
-static PyObject *SPIDev_setLSBFirst(SPIDev *self, PyObject *args, 
-                                    PyObject *kwds) {
+static PyObject *SPIDev_setLSBFirstLocked(SPIDev *self, PyObject *const *args,
+                                          Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("setLSBFirst", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setBitOrder(self->spidev_fd[cs], SPI_LSBFIRST) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setBitOrder(self->spidev_fd[cs], SPI_LSBFIRST);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI bit order");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setLSBFirst)
 
 PyDoc_STRVAR(SPIDev_setBitsPerWord__doc__,
   "SPIDev.setBitsPerWord(cs, bits_per_word)\n"
@@ -530,15 +1174,19 @@ PyDoc_STRVAR(SPIDev_setBitsPerWord__doc__,
   "\n"
   ":raises: `IOError` if unable to set the bits per word.\n"
   );
-static PyObject *SPIDev_setBitsPerWord(SPIDev *self, PyObject *args, 
-                                       PyObject *kwds) {
+static PyObject *SPIDev_setBitsPerWordLocked(SPIDev *self,
+                                             PyObject *const *args,
+                                             Py_ssize_t nargs) {
   uint8_t bpw, cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "bb", &cs, &bpw)) {
+  if (SerBus_checkArgs("setBitsPerWord", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint8Arg(args[1], &bpw) < 0) {
     return NULL;
   }
   if (bpw > 32) {
@@ -547,13 +1195,18 @@ static PyObject *SPIDev_setBitsPerWord(SPIDev *self, PyObject *args,
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
   
-  if (SPI_setBitsPerWord(self->spidev_fd[cs], bpw) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setBitsPerWord(self->spidev_fd[cs], bpw);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_ValueError, "could not set SPI bits per word");
     return NULL;
   }
+  self->bits_per_word = bpw ? bpw : 8;
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setBitsPerWord)
 
 PyDoc_STRVAR(SPIDev_setMaxFrequency__doc__,
   "SPIDev.setMaxFrequency(cs, frequency)\n"
@@ -567,27 +1220,35 @@ PyDoc_STRVAR(SPIDev_setMaxFrequency__doc__,
   "\n"
   ":raises: `IOError` if unable to set the frequency.\n"
   );
-static PyObject *SPIDev_setMaxFrequency(SPIDev *self, PyObject *args, 
-                                        PyObject *kwds) {
+static PyObject *SPIDev_setMaxFrequencyLocked(SPIDev *self,
+                                              PyObject *const *args,
+                                              Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   uint32_t frequency;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "bi", &cs, &frequency)) {
+  if (SerBus_checkArgs("setMaxFrequency", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint32Arg(args[1], &frequency) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setMaxFrequency(self->spidev_fd[cs], frequency) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setMaxFrequency(self->spidev_fd[cs], frequency);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI frequency");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setMaxFrequency)
 
 PyDoc_STRVAR(SPIDev_enableLoopback__doc__,
   "SPIDev.enableLoopback(cs)\n"
@@ -599,26 +1260,33 @@ PyDoc_STRVAR(SPIDev_enableLoopback__doc__,
   "\n"
   ":raises: `IOError` if unable to enable loopback mode.\n"
   );
-static PyObject *SPIDev_enableLoopback(SPIDev *self, PyObject *args, 
-                                        PyObject *kwds) {
+static PyObject *SPIDev_enableLoopbackLocked(SPIDev *self,
+                                             PyObject *const *args,
+                                             Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("enableLoopback", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_enableLoopback(self->spidev_fd[cs]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_enableLoopback(self->spidev_fd[cs]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not enable SPI loopback");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, enableLoopback)
 
 PyDoc_STRVAR(SPIDev_disableLoopback__doc__,
   "SPIDev.disableLoopback(cs)\n"
@@ -630,26 +1298,33 @@ PyDoc_STRVAR(SPIDev_disableLoopback__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_disableLoopback(SPIDev *self, PyObject *args, 
-                                        PyObject *kwds) {
+static PyObject *SPIDev_disableLoopbackLocked(SPIDev *self,
+                                              PyObject *const *args,
+                                              Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("disableLoopback", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_disableLoopback(self->spidev_fd[cs]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_disableLoopback(self->spidev_fd[cs]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not disable SPI loopback");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, disableLoopback)
 
 PyDoc_STRVAR(SPIDev_setClockMode__doc__,
   "SPIDev.setClockMode(cs, clock_mode)\n"
@@ -665,15 +1340,18 @@ PyDoc_STRVAR(SPIDev_setClockMode__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_setClockMode(SPIDev *self, PyObject *args, 
-                                     PyObject *kwds) {
+static PyObject *SPIDev_setClockModeLocked(SPIDev *self, PyObject *const *args,
+                                           Py_ssize_t nargs) {
   uint8_t mode, cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "bb", &cs, &mode)) {
+  if (SerBus_checkArgs("setClockMode", nargs, 2, 2) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0 ||
+      SerBus_uint8Arg(args[1], &mode) < 0) {
     return NULL;
   }
   if (mode > 3) {
@@ -682,13 +1360,17 @@ static PyObject *SPIDev_setClockMode(SPIDev *self, PyObject *args,
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setClockMode(self->spidev_fd[cs], mode) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setClockMode(self->spidev_fd[cs], mode);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI clock mode");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setClockMode)
 
 PyDoc_STRVAR(SPIDev_setCSActiveLow__doc__,
   "SPIDev.setCSActiveLow(cs)\n"
@@ -701,26 +1383,33 @@ PyDoc_STRVAR(SPIDev_setCSActiveLow__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_setCSActiveLow(SPIDev *self, PyObject *args, 
-                                       PyObject *kwds) {
+static PyObject *SPIDev_setCSActiveLowLocked(SPIDev *self,
+                                             PyObject *const *args,
+                                             Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("setCSActiveLow", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setCSActiveLow(self->spidev_fd[cs]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setCSActiveLow(self->spidev_fd[cs]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI CS to active low");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setCSActiveLow)
 
 PyDoc_STRVAR(SPIDev_setCSActiveHigh__doc__,
   "SPIDev.setCSActiveHigh(cs) -> None\n\n"
@@ -733,26 +1422,33 @@ PyDoc_STRVAR(SPIDev_setCSActiveHigh__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_setCSActiveHigh(SPIDev *self, PyObject *args, 
-                                        PyObject *kwds) {
+static PyObject *SPIDev_setCSActiveHighLocked(SPIDev *self,
+                                              PyObject *const *args,
+                                              Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("setCSActiveHigh", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_setCSActiveHigh(self->spidev_fd[cs]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_setCSActiveHigh(self->spidev_fd[cs]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not set SPI CS to active high");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, setCSActiveHigh)
 
 PyDoc_STRVAR(SPIDev_disableCS__doc__,
   "SPIDev.disableCS(cs)\n"
@@ -764,26 +1460,32 @@ PyDoc_STRVAR(SPIDev_disableCS__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_disableCS(SPIDev *self, PyObject *args, 
-                                  PyObject *kwds) {
+static PyObject *SPIDev_disableCSLocked(SPIDev *self, PyObject *const *args,
+                                        Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("disableCS", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_disableCS(self->spidev_fd[cs]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_disableCS(self->spidev_fd[cs]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not disable SPI CS");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, disableCS)
 
 PyDoc_STRVAR(SPIDev_enableCS__doc__,
   "SPIDev.enableCS(cs)\n"
@@ -795,29 +1497,35 @@ PyDoc_STRVAR(SPIDev_enableCS__doc__,
   "\n"
   ":raises: `IOError` if unable to disable loopback mode.\n"
   );
-static PyObject *SPIDev_enableCS(SPIDev *self, PyObject *args, 
-                                  PyObject *kwds) {
+static PyObject *SPIDev_enableCSLocked(SPIDev *self, PyObject *const *args,
+                                        Py_ssize_t nargs) {
   uint8_t cs;
+  int ret;
   if (self->spidev_fd[0] < 0) {
     PyErr_SetString(PyExc_IOError, 
       "must call SPIDev.open() first to initialize the SPI interface");
     return NULL;
   }
-  if(!PyArg_ParseTuple(args, "b", &cs)) {
+  if (SerBus_checkArgs("enableCS", nargs, 1, 1) < 0 ||
+      SerBus_uint8Arg(args[0], &cs) < 0) {
     return NULL;
   }
   if (SPIDev_activateCS(self, cs) < 0) return NULL;
 
-  if (SPI_enableCS(self->spidev_fd[0]) < 0) {
+  Py_BEGIN_ALLOW_THREADS
+  ret = SPI_enableCS(self->spidev_fd[0]);
+  Py_END_ALLOW_THREADS
+  if (ret < 0) {
     PyErr_SetString(PyExc_IOError, "could not enable SPI CS");
     return NULL;
   }
   Py_INCREF(Py_None);
   return Py_None;
 }
+SERBUS_LOCKED(SPIDev, enableCS)
 
 static PyObject *SPIDev_getBus(SPIDev *self, void *closure) {
-  return Py_BuildValue("i", self->bus);
+  return PyLong_FromLong(self->bus);
 }
 
 static int SPIDev_setBus(SPIDev *self, PyObject *value, void *closure) {
@@ -826,12 +1534,12 @@ static int SPIDev_setBus(SPIDev *self, PyObject *value, void *closure) {
     PyErr_SetString(PyExc_TypeError, "Cannot delete bus attribute");
     return -1;
   }
-  if (!PyInt_Check(value)) {
+  if (!PyLong_Check(value)) {
     PyErr_SetString(PyExc_TypeError, "bus attribute must be integer");
     return -1;
   }
 
-  bus = PyInt_AsLong(value);
+  bus = PyLong_AsLong(value);
   if (bus < 0 || bus > 255) {
     PyErr_SetString(PyExc_TypeError, "bus number must be in range [0,255]");
     return -1;
@@ -846,7 +1554,7 @@ static PyObject *SPIDev_getSpidev(SPIDev *self, void *closure) {
   PyObject *spidev_fd;
   spidev_fd = PyList_New(SPIDev_MAX_CS_PER_BUS);
   for (i=0; i<SPIDev_MAX_CS_PER_BUS; i++) {
-    PyList_SetItem(spidev_fd, i, Py_BuildValue("i", self->spidev_fd[i]));
+    PyList_SetItem(spidev_fd, i, PyLong_FromLong(self->spidev_fd[i]));
   }
   return spidev_fd;
 }
@@ -865,63 +1573,77 @@ static PyGetSetDef SPIDev_getseters[] = {
 };
 
 static PyMethodDef SPIDev_methods[] = {
-  {"open", (PyCFunction)SPIDev_open, METH_NOARGS,
+  {"open", (PyCFunction)SPIDev_open, METH_FASTCALL,
     SPIDev_open__doc__},
-  {"close", (PyCFunction)SPIDev_close, METH_NOARGS,
+  {"close", (PyCFunction)SPIDev_close, METH_FASTCALL,
     SPIDev_close__doc__},
 
-  {"read", (PyCFunction)SPIDev_read, METH_VARARGS,
+  {"read", (PyCFunction)SPIDev_read, METH_FASTCALL,
     SPIDev_read__doc__},
-  {"write", (PyCFunction)SPIDev_write, METH_VARARGS,
+  {"readinto", (PyCFunction)SPIDev_readinto, METH_FASTCALL,
+    SPIDev_readinto__doc__},
+  {"write", (PyCFunction)SPIDev_write, METH_FASTCALL,
     SPIDev_write__doc__},
-  {"transaction", (PyCFunction)SPIDev_transaction, METH_VARARGS,
+  {"transaction", (PyCFunction)SPIDev_transaction, METH_FASTCALL,
     SPIDev_transaction__doc__},
-  {"transfer", (PyCFunction)SPIDev_transfer, METH_VARARGS,
+  {"transactionInto", (PyCFunction)SPIDev_transactionInto, METH_FASTCALL,
+    SPIDev_transactionInto__doc__},
+  {"transfer", (PyCFunction)SPIDev_transfer, METH_FASTCALL,
     SPIDev_transfer__doc__},
-
-  {"setMSBFirst", (PyCFunction)SPIDev_setMSBFirst, METH_VARARGS,
+  {"transferInto", (PyCFunction)SPIDev_transferInto, METH_FASTCALL,
+    SPIDev_transferInto__doc__},
+  {"capture", (PyCFunction)SPIDev_capture, METH_FASTCALL | METH_KEYWORDS,
+    SPIDev_capture__doc__},
+
+  {"aread", (PyCFunction)SPIDev_aread, METH_FASTCALL,
+    SPIDev_aread__doc__},
+  {"awrite", (PyCFunction)SPIDev_awrite, METH_FASTCALL,
+    SPIDev_awrite__doc__},
+  {"atransfer", (PyCFunction)SPIDev_atransfer, METH_FASTCALL,
+    SPIDev_atransfer__doc__},
+
+  {"setMSBFirst", (PyCFunction)SPIDev_setMSBFirst, METH_FASTCALL,
     SPIDev_setMSBFirst__doc__},
-  {"setLSBFirst", (PyCFunction)SPIDev_setLSBFirst, METH_VARARGS,
+  {"setLSBFirst", (PyCFunction)SPIDev_setLSBFirst, METH_FASTCALL,
     SPIDev_setLSBFirst__doc__},
 
-  {"setBitsPerWord", (PyCFunction)SPIDev_setBitsPerWord, METH_VARARGS,
+  {"setBitsPerWord", (PyCFunction)SPIDev_setBitsPerWord, METH_FASTCALL,
     SPIDev_setBitsPerWord__doc__},
 
-  {"setMaxFrequency", (PyCFunction)SPIDev_setMaxFrequency, METH_VARARGS,
+  {"setMaxFrequency", (PyCFunction)SPIDev_setMaxFrequency, METH_FASTCALL,
     SPIDev_setMaxFrequency__doc__},
 
-  {"enableLoopback", (PyCFunction)SPIDev_enableLoopback, METH_VARARGS,
+  {"enableLoopback", (PyCFunction)SPIDev_enableLoopback, METH_FASTCALL,
     SPIDev_enableLoopback__doc__},
-  {"disableLoopback", (PyCFunction)SPIDev_disableLoopback, METH_VARARGS,
+  {"disableLoopback", (PyCFunction)SPIDev_disableLoopback, METH_FASTCALL,
     SPIDev_disableLoopback__doc__},
 
-  {"setClockMode", (PyCFunction)SPIDev_setClockMode, METH_VARARGS,
+  {"setClockMode", (PyCFunction)SPIDev_setClockMode, METH_FASTCALL,
 
     SPIDev_setClockMode__doc__},
-  {"setCSActiveLow", (PyCFunction)SPIDev_setCSActiveLow, METH_VARARGS,
+  {"setCSActiveLow", (PyCFunction)SPIDev_setCSActiveLow, METH_FASTCALL,
     SPIDev_setCSActiveLow__doc__},
-  {"setCSActiveHigh", (PyCFunction)SPIDev_setCSActiveHigh, METH_VARARGS,
+  {"setCSActiveHigh", (PyCFunction)SPIDev_setCSActiveHigh, METH_FASTCALL,
     SPIDev_setCSActiveHigh__doc__},
 
-  {"disableCS", (PyCFunction)SPIDev_disableCS, METH_VARARGS,
+  {"disableCS", (PyCFunction)SPIDev_disableCS, METH_FASTCALL,
     SPIDev_disableCS__doc__},
-  {"enableCS", (PyCFunction)SPIDev_enableCS, METH_VARARGS,
+  {"enableCS", (PyCFunction)SPIDev_enableCS, METH_FASTCALL,
     SPIDev_enableCS__doc__},
 
   {NULL},
 };
 
 static PyTypeObject SPIDev_type = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                        /*ob_size*/
+  PyVarObject_HEAD_INIT(NULL, 0)
   "spidev.SPIDev",                          /*tp_name*/
   sizeof(SPIDev),                           /*tp_basicsize*/
   0,                                        /*tp_itemsize*/
   (destructor)SPIDev_dealloc,               /*tp_dealloc*/
-  0,                                        /*tp_print*/
+  0,                                        /*tp_vectorcall_offset*/
   0,                                        /*tp_getattr*/
   0,                                        /*tp_setattr*/
-  0,                                        /*tp_compare*/
+  0,                                        /*tp_as_async*/
   0,                                        /*tp_repr*/
   0,                                        /*tp_as_number*/
   0,                                        /*tp_as_sequence*/
@@ -954,16 +1676,32 @@ static PyTypeObject SPIDev_type = {
 };
 
 
-#ifndef PyMODINIT_FUNC  /* declarations for DLL import/export */
-#define PyMODINIT_FUNC void
-#endif
-PyMODINIT_FUNC initspidev(void) {
+static struct PyModuleDef SPIDev_module = {
+  PyModuleDef_HEAD_INIT,
+  "spidev",                                 /* m_name */
+  SPIDev_module__doc__,                     /* m_doc */
+  -1,                                       /* m_size */
+  NULL,                                     /* m_methods */
+};
+
+PyMODINIT_FUNC PyInit_spidev(void) {
   PyObject* m;
 
-  SPIDev_type.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&SPIDev_type) < 0) return;
+  if (PyType_Ready(&SPIDev_type) < 0) return NULL;
 
-  m = Py_InitModule3("spidev", SPIDev_methods, SPIDev_module__doc__);
+  m = PyImport_ImportModule("array");
+  if (!m) return NULL;
+  SPIDev_array_type = PyObject_GetAttrString(m, "array");
+  Py_DECREF(m);
+  if (!SPIDev_array_type) return NULL;
+
+  m = PyModule_Create(&SPIDev_module);
+  if (!m) return NULL;
   Py_INCREF(&SPIDev_type);
-  PyModule_AddObject(m, "SPIDev", (PyObject *)&SPIDev_type);
-}
\ No newline at end of file
+  if (PyModule_AddObject(m, "SPIDev", (PyObject *)&SPIDev_type) < 0) {
+    Py_DECREF(&SPIDev_type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
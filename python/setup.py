@@ -3,12 +3,25 @@ from setuptools import setup, Extension
 extensions = [
   Extension("serbus.spidev",
             ["serbus/pyspidev.c",
-             "src/spidriver.c"],
+             "src/spidriver.c",
+             "src/spipack.c",
+             "src/fdmap.c",
+             "src/bufpool.c",
+             "src/transport.c",
+             "src/simbus.c",
+             "src/simdevices.c"],
             include_dirs=["include"]),
 
   Extension("serbus.i2cdev",
             ["serbus/pyi2cdev.c",
-             "src/i2cdriver.c"],
+             "src/i2cdriver.c",
+             "src/smbus.c",
+             "src/crc.c",
+             "src/fdmap.c",
+             "src/bufpool.c",
+             "src/transport.c",
+             "src/simbus.c",
+             "src/simdevices.c"],
             include_dirs=["include"]),
   ]
 
@@ -24,9 +37,14 @@ setup(name="serbus",
       keywords=["I2C", "SPI", "serial", "Linux"],
       packages=["serbus"],
       ext_modules=extensions, 
+      python_requires=">=3.7",
+      extras_require={"numpy": ["numpy"]},
       classifiers=[
         "License :: OSI Approved :: MIT License",
         "Operating System :: POSIX :: Linux",
+        "Programming Language :: C",
+        "Programming Language :: Python :: 3",
+        "Programming Language :: Python :: 3 :: Only",
         "Topic :: Software Development :: Embedded Systems",
         "Topic :: Software Development :: Libraries :: Python Modules",
         "Topic :: System :: Hardware"
@@ -0,0 +1,73 @@
+# test_async.py
+# Checks the asyncio methods of serbus.I2CDev against the simulated buses, so
+# no hardware is needed. See test_spidev.py for how to run.
+import asyncio, errno, os, tempfile, unittest
+
+# Must be set before the first bus is opened:
+os.environ["SERBUS_TRANSPORT"] = "sim"
+import serbus
+
+htu21d_bus      = 1    # Simulated HTU21D on /dev/i2c-1
+htu21d_addr     = 0x40
+htu21d_cmd_temp = 0xe3 # Command to read temperature
+
+class TestEventLoops(unittest.TestCase):
+
+  def setUp(self):
+    self.i2c = serbus.I2CDev(htu21d_bus)
+    self.i2c.open()
+
+  def tearDown(self):
+    self.i2c.close()
+
+  def readTemp(self):
+    return self.i2c.areadTransaction(htu21d_addr, htu21d_cmd_temp, 3)
+
+  def test_cancelled_then_new_loop(self):
+    async def cancelAll():
+      for future in [self.readTemp() for _ in range(1000)]:
+        future.cancel()
+
+    async def read():
+      return await self.readTemp()
+
+    # The loop is closed as soon as the futures are cancelled, before the
+    # transfers are all done:
+    loop = asyncio.new_event_loop()
+    try:
+      loop.run_until_complete(cancelAll())
+    finally:
+      loop.close()
+    self.assertEqual(len(asyncio.run(read())), 3)
+    # And again once the first loop's transfers have all been freed:
+    self.assertEqual(len(asyncio.run(read())), 3)
+
+  def test_two_open_loops(self):
+    loop = asyncio.new_event_loop()
+    try:
+      future = loop.run_until_complete(self.makeFuture())
+      # The first loop is still open, so its transfers can't be moved:
+      with self.assertRaises(RuntimeError):
+        asyncio.run(self.makeFuture())
+      self.assertEqual(len(loop.run_until_complete(future)), 3)
+    finally:
+      loop.close()
+
+  def test_closed(self):
+    async def write():
+      await self.i2c.awrite(htu21d_addr, b"CORRUPT")
+
+    self.i2c.close()
+    # Whatever reuses the closed interface's fd mustn't be written to:
+    with tempfile.TemporaryFile() as f:
+      with self.assertRaises(OSError) as context:
+        asyncio.run(write())
+      self.assertEqual(context.exception.errno, errno.EBADF)
+      f.seek(0)
+      self.assertEqual(f.read(), b"")
+
+  async def makeFuture(self):
+    return self.readTemp()
+
+if __name__ == "__main__":
+  unittest.main()
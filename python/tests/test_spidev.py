@@ -0,0 +1,33 @@
+# test_spidev.py
+# Checks serbus.SPIDev against the simulated buses, so no hardware is needed.
+# Run from the python directory after building in place:
+#   python setup.py build_ext --inplace && python -m unittest discover tests
+import array, os, unittest
+
+# Must be set before the first bus is opened:
+os.environ["SERBUS_TRANSPORT"] = "sim"
+import serbus
+
+adc_bus    = 0    # Simulated 12-bit ramp ADC on /dev/spidev0.1
+adc_cs     = 1
+adc_frames = 1000 # More frames than one SPI_IOC_MESSAGE can hold
+
+class TestCapture(unittest.TestCase):
+
+  def setUp(self):
+    self.spi = serbus.SPIDev(adc_bus)
+    self.spi.open()
+    self.spi.setBitsPerWord(adc_cs, 16)
+
+  def tearDown(self):
+    self.spi.close()
+
+  def test_many_frames(self):
+    # The ADC restarts its ramp each time it's selected, so every frame
+    # should read the same two samples:
+    out = array.array('H', [0xffff] * (2 * adc_frames))
+    self.assertIs(self.spi.capture(adc_cs, 2, adc_frames, out=out), out)
+    self.assertEqual(out.tolist(), [0, 1] * adc_frames)
+
+if __name__ == "__main__":
+  unittest.main()
@@ -0,0 +1,98 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file bufpool.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Internal pool of reusable, page-aligned transfer buffers.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bufpool.h"
+
+/**
+ * Allocates a buffer of at least \p size bytes aligned to the page size.
+ */
+static void *BufPool_allocPages(size_t size) {
+  void *buffer;
+  long page_size;
+  page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0) page_size = 4096;
+  // posix_memalign may return NULL for 0 bytes:
+  if (posix_memalign(&buffer, page_size, size ? size : 1)) return NULL;
+  return buffer;
+}
+
+void *BufPool_alloc(BufPool *pool, size_t buffer_size, size_t size) {
+  long page_size;
+  void *buffer;
+  int i;
+  pthread_mutex_lock(&pool->lock);
+  if (!pool->buffer_size) {
+    page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) page_size = 4096;
+    pool->buffer_size = (buffer_size + page_size - 1) / page_size * page_size;
+    if (!pool->buffer_size) pool->buffer_size = page_size;
+  }
+  if (size <= pool->buffer_size) {
+    for (i=0; i<pool->n_buffers; i++) {
+      if (!pool->in_use[i]) {
+        pool->in_use[i] = 1;
+        pthread_mutex_unlock(&pool->lock);
+        return pool->buffers[i];
+      }
+    }
+    if (pool->n_buffers < BUFPOOL_MAX_BUFFERS) {
+      buffer = BufPool_allocPages(pool->buffer_size);
+      if (buffer) {
+        pool->buffers[pool->n_buffers] = buffer;
+        pool->in_use[pool->n_buffers] = 1;
+        pool->n_buffers++;
+      }
+      pthread_mutex_unlock(&pool->lock);
+      return buffer;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return BufPool_allocPages(size);
+}
+
+void BufPool_release(BufPool *pool, void *buffer) {
+  int i;
+  if (!buffer) return;
+  pthread_mutex_lock(&pool->lock);
+  for (i=0; i<pool->n_buffers; i++) {
+    if (pool->buffers[i] == buffer) {
+      pool->in_use[i] = 0;
+      pthread_mutex_unlock(&pool->lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  // Not one of the pool's, so it was a one-off allocation:
+  free(buffer);
+}
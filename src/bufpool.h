@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file bufpool.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Internal pool of reusable, page-aligned transfer buffers.
+ *
+ * Backs the SPI_allocBuffer/SPI_releaseBuffer and I2C_allocBuffer/
+ * I2C_releaseBuffer APIs so that the transfer hot paths don't need a malloc
+ * and free per call. Each pool keeps up to #BUFPOOL_MAX_BUFFERS buffers of a
+ * single size, allocated the first time they're needed and then reused. 
+ * Requests larger than that size, or made while every pooled buffer is in 
+ * use, get a one-off page-aligned allocation that's freed when released. Not
+ * part of the public API.
+ */
+
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/// Maximum number of buffers kept by each pool
+#define BUFPOOL_MAX_BUFFERS 16
+
+/**
+ * A thread-safe pool of equally sized, page-aligned buffers.
+ */
+typedef struct {
+  size_t buffer_size;                  ///< Size of each buffer, 0 until used
+  int n_buffers;                       ///< Number of buffers allocated so far
+  void *buffers[BUFPOOL_MAX_BUFFERS];  ///< The pooled buffers
+  uint8_t in_use[BUFPOOL_MAX_BUFFERS]; ///< Set while a buffer is handed out
+  pthread_mutex_t lock;                ///< Protects all of the above
+} BufPool;
+
+/// Static initializer for an empty #BufPool
+#define BUFPOOL_INITIALIZER { 0, 0, { NULL }, { 0 }, PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * @brief Gets a page-aligned buffer of at least \p size bytes from the pool.
+ *
+ * @param pool the pool to allocate from
+ * @param buffer_size the size of the pool's buffers; only used by the first
+ *        call for a pool, and rounded up to a whole number of pages
+ * @param size the number of bytes needed
+ *
+ * @return Returns the buffer, or NULL if unable to allocate it
+ */
+void *BufPool_alloc(BufPool *pool, size_t buffer_size, size_t size);
+
+/**
+ * @brief Returns a buffer from #BufPool_alloc to the pool.
+ *
+ * @param pool the pool the buffer came from
+ * @param buffer the buffer to release, or NULL to do nothing
+ */
+void BufPool_release(BufPool *pool, void *buffer);
+
+#endif // _BUFPOOL_H_
@@ -0,0 +1,335 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file crc.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief CRCs used to check sensor data and SMBus transfers.
+ *
+ * The slicing-by-8 tables hold, for each byte value, its CRC followed by 0-7
+ * zero bytes, so 8 bytes can be folded into the CRC with 8 independent 
+ * lookups. They're built on first use.
+ *
+ * The CRC-32 kernels handle as many whole blocks as they can and return the
+ * number of bytes they consumed; the tables finish the rest. The kernel is 
+ * picked once at runtime based on the CPU's features.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_X86
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC_ARM
+#include <arm_acle.h>
+#endif
+
+/// Polynomial of the HTU21D/Sensirion CRC-8
+#define CRC8_POLY       0x31
+/// Polynomial of the SMBus PEC
+#define CRC8_SMBUS_POLY 0x07
+/// Polynomial of CRC-16/CCITT
+#define CRC16_POLY      0x1021
+/// Polynomial of CRC-32, bit reversed
+#define CRC32_POLY      0xedb88320
+
+/**
+ * Folds whole blocks of data into a CRC-32 (in its inverted form), returning
+ * the number of bytes consumed.
+ */
+typedef size_t (*CRC_crc32_kernel)(uint32_t *crc, const uint8_t *data, 
+                                   size_t n_bytes);
+
+static uint8_t CRC_table8[8][256];
+static uint8_t CRC_tableSMBus[8][256];
+static uint16_t CRC_table16[8][256];
+static uint32_t CRC_table32[8][256];
+/// The CRC-32 kernel selected for this CPU, or NULL for the tables only
+static CRC_crc32_kernel CRC_kernel32;
+static pthread_once_t CRC_init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fills in the slicing tables of an unreflected CRC-8.
+ */
+static void CRC_buildTable8(uint8_t table[8][256], uint8_t poly) {
+  int i, bit, k;
+  uint8_t crc;
+  for (i=0; i<256; i++) {
+    crc = i;
+    for (bit=0; bit<8; bit++) crc = (crc & 0x80) ? (crc << 1) ^ poly : crc << 1;
+    table[0][i] = crc;
+  }
+  for (k=1; k<8; k++) {
+    for (i=0; i<256; i++) table[k][i] = table[0][table[k-1][i]];
+  }
+}
+
+/**
+ * Fills in the slicing tables of an unreflected CRC-16.
+ */
+static void CRC_buildTable16(uint16_t table[8][256], uint16_t poly) {
+  int i, bit, k;
+  uint16_t crc;
+  for (i=0; i<256; i++) {
+    crc = i << 8;
+    for (bit=0; bit<8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ poly : crc << 1;
+    }
+    table[0][i] = crc;
+  }
+  for (k=1; k<8; k++) {
+    for (i=0; i<256; i++) {
+      table[k][i] = (table[k-1][i] << 8) ^ table[0][table[k-1][i] >> 8];
+    }
+  }
+}
+
+/**
+ * Fills in the slicing tables of a reflected CRC-32.
+ */
+static void CRC_buildTable32(uint32_t table[8][256], uint32_t poly) {
+  int i, bit, k;
+  uint32_t crc;
+  for (i=0; i<256; i++) {
+    crc = i;
+    for (bit=0; bit<8; bit++) crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+    table[0][i] = crc;
+  }
+  for (k=1; k<8; k++) {
+    for (i=0; i<256; i++) {
+      table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 0xff];
+    }
+  }
+}
+
+#ifdef CRC_X86
+
+#define CRC_CLMUL __attribute__((target("pclmul,sse4.1")))
+
+/// Multiplies the low (0x00) or high (0x11) halves of two vectors
+#define CRC_clmul(a, b, imm) _mm_clmulepi64_si128(a, b, imm)
+
+/**
+ * CRC-32 by folding 64 bytes at a time with carry-less multiplication, then
+ * reducing with Barrett reduction, as described in Intel's "Fast CRC 
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction". The 
+ * constants are for the bit-reflected CRC-32 polynomial. Needs at least 64 
+ * bytes, and consumes a multiple of 16.
+ */
+CRC_CLMUL static size_t CRC_crc32CLMUL(uint32_t *crc, const uint8_t *data, 
+                                       size_t n_bytes) {
+  static const uint64_t k1k2[2] __attribute__((aligned(16))) = 
+    { 0x0154442bd4, 0x01c6e41596 };
+  static const uint64_t k3k4[2] __attribute__((aligned(16))) = 
+    { 0x01751997d0, 0x00ccaa009e };
+  static const uint64_t k5k0[2] __attribute__((aligned(16))) = 
+    { 0x0163cd6124, 0x0000000000 };
+  static const uint64_t poly[2] __attribute__((aligned(16))) = 
+    { 0x01db710641, 0x01f7011641 };
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, mask;
+  size_t n_left;
+
+  if (n_bytes < 64) return 0;
+  n_left = n_bytes & ~(size_t) 15;
+  n_bytes = n_left;
+
+  x1 = _mm_loadu_si128((const __m128i *) (data + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *) (data + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *) (data + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *) (data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(*crc));
+  x0 = _mm_load_si128((const __m128i *) k1k2);
+  data += 64;
+  n_left -= 64;
+
+  // Fold 4 blocks of 16 bytes in parallel:
+  while (n_left >= 64) {
+    x5 = CRC_clmul(x1, x0, 0x00);
+    x6 = CRC_clmul(x2, x0, 0x00);
+    x7 = CRC_clmul(x3, x0, 0x00);
+    x8 = CRC_clmul(x4, x0, 0x00);
+    x1 = CRC_clmul(x1, x0, 0x11);
+    x2 = CRC_clmul(x2, x0, 0x11);
+    x3 = CRC_clmul(x3, x0, 0x11);
+    x4 = CRC_clmul(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), 
+                       _mm_loadu_si128((const __m128i *) (data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), 
+                       _mm_loadu_si128((const __m128i *) (data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), 
+                       _mm_loadu_si128((const __m128i *) (data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), 
+                       _mm_loadu_si128((const __m128i *) (data + 0x30)));
+    data += 64;
+    n_left -= 64;
+  }
+
+  // Fold the 4 blocks into 1:
+  x0 = _mm_load_si128((const __m128i *) k3k4);
+  x5 = CRC_clmul(x1, x0, 0x00);
+  x1 = CRC_clmul(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = CRC_clmul(x1, x0, 0x00);
+  x1 = CRC_clmul(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = CRC_clmul(x1, x0, 0x00);
+  x1 = CRC_clmul(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Fold in any remaining 16 byte blocks:
+  while (n_left >= 16) {
+    x5 = CRC_clmul(x1, x0, 0x00);
+    x1 = CRC_clmul(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, 
+                         _mm_loadu_si128((const __m128i *) data)), x5);
+    data += 16;
+    n_left -= 16;
+  }
+
+  // Reduce 128 bits to 64:
+  x2 = CRC_clmul(x1, x0, 0x10);
+  mask = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_srli_si128(x1, 8);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask);
+  x1 = CRC_clmul(x1, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits:
+  x0 = _mm_load_si128((const __m128i *) poly);
+  x2 = _mm_and_si128(x1, mask);
+  x2 = CRC_clmul(x2, x0, 0x10);
+  x2 = _mm_and_si128(x2, mask);
+  x2 = CRC_clmul(x2, x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  *crc = _mm_extract_epi32(x1, 1);
+  return n_bytes;
+}
+
+#endif // CRC_X86
+
+#ifdef CRC_ARM
+
+/**
+ * CRC-32 with the ARMv8 CRC32 instructions, 8 bytes at a time.
+ */
+static size_t CRC_crc32ARM(uint32_t *crc, const uint8_t *data, 
+                           size_t n_bytes) {
+  uint64_t word;
+  size_t n_done;
+  for (n_done=0; n_done+8<=n_bytes; n_done+=8) {
+    memcpy(&word, data + n_done, 8);
+    *crc = __crc32d(*crc, word);
+  }
+  return n_done;
+}
+
+#endif // CRC_ARM
+
+static void CRC_init(void) {
+  CRC_buildTable8(CRC_table8, CRC8_POLY);
+  CRC_buildTable8(CRC_tableSMBus, CRC8_SMBUS_POLY);
+  CRC_buildTable16(CRC_table16, CRC16_POLY);
+  CRC_buildTable32(CRC_table32, CRC32_POLY);
+#ifdef CRC_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+    CRC_kernel32 = CRC_crc32CLMUL;
+  }
+#elif defined(CRC_ARM)
+  CRC_kernel32 = CRC_crc32ARM;
+#endif
+}
+
+/**
+ * Unreflected CRC-8 with the given tables.
+ */
+static uint8_t CRC_slice8(uint8_t table[8][256], uint8_t crc, 
+                          const uint8_t *data, size_t n_bytes) {
+  while (n_bytes >= 8) {
+    crc = table[7][data[0] ^ crc] ^ table[6][data[1]] ^ 
+      table[5][data[2]] ^ table[4][data[3]] ^ table[3][data[4]] ^ 
+      table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+    data += 8;
+    n_bytes -= 8;
+  }
+  while (n_bytes--) crc = table[0][crc ^ *data++];
+  return crc;
+}
+
+uint8_t CRC_crc8(uint8_t crc, const void *data, size_t n_bytes) {
+  pthread_once(&CRC_init_once, CRC_init);
+  return CRC_slice8(CRC_table8, crc, data, n_bytes);
+}
+
+uint8_t CRC_smbusPEC(uint8_t crc, const void *data, size_t n_bytes) {
+  pthread_once(&CRC_init_once, CRC_init);
+  return CRC_slice8(CRC_tableSMBus, crc, data, n_bytes);
+}
+
+uint16_t CRC_crc16(uint16_t crc, const void *data, size_t n_bytes) {
+  const uint8_t *bytes = data;
+  uint16_t (*table)[256] = CRC_table16;
+  pthread_once(&CRC_init_once, CRC_init);
+  while (n_bytes >= 8) {
+    crc = table[7][bytes[0] ^ (crc >> 8)] ^ table[6][bytes[1] ^ (crc & 0xff)] ^
+      table[5][bytes[2]] ^ table[4][bytes[3]] ^ table[3][bytes[4]] ^ 
+      table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+    bytes += 8;
+    n_bytes -= 8;
+  }
+  while (n_bytes--) crc = (crc << 8) ^ table[0][(crc >> 8) ^ *bytes++];
+  return crc;
+}
+
+uint32_t CRC_crc32(uint32_t crc, const void *data, size_t n_bytes) {
+  const uint8_t *bytes = data;
+  uint32_t (*table)[256] = CRC_table32;
+  size_t n_done;
+  pthread_once(&CRC_init_once, CRC_init);
+  crc = ~crc;
+  if (CRC_kernel32) {
+    n_done = CRC_kernel32(&crc, bytes, n_bytes);
+    bytes += n_done;
+    n_bytes -= n_done;
+  }
+  while (n_bytes >= 8) {
+    crc = table[7][bytes[0] ^ (crc & 0xff)] ^ 
+      table[6][bytes[1] ^ ((crc >> 8) & 0xff)] ^
+      table[5][bytes[2] ^ ((crc >> 16) & 0xff)] ^ 
+      table[4][bytes[3] ^ (crc >> 24)] ^ table[3][bytes[4]] ^ 
+      table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+    bytes += 8;
+    n_bytes -= 8;
+  }
+  while (n_bytes--) crc = (crc >> 8) ^ table[0][(crc ^ *bytes++) & 0xff];
+  return ~crc;
+}
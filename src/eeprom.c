@@ -0,0 +1,208 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file eeprom.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Fast reading and writing of 24Cxx-style I2C EEPROMs.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/i2c-dev.h>
+#include "eeprom.h"
+#include "i2cdriver.h"
+
+/// The largest message i2c-dev accepts
+#define EEPROM_MAX_MESSAGE 8192
+/// Address/read message pairs that fit in one I2C_RDWR
+#define EEPROM_MAX_CHUNKS (I2C_RDWR_IOCTL_MAX_MSGS / 2)
+/// Time between ACK polls, so a busy EEPROM doesn't monopolise the bus
+#define EEPROM_POLL_US 100
+
+/**
+ * Checks the config, and that the given range of memory is in the EEPROM.
+ */
+static int EEPROM_check(const EEPROM_config *config, uint32_t mem_addr, 
+                        uint32_t n_bytes) {
+  if (config->addr_bytes < 1 || config->addr_bytes > 2 ||
+      config->page_size == 0 || 
+      (config->page_size & (config->page_size - 1)) != 0 ||
+      mem_addr > config->size || n_bytes > config->size - mem_addr) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Gets the slave address to use for the given memory address. Memory 
+ * address bits above the address bytes go in the slave address.
+ */
+static uint16_t EEPROM_slaveAddress(const EEPROM_config *config, 
+                                    uint32_t mem_addr) {
+  return config->addr | (mem_addr >> (8 * config->addr_bytes));
+}
+
+/**
+ * Puts the low address bytes of the memory address in the given buffer, MSB
+ * first.
+ */
+static void EEPROM_encodeAddress(const EEPROM_config *config, 
+                                 uint32_t mem_addr, uint8_t *buffer) {
+  if (config->addr_bytes == 2) {
+    buffer[0] = mem_addr >> 8;
+    buffer[1] = mem_addr;
+  }
+  else {
+    buffer[0] = mem_addr;
+  }
+}
+
+/**
+ * Checks whether the given errno is what adapter drivers give for a NAK.
+ */
+static int EEPROM_isNak(int error) {
+  return error == ENXIO || error == EREMOTEIO || error == EIO;
+}
+
+static uint64_t EEPROM_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int EEPROM_waitReady(int i2c_fd, const EEPROM_config *config) {
+  // Polling does its own retrying, so mustn't be slowed by the fd's policy:
+  static const I2C_retry_policy no_retries;
+  I2C_message message;
+  uint64_t deadline;
+  uint8_t dummy;
+
+  deadline = EEPROM_now() + (config->write_timeout_us ? 
+                             config->write_timeout_us : 
+                             EEPROM_DEFAULT_TIMEOUT_US);
+  // Poll with address-only writes:
+  message.addr = config->addr;
+  message.flags = 0;
+  message.n_bytes = 0;
+  message.buffer = &dummy;
+  for (;;) {
+    if (I2C_transferEx(i2c_fd, &message, 1, &no_retries) == 0) return 0;
+    if (errno == EOPNOTSUPP && message.n_bytes == 0) {
+      // The adapter can't send zero length messages, poll with 1 byte reads
+      // instead, which don't change any memory:
+      message.flags = I2C_M_RD;
+      message.n_bytes = 1;
+      continue;
+    }
+    if (!EEPROM_isNak(errno)) return -1;
+    if (EEPROM_now() >= deadline) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    usleep(EEPROM_POLL_US);
+  }
+}
+
+int EEPROM_read(int i2c_fd, const EEPROM_config *config, uint32_t mem_addr,
+                void *rx_buffer, uint32_t n_bytes) {
+  uint8_t addresses[EEPROM_MAX_CHUNKS][2];
+  I2C_message messages[EEPROM_MAX_CHUNKS * 2];
+  uint8_t *rx = (uint8_t *) rx_buffer;
+  uint32_t block_size, chunk;
+  int n_chunks;
+
+  if (EEPROM_check(config, mem_addr, n_bytes) < 0) return -1;
+  // The range reachable by the address bytes for one slave address:
+  block_size = 1 << (8 * config->addr_bytes);
+
+  while (n_bytes > 0) {
+    // Fit as many sequential reads as possible into one I2C_RDWR:
+    for (n_chunks=0; n_chunks<EEPROM_MAX_CHUNKS && n_bytes>0; n_chunks++) {
+      chunk = block_size - (mem_addr & (block_size - 1));
+      if (chunk > EEPROM_MAX_MESSAGE) chunk = EEPROM_MAX_MESSAGE;
+      if (chunk > n_bytes) chunk = n_bytes;
+      EEPROM_encodeAddress(config, mem_addr, addresses[n_chunks]);
+      messages[2*n_chunks].addr = EEPROM_slaveAddress(config, mem_addr);
+      messages[2*n_chunks].flags = 0;
+      messages[2*n_chunks].n_bytes = config->addr_bytes;
+      messages[2*n_chunks].buffer = addresses[n_chunks];
+      messages[2*n_chunks+1].addr = messages[2*n_chunks].addr;
+      messages[2*n_chunks+1].flags = I2C_M_RD;
+      messages[2*n_chunks+1].n_bytes = chunk;
+      messages[2*n_chunks+1].buffer = rx;
+      mem_addr += chunk;
+      rx += chunk;
+      n_bytes -= chunk;
+    }
+    if (I2C_transfer(i2c_fd, messages, 2 * n_chunks) < 0) return -1;
+  }
+  return 0;
+}
+
+int EEPROM_write(int i2c_fd, const EEPROM_config *config, uint32_t mem_addr,
+                 const void *tx_buffer, uint32_t n_bytes) {
+  const uint8_t *tx = (const uint8_t *) tx_buffer;
+  I2C_message message;
+  uint8_t *buffer;
+  uint32_t chunk;
+  int ret, first;
+
+  if (EEPROM_check(config, mem_addr, n_bytes) < 0) return -1;
+  buffer = I2C_allocBuffer(config->addr_bytes + config->page_size);
+  if (!buffer) return -1;
+
+  ret = 0;
+  first = 1;
+  while (ret == 0 && n_bytes > 0) {
+    // Writes wrap around within a page, so never cross a page boundary:
+    chunk = config->page_size - (mem_addr & (config->page_size - 1));
+    if (chunk > n_bytes) chunk = n_bytes;
+    EEPROM_encodeAddress(config, mem_addr, buffer);
+    memcpy(&buffer[config->addr_bytes], tx, chunk);
+    message.addr = EEPROM_slaveAddress(config, mem_addr);
+    message.flags = 0;
+    message.n_bytes = config->addr_bytes + chunk;
+    message.buffer = buffer;
+
+    ret = I2C_transfer(i2c_fd, &message, 1);
+    // The EEPROM may still be busy with a write from before this call:
+    if (ret < 0 && first && EEPROM_isNak(errno)) {
+      ret = EEPROM_waitReady(i2c_fd, config);
+      if (ret == 0) ret = I2C_transfer(i2c_fd, &message, 1);
+    }
+    if (ret == 0) ret = EEPROM_waitReady(i2c_fd, config);
+
+    first = 0;
+    mem_addr += chunk;
+    tx += chunk;
+    n_bytes -= chunk;
+  }
+  I2C_releaseBuffer(buffer);
+  return ret;
+}
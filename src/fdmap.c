@@ -0,0 +1,82 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file fdmap.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Internal table for attaching per-file-descriptor state to open bus
+ *        interfaces.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fdmap.h"
+
+/// Minimum number of slots allocated the first time a map grows
+#define FDMAP_MIN_SLOTS 16
+
+int FDMap_set(FDMap *map, int fd, void *value) {
+  void **slots;
+  int n_slots;
+  if (fd < 0) return -1;
+  pthread_mutex_lock(&map->lock);
+  if (fd >= map->n_slots) {
+    n_slots = map->n_slots ? map->n_slots : FDMAP_MIN_SLOTS;
+    while (n_slots <= fd) n_slots <<= 1;
+    slots = realloc(map->slots, n_slots * sizeof(void *));
+    if (!slots) {
+      pthread_mutex_unlock(&map->lock);
+      return -1;
+    }
+    memset((void *) &slots[map->n_slots], 0, 
+           (n_slots - map->n_slots) * sizeof(void *));
+    map->slots = slots;
+    map->n_slots = n_slots;
+  }
+  map->slots[fd] = value;
+  pthread_mutex_unlock(&map->lock);
+  return 0;
+}
+
+void *FDMap_get(FDMap *map, int fd) {
+  void *value = NULL;
+  if (fd < 0) return NULL;
+  pthread_mutex_lock(&map->lock);
+  if (fd < map->n_slots) value = map->slots[fd];
+  pthread_mutex_unlock(&map->lock);
+  return value;
+}
+
+void *FDMap_remove(FDMap *map, int fd) {
+  void *value = NULL;
+  if (fd < 0) return NULL;
+  pthread_mutex_lock(&map->lock);
+  if (fd < map->n_slots) {
+    value = map->slots[fd];
+    map->slots[fd] = NULL;
+  }
+  pthread_mutex_unlock(&map->lock);
+  return value;
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file fdmap.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Internal table for attaching per-file-descriptor state to open bus
+ *        interfaces.
+ *
+ * The public C APIs identify interfaces by file descriptor, so any state the
+ * drivers want to keep between calls (cached settings, etc.) is looked up by
+ * fd through one of these tables. Not part of the public API.
+ */
+
+#ifndef _FDMAP_H_
+#define _FDMAP_H_
+
+#include <pthread.h>
+
+/**
+ * A thread-safe map from file descriptors to opaque pointers.
+ */
+typedef struct {
+  void **slots;         ///< Array of values indexed by fd
+  int n_slots;          ///< Current length of slots
+  pthread_mutex_t lock; ///< Protects slots and n_slots
+} FDMap;
+
+/// Static initializer for an empty #FDMap
+#define FDMAP_INITIALIZER { NULL, 0, PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * @brief Stores \p value for the given fd, replacing any existing value.
+ *
+ * @param map the map to store into
+ * @param fd file descriptor to use as the key
+ * @param value the pointer to store
+ *
+ * @return Returns 0 if successful, or -1 if error
+ */
+int FDMap_set(FDMap *map, int fd, void *value);
+
+/**
+ * @brief Gets the value stored for the given fd.
+ *
+ * @param map the map to look in
+ * @param fd file descriptor to look up
+ *
+ * @return Returns the stored pointer, or NULL if nothing is stored for \p fd
+ */
+void *FDMap_get(FDMap *map, int fd);
+
+/**
+ * @brief Removes and returns the value stored for the given fd.
+ *
+ * @param map the map to remove from
+ * @param fd file descriptor to remove
+ *
+ * @return Returns the removed pointer, or NULL if nothing was stored
+ */
+void *FDMap_remove(FDMap *map, int fd);
+
+#endif // _FDMAP_H_
@@ -33,68 +33,536 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "i2cdriver.h"
+#include "fdmap.h"
+#include "bufpool.h"
+#include "transport.h"
 
 /// Buffer size at least large enough to fit the max length of "/dev/i2c-N"
 #define I2C_PATH_LEN   20 
+/// The most messages the kernel accepts in one I2C_RDWR ioctl
+#define I2C_MAX_MESSAGES I2C_RDWR_IOCTL_MAX_MSGS
+
+/**
+ * What the driver remembers about an interface opened with #I2C_open. The
+ * I2C_RDWR ioctl takes the slave address in each message rather than using
+ * the one set with I2C_SLAVE, so it's tracked here.
+ */
+typedef struct {
+  int addr;                ///< Current slave address, or -1 if not set yet
+  uint16_t flags;          ///< I2C_M_TEN if 10-bit addressing is enabled
+  int have_funcs;          ///< Set once funcs has been read from the adapter
+  unsigned long funcs;     ///< The adapter's I2C_FUNCS capabilities
+  pthread_mutex_t lock;    ///< Protects policy and crc_check
+  I2C_retry_policy policy; ///< Retry policy for transfers on this fd
+  I2C_retry_stats stats;   ///< Retry counters, updated atomically
+  I2C_crc_check crc_check; ///< How read transactions are checked
+  I2C_crc_stats crc_stats; ///< CRC counters, updated atomically
+} I2C_state;
+
+/// State of the interfaces opened with I2C_open, indexed by fd
+static FDMap I2C_states = FDMAP_INITIALIZER;
 
 int I2C_open(uint8_t bus) {
   char device[I2C_PATH_LEN];
+  int i2c_fd;
+  I2C_state *state;
   sprintf(device, "/dev/i2c-%d", bus);
-  return open(device, O_RDWR, 0);
+  i2c_fd = Transport_open(device, O_RDWR);
+  if (i2c_fd < 0) return i2c_fd;
+
+  // Without state the combined transfers fall back to write() then read(),
+  // so failing to allocate it isn't fatal:
+  state = calloc(1, sizeof(I2C_state));
+  if (state) {
+    state->addr = -1;
+    pthread_mutex_init(&state->lock, NULL);
+    if (FDMap_set(&I2C_states, i2c_fd, state) < 0) {
+      pthread_mutex_destroy(&state->lock);
+      free(state);
+    }
+    else I2C_getFunctionality(i2c_fd, &state->funcs);
+  }
+  return i2c_fd;
 }
 
 void I2C_close(int i2c_fd) {
-  close(i2c_fd);
+  I2C_state *state;
+  state = FDMap_remove(&I2C_states, i2c_fd);
+  if (state) {
+    pthread_mutex_destroy(&state->lock);
+    free(state);
+  }
+  Transport_close(i2c_fd);
+}
+
+/// Pool of page-sized transfer buffers
+static BufPool I2C_buffers = BUFPOOL_INITIALIZER;
+
+void *I2C_allocBuffer(uint32_t n_bytes) {
+  // A buffer size of 0 gets rounded up to one page:
+  return BufPool_alloc(&I2C_buffers, 0, n_bytes);
+}
+
+void I2C_releaseBuffer(void *buffer) {
+  BufPool_release(&I2C_buffers, buffer);
+}
+
+int I2C_getFunctionality(int i2c_fd, unsigned long *funcs) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (state && state->have_funcs) {
+    *funcs = state->funcs;
+    return 0;
+  }
+  if (Transport_ioctl(i2c_fd, I2C_FUNCS, funcs) < 0) return -1;
+  if (state) {
+    state->funcs = *funcs;
+    state->have_funcs = 1;
+  }
+  return 0;
+}
+
+int I2C_setTimeout(int i2c_fd, uint32_t timeout_ms) {
+  // I2C_TIMEOUT is in units of 10ms, round up so the timeout isn't shorter
+  // than asked for:
+  return Transport_ioctl(i2c_fd, I2C_TIMEOUT, 
+                         (unsigned long) (timeout_ms + 9) / 10) < 0 ? -1 : 0;
+}
+
+int I2C_setRetries(int i2c_fd, uint32_t retries) {
+  return Transport_ioctl(i2c_fd, I2C_RETRIES, 
+                         (unsigned long) retries) < 0 ? -1 : 0;
+}
+
+int I2C_setRetryPolicy(int i2c_fd, const I2C_retry_policy *policy) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&state->lock);
+  if (policy) state->policy = *policy;
+  else memset(&state->policy, 0, sizeof(I2C_retry_policy));
+  pthread_mutex_unlock(&state->lock);
+  return 0;
+}
+
+int I2C_getRetryStats(int i2c_fd, I2C_retry_stats *stats) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  stats->transfers = __atomic_load_n(&state->stats.transfers, 
+                                     __ATOMIC_RELAXED);
+  stats->retries = __atomic_load_n(&state->stats.retries, __ATOMIC_RELAXED);
+  stats->recovered = __atomic_load_n(&state->stats.recovered, 
+                                     __ATOMIC_RELAXED);
+  stats->failed = __atomic_load_n(&state->stats.failed, __ATOMIC_RELAXED);
+  return 0;
+}
+
+int I2C_resetRetryStats(int i2c_fd) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  __atomic_store_n(&state->stats.transfers, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->stats.retries, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->stats.recovered, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->stats.failed, 0, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/**
+ * Tracks the attempts at one transfer under a retry policy.
+ */
+typedef struct {
+  I2C_retry_policy policy; ///< Policy in use
+  I2C_state *state;        ///< State to count into, or NULL
+  uint64_t start;          ///< Time of the first attempt in microseconds
+  uint32_t backoff_us;     ///< Wait before the next retry
+  int attempts;            ///< Attempts made so far
+} I2C_retry;
+
+static uint64_t I2C_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Starts tracking a transfer, using the given policy or the fd's if NULL.
+ */
+static void I2C_retryBegin(I2C_retry *retry, int i2c_fd, 
+                           const I2C_retry_policy *policy) {
+  retry->state = FDMap_get(&I2C_states, i2c_fd);
+  if (policy) {
+    retry->policy = *policy;
+  }
+  else if (retry->state) {
+    pthread_mutex_lock(&retry->state->lock);
+    retry->policy = retry->state->policy;
+    pthread_mutex_unlock(&retry->state->lock);
+  }
+  else {
+    memset(&retry->policy, 0, sizeof(I2C_retry_policy));
+  }
+  retry->attempts = 1;
+  // Only look at the clock if there may be retries:
+  if (retry->policy.max_attempts > 1) {
+    retry->start = I2C_now();
+    retry->backoff_us = retry->policy.backoff_us;
+  }
+}
+
+/**
+ * Called when an attempt fails; checks whether the policy allows another
+ * and if so waits out the backoff. errno is preserved.
+ */
+static int I2C_retryAgain(I2C_retry *retry) {
+  int error, i;
+  uint64_t elapsed;
+  error = errno;
+  if (retry->attempts >= retry->policy.max_attempts) return 0;
+  for (i=0; i<I2C_MAX_RETRY_ERRNOS; i++) {
+    if (retry->policy.retry_errnos[i] == 0) return 0;
+    if (retry->policy.retry_errnos[i] == error) break;
+  }
+  if (i == I2C_MAX_RETRY_ERRNOS) return 0;
+  if (retry->policy.budget_us) {
+    elapsed = I2C_now() - retry->start;
+    if (elapsed + retry->backoff_us >= retry->policy.budget_us) return 0;
+  }
+
+  if (retry->backoff_us) usleep(retry->backoff_us);
+  if (retry->policy.max_backoff_us > retry->backoff_us) {
+    retry->backoff_us *= 2;
+    if (retry->backoff_us > retry->policy.max_backoff_us) {
+      retry->backoff_us = retry->policy.max_backoff_us;
+    }
+  }
+  retry->attempts++;
+  if (retry->state) {
+    __atomic_fetch_add(&retry->state->stats.retries, 1, __ATOMIC_RELAXED);
+  }
+  errno = error;
+  return 1;
+}
+
+/**
+ * Records the outcome of a transfer in the fd's counters. errno is 
+ * preserved.
+ */
+static void I2C_retryEnd(I2C_retry *retry, int ret) {
+  if (!retry->state || retry->policy.max_attempts <= 1) return;
+  __atomic_fetch_add(&retry->state->stats.transfers, 1, __ATOMIC_RELAXED);
+  if (ret < 0) {
+    __atomic_fetch_add(&retry->state->stats.failed, 1, __ATOMIC_RELAXED);
+  }
+  else if (retry->attempts > 1) {
+    __atomic_fetch_add(&retry->state->stats.recovered, 1, __ATOMIC_RELAXED);
+  }
+}
+
+int I2C_setCRCCheck(int i2c_fd, const I2C_crc_check *check) {
+  I2C_state *state;
+  if (check && check->type != I2C_CRC_NONE && 
+      ((check->type != I2C_CRC8 && check->type != I2C_CRC8_SMBUS) ||
+       check->word_bytes == 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&state->lock);
+  if (check) state->crc_check = *check;
+  else memset(&state->crc_check, 0, sizeof(I2C_crc_check));
+  pthread_mutex_unlock(&state->lock);
+  return 0;
+}
+
+int I2C_getCRCStats(int i2c_fd, I2C_crc_stats *stats) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  stats->checked = __atomic_load_n(&state->crc_stats.checked, 
+                                   __ATOMIC_RELAXED);
+  stats->errors = __atomic_load_n(&state->crc_stats.errors, __ATOMIC_RELAXED);
+  return 0;
+}
+
+int I2C_resetCRCStats(int i2c_fd) {
+  I2C_state *state;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (!state) {
+    errno = EBADF;
+    return -1;
+  }
+  __atomic_store_n(&state->crc_stats.checked, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&state->crc_stats.errors, 0, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/**
+ * Checks the CRC after each word of data read, setting errno to EBADMSG and 
+ * returning -1 if any is wrong. The read must be a whole number of words 
+ * and CRCs.
+ */
+static int I2C_checkCRC(I2C_state *state, const I2C_crc_check *check, 
+                        const uint8_t *data, int n_bytes) {
+  int i, frame_bytes, bad;
+  uint8_t crc;
+  frame_bytes = check->word_bytes + 1;
+  if (check->type == I2C_CRC_NONE || n_bytes == 0) return 0;
+  bad = 0;
+  for (i=0; i<n_bytes && !bad; i+=frame_bytes) {
+    if (check->type == I2C_CRC8) {
+      crc = CRC_crc8(check->init, &data[i], check->word_bytes);
+    }
+    else crc = CRC_smbusPEC(check->init, &data[i], check->word_bytes);
+    bad = crc != data[i + check->word_bytes];
+  }
+  __atomic_fetch_add(&state->crc_stats.checked, 1, __ATOMIC_RELAXED);
+  if (!bad) return 0;
+  __atomic_fetch_add(&state->crc_stats.errors, 1, __ATOMIC_RELAXED);
+  errno = EBADMSG;
+  return -1;
 }
 
 int I2C_enable10BitAddressing(int i2c_fd) {
   int ret;
-  ret = ioctl(i2c_fd, I2C_TENBIT, 1);
+  I2C_state *state;
+  ret = Transport_ioctl(i2c_fd, I2C_TENBIT, 1UL);
   if (ret < 0) return ret;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (state) state->flags = I2C_M_TEN;
   return 0;
 }
 
 int I2C_disable10BitAddressing(int i2c_fd) {
   int ret;
-  ret = ioctl(i2c_fd, I2C_TENBIT, 0);
+  I2C_state *state;
+  ret = Transport_ioctl(i2c_fd, I2C_TENBIT, 0UL);
   if (ret < 0) return ret;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (state) state->flags = 0;
   return 0;
 }
 
 int I2C_setSlaveAddress(int i2c_fd, int addr) {
   int ret;
-  ret = ioctl(i2c_fd, I2C_SLAVE, addr);
+  I2C_state *state;
+  ret = Transport_ioctl(i2c_fd, I2C_SLAVE, (unsigned long) addr);
   if (ret < 0) return ret;
+  state = FDMap_get(&I2C_states, i2c_fd);
+  if (state) state->addr = addr;
   return 0;
 }
 
 int I2C_read(int i2c_fd, void *rx_buffer, int n_bytes) {
   int ret;
-  ret = read(i2c_fd, rx_buffer, n_bytes);
+  I2C_retry retry;
+  I2C_retryBegin(&retry, i2c_fd, NULL);
+  do {
+    ret = Transport_read(i2c_fd, rx_buffer, n_bytes);
+  } while (ret < 0 && I2C_retryAgain(&retry));
+  I2C_retryEnd(&retry, ret);
   if (ret < 0) return ret;
   return 0;
 }
 
-int I2C_readTransaction(int i2c_fd, uint8_t command, void *rx_buffer, 
-                        int n_bytes) {
+/**
+ * Writes the given bytes then reads into rx_buffer with a repeated start in
+ * between, in a single I2C_RDWR ioctl. Falls back to a write() then a read()
+ * if the slave address isn't known or the adapter can't do I2C_RDWR.
+ */
+static int I2C_writeReadOnce(int i2c_fd, uint8_t *tx_buffer, int n_tx_bytes,
+                             void *rx_buffer, int n_rx_bytes) {
   int ret;
-  ret = write(i2c_fd, &command, 1);
+  I2C_state *state;
+  struct i2c_msg messages[2];
+  struct i2c_rdwr_ioctl_data rdwr;
+
+  state = FDMap_get(&I2C_states, i2c_fd);
+  // SMBus-only adapters don't support I2C_RDWR:
+  if (state && state->addr >= 0 && 
+      (!state->have_funcs || (state->funcs & I2C_FUNC_I2C))) {
+    messages[0].addr = state->addr;
+    messages[0].flags = state->flags;
+    messages[0].len = n_tx_bytes;
+    messages[0].buf = tx_buffer;
+    messages[1].addr = state->addr;
+    messages[1].flags = state->flags | I2C_M_RD;
+    messages[1].len = n_rx_bytes;
+    messages[1].buf = (uint8_t *) rx_buffer;
+    rdwr.msgs = messages;
+    rdwr.nmsgs = 2;
+    ret = Transport_ioctl(i2c_fd, I2C_RDWR, &rdwr);
+    if (ret >= 0) return 0;
+    if (errno != EOPNOTSUPP && errno != ENOTTY) return ret;
+  }
+
+  ret = Transport_write(i2c_fd, tx_buffer, n_tx_bytes);
   if (ret < 0) return ret;
 
-  ret = read(i2c_fd, rx_buffer, n_bytes);
+  ret = Transport_read(i2c_fd, rx_buffer, n_rx_bytes);
   if (ret < 0) return ret;
   return 0;
 }
 
+/**
+ * #I2C_writeReadOnce under the fd's retry policy, checking the data read if
+ * the fd has a CRC check set.
+ */
+static int I2C_writeRead(int i2c_fd, uint8_t *tx_buffer, int n_tx_bytes,
+                         void *rx_buffer, int n_rx_bytes) {
+  int ret;
+  I2C_retry retry;
+  I2C_crc_check check;
+  I2C_retryBegin(&retry, i2c_fd, NULL);
+  if (retry.state) {
+    pthread_mutex_lock(&retry.state->lock);
+    check = retry.state->crc_check;
+    pthread_mutex_unlock(&retry.state->lock);
+  }
+  else memset(&check, 0, sizeof(I2C_crc_check));
+  // A read that isn't whole words and CRCs can't be checked, so fail it
+  // before it's made:
+  if (check.type != I2C_CRC_NONE && n_rx_bytes % (check.word_bytes + 1)) {
+    errno = EINVAL;
+    return -1;
+  }
+  do {
+    ret = I2C_writeReadOnce(i2c_fd, tx_buffer, n_tx_bytes, rx_buffer, 
+                            n_rx_bytes);
+    if (ret == 0 && check.type != I2C_CRC_NONE) {
+      ret = I2C_checkCRC(retry.state, &check, rx_buffer, n_rx_bytes);
+    }
+  } while (ret < 0 && I2C_retryAgain(&retry));
+  I2C_retryEnd(&retry, ret);
+  return ret;
+}
+
+int I2C_readTransaction(int i2c_fd, uint8_t command, void *rx_buffer, 
+                        int n_bytes) {
+  return I2C_writeRead(i2c_fd, &command, 1, rx_buffer, n_bytes);
+}
+
+int I2C_readRegister(int i2c_fd, uint32_t reg, int reg_bytes, 
+                     void *rx_buffer, int n_bytes) {
+  uint8_t reg_buffer[4];
+  int i;
+  if (reg_bytes < 1 || reg_bytes > 4) {
+    errno = EINVAL;
+    return -1;
+  }
+  // Register addresses go out most significant byte first:
+  for (i=0; i<reg_bytes; i++) {
+    reg_buffer[i] = reg >> (8 * (reg_bytes - 1 - i));
+  }
+  return I2C_writeRead(i2c_fd, reg_buffer, reg_bytes, rx_buffer, n_bytes);
+}
+
 int I2C_write(int i2c_fd, void *tx_buffer, int n_bytes) {
   int ret;
-  ret = write(i2c_fd, tx_buffer, n_bytes);
+  I2C_retry retry;
+  I2C_retryBegin(&retry, i2c_fd, NULL);
+  do {
+    ret = Transport_write(i2c_fd, tx_buffer, n_bytes);
+  } while (ret < 0 && I2C_retryAgain(&retry));
+  I2C_retryEnd(&retry, ret);
   if (ret < 0) return ret;
   return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Finds how many of the given messages to put in the next I2C_RDWR, backing
+ * up so that a message flagged I2C_M_NOSTART stays with the one before it.
+ */
+static int I2C_groupSize(I2C_message *messages, int n_messages) {
+  int n;
+  if (n_messages <= I2C_MAX_MESSAGES) return n_messages;
+  n = I2C_MAX_MESSAGES;
+  while (n > 0 && (messages[n].flags & I2C_M_NOSTART)) n--;
+  return n;
+}
+
+int I2C_transfer(int i2c_fd, I2C_message *messages, int n_messages) {
+  return I2C_transferEx(i2c_fd, messages, n_messages, NULL);
+}
+
+int I2C_transferEx(int i2c_fd, I2C_message *messages, int n_messages,
+                   const I2C_retry_policy *policy) {
+  struct i2c_msg msgs[I2C_MAX_MESSAGES];
+  struct i2c_rdwr_ioctl_data rdwr;
+  I2C_retry retry;
+  int first, n, i, ret, error;
+
+  if (n_messages < 0 || (n_messages > 0 && !messages)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (first=0; first<n_messages; first+=n) {
+    n = I2C_groupSize(&messages[first], n_messages - first);
+    if (n == 0) {
+      // More than I2C_MAX_MESSAGES chained with I2C_M_NOSTART, fail the 
+      // whole chain:
+      n = 1;
+      while (first + n < n_messages && 
+             (messages[first+n].flags & I2C_M_NOSTART)) {
+        n++;
+      }
+      ret = -1;
+      errno = EINVAL;
+    }
+    else {
+      for (i=0; i<n; i++) {
+        msgs[i].addr = messages[first+i].addr;
+        msgs[i].flags = messages[first+i].flags;
+        msgs[i].len = messages[first+i].n_bytes;
+        msgs[i].buf = (uint8_t *) messages[first+i].buffer;
+      }
+      rdwr.msgs = msgs;
+      rdwr.nmsgs = n;
+      I2C_retryBegin(&retry, i2c_fd, policy);
+      do {
+        ret = Transport_ioctl(i2c_fd, I2C_RDWR, &rdwr);
+      } while (ret < 0 && I2C_retryAgain(&retry));
+      I2C_retryEnd(&retry, ret);
+    }
+
+    if (ret < 0) {
+      error = errno;
+      for (i=first; i<first+n; i++) messages[i].status = error;
+      for (i=first+n; i<n_messages; i++) messages[i].status = ECANCELED;
+      errno = error;
+      return -1;
+    }
+    for (i=first; i<first+n; i++) messages[i].status = 0;
+  }
+  return 0;
+}
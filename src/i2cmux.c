@@ -0,0 +1,317 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2cmux.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Access to I2C devices behind PCA954x/TCA954x multiplexers.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "i2cmux.h"
+#include "i2cdriver.h"
+
+/// Transfers up to this many messages, including selects, use the stack
+#define I2C_MUX_STACK_MESSAGES 16
+/// Enable bit of the PCA9540/2/4 control register
+#define I2C_MUX_PCA9544_ENABLE 0x04
+
+typedef struct {
+  int parent;             ///< Id of the mux this is behind, or I2C_MUX_ROOT
+  uint8_t parent_channel; ///< Channel of parent this is on
+  uint16_t addr;          ///< 7-bit address
+  I2C_mux_type type;      ///< Kind of mux
+  int depth;              ///< Number of muxes between this and the bus
+  int selected;           ///< Control register value, or -1 if unknown
+  uint8_t control;        ///< Control register value being written
+} I2C_mux;
+
+struct I2C_mux_tree {
+  int i2c_fd;           ///< I2C file descriptor
+  I2C_mux *muxes;       ///< Muxes, indexed by id
+  int n_muxes;          ///< Length of muxes
+  int max_depth;        ///< Greatest depth of any mux
+  int select_stop;      ///< Set if selects can end with I2C_M_STOP
+  pthread_mutex_t lock; ///< Serialises accesses, so the cache stays valid
+};
+
+I2C_mux_tree *I2C_muxTreeCreate(int i2c_fd) {
+  I2C_mux_tree *tree;
+  unsigned long funcs;
+  tree = calloc(1, sizeof(I2C_mux_tree));
+  if (!tree) return NULL;
+  tree->i2c_fd = i2c_fd;
+  if (I2C_getFunctionality(i2c_fd, &funcs) == 0) {
+    tree->select_stop = (funcs & I2C_FUNC_PROTOCOL_MANGLING) != 0;
+  }
+  pthread_mutex_init(&tree->lock, NULL);
+  return tree;
+}
+
+void I2C_muxTreeDestroy(I2C_mux_tree *tree) {
+  if (!tree) return;
+  pthread_mutex_destroy(&tree->lock);
+  free(tree->muxes);
+  free(tree);
+}
+
+/**
+ * Gets the number of channels the given kind of mux has.
+ */
+static int I2C_muxChannels(I2C_mux_type type) {
+  return type == I2C_MUX_PCA9544 ? 4 : 8;
+}
+
+/**
+ * Gets the control register value that selects the given channel.
+ */
+static uint8_t I2C_muxControl(I2C_mux_type type, uint8_t channel) {
+  if (type == I2C_MUX_PCA9544) return I2C_MUX_PCA9544_ENABLE | channel;
+  return 1 << channel;
+}
+
+int I2C_muxAdd(I2C_mux_tree *tree, int parent, uint8_t parent_channel, 
+               uint16_t addr, I2C_mux_type type) {
+  I2C_mux *muxes, *mux;
+  int id;
+
+  pthread_mutex_lock(&tree->lock);
+  if ((parent != I2C_MUX_ROOT && (parent < 0 || parent >= tree->n_muxes)) ||
+      (parent != I2C_MUX_ROOT && 
+       parent_channel >= I2C_muxChannels(tree->muxes[parent].type)) ||
+      (type != I2C_MUX_PCA9548 && type != I2C_MUX_PCA9544)) {
+    pthread_mutex_unlock(&tree->lock);
+    errno = EINVAL;
+    return -1;
+  }
+  muxes = realloc(tree->muxes, (tree->n_muxes + 1) * sizeof(I2C_mux));
+  if (!muxes) {
+    pthread_mutex_unlock(&tree->lock);
+    return -1;
+  }
+  tree->muxes = muxes;
+  id = tree->n_muxes++;
+  mux = &muxes[id];
+  mux->parent = parent;
+  mux->parent_channel = parent == I2C_MUX_ROOT ? 0 : parent_channel;
+  mux->addr = addr;
+  mux->type = type;
+  mux->depth = parent == I2C_MUX_ROOT ? 0 : muxes[parent].depth + 1;
+  mux->selected = -1;
+  if (mux->depth > tree->max_depth) tree->max_depth = mux->depth;
+  pthread_mutex_unlock(&tree->lock);
+  return id;
+}
+
+void I2C_muxInvalidate(I2C_mux_tree *tree) {
+  int i;
+  pthread_mutex_lock(&tree->lock);
+  for (i=0; i<tree->n_muxes; i++) tree->muxes[i].selected = -1;
+  pthread_mutex_unlock(&tree->lock);
+}
+
+/**
+ * Adds a message writing the given control value to a mux, if it doesn't 
+ * already have it.
+ */
+static void I2C_muxAddSelect(I2C_mux_tree *tree, int id, uint8_t control,
+                             I2C_message *messages, int *select_ids, 
+                             int *n_selects) {
+  I2C_mux *mux = &tree->muxes[id];
+  if (mux->selected == control) return;
+  mux->control = control;
+  messages[*n_selects].addr = mux->addr;
+  messages[*n_selects].flags = 0;
+  messages[*n_selects].n_bytes = 1;
+  messages[*n_selects].buffer = &mux->control;
+  select_ids[*n_selects] = id;
+  (*n_selects)++;
+}
+
+/**
+ * Puts the messages needed to connect the given channel of the given mux to
+ * the bus, and nothing else that could clash with it, into messages. Muxes
+ * are written from the bus outward, since each is only reachable once the 
+ * ones before it are set. Must hold the tree's lock.
+ */
+static int I2C_muxSelects(I2C_mux_tree *tree, int target, uint8_t channel,
+                          I2C_message *messages, int *select_ids, 
+                          uint8_t *on_path) {
+  I2C_mux *mux;
+  int id, depth, n_selects, connected;
+
+  // on_path[id] is 1 + the channel selected on each mux in the path:
+  memset(on_path, 0, tree->n_muxes);
+  for (id=target; id!=I2C_MUX_ROOT; id=tree->muxes[id].parent) {
+    on_path[id] = channel + 1;
+    channel = tree->muxes[id].parent_channel;
+  }
+
+  n_selects = 0;
+  for (depth=0; depth<=tree->max_depth; depth++) {
+    for (id=0; id<tree->n_muxes; id++) {
+      mux = &tree->muxes[id];
+      if (mux->depth != depth) continue;
+      connected = mux->parent == I2C_MUX_ROOT || 
+        on_path[mux->parent] == mux->parent_channel + 1;
+      if (!connected) continue;
+      if (on_path[id]) {
+        I2C_muxAddSelect(tree, id, I2C_muxControl(mux->type, on_path[id] - 1),
+                         messages, select_ids, &n_selects);
+      }
+      else {
+        I2C_muxAddSelect(tree, id, 0, messages, select_ids, &n_selects);
+      }
+    }
+  }
+  return n_selects;
+}
+
+int I2C_muxTransfer(I2C_mux_tree *tree, int mux, uint8_t channel,
+                    I2C_message *messages, int n_messages) {
+  I2C_message stack_messages[I2C_MUX_STACK_MESSAGES], *all;
+  int stack_ids[I2C_MUX_STACK_MESSAGES], *select_ids;
+  uint8_t stack_path[I2C_MUX_STACK_MESSAGES], *on_path;
+  int n_selects, n_all, i, ret, error;
+
+  if (n_messages < 0 || (n_messages > 0 && !messages)) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&tree->lock);
+  if ((mux != I2C_MUX_ROOT && (mux < 0 || mux >= tree->n_muxes)) ||
+      (mux != I2C_MUX_ROOT && 
+       channel >= I2C_muxChannels(tree->muxes[mux].type))) {
+    pthread_mutex_unlock(&tree->lock);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // At most one select per mux:
+  n_all = tree->n_muxes + n_messages;
+  if (n_all <= I2C_MUX_STACK_MESSAGES) {
+    all = stack_messages;
+    select_ids = stack_ids;
+    on_path = stack_path;
+  }
+  else {
+    all = malloc(n_all * sizeof(I2C_message));
+    select_ids = malloc(tree->n_muxes * sizeof(int));
+    on_path = malloc(tree->n_muxes);
+    if (!all || !select_ids || !on_path) {
+      free(all);
+      free(select_ids);
+      free(on_path);
+      pthread_mutex_unlock(&tree->lock);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  if (mux == I2C_MUX_ROOT) channel = 0;
+  n_selects = I2C_muxSelects(tree, mux, channel, all, select_ids, on_path);
+  memcpy(&all[n_selects], messages, n_messages * sizeof(I2C_message));
+  // Muxes only switch at a stop, not at the repeated start after a select:
+  if (tree->select_stop) {
+    for (i=0; i<n_selects; i++) all[i].flags |= I2C_M_STOP;
+    ret = I2C_transfer(tree->i2c_fd, all, n_selects + n_messages);
+    error = errno;
+  }
+  else {
+    // Each I2C_RDWR ends with a stop, so give every select its own:
+    ret = 0;
+    error = 0;
+    for (i=0; i<n_selects && ret==0; i++) {
+      ret = I2C_transfer(tree->i2c_fd, &all[i], 1);
+      error = errno;
+    }
+    if (ret == 0) {
+      ret = I2C_transfer(tree->i2c_fd, &all[n_selects], n_messages);
+      error = errno;
+    }
+    else {
+      for (; i<n_selects+n_messages; i++) all[i].status = ECANCELED;
+    }
+  }
+
+  // A select only took effect if it was sent; one that failed may or may
+  // not have, and one that was never sent left the mux as it was:
+  for (i=0; i<n_selects; i++) {
+    if (all[i].status == 0) {
+      tree->muxes[select_ids[i]].selected = tree->muxes[select_ids[i]].control;
+    }
+    else if (all[i].status != ECANCELED) {
+      tree->muxes[select_ids[i]].selected = -1;
+    }
+  }
+  for (i=0; i<n_messages; i++) messages[i].status = all[n_selects+i].status;
+
+  if (all != stack_messages) {
+    free(all);
+    free(select_ids);
+    free(on_path);
+  }
+  pthread_mutex_unlock(&tree->lock);
+  errno = error;
+  return ret;
+}
+
+int I2C_muxWrite(I2C_mux_tree *tree, int mux, uint8_t channel, uint16_t addr,
+                 void *tx_buffer, int n_bytes) {
+  I2C_message message;
+  message.addr = addr;
+  message.flags = 0;
+  message.n_bytes = n_bytes;
+  message.buffer = tx_buffer;
+  return I2C_muxTransfer(tree, mux, channel, &message, 1);
+}
+
+int I2C_muxRead(I2C_mux_tree *tree, int mux, uint8_t channel, uint16_t addr,
+                void *rx_buffer, int n_bytes) {
+  I2C_message message;
+  message.addr = addr;
+  message.flags = I2C_M_RD;
+  message.n_bytes = n_bytes;
+  message.buffer = rx_buffer;
+  return I2C_muxTransfer(tree, mux, channel, &message, 1);
+}
+
+int I2C_muxReadTransaction(I2C_mux_tree *tree, int mux, uint8_t channel, 
+                           uint16_t addr, uint8_t command, void *rx_buffer, 
+                           int n_bytes) {
+  I2C_message messages[2];
+  messages[0].addr = addr;
+  messages[0].flags = 0;
+  messages[0].n_bytes = 1;
+  messages[0].buffer = &command;
+  messages[1].addr = addr;
+  messages[1].flags = I2C_M_RD;
+  messages[1].n_bytes = n_bytes;
+  messages[1].buffer = rx_buffer;
+  return I2C_muxTransfer(tree, mux, channel, messages, 2);
+}
@@ -0,0 +1,361 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2cscan.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Discovery of the devices on I2C buses.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "i2cscan.h"
+#include "i2cdriver.h"
+#include "smbus.h"
+
+/// Number of possible bus numbers
+#define I2C_SCAN_N_BUSES 256
+/// Longest line in the cache file: a bus number then up to 128 addresses
+#define I2C_SCAN_LINE_LEN (4 + 128 * 5 + 2)
+
+/// Probes make a single attempt whatever the fd's retry policy
+static const I2C_retry_policy I2C_scan_no_retries;
+
+/**
+ * Every bus's entry from a cache file.
+ */
+typedef struct {
+  uint8_t have[I2C_SCAN_N_BUSES];         ///< Set if the bus has an entry
+  uint8_t present[I2C_SCAN_N_BUSES][16];  ///< Bitmap of each bus's devices
+} I2C_scan_cache;
+
+/**
+ * Work for one bus's scanning thread.
+ */
+typedef struct {
+  I2C_scan_options options; ///< Probe settings, with defaults filled in
+  const uint8_t *cached;    ///< Bitmap of the cached devices, or NULL
+  I2C_scan_result *result;  ///< Where to put the result
+  pthread_t thread;         ///< Thread scanning the bus
+  int started;              ///< Set if thread was started
+} I2C_scan_job;
+
+/**
+ * Chooses the probe for the given address, with the i2cdetect rules: reads
+ * where quick writes can corrupt EEPROMs, and otherwise whichever the 
+ * adapter supports.
+ */
+static I2C_probe_mode I2C_probeMode(uint16_t addr, I2C_probe_mode mode,
+                                    unsigned long funcs) {
+  if (mode == I2C_PROBE_AUTO) {
+    if ((addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5f)) {
+      mode = I2C_PROBE_READ;
+    }
+    else mode = I2C_PROBE_QUICK;
+    if (mode == I2C_PROBE_QUICK && !(funcs & I2C_FUNC_SMBUS_QUICK)) {
+      mode = I2C_PROBE_READ;
+    }
+    else if (mode == I2C_PROBE_READ && !(funcs & I2C_FUNC_SMBUS_READ_BYTE)) {
+      mode = I2C_PROBE_QUICK;
+    }
+  }
+  return mode;
+}
+
+/**
+ * Fills in the I2C_RDWR message for a probe.
+ */
+static void I2C_probeMessage(I2C_message *message, uint16_t addr, 
+                             I2C_probe_mode mode, uint8_t *buffer) {
+  message->addr = addr;
+  message->flags = mode == I2C_PROBE_READ ? I2C_M_RD : 0;
+  message->n_bytes = mode == I2C_PROBE_READ ? 1 : 0;
+  message->buffer = buffer;
+}
+
+/**
+ * Checks whether a failed probe means there's no device, like i2cdetect 
+ * does for any error other than ones that mean the probe itself was bad.
+ */
+static int I2C_probeAbsent(int error) {
+  return error != EBADF && error != ENOTTY && error != EINVAL && 
+    error != EOPNOTSUPP && error != EFAULT && error != ENOMEM;
+}
+
+int I2C_probe(int i2c_fd, uint16_t addr, I2C_probe_mode mode) {
+  I2C_message message;
+  unsigned long funcs;
+  uint8_t byte;
+  int ret;
+
+  if (I2C_getFunctionality(i2c_fd, &funcs) < 0) return -1;
+  mode = I2C_probeMode(addr, mode, funcs);
+
+  if (funcs & I2C_FUNC_I2C) {
+    I2C_probeMessage(&message, addr, mode, &byte);
+    ret = I2C_transferEx(i2c_fd, &message, 1, &I2C_scan_no_retries);
+  }
+  else {
+    // SMBus only adapters need the address set, which fails with EBUSY if
+    // a kernel driver is using the device:
+    if (I2C_setSlaveAddress(i2c_fd, addr) < 0) {
+      return errno == EBUSY ? 1 : -1;
+    }
+    if (mode == I2C_PROBE_READ) ret = SMBus_readByte(i2c_fd);
+    else ret = SMBus_quick(i2c_fd, I2C_SMBUS_WRITE);
+  }
+  if (ret >= 0) return 1;
+  return I2C_probeAbsent(errno) ? 0 : -1;
+}
+
+/**
+ * Fills in the defaults for any options not given.
+ */
+static void I2C_scanDefaults(const I2C_scan_options *options, 
+                             I2C_scan_options *filled) {
+  if (options) *filled = *options;
+  else memset(filled, 0, sizeof(I2C_scan_options));
+  if (filled->first == 0) filled->first = I2C_SCAN_FIRST;
+  if (filled->last == 0 || filled->last > 0x7f) filled->last = I2C_SCAN_LAST;
+}
+
+int I2C_scan(int i2c_fd, const I2C_scan_options *options, uint8_t *present) {
+  I2C_scan_options filled;
+  int addr, ret, n_devices;
+
+  I2C_scanDefaults(options, &filled);
+  memset(present, 0, 16);
+  n_devices = 0;
+  for (addr=filled.first; addr<=filled.last; addr++) {
+    ret = I2C_probe(i2c_fd, addr, filled.mode);
+    if (ret < 0) return -1;
+    if (ret) {
+      present[addr >> 3] |= 1 << (addr & 7);
+      n_devices++;
+    }
+  }
+  return n_devices;
+}
+
+/**
+ * Checks that all the cached devices in the scan range are still present, 
+ * with all the probes batched into as few I2C_RDWRs as possible. Returns 1 
+ * if they are, 0 if not, or -1 if error.
+ */
+static int I2C_scanVerify(int i2c_fd, const I2C_scan_options *options,
+                          const uint8_t *cached) {
+  I2C_message messages[128];
+  uint8_t bytes[128];
+  unsigned long funcs;
+  int addr, n_messages, ret;
+
+  if (I2C_getFunctionality(i2c_fd, &funcs) < 0) return -1;
+  n_messages = 0;
+  for (addr=options->first; addr<=options->last; addr++) {
+    if (!((cached[addr >> 3] >> (addr & 7)) & 1)) continue;
+    if (!(funcs & I2C_FUNC_I2C)) {
+      ret = I2C_probe(i2c_fd, addr, options->mode);
+      if (ret <= 0) return ret;
+      continue;
+    }
+    I2C_probeMessage(&messages[n_messages], addr, 
+                     I2C_probeMode(addr, options->mode, funcs), 
+                     &bytes[n_messages]);
+    n_messages++;
+  }
+  if (n_messages == 0) return 1;
+
+  if (I2C_transferEx(i2c_fd, messages, n_messages, 
+                     &I2C_scan_no_retries) == 0) {
+    return 1;
+  }
+  return I2C_probeAbsent(errno) ? 0 : -1;
+}
+
+static void *I2C_scanThread(void *arg) {
+  I2C_scan_job *job = (I2C_scan_job *) arg;
+  I2C_scan_result *result = job->result;
+  int i2c_fd, ret, addr;
+
+  i2c_fd = I2C_open(result->bus);
+  if (i2c_fd < 0) {
+    result->error = errno;
+    return NULL;
+  }
+
+  if (job->cached) {
+    ret = I2C_scanVerify(i2c_fd, &job->options, job->cached);
+    if (ret == 1) {
+      memcpy(result->present, job->cached, 16);
+      // Only report the cached devices in the scan range:
+      for (addr=0; addr<128; addr++) {
+        if (addr < job->options.first || addr > job->options.last) {
+          result->present[addr >> 3] &= ~(1 << (addr & 7));
+        }
+        else if (I2C_SCAN_PRESENT(result, addr)) result->n_devices++;
+      }
+      result->from_cache = 1;
+      I2C_close(i2c_fd);
+      return NULL;
+    }
+  }
+
+  ret = I2C_scan(i2c_fd, &job->options, result->present);
+  if (ret < 0) result->error = errno;
+  else result->n_devices = ret;
+  I2C_close(i2c_fd);
+  return NULL;
+}
+
+/**
+ * Reads the cache file into the given cache, which is left empty if there's
+ * no file. Lines are a bus number followed by the hex addresses found on it.
+ */
+static void I2C_scanReadCache(const char *path, I2C_scan_cache *cache) {
+  char line[I2C_SCAN_LINE_LEN];
+  unsigned long bus, addr;
+  char *position, *end;
+  FILE *cache_file;
+
+  memset(cache, 0, sizeof(I2C_scan_cache));
+  cache_file = fopen(path, "r");
+  if (!cache_file) return;
+  while (fgets(line, sizeof(line), cache_file)) {
+    if (line[0] == '#') continue;
+    bus = strtoul(line, &end, 10);
+    if (end == line || bus >= I2C_SCAN_N_BUSES) continue;
+    cache->have[bus] = 1;
+    position = end;
+    for (;;) {
+      addr = strtoul(position, &end, 16);
+      if (end == position || addr > 0x7f) break;
+      cache->present[bus][addr >> 3] |= 1 << (addr & 7);
+      position = end;
+    }
+  }
+  fclose(cache_file);
+}
+
+/**
+ * Writes the given cache to a temporary file then renames it into place, so
+ * a crash can't leave a partial cache file.
+ */
+static int I2C_scanWriteCache(const char *path, const I2C_scan_cache *cache) {
+  char *temp_path;
+  FILE *cache_file;
+  int bus, addr, ret;
+
+  temp_path = malloc(strlen(path) + 5);
+  if (!temp_path) return -1;
+  sprintf(temp_path, "%s.tmp", path);
+  cache_file = fopen(temp_path, "w");
+  if (!cache_file) {
+    free(temp_path);
+    return -1;
+  }
+  fprintf(cache_file, "# serbus I2C topology cache: bus addresses...\n");
+  for (bus=0; bus<I2C_SCAN_N_BUSES; bus++) {
+    if (!cache->have[bus]) continue;
+    fprintf(cache_file, "%d", bus);
+    for (addr=0; addr<128; addr++) {
+      if ((cache->present[bus][addr >> 3] >> (addr & 7)) & 1) {
+        fprintf(cache_file, " %02x", addr);
+      }
+    }
+    fprintf(cache_file, "\n");
+  }
+  ret = fclose(cache_file) == 0 ? 0 : -1;
+  if (ret == 0) ret = rename(temp_path, path);
+  if (ret < 0) remove(temp_path);
+  free(temp_path);
+  return ret;
+}
+
+int I2C_scanBuses(const uint8_t *buses, int n_buses, 
+                  const I2C_scan_options *options, I2C_scan_result *results) {
+  I2C_scan_cache *cache;
+  I2C_scan_job *jobs;
+  int i, addr, ret;
+
+  if (n_buses < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  cache = NULL;
+  jobs = calloc(n_buses + 1, sizeof(I2C_scan_job));
+  if (options && options->cache_path) cache = malloc(sizeof(I2C_scan_cache));
+  if (!jobs || (options && options->cache_path && !cache)) {
+    free(jobs);
+    free(cache);
+    errno = ENOMEM;
+    return -1;
+  }
+  if (cache) I2C_scanReadCache(options->cache_path, cache);
+
+  for (i=0; i<n_buses; i++) {
+    memset(&results[i], 0, sizeof(I2C_scan_result));
+    results[i].bus = buses[i];
+    I2C_scanDefaults(options, &jobs[i].options);
+    jobs[i].result = &results[i];
+    if (cache && !jobs[i].options.rescan && cache->have[buses[i]]) {
+      jobs[i].cached = cache->present[buses[i]];
+    }
+    if (pthread_create(&jobs[i].thread, NULL, I2C_scanThread, &jobs[i]) == 0) {
+      jobs[i].started = 1;
+    }
+    // Scan this one here if a thread couldn't be started:
+    else I2C_scanThread(&jobs[i]);
+  }
+
+  ret = 0;
+  for (i=0; i<n_buses; i++) {
+    if (jobs[i].started) pthread_join(jobs[i].thread, NULL);
+    if (results[i].error) ret = -1;
+  }
+
+  if (cache) {
+    for (i=0; i<n_buses; i++) {
+      if (results[i].error) continue;
+      if (!cache->have[buses[i]]) {
+        memset(cache->present[buses[i]], 0, 16);
+        cache->have[buses[i]] = 1;
+      }
+      // Replace the cached devices in the scanned range with the results:
+      for (addr=jobs[i].options.first; addr<=jobs[i].options.last; addr++) {
+        cache->present[buses[i]][addr >> 3] &= ~(1 << (addr & 7));
+        cache->present[buses[i]][addr >> 3] |= 
+          results[i].present[addr >> 3] & (1 << (addr & 7));
+      }
+    }
+    // A failed write only costs a full scan next time, so isn't an error:
+    I2C_scanWriteCache(options->cache_path, cache);
+    free(cache);
+  }
+  free(jobs);
+  return ret;
+}
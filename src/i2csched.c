@@ -0,0 +1,361 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file i2csched.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Non-blocking scheduler for polling many I2C sensors on one bus.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "i2csched.h"
+#include "i2cdriver.h"
+
+/// A task's state
+typedef enum {
+  I2C_SCHED_FREE,      ///< Slot is unused
+  I2C_SCHED_IDLE,      ///< Waiting to be triggered
+  I2C_SCHED_CONVERTING ///< Triggered, waiting to be read out
+} I2C_sched_state;
+
+typedef struct {
+  I2C_sched_task task;   ///< Copy of the task, with buffers below
+  uint8_t *trigger;      ///< Copy of the trigger bytes
+  uint8_t *readout;      ///< Copy of the readout bytes
+  uint8_t *result;       ///< Buffer the result is read into
+  I2C_sched_state state; ///< Current state
+  uint64_t due;          ///< When the next step is due, in microseconds
+  uint64_t triggered;    ///< When the current conversion was triggered
+  uint8_t retries;       ///< Readout retries made in the current conversion
+} I2C_sched_entry;
+
+struct I2C_scheduler {
+  int i2c_fd;               ///< I2C file descriptor
+  int timer_fd;             ///< timerfd armed for the next due step
+  I2C_sched_entry *entries; ///< Tasks, indexed by id
+  int n_entries;            ///< Length of entries
+  int calling;              ///< Task whose callback is running, or -1
+};
+
+/**
+ * Gets the CLOCK_MONOTONIC time in microseconds.
+ */
+static uint64_t I2C_schedNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+I2C_scheduler *I2C_schedCreate(int i2c_fd) {
+  I2C_scheduler *sched;
+  sched = calloc(1, sizeof(I2C_scheduler));
+  if (!sched) return NULL;
+  sched->i2c_fd = i2c_fd;
+  sched->calling = -1;
+  sched->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (sched->timer_fd < 0) {
+    free(sched);
+    return NULL;
+  }
+  return sched;
+}
+
+static void I2C_schedFreeEntry(I2C_sched_entry *entry) {
+  free(entry->trigger);
+  free(entry->readout);
+  free(entry->result);
+  memset(entry, 0, sizeof(I2C_sched_entry));
+}
+
+void I2C_schedDestroy(I2C_scheduler *sched) {
+  int i;
+  if (!sched) return;
+  for (i=0; i<sched->n_entries; i++) I2C_schedFreeEntry(&sched->entries[i]);
+  free(sched->entries);
+  close(sched->timer_fd);
+  free(sched);
+}
+
+/**
+ * Checks whether a task other than the given one is converting on the same 
+ * device.
+ */
+static int I2C_schedDeviceBusy(I2C_scheduler *sched, int id) {
+  int i;
+  for (i=0; i<sched->n_entries; i++) {
+    if (i != id && sched->entries[i].state == I2C_SCHED_CONVERTING &&
+        sched->entries[i].task.addr == sched->entries[id].task.addr) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Arms the timerfd for the earliest due step, or disarms it if none. Tasks
+ * waiting on another task's conversion are skipped, they're triggered when
+ * that conversion is read out.
+ */
+static int I2C_schedArm(I2C_scheduler *sched) {
+  struct itimerspec timer;
+  uint64_t next;
+  int i;
+  next = 0;
+  for (i=0; i<sched->n_entries; i++) {
+    if (sched->entries[i].state == I2C_SCHED_FREE) continue;
+    if (sched->entries[i].state == I2C_SCHED_IDLE && 
+        I2C_schedDeviceBusy(sched, i)) {
+      continue;
+    }
+    if (next == 0 || sched->entries[i].due < next) {
+      next = sched->entries[i].due;
+    }
+  }
+  memset(&timer, 0, sizeof(timer));
+  if (next != 0) {
+    timer.it_value.tv_sec = next / 1000000;
+    timer.it_value.tv_nsec = (next % 1000000) * 1000;
+  }
+  return timerfd_settime(sched->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+int I2C_schedAdd(I2C_scheduler *sched, const I2C_sched_task *task) {
+  I2C_sched_entry *entry, *entries;
+  int id;
+
+  if (!task->callback || 
+      (task->n_trigger_bytes && !task->trigger) ||
+      (task->n_readout_bytes && !task->readout) ||
+      (task->n_readout_bytes == 0 && task->n_result_bytes == 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Reuse a free slot if there is one, other than that of a task removed by
+  // its own callback, whose result buffer the callback still has:
+  for (id=0; id<sched->n_entries; id++) {
+    if (sched->entries[id].state == I2C_SCHED_FREE && 
+        id != sched->calling) {
+      break;
+    }
+  }
+  if (id == sched->n_entries) {
+    entries = realloc(sched->entries, 
+                      (sched->n_entries + 1) * sizeof(I2C_sched_entry));
+    if (!entries) return -1;
+    sched->entries = entries;
+    memset(&entries[id], 0, sizeof(I2C_sched_entry));
+    sched->n_entries++;
+  }
+  entry = &sched->entries[id];
+  // Buffers of a removed task are only freed when its slot is reused:
+  I2C_schedFreeEntry(entry);
+
+  entry->task = *task;
+  // Allocate at least 1 byte so a NULL always means failure:
+  entry->trigger = malloc(task->n_trigger_bytes + 1);
+  entry->readout = malloc(task->n_readout_bytes + 1);
+  entry->result = malloc(task->n_result_bytes + 1);
+  if (!entry->trigger || !entry->readout || !entry->result) {
+    I2C_schedFreeEntry(entry);
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(entry->trigger, task->trigger, task->n_trigger_bytes);
+  memcpy(entry->readout, task->readout, task->n_readout_bytes);
+  entry->task.trigger = entry->trigger;
+  entry->task.readout = entry->readout;
+  entry->state = I2C_SCHED_IDLE;
+  entry->due = I2C_schedNow();
+
+  if (I2C_schedArm(sched) < 0) {
+    I2C_schedFreeEntry(entry);
+    return -1;
+  }
+  return id;
+}
+
+int I2C_schedRemove(I2C_scheduler *sched, int id) {
+  if (id < 0 || id >= sched->n_entries || 
+      sched->entries[id].state == I2C_SCHED_FREE) {
+    errno = EINVAL;
+    return -1;
+  }
+  // The result buffer may be in use by the callback calling this, so just
+  // mark the slot free; I2C_schedAdd won't reuse it during the callback:
+  sched->entries[id].state = I2C_SCHED_FREE;
+  return I2C_schedArm(sched);
+}
+
+int I2C_schedFd(I2C_scheduler *sched) {
+  return sched->timer_fd;
+}
+
+/**
+ * Sets the time of the task's next trigger, once its measurement is done.
+ */
+static void I2C_schedNextTrigger(I2C_sched_entry *entry, uint64_t now) {
+  entry->state = I2C_SCHED_IDLE;
+  entry->due = entry->triggered + entry->task.period_us;
+  // Don't try to catch up on missed periods:
+  if (entry->due < now) entry->due = now;
+}
+
+/**
+ * Passes a result or error to the task's callback. The callback may add or
+ * remove tasks, which can move the entries, so nothing is read from the 
+ * entry once it's called.
+ */
+static void I2C_schedCall(I2C_scheduler *sched, int id, const uint8_t *result,
+                          int n_bytes, int error) {
+  I2C_sched_callback callback;
+  void *context;
+  int calling;
+  callback = sched->entries[id].task.callback;
+  context = sched->entries[id].task.context;
+  calling = sched->calling;
+  sched->calling = id;
+  callback(context, result, n_bytes, error);
+  sched->calling = calling;
+}
+
+/**
+ * Writes the task's trigger bytes to start a conversion.
+ */
+static void I2C_schedTrigger(I2C_scheduler *sched, int id, uint64_t now) {
+  I2C_sched_entry *entry = &sched->entries[id];
+  I2C_message message;
+  int error;
+
+  entry->triggered = now;
+  if (entry->task.n_trigger_bytes) {
+    message.addr = entry->task.addr;
+    message.flags = 0;
+    message.n_bytes = entry->task.n_trigger_bytes;
+    message.buffer = entry->trigger;
+    if (I2C_transfer(sched->i2c_fd, &message, 1) < 0) {
+      error = errno;
+      I2C_schedNextTrigger(entry, now);
+      I2C_schedCall(sched, id, NULL, 0, error);
+      return;
+    }
+  }
+  entry->state = I2C_SCHED_CONVERTING;
+  entry->due = now + entry->task.conversion_us;
+  entry->retries = 0;
+}
+
+/**
+ * Reads the result of the task's conversion and passes it to its callback.
+ */
+static void I2C_schedReadout(I2C_scheduler *sched, int id, uint64_t now) {
+  I2C_sched_entry *entry = &sched->entries[id];
+  I2C_message messages[2];
+  int n_messages, error;
+
+  n_messages = 0;
+  if (entry->task.n_readout_bytes) {
+    messages[n_messages].addr = entry->task.addr;
+    messages[n_messages].flags = 0;
+    messages[n_messages].n_bytes = entry->task.n_readout_bytes;
+    messages[n_messages].buffer = entry->readout;
+    n_messages++;
+  }
+  if (entry->task.n_result_bytes) {
+    messages[n_messages].addr = entry->task.addr;
+    messages[n_messages].flags = I2C_M_RD;
+    messages[n_messages].n_bytes = entry->task.n_result_bytes;
+    messages[n_messages].buffer = entry->result;
+    n_messages++;
+  }
+
+  error = 0;
+  if (I2C_transfer(sched->i2c_fd, messages, n_messages) < 0) {
+    error = errno;
+    // Devices that NAK until their conversion is done get more time:
+    if (error == ENXIO && entry->task.retry_us && 
+        entry->retries < entry->task.max_retries) {
+      entry->retries++;
+      entry->due = now + entry->task.retry_us;
+      return;
+    }
+  }
+
+  I2C_schedNextTrigger(entry, now);
+  if (error) I2C_schedCall(sched, id, NULL, 0, error);
+  else I2C_schedCall(sched, id, entry->result, entry->task.n_result_bytes, 0);
+}
+
+int I2C_schedDispatch(I2C_scheduler *sched) {
+  uint64_t now, expirations;
+  int i, n_steps;
+
+  // Clear the timerfd; EAGAIN just means it hasn't expired:
+  if (read(sched->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+      errno != EAGAIN) {
+    return -1;
+  }
+
+  now = I2C_schedNow();
+  n_steps = 0;
+  // Read out finished conversions first, so the devices they free up can be
+  // triggered again in the same pass:
+  for (i=0; i<sched->n_entries; i++) {
+    if (sched->entries[i].state != I2C_SCHED_CONVERTING ||
+        sched->entries[i].due > now) {
+      continue;
+    }
+    I2C_schedReadout(sched, i, now);
+    n_steps++;
+  }
+  for (i=0; i<sched->n_entries; i++) {
+    if (sched->entries[i].state != I2C_SCHED_IDLE ||
+        sched->entries[i].due > now || I2C_schedDeviceBusy(sched, i)) {
+      continue;
+    }
+    I2C_schedTrigger(sched, i, now);
+    n_steps++;
+  }
+
+  if (I2C_schedArm(sched) < 0) return -1;
+  return n_steps;
+}
+
+int I2C_schedRun(I2C_scheduler *sched, int timeout_ms) {
+  struct pollfd pfd;
+  int ret;
+  pfd.fd = sched->timer_fd;
+  pfd.events = POLLIN;
+  ret = poll(&pfd, 1, timeout_ms);
+  if (ret < 0) return -1;
+  if (ret == 0) return 0;
+  return I2C_schedDispatch(sched);
+}
@@ -0,0 +1,550 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file regmap.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Cached register access for I2C and SPI peripherals.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "regmap.h"
+#include "i2cdriver.h"
+#include "spidriver.h"
+
+/// The most registers moved in a single bus transfer
+#define REGMAP_MAX_RUN 32
+/// Largest register address size, in bytes
+#define REGMAP_MAX_REG_BYTES 2
+/// Largest register value size, in bytes
+#define REGMAP_MAX_VAL_BYTES 4
+
+#define REGMAP_CACHED 0x01 ///< The register's value is in the cache
+#define REGMAP_DIRTY  0x02 ///< The cached value hasn't been written yet
+
+struct Regmap {
+  int fd;                ///< I2C or spidev file descriptor
+  int is_spi;            ///< Set if fd is an spidev interface
+  uint16_t addr;         ///< I2C slave address
+  Regmap_config config;  ///< Device description, ranges not kept
+  uint8_t *flags;        ///< REGMAP_* class flags of each register
+  uint8_t *state;        ///< REGMAP_CACHED/REGMAP_DIRTY of each register
+  uint32_t *values;      ///< Cached value of each register
+  int cache_only;        ///< Set while in cache-only mode
+  Regmap_stats stats;    ///< Cache counters
+  pthread_mutex_t lock;  ///< Serialises access to the map and its device
+};
+
+static Regmap *Regmap_create(const Regmap_config *config) {
+  Regmap *map;
+  uint32_t n_registers, reg, last;
+  int i;
+
+  if (config->reg_bytes < 1 || config->reg_bytes > REGMAP_MAX_REG_BYTES ||
+      (config->val_bytes != 1 && config->val_bytes != 2 && 
+       config->val_bytes != 4) ||
+      config->max_register >> (8 * config->reg_bytes) != 0 ||
+      config->n_ranges < 0 || (config->n_ranges > 0 && !config->ranges)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  n_registers = config->max_register + 1;
+
+  map = calloc(1, sizeof(Regmap));
+  if (!map) return NULL;
+  map->config = *config;
+  map->config.ranges = NULL;
+  map->flags = calloc(n_registers, sizeof(uint8_t));
+  map->state = calloc(n_registers, sizeof(uint8_t));
+  map->values = calloc(n_registers, sizeof(uint32_t));
+  if (!map->flags || !map->state || !map->values) {
+    free(map->flags);
+    free(map->state);
+    free(map->values);
+    free(map);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  for (i=0; i<config->n_ranges; i++) {
+    last = config->ranges[i].last;
+    if (last > config->max_register) last = config->max_register;
+    for (reg=config->ranges[i].first; reg<=last; reg++) {
+      map->flags[reg] |= config->ranges[i].flags;
+    }
+  }
+  pthread_mutex_init(&map->lock, NULL);
+  return map;
+}
+
+Regmap *Regmap_createI2C(int i2c_fd, uint16_t addr, 
+                         const Regmap_config *config) {
+  Regmap *map;
+  map = Regmap_create(config);
+  if (!map) return NULL;
+  map->fd = i2c_fd;
+  map->addr = addr;
+  return map;
+}
+
+Regmap *Regmap_createSPI(int spidev_fd, const Regmap_config *config) {
+  Regmap *map;
+  map = Regmap_create(config);
+  if (!map) return NULL;
+  map->fd = spidev_fd;
+  map->is_spi = 1;
+  return map;
+}
+
+void Regmap_destroy(Regmap *map) {
+  if (!map) return;
+  pthread_mutex_destroy(&map->lock);
+  free(map->flags);
+  free(map->state);
+  free(map->values);
+  free(map);
+}
+
+/**
+ * Registers whose values can be kept in the cache.
+ */
+static int Regmap_cacheable(Regmap *map, uint32_t reg) {
+  return !(map->flags[reg] & (REGMAP_VOLATILE | REGMAP_PRECIOUS));
+}
+
+/**
+ * Checks that the n_registers registers starting at reg exist, and have none
+ * of the given class flags.
+ */
+static int Regmap_checkRange(Regmap *map, uint32_t reg, int n_registers,
+                             uint8_t excluded) {
+  int i;
+  if (n_registers < 1 || reg > map->config.max_register ||
+      (uint32_t) n_registers - 1 > map->config.max_register - reg) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i=0; i<n_registers; i++) {
+    if (map->flags[reg+i] & excluded) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Checks that the given values fit in the registers, since only the low 
+ * val_bytes bytes would be written and the rest would only be cached.
+ */
+static int Regmap_checkValues(Regmap *map, const uint32_t *values, 
+                              int n_values) {
+  int i;
+  if (map->config.val_bytes == 4) return 0;
+  for (i=0; i<n_values; i++) {
+    if (values[i] >> (8 * map->config.val_bytes)) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Puts the register address in the given buffer, MSB first, with mask OR'd 
+ * into the first byte. Returns the number of bytes used.
+ */
+static int Regmap_encodeAddress(Regmap *map, uint32_t reg, uint8_t mask,
+                                uint8_t *buffer) {
+  int i, n_bytes;
+  n_bytes = map->config.reg_bytes;
+  for (i=0; i<n_bytes; i++) buffer[i] = reg >> (8 * (n_bytes - 1 - i));
+  buffer[0] |= mask;
+  return n_bytes;
+}
+
+static void Regmap_encodeValue(Regmap *map, uint32_t value, uint8_t *buffer) {
+  int i, n_bytes;
+  n_bytes = map->config.val_bytes;
+  for (i=0; i<n_bytes; i++) {
+    if (map->config.little_endian) buffer[i] = value >> (8 * i);
+    else buffer[i] = value >> (8 * (n_bytes - 1 - i));
+  }
+}
+
+static uint32_t Regmap_decodeValue(Regmap *map, const uint8_t *buffer) {
+  uint32_t value;
+  int i, n_bytes;
+  n_bytes = map->config.val_bytes;
+  value = 0;
+  for (i=0; i<n_bytes; i++) {
+    if (map->config.little_endian) value |= (uint32_t) buffer[i] << (8 * i);
+    else value = (value << 8) | buffer[i];
+  }
+  return value;
+}
+
+/**
+ * Reads up to REGMAP_MAX_RUN consecutive registers from the device.
+ */
+static int Regmap_busRead(Regmap *map, uint32_t reg, uint32_t *values, 
+                          int n_registers) {
+  uint8_t address[REGMAP_MAX_REG_BYTES];
+  uint8_t data[REGMAP_MAX_RUN * REGMAP_MAX_VAL_BYTES];
+  I2C_message messages[2];
+  int n_address, n_data, i, ret;
+
+  n_data = n_registers * map->config.val_bytes;
+  if (map->is_spi) {
+    n_address = Regmap_encodeAddress(map, reg, map->config.spi_read_mask, 
+                                     address);
+    ret = SPI_transaction(map->fd, address, n_address, data, n_data);
+  }
+  else {
+    n_address = Regmap_encodeAddress(map, reg, 0, address);
+    messages[0].addr = map->addr;
+    messages[0].flags = 0;
+    messages[0].n_bytes = n_address;
+    messages[0].buffer = address;
+    messages[1].addr = map->addr;
+    messages[1].flags = I2C_M_RD;
+    messages[1].n_bytes = n_data;
+    messages[1].buffer = data;
+    ret = I2C_transfer(map->fd, messages, 2);
+  }
+  if (ret < 0) return -1;
+  map->stats.bus_reads++;
+
+  for (i=0; i<n_registers; i++) {
+    values[i] = Regmap_decodeValue(map, &data[i * map->config.val_bytes]);
+  }
+  return 0;
+}
+
+/**
+ * Writes up to REGMAP_MAX_RUN consecutive registers to the device.
+ */
+static int Regmap_busWrite(Regmap *map, uint32_t reg, const uint32_t *values,
+                           int n_registers) {
+  uint8_t buffer[REGMAP_MAX_REG_BYTES + REGMAP_MAX_RUN * REGMAP_MAX_VAL_BYTES];
+  I2C_message message;
+  int n_bytes, i, ret;
+
+  n_bytes = Regmap_encodeAddress(map, reg, 
+                                 map->is_spi ? map->config.spi_write_mask : 0,
+                                 buffer);
+  for (i=0; i<n_registers; i++) {
+    Regmap_encodeValue(map, values[i], &buffer[n_bytes]);
+    n_bytes += map->config.val_bytes;
+  }
+
+  if (map->is_spi) {
+    ret = SPI_write(map->fd, buffer, n_bytes);
+  }
+  else {
+    message.addr = map->addr;
+    message.flags = 0;
+    message.n_bytes = n_bytes;
+    message.buffer = buffer;
+    ret = I2C_transfer(map->fd, &message, 1);
+  }
+  if (ret < 0) return -1;
+  map->stats.bus_writes++;
+  return 0;
+}
+
+/**
+ * Reads one register, must hold the map's lock.
+ */
+static int Regmap_readLocked(Regmap *map, uint32_t reg, uint32_t *value) {
+  if (Regmap_checkRange(map, reg, 1, 0) < 0) return -1;
+  if (Regmap_cacheable(map, reg)) {
+    if (map->state[reg] & REGMAP_CACHED) {
+      map->stats.hits++;
+      *value = map->values[reg];
+      return 0;
+    }
+    if (map->cache_only) {
+      errno = EBUSY;
+      return -1;
+    }
+    map->stats.misses++;
+    if (Regmap_busRead(map, reg, value, 1) < 0) return -1;
+    map->values[reg] = *value;
+    map->state[reg] = REGMAP_CACHED;
+    return 0;
+  }
+  if (map->cache_only) {
+    errno = EBUSY;
+    return -1;
+  }
+  return Regmap_busRead(map, reg, value, 1);
+}
+
+/**
+ * Writes one register, must hold the map's lock.
+ */
+static int Regmap_writeLocked(Regmap *map, uint32_t reg, uint32_t value) {
+  int cacheable;
+  if (Regmap_checkRange(map, reg, 1, REGMAP_READ_ONLY) < 0 ||
+      Regmap_checkValues(map, &value, 1) < 0) {
+    return -1;
+  }
+  cacheable = Regmap_cacheable(map, reg);
+  if (cacheable && (map->state[reg] & REGMAP_CACHED) && 
+      map->values[reg] == value) {
+    map->stats.skipped_writes++;
+    return 0;
+  }
+  if (map->cache_only) {
+    if (!cacheable) {
+      errno = EBUSY;
+      return -1;
+    }
+    map->values[reg] = value;
+    map->state[reg] = REGMAP_CACHED | REGMAP_DIRTY;
+    return 0;
+  }
+  if (Regmap_busWrite(map, reg, &value, 1) < 0) return -1;
+  if (cacheable) {
+    map->values[reg] = value;
+    map->state[reg] = REGMAP_CACHED;
+  }
+  return 0;
+}
+
+int Regmap_read(Regmap *map, uint32_t reg, uint32_t *value) {
+  int ret;
+  pthread_mutex_lock(&map->lock);
+  ret = Regmap_readLocked(map, reg, value);
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+int Regmap_write(Regmap *map, uint32_t reg, uint32_t value) {
+  int ret;
+  pthread_mutex_lock(&map->lock);
+  ret = Regmap_writeLocked(map, reg, value);
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+int Regmap_update(Regmap *map, uint32_t reg, uint32_t mask, uint32_t value) {
+  uint32_t old_value;
+  int ret;
+  pthread_mutex_lock(&map->lock);
+  ret = Regmap_readLocked(map, reg, &old_value);
+  if (ret == 0) {
+    ret = Regmap_writeLocked(map, reg, (old_value & ~mask) | (value & mask));
+  }
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+/**
+ * Checks whether all the given registers are cached.
+ */
+static int Regmap_allCached(Regmap *map, uint32_t reg, int n_registers) {
+  int i;
+  for (i=0; i<n_registers; i++) {
+    if (!Regmap_cacheable(map, reg+i) || 
+        !(map->state[reg+i] & REGMAP_CACHED)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int Regmap_bulkReadLocked(Regmap *map, uint32_t reg, uint32_t *values,
+                                 int n_registers) {
+  uint32_t run[REGMAP_MAX_RUN];
+  int first, n, i;
+
+  if (Regmap_checkRange(map, reg, n_registers, REGMAP_PRECIOUS) < 0) {
+    return -1;
+  }
+  if (Regmap_allCached(map, reg, n_registers)) {
+    map->stats.hits += n_registers;
+    memcpy(values, &map->values[reg], n_registers * sizeof(uint32_t));
+    return 0;
+  }
+  if (map->cache_only) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  for (first=0; first<n_registers; first+=n) {
+    n = n_registers - first;
+    if (n > REGMAP_MAX_RUN) n = REGMAP_MAX_RUN;
+    if (Regmap_busRead(map, reg + first, run, n) < 0) return -1;
+    for (i=0; i<n; i++) {
+      if (!Regmap_cacheable(map, reg + first + i)) {
+        values[first+i] = run[i];
+      }
+      else if (map->state[reg+first+i] & REGMAP_CACHED) {
+        // The cache is authoritative, it may hold a write not yet synced:
+        map->stats.hits++;
+        values[first+i] = map->values[reg+first+i];
+      }
+      else {
+        map->stats.misses++;
+        map->values[reg+first+i] = run[i];
+        map->state[reg+first+i] = REGMAP_CACHED;
+        values[first+i] = run[i];
+      }
+    }
+  }
+  return 0;
+}
+
+int Regmap_bulkRead(Regmap *map, uint32_t reg, uint32_t *values, 
+                    int n_registers) {
+  int ret;
+  pthread_mutex_lock(&map->lock);
+  ret = Regmap_bulkReadLocked(map, reg, values, n_registers);
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+static int Regmap_bulkWriteLocked(Regmap *map, uint32_t reg, 
+                                  const uint32_t *values, int n_registers) {
+  int first, n, i;
+
+  if (Regmap_checkRange(map, reg, n_registers, REGMAP_READ_ONLY) < 0 ||
+      Regmap_checkValues(map, values, n_registers) < 0) {
+    return -1;
+  }
+  if (Regmap_allCached(map, reg, n_registers) &&
+      memcmp(values, &map->values[reg], n_registers * sizeof(uint32_t)) == 0) {
+    map->stats.skipped_writes++;
+    return 0;
+  }
+
+  if (map->cache_only) {
+    for (i=0; i<n_registers; i++) {
+      if (!Regmap_cacheable(map, reg+i)) {
+        errno = EBUSY;
+        return -1;
+      }
+    }
+    for (i=0; i<n_registers; i++) {
+      map->values[reg+i] = values[i];
+      map->state[reg+i] = REGMAP_CACHED | REGMAP_DIRTY;
+    }
+    return 0;
+  }
+
+  for (first=0; first<n_registers; first+=n) {
+    n = n_registers - first;
+    if (n > REGMAP_MAX_RUN) n = REGMAP_MAX_RUN;
+    if (Regmap_busWrite(map, reg + first, &values[first], n) < 0) return -1;
+    for (i=first; i<first+n; i++) {
+      if (Regmap_cacheable(map, reg+i)) {
+        map->values[reg+i] = values[i];
+        map->state[reg+i] = REGMAP_CACHED;
+      }
+    }
+  }
+  return 0;
+}
+
+int Regmap_bulkWrite(Regmap *map, uint32_t reg, const uint32_t *values, 
+                     int n_registers) {
+  int ret;
+  pthread_mutex_lock(&map->lock);
+  ret = Regmap_bulkWriteLocked(map, reg, values, n_registers);
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+void Regmap_setCacheOnly(Regmap *map, int enable) {
+  pthread_mutex_lock(&map->lock);
+  map->cache_only = enable != 0;
+  pthread_mutex_unlock(&map->lock);
+}
+
+void Regmap_markDirty(Regmap *map) {
+  uint32_t reg;
+  pthread_mutex_lock(&map->lock);
+  for (reg=0; reg<=map->config.max_register; reg++) {
+    if ((map->state[reg] & REGMAP_CACHED) && 
+        !(map->flags[reg] & REGMAP_READ_ONLY)) {
+      map->state[reg] |= REGMAP_DIRTY;
+    }
+  }
+  pthread_mutex_unlock(&map->lock);
+}
+
+int Regmap_sync(Regmap *map) {
+  uint32_t reg, first, n_registers;
+  int n, i, ret;
+
+  pthread_mutex_lock(&map->lock);
+  if (map->cache_only) {
+    pthread_mutex_unlock(&map->lock);
+    errno = EBUSY;
+    return -1;
+  }
+  ret = 0;
+  n_registers = map->config.max_register + 1;
+  reg = 0;
+  while (ret == 0 && reg < n_registers) {
+    if (!(map->state[reg] & REGMAP_DIRTY)) {
+      reg++;
+      continue;
+    }
+    // Write the run of dirty registers starting here in one transfer:
+    first = reg;
+    n = 0;
+    while (reg < n_registers && n < REGMAP_MAX_RUN && 
+           (map->state[reg] & REGMAP_DIRTY)) {
+      reg++;
+      n++;
+    }
+    ret = Regmap_busWrite(map, first, &map->values[first], n);
+    if (ret == 0) {
+      for (i=0; i<n; i++) map->state[first+i] &= ~REGMAP_DIRTY;
+    }
+  }
+  pthread_mutex_unlock(&map->lock);
+  return ret;
+}
+
+void Regmap_invalidate(Regmap *map, uint32_t first, uint32_t last) {
+  uint32_t reg;
+  pthread_mutex_lock(&map->lock);
+  if (last > map->config.max_register) last = map->config.max_register;
+  for (reg=first; reg<=last; reg++) map->state[reg] = 0;
+  pthread_mutex_unlock(&map->lock);
+}
+
+void Regmap_getStats(Regmap *map, Regmap_stats *stats) {
+  pthread_mutex_lock(&map->lock);
+  *stats = map->stats;
+  pthread_mutex_unlock(&map->lock);
+}
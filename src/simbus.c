@@ -0,0 +1,887 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file simbus.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief An in-process simulated SPI and I2C bus for testing and profiling.
+ *
+ * Each simulated file gets a real file descriptor from /dev/null so that fds
+ * stay unique across transports; its simulated state is then looked up by fd.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/spi/spidev.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "simbus.h"
+#include "fdmap.h"
+
+/// Where the spidev driver exposes its per-message buffer size
+#define SIM_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+/// spidev's default bufsiz
+#define SIM_DEFAULT_BUFSIZ 4096
+/// ARCH_DMA_MINALIGN, which spidev aligns transfer lengths to within bufsiz
+#define SIM_DMA_ALIGN 128
+/// The kernel's limit on the number of messages in an I2C_RDWR
+#define SIM_I2C_RDWR_MAX_MSGS 42
+/// Default max clock frequency of simulated SPI interfaces
+#define SIM_DEFAULT_SPEED_HZ 500000
+/// I2C_FUNCS flags reported by default
+#define SIM_DEFAULT_I2C_FUNCS (I2C_FUNC_I2C | I2C_FUNC_10BIT_ADDR | \
+  I2C_FUNC_PROTOCOL_MANGLING | I2C_FUNC_SMBUS_EMUL | \
+  I2C_FUNC_SMBUS_READ_BLOCK_DATA | I2C_FUNC_SMBUS_BLOCK_PROC_CALL)
+
+/**
+ * A device attached to a simulated SPI or I2C bus.
+ */
+typedef struct SimSlot {
+  int is_spi;           ///< 1 if on an SPI bus, 0 if on an I2C bus
+  uint8_t bus;          ///< Bus number
+  uint16_t addr;        ///< Chip select for SPI, slave address for I2C
+  int selected;         ///< SPI: whether CS is currently asserted
+  SimDevice *device;    ///< The device model
+  struct SimSlot *mux;  ///< I2C: the mux this is behind, or NULL if none
+  uint8_t channel;      ///< I2C: the channel of mux this is on
+  struct SimSlot *next;
+} SimSlot;
+
+/**
+ * The state of an open simulated file.
+ */
+typedef struct {
+  int is_spi;            ///< 1 for /dev/spidevB.C, 0 for /dev/i2c-B
+  uint8_t bus;           ///< Bus number
+  uint8_t cs;            ///< SPI chip select
+  uint32_t mode;         ///< SPI mode
+  uint32_t speed_hz;     ///< SPI max clock frequency
+  uint8_t bits_per_word; ///< SPI bits per word, 0 meaning 8
+  uint16_t addr;         ///< I2C slave address
+  int tenbit;            ///< I2C 10-bit addressing enabled
+} SimFile;
+
+/// Serializes all simulated I/O and changes to the topology
+static pthread_mutex_t Sim_lock = PTHREAD_MUTEX_INITIALIZER;
+/// All attached devices
+static SimSlot *Sim_slots = NULL;
+/// Set once the topology has been set up, by default or explicitly
+static int Sim_topology_set = 0;
+/// Current recorder, only valid if Sim_recording is set
+static SimRecorder Sim_recorder;
+static int Sim_recording = 0;
+/// I2C_FUNCS flags reported by the I2C buses
+static unsigned long Sim_i2c_funcs = SIM_DEFAULT_I2C_FUNCS;
+/// Open simulated files, indexed by fd
+static FDMap Sim_files = FDMAP_INITIALIZER;
+
+static uint32_t Sim_bufsiz = SIM_DEFAULT_BUFSIZ;
+static pthread_once_t Sim_bufsiz_once = PTHREAD_ONCE_INIT;
+
+static void Sim_readBufsiz(void) {
+  FILE *bufsiz_file;
+  unsigned int bufsiz;
+  bufsiz_file = fopen(SIM_BUFSIZ_PATH, "r");
+  if (!bufsiz_file) return;
+  if (fscanf(bufsiz_file, "%u", &bufsiz) == 1 && bufsiz >= 4) {
+    Sim_bufsiz = bufsiz;
+  }
+  fclose(bufsiz_file);
+}
+
+/**
+ * Finds the slot for the given bus and address that isn't behind a mux, must
+ * hold Sim_lock.
+ */
+static SimSlot *Sim_findSlot(int is_spi, uint8_t bus, uint16_t addr) {
+  SimSlot *slot;
+  for (slot=Sim_slots; slot; slot=slot->next) {
+    if (slot->is_spi == is_spi && slot->bus == bus && slot->addr == addr &&
+        !slot->mux) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Checks whether every mux between the given slot and its bus has the path
+ * to it connected, must hold Sim_lock.
+ */
+static int Sim_connected(SimSlot *slot) {
+  SimDevice *mux;
+  for (; slot->mux; slot=slot->mux) {
+    mux = slot->mux->device;
+    if (!mux->i2c_channels || 
+        !(mux->i2c_channels(mux) & (1 << slot->channel))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Finds the device currently answering the given address on an I2C bus. If
+ * several are connected they'd all answer and garble each other, so none is
+ * returned and \p clash is set. Must hold Sim_lock.
+ */
+static SimSlot *Sim_findI2C(uint8_t bus, uint16_t addr, int *clash) {
+  SimSlot *slot, *found;
+  found = NULL;
+  *clash = 0;
+  for (slot=Sim_slots; slot; slot=slot->next) {
+    if (slot->is_spi || slot->bus != bus || slot->addr != addr || 
+        !Sim_connected(slot)) {
+      continue;
+    }
+    if (found) {
+      *clash = 1;
+      return NULL;
+    }
+    found = slot;
+  }
+  return found;
+}
+
+/**
+ * Attaches the given device, behind the given mux slot if not NULL, must 
+ * hold Sim_lock.
+ */
+static int Sim_attach(int is_spi, uint8_t bus, uint16_t addr, SimSlot *mux,
+                      uint8_t channel, SimDevice *device) {
+  SimSlot *slot;
+  if (!device) {
+    errno = EINVAL;
+    return -1;
+  }
+  Sim_topology_set = 1;
+  for (slot=Sim_slots; slot; slot=slot->next) {
+    if (slot->is_spi == is_spi && slot->bus == bus && slot->addr == addr &&
+        slot->mux == mux && (!mux || slot->channel == channel)) {
+      break;
+    }
+  }
+  if (slot) {
+    if (slot->device->destroy) slot->device->destroy(slot->device);
+    slot->device = device;
+    slot->selected = 0;
+    return 0;
+  }
+  slot = calloc(1, sizeof(SimSlot));
+  if (!slot) {
+    if (device->destroy) device->destroy(device);
+    return -1;
+  }
+  slot->is_spi = is_spi;
+  slot->bus = bus;
+  slot->addr = addr;
+  slot->device = device;
+  slot->mux = mux;
+  slot->channel = channel;
+  slot->next = Sim_slots;
+  Sim_slots = slot;
+  return 0;
+}
+
+int Sim_attachSPI(uint8_t bus, uint8_t cs, SimDevice *device) {
+  int ret;
+  pthread_mutex_lock(&Sim_lock);
+  ret = Sim_attach(1, bus, cs, NULL, 0, device);
+  pthread_mutex_unlock(&Sim_lock);
+  return ret;
+}
+
+int Sim_attachI2C(uint8_t bus, uint16_t addr, SimDevice *device) {
+  int ret;
+  pthread_mutex_lock(&Sim_lock);
+  ret = Sim_attach(0, bus, addr, NULL, 0, device);
+  pthread_mutex_unlock(&Sim_lock);
+  return ret;
+}
+
+int Sim_attachI2CMuxed(uint8_t bus, SimDevice *mux, uint8_t channel,
+                       uint16_t addr, SimDevice *device) {
+  SimSlot *slot;
+  int ret;
+  pthread_mutex_lock(&Sim_lock);
+  for (slot=Sim_slots; slot; slot=slot->next) {
+    if (!slot->is_spi && slot->bus == bus && slot->device == mux) break;
+  }
+  if (!slot || !mux->i2c_channels || channel > 7) {
+    pthread_mutex_unlock(&Sim_lock);
+    if (device && device->destroy) device->destroy(device);
+    errno = EINVAL;
+    return -1;
+  }
+  ret = Sim_attach(0, bus, addr, slot, channel, device);
+  pthread_mutex_unlock(&Sim_lock);
+  return ret;
+}
+
+void Sim_setI2CFunctionality(unsigned long funcs) {
+  pthread_mutex_lock(&Sim_lock);
+  Sim_i2c_funcs = funcs;
+  pthread_mutex_unlock(&Sim_lock);
+}
+
+void Sim_reset(void) {
+  SimSlot *slot;
+  pthread_mutex_lock(&Sim_lock);
+  while (Sim_slots) {
+    slot = Sim_slots;
+    Sim_slots = slot->next;
+    if (slot->device->destroy) slot->device->destroy(slot->device);
+    free(slot);
+  }
+  Sim_topology_set = 0;
+  Sim_i2c_funcs = SIM_DEFAULT_I2C_FUNCS;
+  pthread_mutex_unlock(&Sim_lock);
+}
+
+/**
+ * Attaches the default devices, must hold Sim_lock.
+ */
+static void Sim_attachDefaults(void) {
+  Sim_attach(1, 0, 0, NULL, 0, SimDevice_spiLoopback());
+  Sim_attach(1, 0, 1, NULL, 0, SimDevice_adc(12));
+  Sim_attach(1, 1, 0, NULL, 0, SimDevice_spiLoopback());
+  Sim_attach(0, 1, 0x40, NULL, 0, SimDevice_htu21d(25.0, 50.0));
+  Sim_attach(0, 1, 0x50, NULL, 0, SimDevice_eeprom24c(4096, 32, 5000));
+}
+
+void Sim_loadDefaultTopology(void) {
+  pthread_mutex_lock(&Sim_lock);
+  Sim_attachDefaults();
+  pthread_mutex_unlock(&Sim_lock);
+}
+
+void Sim_setRecorder(const SimRecorder *recorder) {
+  pthread_mutex_lock(&Sim_lock);
+  Sim_recording = recorder != NULL;
+  if (recorder) Sim_recorder = *recorder;
+  pthread_mutex_unlock(&Sim_lock);
+}
+
+/******************************************************************************
+ * SPI
+ */
+
+/**
+ * Gets the number of bytes each word takes in a buffer, or 0 if invalid.
+ */
+static uint32_t Sim_wordBytes(uint8_t bits_per_word) {
+  if (bits_per_word == 0 || bits_per_word > 32) return 0;
+  if (bits_per_word <= 8) return 1;
+  if (bits_per_word <= 16) return 2;
+  return 4;
+}
+
+/**
+ * Checks the given number of lanes is allowed by the given mode flags.
+ */
+static int Sim_validLanes(uint8_t nbits, uint32_t mode, uint32_t dual, 
+                          uint32_t quad) {
+  switch (nbits) {
+    case 0:
+    case 1: return 1;
+    case 2: return (mode & (dual | quad)) != 0;
+    case 4: return (mode & quad) != 0;
+    default: return 0;
+  }
+}
+
+/**
+ * Carries out an SPI message on the given file the way spidev would, must
+ * hold Sim_lock.
+ */
+static int Sim_spiMessage(SimFile *file, struct spi_ioc_transfer *transfers,
+                          int n_transfers) {
+  SimSlot *slot;
+  SimDevice *device;
+  uint32_t tx_total, rx_total, total, word_bytes, len_aligned;
+  uint8_t bits_per_word, *tx, *rx;
+  int i;
+
+  slot = Sim_findSlot(1, file->bus, file->cs);
+  if (!slot) {
+    errno = ENODEV;
+    return -1;
+  }
+  pthread_once(&Sim_bufsiz_once, Sim_readBufsiz);
+  tx_total = 0;
+  rx_total = 0;
+  for (i=0; i<n_transfers; i++) {
+    bits_per_word = transfers[i].bits_per_word ? transfers[i].bits_per_word :
+      (file->bits_per_word ? file->bits_per_word : 8);
+    word_bytes = Sim_wordBytes(bits_per_word);
+    if (!word_bytes || transfers[i].len % word_bytes) {
+      errno = EINVAL;
+      return -1;
+    }
+    if ((transfers[i].tx_buf && 
+         !Sim_validLanes(transfers[i].tx_nbits, file->mode, SPI_TX_DUAL, 
+                         SPI_TX_QUAD)) ||
+        (transfers[i].rx_buf &&
+         !Sim_validLanes(transfers[i].rx_nbits, file->mode, SPI_RX_DUAL, 
+                         SPI_RX_QUAD))) {
+      errno = EINVAL;
+      return -1;
+    }
+    // Like spidev, counts each transfer as its length aligned for DMA:
+    len_aligned = (transfers[i].len + SIM_DMA_ALIGN - 1) & 
+      ~(uint32_t) (SIM_DMA_ALIGN - 1);
+    if (transfers[i].tx_buf) tx_total += len_aligned;
+    if (transfers[i].rx_buf) rx_total += len_aligned;
+    if (tx_total > Sim_bufsiz || rx_total > Sim_bufsiz) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+  }
+  if (Sim_recording && Sim_recorder.spi_message) {
+    Sim_recorder.spi_message(Sim_recorder.context, file->bus, file->cs, 
+                             file->mode, transfers, n_transfers);
+  }
+
+  device = slot->device;
+  total = 0;
+  for (i=0; i<n_transfers; i++) {
+    if (!slot->selected) {
+      slot->selected = 1;
+      if (device->spi_select) device->spi_select(device, 1);
+    }
+    bits_per_word = transfers[i].bits_per_word ? transfers[i].bits_per_word :
+      (file->bits_per_word ? file->bits_per_word : 8);
+    tx = (uint8_t *) (uintptr_t) transfers[i].tx_buf;
+    rx = (uint8_t *) (uintptr_t) transfers[i].rx_buf;
+    if (file->mode & SPI_LOOP) {
+      // The controller connects MOSI to MISO itself:
+      if (rx && tx) memcpy(rx, tx, transfers[i].len);
+      else if (rx) memset(rx, 0, transfers[i].len);
+    }
+    else if (device->spi_transfer) {
+      device->spi_transfer(device, tx, rx, transfers[i].len, bits_per_word);
+    }
+    else if (rx) {
+      memset(rx, 0, transfers[i].len);
+    }
+    total += transfers[i].len;
+    // cs_change deselects between transfers, but keeps CS asserted after the
+    // last one:
+    if (transfers[i].cs_change == (i < n_transfers - 1)) {
+      slot->selected = 0;
+      if (device->spi_select) device->spi_select(device, 0);
+    }
+  }
+  return total;
+}
+
+/**
+ * Emulates the spidev ioctls, must hold Sim_lock.
+ */
+static int Sim_spiIoctl(SimFile *file, unsigned long request, void *arg) {
+  if (_IOC_TYPE(request) == SPI_IOC_MAGIC && _IOC_NR(request) == 0 &&
+      _IOC_DIR(request) == _IOC_WRITE) {
+    // spidev quietly does nothing with a size of 0, which is what a count 
+    // too big for the size field wraps to, so fail loudly instead:
+    if (!_IOC_SIZE(request) || 
+        _IOC_SIZE(request) % sizeof(struct spi_ioc_transfer)) {
+      errno = EINVAL;
+      return -1;
+    }
+    return Sim_spiMessage(file, (struct spi_ioc_transfer *) arg, 
+                          _IOC_SIZE(request) / sizeof(struct spi_ioc_transfer));
+  }
+  switch (request) {
+    case SPI_IOC_RD_MODE:
+      *(uint8_t *) arg = file->mode;
+      return 0;
+    case SPI_IOC_WR_MODE:
+      // Like spidev, clears the mode bits above the first 8:
+      file->mode = *(uint8_t *) arg;
+      return 0;
+    case SPI_IOC_RD_MODE32:
+      *(uint32_t *) arg = file->mode;
+      return 0;
+    case SPI_IOC_WR_MODE32:
+      file->mode = *(uint32_t *) arg;
+      return 0;
+    case SPI_IOC_RD_LSB_FIRST:
+      *(uint8_t *) arg = (file->mode & SPI_LSB_FIRST) ? 1 : 0;
+      return 0;
+    case SPI_IOC_WR_LSB_FIRST:
+      if (*(uint8_t *) arg) file->mode |= SPI_LSB_FIRST;
+      else file->mode &= ~SPI_LSB_FIRST;
+      return 0;
+    case SPI_IOC_RD_BITS_PER_WORD:
+      *(uint8_t *) arg = file->bits_per_word;
+      return 0;
+    case SPI_IOC_WR_BITS_PER_WORD:
+      if (*(uint8_t *) arg > 32) {
+        errno = EINVAL;
+        return -1;
+      }
+      file->bits_per_word = *(uint8_t *) arg;
+      return 0;
+    case SPI_IOC_RD_MAX_SPEED_HZ:
+      *(uint32_t *) arg = file->speed_hz;
+      return 0;
+    case SPI_IOC_WR_MAX_SPEED_HZ:
+      file->speed_hz = *(uint32_t *) arg;
+      return 0;
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+/******************************************************************************
+ * I2C
+ */
+
+/**
+ * Sends the stop condition to every device addressed since the last one, in
+ * the order they were addressed, must hold Sim_lock.
+ */
+static void Sim_i2cStop(SimDevice **addressed, int *n_addressed) {
+  int i;
+  for (i=0; i<*n_addressed; i++) {
+    if (addressed[i]->i2c_stop) addressed[i]->i2c_stop(addressed[i]);
+  }
+  *n_addressed = 0;
+}
+
+/**
+ * Carries out an I2C transfer on the given bus, must hold Sim_lock.
+ */
+static int Sim_i2cTransfer(uint8_t bus, struct i2c_msg *messages, 
+                           int n_messages) {
+  SimDevice *addressed[SIM_I2C_RDWR_MAX_MSGS];
+  SimSlot *slot;
+  SimDevice *device;
+  uint8_t n_block;
+  int i, j, ret, clash, n_addressed;
+
+  if (n_messages > SIM_I2C_RDWR_MAX_MSGS) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i=0; i<n_messages; i++) {
+    if ((messages[i].flags & I2C_M_STOP) && 
+        !(Sim_i2c_funcs & I2C_FUNC_PROTOCOL_MANGLING)) {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+  }
+
+  ret = n_messages;
+  n_addressed = 0;
+  for (i=0; i<n_messages; i++) {
+    // Messages are joined by repeated starts unless I2C_M_STOP asks for a
+    // stop, which is when muxes switch channels:
+    if (i > 0 && (messages[i-1].flags & I2C_M_STOP)) {
+      Sim_i2cStop(addressed, &n_addressed);
+    }
+    slot = Sim_findI2C(bus, messages[i].addr, &clash);
+    if (clash) {
+      errno = EIO;
+      ret = -1;
+      break;
+    }
+    device = slot ? slot->device : NULL;
+    if (device) {
+      for (j=0; j<n_addressed && addressed[j]!=device; j++);
+      if (j == n_addressed) addressed[n_addressed++] = device;
+    }
+    if (!device) {
+      if (messages[i].flags & I2C_M_IGNORE_NAK) continue;
+      errno = ENXIO;
+      ret = -1;
+      break;
+    }
+    if (!(messages[i].flags & I2C_M_RD)) {
+      if ((!device->i2c_write || 
+           device->i2c_write(device, messages[i].buf, messages[i].len) < 0) &&
+          !(messages[i].flags & I2C_M_IGNORE_NAK)) {
+        errno = ENXIO;
+        ret = -1;
+        break;
+      }
+      continue;
+    }
+    if (!(messages[i].flags & I2C_M_RECV_LEN)) {
+      if ((!device->i2c_read || 
+           device->i2c_read(device, messages[i].buf, messages[i].len) < 0) &&
+          !(messages[i].flags & I2C_M_IGNORE_NAK)) {
+        errno = ENXIO;
+        ret = -1;
+        break;
+      }
+      continue;
+    }
+    // The first byte read gives the number of bytes that follow:
+    if (messages[i].len < I2C_SMBUS_BLOCK_MAX + 1) {
+      errno = EINVAL;
+      ret = -1;
+      break;
+    }
+    if (!device->i2c_read || device->i2c_read(device, messages[i].buf, 1) < 0) {
+      errno = ENXIO;
+      ret = -1;
+      break;
+    }
+    n_block = messages[i].buf[0];
+    if (n_block == 0 || n_block > I2C_SMBUS_BLOCK_MAX) {
+      errno = EPROTO;
+      ret = -1;
+      break;
+    }
+    if (device->i2c_read(device, messages[i].buf + 1, n_block) < 0) {
+      errno = ENXIO;
+      ret = -1;
+      break;
+    }
+  }
+  Sim_i2cStop(addressed, &n_addressed);
+  if (Sim_recording && Sim_recorder.i2c_transfer) {
+    Sim_recorder.i2c_transfer(Sim_recorder.context, bus, messages, 
+                              ret < 0 ? i + 1 : n_messages);
+  }
+  return ret;
+}
+
+/**
+ * Emulates an SMBus transfer with I2C messages, the same way the kernel does
+ * for adapters without native SMBus support. Must hold Sim_lock.
+ */
+static int Sim_smbus(SimFile *file, struct i2c_smbus_ioctl_data *args) {
+  uint8_t tx[I2C_SMBUS_BLOCK_MAX + 3], rx[I2C_SMBUS_BLOCK_MAX + 2];
+  struct i2c_msg messages[2];
+  union i2c_smbus_data *data;
+  uint16_t flags;
+  int reading, n_messages;
+
+  data = args->data;
+  reading = args->read_write == I2C_SMBUS_READ;
+  flags = file->tenbit ? I2C_M_TEN : 0;
+  memset((void *) messages, 0, sizeof(messages));
+  messages[0].addr = file->addr;
+  messages[0].flags = flags;
+  messages[0].len = 1;
+  messages[0].buf = tx;
+  messages[1].addr = file->addr;
+  messages[1].flags = flags | I2C_M_RD;
+  messages[1].len = 0;
+  messages[1].buf = rx;
+  tx[0] = args->command;
+  n_messages = reading ? 2 : 1;
+
+  if (args->size != I2C_SMBUS_QUICK && !data) {
+    errno = EINVAL;
+    return -1;
+  }
+  switch (args->size) {
+    case I2C_SMBUS_QUICK:
+      messages[0].len = 0;
+      if (reading) messages[0].flags |= I2C_M_RD;
+      n_messages = 1;
+      break;
+    case I2C_SMBUS_BYTE:
+      if (reading) {
+        messages[0] = messages[1];
+        messages[0].len = 1;
+        n_messages = 1;
+      }
+      break;
+    case I2C_SMBUS_BYTE_DATA:
+      if (reading) {
+        messages[1].len = 1;
+      }
+      else {
+        messages[0].len = 2;
+        tx[1] = data->byte;
+      }
+      break;
+    case I2C_SMBUS_WORD_DATA:
+    case I2C_SMBUS_PROC_CALL:
+      if (!reading || args->size == I2C_SMBUS_PROC_CALL) {
+        messages[0].len = 3;
+        tx[1] = data->word & 0xff;
+        tx[2] = data->word >> 8;
+      }
+      if (args->size == I2C_SMBUS_PROC_CALL) {
+        reading = 1;
+        n_messages = 2;
+      }
+      messages[1].len = 2;
+      break;
+    case I2C_SMBUS_BLOCK_DATA:
+    case I2C_SMBUS_BLOCK_PROC_CALL:
+      if (!reading || args->size == I2C_SMBUS_BLOCK_PROC_CALL) {
+        if (data->block[0] == 0 || data->block[0] > I2C_SMBUS_BLOCK_MAX) {
+          errno = EINVAL;
+          return -1;
+        }
+        messages[0].len = data->block[0] + 2;
+        memcpy(tx + 1, data->block, data->block[0] + 1);
+      }
+      if (args->size == I2C_SMBUS_BLOCK_PROC_CALL) {
+        reading = 1;
+        n_messages = 2;
+      }
+      messages[1].flags |= I2C_M_RECV_LEN;
+      messages[1].len = I2C_SMBUS_BLOCK_MAX + 1;
+      break;
+    case I2C_SMBUS_I2C_BLOCK_BROKEN:
+    case I2C_SMBUS_I2C_BLOCK_DATA:
+      if (data->block[0] == 0 || data->block[0] > I2C_SMBUS_BLOCK_MAX) {
+        errno = EINVAL;
+        return -1;
+      }
+      if (reading) {
+        messages[1].len = data->block[0];
+      }
+      else {
+        messages[0].len = data->block[0] + 1;
+        memcpy(tx + 1, data->block + 1, data->block[0]);
+      }
+      break;
+    default:
+      errno = EOPNOTSUPP;
+      return -1;
+  }
+
+  if (Sim_i2cTransfer(file->bus, messages, n_messages) < 0) return -1;
+  if (!reading) return 0;
+  switch (args->size) {
+    case I2C_SMBUS_BYTE:
+    case I2C_SMBUS_BYTE_DATA:
+      data->byte = rx[0];
+      break;
+    case I2C_SMBUS_WORD_DATA:
+    case I2C_SMBUS_PROC_CALL:
+      data->word = rx[0] | (rx[1] << 8);
+      break;
+    case I2C_SMBUS_BLOCK_DATA:
+    case I2C_SMBUS_BLOCK_PROC_CALL:
+      memcpy(data->block, rx, rx[0] + 1);
+      break;
+    case I2C_SMBUS_I2C_BLOCK_BROKEN:
+    case I2C_SMBUS_I2C_BLOCK_DATA:
+      memcpy(data->block + 1, rx, data->block[0]);
+      break;
+  }
+  return 0;
+}
+
+/**
+ * Emulates the i2c-dev ioctls, must hold Sim_lock.
+ */
+static int Sim_i2cIoctl(SimFile *file, unsigned long request, void *arg) {
+  struct i2c_rdwr_ioctl_data *rdwr;
+  unsigned long value = (unsigned long) arg;
+  switch (request) {
+    case I2C_SLAVE:
+    case I2C_SLAVE_FORCE:
+      if (value > (file->tenbit ? 0x3ffUL : 0x7fUL)) {
+        errno = EINVAL;
+        return -1;
+      }
+      file->addr = value;
+      return 0;
+    case I2C_TENBIT:
+      file->tenbit = value != 0;
+      return 0;
+    case I2C_PEC:
+    case I2C_TIMEOUT:
+    case I2C_RETRIES:
+      return 0;
+    case I2C_FUNCS:
+      *(unsigned long *) arg = Sim_i2c_funcs;
+      return 0;
+    case I2C_RDWR:
+      rdwr = (struct i2c_rdwr_ioctl_data *) arg;
+      if (rdwr->nmsgs > SIM_I2C_RDWR_MAX_MSGS) {
+        errno = EINVAL;
+        return -1;
+      }
+      return Sim_i2cTransfer(file->bus, rdwr->msgs, rdwr->nmsgs);
+    case I2C_SMBUS:
+      return Sim_smbus(file, (struct i2c_smbus_ioctl_data *) arg);
+    default:
+      errno = ENOTTY;
+      return -1;
+  }
+}
+
+/******************************************************************************
+ * Transport
+ */
+
+static int Sim_open(const char *path, int flags) {
+  SimFile *file;
+  SimSlot *slot;
+  unsigned int bus, cs;
+  int fd, n_chars, is_spi;
+
+  n_chars = 0;
+  if (sscanf(path, "/dev/spidev%u.%u%n", &bus, &cs, &n_chars) == 2 && 
+      !path[n_chars] && bus <= 0xff && cs <= 0xff) {
+    is_spi = 1;
+  }
+  else if (sscanf(path, "/dev/i2c-%u%n", &bus, &n_chars) == 1 && 
+           !path[n_chars] && bus <= 0xff) {
+    is_spi = 0;
+    cs = 0;
+  }
+  else {
+    errno = ENOENT;
+    return -1;
+  }
+
+  pthread_mutex_lock(&Sim_lock);
+  if (!Sim_topology_set) Sim_attachDefaults();
+  for (slot=Sim_slots; slot; slot=slot->next) {
+    if (slot->is_spi == is_spi && slot->bus == bus && 
+        (!is_spi || slot->addr == cs)) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&Sim_lock);
+  if (!slot) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  file = calloc(1, sizeof(SimFile));
+  if (!file) return -1;
+  file->is_spi = is_spi;
+  file->bus = bus;
+  file->cs = cs;
+  file->speed_hz = SIM_DEFAULT_SPEED_HZ;
+  // Reserve a real fd so simulated fds never clash with real ones:
+  fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    free(file);
+    return -1;
+  }
+  if (FDMap_set(&Sim_files, fd, file) < 0) {
+    close(fd);
+    free(file);
+    errno = ENOMEM;
+    return -1;
+  }
+  return fd;
+}
+
+static int Sim_close(int fd) {
+  SimFile *file;
+  SimSlot *slot;
+  file = FDMap_remove(&Sim_files, fd);
+  if (file && file->is_spi) {
+    // Release CS if the last message left it asserted:
+    pthread_mutex_lock(&Sim_lock);
+    slot = Sim_findSlot(1, file->bus, file->cs);
+    if (slot && slot->selected) {
+      slot->selected = 0;
+      if (slot->device->spi_select) slot->device->spi_select(slot->device, 0);
+    }
+    pthread_mutex_unlock(&Sim_lock);
+  }
+  free(file);
+  return close(fd);
+}
+
+static int Sim_ioctl(int fd, unsigned long request, void *arg) {
+  SimFile *file;
+  int ret;
+  file = FDMap_get(&Sim_files, fd);
+  if (!file) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&Sim_lock);
+  if (file->is_spi) ret = Sim_spiIoctl(file, request, arg);
+  else ret = Sim_i2cIoctl(file, request, arg);
+  pthread_mutex_unlock(&Sim_lock);
+  return ret;
+}
+
+/**
+ * Reads or writes the given file as a single SPI transfer or I2C message.
+ */
+static ssize_t Sim_readWrite(int fd, void *buffer, size_t n_bytes, 
+                             int reading) {
+  struct spi_ioc_transfer transfer;
+  struct i2c_msg message;
+  SimFile *file;
+  int ret;
+  file = FDMap_get(&Sim_files, fd);
+  if (!file) {
+    errno = EBADF;
+    return -1;
+  }
+  pthread_mutex_lock(&Sim_lock);
+  if (file->is_spi) {
+    memset((void *) &transfer, 0, sizeof(transfer));
+    if (reading) transfer.rx_buf = (uintptr_t) buffer;
+    else transfer.tx_buf = (uintptr_t) buffer;
+    transfer.len = n_bytes;
+    ret = Sim_spiMessage(file, &transfer, 1);
+  }
+  else {
+    message.addr = file->addr;
+    message.flags = (file->tenbit ? I2C_M_TEN : 0) | (reading ? I2C_M_RD : 0);
+    message.len = n_bytes;
+    message.buf = buffer;
+    ret = Sim_i2cTransfer(file->bus, &message, 1) < 0 ? -1 : (int) n_bytes;
+  }
+  pthread_mutex_unlock(&Sim_lock);
+  return ret;
+}
+
+static ssize_t Sim_read(int fd, void *buffer, size_t n_bytes) {
+  return Sim_readWrite(fd, buffer, n_bytes, 1);
+}
+
+static ssize_t Sim_write(int fd, const void *buffer, size_t n_bytes) {
+  return Sim_readWrite(fd, (void *) buffer, n_bytes, 0);
+}
+
+const Transport Transport_sim = {
+  "sim",
+  Sim_open,
+  Sim_close,
+  Sim_ioctl,
+  Sim_read,
+  Sim_write
+};
@@ -0,0 +1,411 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file simdevices.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Device models for the simulated bus.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simbus.h"
+
+/// Mask of the lowest n bits, for n from 0 to 32
+#define SIM_MASK(n) ((n) >= 32 ? 0xffffffffUL : (1UL << (n)) - 1)
+
+static void SimDevice_free(SimDevice *device) {
+  free(device);
+}
+
+/******************************************************************************
+ * SPI loopback
+ */
+
+static void SimLoopback_transfer(SimDevice *device, const uint8_t *tx, 
+                                 uint8_t *rx, uint32_t n_bytes, 
+                                 uint8_t bits_per_word) {
+  if (!rx) return;
+  if (tx) memcpy(rx, tx, n_bytes);
+  else memset(rx, 0, n_bytes);
+}
+
+SimDevice *SimDevice_spiLoopback(void) {
+  SimDevice *device;
+  device = calloc(1, sizeof(SimDevice));
+  if (!device) return NULL;
+  device->spi_transfer = SimLoopback_transfer;
+  device->destroy = SimDevice_free;
+  return device;
+}
+
+/******************************************************************************
+ * Streaming ADC
+ */
+
+typedef struct {
+  SimDevice device;
+  uint8_t bits;       ///< Resolution
+  uint32_t sample;    ///< Next sample
+  uint64_t stream;    ///< Bitstream bits not yet sent
+  int n_stream_bits;  ///< Number of bits in stream
+} SimADC;
+
+static uint32_t SimADC_nextSample(SimADC *adc) {
+  return adc->sample++ & SIM_MASK(adc->bits);
+}
+
+static void SimADC_select(SimDevice *device, int selected) {
+  SimADC *adc = (SimADC *) device;
+  if (!selected) return;
+  adc->sample = 0;
+  adc->stream = 0;
+  adc->n_stream_bits = 0;
+}
+
+static void SimADC_transfer(SimDevice *device, const uint8_t *tx, 
+                            uint8_t *rx, uint32_t n_bytes, 
+                            uint8_t bits_per_word) {
+  SimADC *adc = (SimADC *) device;
+  uint32_t i, word;
+  uint16_t word16;
+  if (bits_per_word <= 8) {
+    for (i=0; i<n_bytes; i++) {
+      while (adc->n_stream_bits < 8) {
+        adc->stream = (adc->stream << adc->bits) | SimADC_nextSample(adc);
+        adc->n_stream_bits += adc->bits;
+      }
+      adc->n_stream_bits -= 8;
+      if (rx) rx[i] = adc->stream >> adc->n_stream_bits;
+      adc->stream &= SIM_MASK(adc->n_stream_bits);
+    }
+    return;
+  }
+  if (bits_per_word <= 16) {
+    for (i=0; i+2<=n_bytes; i+=2) {
+      word16 = SimADC_nextSample(adc) & SIM_MASK(bits_per_word);
+      if (rx) memcpy(rx + i, &word16, 2);
+    }
+    return;
+  }
+  for (i=0; i+4<=n_bytes; i+=4) {
+    word = SimADC_nextSample(adc) & SIM_MASK(bits_per_word);
+    if (rx) memcpy(rx + i, &word, 4);
+  }
+}
+
+SimDevice *SimDevice_adc(uint8_t bits) {
+  SimADC *adc;
+  if (bits == 0 || bits > 32) return NULL;
+  adc = calloc(1, sizeof(SimADC));
+  if (!adc) return NULL;
+  adc->bits = bits;
+  adc->device.spi_select = SimADC_select;
+  adc->device.spi_transfer = SimADC_transfer;
+  adc->device.destroy = SimDevice_free;
+  return &adc->device;
+}
+
+/******************************************************************************
+ * 24C-series EEPROM
+ */
+
+typedef struct {
+  SimDevice device;
+  uint8_t *memory;
+  uint32_t size;
+  uint16_t page_size;
+  uint32_t write_cycle_us;
+  int addr_bytes;             ///< Number of address bytes, 1 or 2
+  uint32_t pointer;           ///< Current address
+  uint8_t *page;              ///< Page buffer for the pending write
+  uint8_t *page_written;      ///< Which bytes of page have been written
+  uint32_t page_base;         ///< Address of the pending write's page
+  int write_pending;          ///< Set if page holds a write to commit
+  struct timespec busy_until; ///< End of the current write cycle
+} SimEEPROM;
+
+static int SimEEPROM_busy(SimEEPROM *eeprom) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec < eeprom->busy_until.tv_sec ||
+    (now.tv_sec == eeprom->busy_until.tv_sec && 
+     now.tv_nsec < eeprom->busy_until.tv_nsec);
+}
+
+static int SimEEPROM_write(SimDevice *device, const uint8_t *data, 
+                           uint32_t n_bytes) {
+  SimEEPROM *eeprom = (SimEEPROM *) device;
+  uint32_t i, offset;
+  if (SimEEPROM_busy(eeprom)) return -1;
+  if (n_bytes < (uint32_t) eeprom->addr_bytes) return 0;
+  eeprom->pointer = eeprom->addr_bytes == 2 ? 
+    (data[0] << 8) | data[1] : data[0];
+  eeprom->pointer %= eeprom->size;
+  if (n_bytes == (uint32_t) eeprom->addr_bytes) return 0;
+  // Data bytes wrap around within the page:
+  eeprom->page_base = eeprom->pointer & ~(eeprom->page_size - 1);
+  offset = eeprom->pointer - eeprom->page_base;
+  for (i=eeprom->addr_bytes; i<n_bytes; i++) {
+    eeprom->page[offset] = data[i];
+    eeprom->page_written[offset] = 1;
+    offset = (offset + 1) & (eeprom->page_size - 1);
+  }
+  eeprom->write_pending = 1;
+  eeprom->pointer = eeprom->page_base + offset;
+  return 0;
+}
+
+static int SimEEPROM_read(SimDevice *device, uint8_t *data, 
+                          uint32_t n_bytes) {
+  SimEEPROM *eeprom = (SimEEPROM *) device;
+  uint32_t i;
+  if (SimEEPROM_busy(eeprom)) return -1;
+  for (i=0; i<n_bytes; i++) {
+    data[i] = eeprom->memory[eeprom->pointer];
+    eeprom->pointer = (eeprom->pointer + 1) % eeprom->size;
+  }
+  return 0;
+}
+
+static void SimEEPROM_stop(SimDevice *device) {
+  SimEEPROM *eeprom = (SimEEPROM *) device;
+  uint32_t i;
+  if (!eeprom->write_pending) return;
+  for (i=0; i<eeprom->page_size; i++) {
+    if (eeprom->page_written[i]) {
+      eeprom->memory[eeprom->page_base + i] = eeprom->page[i];
+    }
+  }
+  memset(eeprom->page_written, 0, eeprom->page_size);
+  eeprom->write_pending = 0;
+  clock_gettime(CLOCK_MONOTONIC, &eeprom->busy_until);
+  eeprom->busy_until.tv_sec += eeprom->write_cycle_us / 1000000;
+  eeprom->busy_until.tv_nsec += (eeprom->write_cycle_us % 1000000) * 1000L;
+  if (eeprom->busy_until.tv_nsec >= 1000000000L) {
+    eeprom->busy_until.tv_sec++;
+    eeprom->busy_until.tv_nsec -= 1000000000L;
+  }
+}
+
+static void SimEEPROM_destroy(SimDevice *device) {
+  SimEEPROM *eeprom = (SimEEPROM *) device;
+  free(eeprom->memory);
+  free(eeprom->page);
+  free(eeprom->page_written);
+  free(eeprom);
+}
+
+SimDevice *SimDevice_eeprom24c(uint32_t size, uint16_t page_size, 
+                               uint32_t write_cycle_us) {
+  SimEEPROM *eeprom;
+  if (size == 0 || size > 0x10000 || page_size == 0 || 
+      (page_size & (page_size - 1)) || page_size > size) {
+    return NULL;
+  }
+  eeprom = calloc(1, sizeof(SimEEPROM));
+  if (!eeprom) return NULL;
+  eeprom->memory = malloc(size);
+  eeprom->page = malloc(page_size);
+  eeprom->page_written = calloc(1, page_size);
+  if (!eeprom->memory || !eeprom->page || !eeprom->page_written) {
+    SimEEPROM_destroy(&eeprom->device);
+    return NULL;
+  }
+  memset(eeprom->memory, 0xff, size);
+  eeprom->size = size;
+  eeprom->page_size = page_size;
+  eeprom->write_cycle_us = write_cycle_us;
+  eeprom->addr_bytes = size > 256 ? 2 : 1;
+  eeprom->device.i2c_write = SimEEPROM_write;
+  eeprom->device.i2c_read = SimEEPROM_read;
+  eeprom->device.i2c_stop = SimEEPROM_stop;
+  eeprom->device.destroy = SimEEPROM_destroy;
+  return &eeprom->device;
+}
+
+/******************************************************************************
+ * HTU21D
+ */
+
+#define HTU21D_CMD_TEMP_HOLD    0xe3
+#define HTU21D_CMD_RH_HOLD      0xe5
+#define HTU21D_CMD_TEMP_NO_HOLD 0xf3
+#define HTU21D_CMD_RH_NO_HOLD   0xf5
+#define HTU21D_CMD_WRITE_USER   0xe6
+#define HTU21D_CMD_READ_USER    0xe7
+#define HTU21D_CMD_RESET        0xfe
+#define HTU21D_USER_DEFAULT     0x02
+
+typedef struct {
+  SimDevice device;
+  uint16_t temperature; ///< Raw temperature measurement, status bits set
+  uint16_t humidity;    ///< Raw humidity measurement, status bits set
+  uint8_t user;         ///< User register
+  uint8_t result[3];    ///< Bytes returned by the next read
+  uint32_t n_result;    ///< Number of bytes in result
+} SimHTU21D;
+
+/**
+ * The HTU21D's CRC-8 (polynomial x^8 + x^5 + x^4 + 1).
+ */
+static uint8_t SimHTU21D_crc(const uint8_t *data, int n_bytes) {
+  uint8_t crc = 0;
+  int i, bit;
+  for (i=0; i<n_bytes; i++) {
+    crc ^= data[i];
+    for (bit=0; bit<8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static void SimHTU21D_setMeasurement(SimHTU21D *htu21d, uint16_t raw) {
+  htu21d->result[0] = raw >> 8;
+  htu21d->result[1] = raw & 0xff;
+  htu21d->result[2] = SimHTU21D_crc(htu21d->result, 2);
+  htu21d->n_result = 3;
+}
+
+static int SimHTU21D_write(SimDevice *device, const uint8_t *data, 
+                           uint32_t n_bytes) {
+  SimHTU21D *htu21d = (SimHTU21D *) device;
+  if (n_bytes == 0) return 0;
+  htu21d->n_result = 0;
+  switch (data[0]) {
+    case HTU21D_CMD_TEMP_HOLD:
+    case HTU21D_CMD_TEMP_NO_HOLD:
+      SimHTU21D_setMeasurement(htu21d, htu21d->temperature);
+      return 0;
+    case HTU21D_CMD_RH_HOLD:
+    case HTU21D_CMD_RH_NO_HOLD:
+      SimHTU21D_setMeasurement(htu21d, htu21d->humidity);
+      return 0;
+    case HTU21D_CMD_WRITE_USER:
+      if (n_bytes > 1) htu21d->user = data[1];
+      return 0;
+    case HTU21D_CMD_READ_USER:
+      htu21d->result[0] = htu21d->user;
+      htu21d->n_result = 1;
+      return 0;
+    case HTU21D_CMD_RESET:
+      htu21d->user = HTU21D_USER_DEFAULT;
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+static int SimHTU21D_read(SimDevice *device, uint8_t *data, 
+                          uint32_t n_bytes) {
+  SimHTU21D *htu21d = (SimHTU21D *) device;
+  uint32_t i;
+  if (!htu21d->n_result) return -1;
+  for (i=0; i<n_bytes; i++) {
+    data[i] = i < htu21d->n_result ? htu21d->result[i] : 0xff;
+  }
+  return 0;
+}
+
+/**
+ * Converts a measurement to the HTU21D's raw 16-bit format.
+ */
+static uint16_t SimHTU21D_raw(float value, float offset, float scale, 
+                              uint16_t status) {
+  float raw;
+  raw = (value - offset) * 65536.0 / scale;
+  if (raw < 0) raw = 0;
+  if (raw > 65535) raw = 65535;
+  return ((uint16_t) raw & ~0x3) | status;
+}
+
+SimDevice *SimDevice_htu21d(float temperature, float humidity) {
+  SimHTU21D *htu21d;
+  htu21d = calloc(1, sizeof(SimHTU21D));
+  if (!htu21d) return NULL;
+  // Conversions from the datasheet; bit 1 is set in humidity measurements:
+  htu21d->temperature = SimHTU21D_raw(temperature, -46.85, 175.72, 0x0);
+  htu21d->humidity = SimHTU21D_raw(humidity, -6.0, 125.0, 0x2);
+  htu21d->user = HTU21D_USER_DEFAULT;
+  htu21d->device.i2c_write = SimHTU21D_write;
+  htu21d->device.i2c_read = SimHTU21D_read;
+  htu21d->device.destroy = SimDevice_free;
+  return &htu21d->device;
+}
+
+/******************************************************************************
+ * PCA9548
+ */
+
+typedef struct {
+  SimDevice device;
+  uint8_t control;     ///< Connected channels, one bit each
+  uint8_t pending;     ///< Control value written, applied at the stop
+  int have_pending;    ///< Set if pending was written since the last stop
+} SimPCA9548;
+
+static int SimPCA9548_write(SimDevice *device, const uint8_t *data, 
+                            uint32_t n_bytes) {
+  SimPCA9548 *mux = (SimPCA9548 *) device;
+  // If more than one byte is written, the last one counts:
+  if (n_bytes) {
+    mux->pending = data[n_bytes - 1];
+    mux->have_pending = 1;
+  }
+  return 0;
+}
+
+static int SimPCA9548_read(SimDevice *device, uint8_t *data, 
+                           uint32_t n_bytes) {
+  SimPCA9548 *mux = (SimPCA9548 *) device;
+  memset(data, mux->control, n_bytes);
+  return 0;
+}
+
+static void SimPCA9548_stop(SimDevice *device) {
+  SimPCA9548 *mux = (SimPCA9548 *) device;
+  if (!mux->have_pending) return;
+  mux->control = mux->pending;
+  mux->have_pending = 0;
+}
+
+static uint8_t SimPCA9548_channels(SimDevice *device) {
+  return ((SimPCA9548 *) device)->control;
+}
+
+SimDevice *SimDevice_pca9548(void) {
+  SimPCA9548 *mux;
+  mux = calloc(1, sizeof(SimPCA9548));
+  if (!mux) return NULL;
+  mux->device.i2c_write = SimPCA9548_write;
+  mux->device.i2c_read = SimPCA9548_read;
+  mux->device.i2c_stop = SimPCA9548_stop;
+  mux->device.i2c_channels = SimPCA9548_channels;
+  mux->device.destroy = SimDevice_free;
+  return &mux->device;
+}
@@ -0,0 +1,234 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file smbus.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief SMBus protocol transfers on Linux I2C interfaces.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "smbus.h"
+#include "i2cdriver.h"
+#include "transport.h"
+
+/**
+ * Checks that the interface's adapter has all the given I2C_FUNC_* flags.
+ */
+static int SMBus_supports(int i2c_fd, unsigned long required) {
+  unsigned long funcs;
+  if (I2C_getFunctionality(i2c_fd, &funcs) < 0) return 0;
+  return (funcs & required) == required;
+}
+
+/**
+ * Does one I2C_SMBUS ioctl, if the adapter has the given I2C_FUNC_* flag.
+ */
+static int SMBus_access(int i2c_fd, unsigned long func, uint8_t read_write, 
+                        uint8_t command, uint32_t size, 
+                        union i2c_smbus_data *data) {
+  struct i2c_smbus_ioctl_data args;
+  if (!SMBus_supports(i2c_fd, func)) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  args.read_write = read_write;
+  args.command = command;
+  args.size = size;
+  args.data = data;
+  return Transport_ioctl(i2c_fd, I2C_SMBUS, &args) < 0 ? -1 : 0;
+}
+
+int SMBus_setPEC(int i2c_fd, int enable) {
+  if (enable && !SMBus_supports(i2c_fd, I2C_FUNC_SMBUS_PEC)) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  return Transport_ioctl(i2c_fd, I2C_PEC, enable ? 1UL : 0UL) < 0 ? -1 : 0;
+}
+
+int SMBus_quick(int i2c_fd, uint8_t read_write) {
+  return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_QUICK, read_write, 0, 
+                      I2C_SMBUS_QUICK, NULL);
+}
+
+int SMBus_readByte(int i2c_fd) {
+  union i2c_smbus_data data;
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_READ_BYTE, I2C_SMBUS_READ, 0, 
+                   I2C_SMBUS_BYTE, &data) < 0) {
+    return -1;
+  }
+  return data.byte;
+}
+
+int SMBus_writeByte(int i2c_fd, uint8_t value) {
+  // The byte goes in the command field:
+  return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_WRITE_BYTE, I2C_SMBUS_WRITE, 
+                      value, I2C_SMBUS_BYTE, NULL);
+}
+
+int SMBus_readByteData(int i2c_fd, uint8_t command) {
+  union i2c_smbus_data data;
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_READ_BYTE_DATA, I2C_SMBUS_READ, 
+                   command, I2C_SMBUS_BYTE_DATA, &data) < 0) {
+    return -1;
+  }
+  return data.byte;
+}
+
+int SMBus_writeByteData(int i2c_fd, uint8_t command, uint8_t value) {
+  union i2c_smbus_data data;
+  data.byte = value;
+  return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_WRITE_BYTE_DATA, I2C_SMBUS_WRITE,
+                      command, I2C_SMBUS_BYTE_DATA, &data);
+}
+
+int SMBus_readWordData(int i2c_fd, uint8_t command) {
+  union i2c_smbus_data data;
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_READ_WORD_DATA, I2C_SMBUS_READ, 
+                   command, I2C_SMBUS_WORD_DATA, &data) < 0) {
+    return -1;
+  }
+  return data.word;
+}
+
+int SMBus_writeWordData(int i2c_fd, uint8_t command, uint16_t value) {
+  union i2c_smbus_data data;
+  data.word = value;
+  return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_WRITE_WORD_DATA, I2C_SMBUS_WRITE,
+                      command, I2C_SMBUS_WORD_DATA, &data);
+}
+
+int SMBus_processCall(int i2c_fd, uint8_t command, uint16_t value) {
+  union i2c_smbus_data data;
+  data.word = value;
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_PROC_CALL, I2C_SMBUS_WRITE, 
+                   command, I2C_SMBUS_PROC_CALL, &data) < 0) {
+    return -1;
+  }
+  return data.word;
+}
+
+int SMBus_readBlockData(int i2c_fd, uint8_t command, void *rx_buffer) {
+  union i2c_smbus_data data;
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_READ_BLOCK_DATA, I2C_SMBUS_READ, 
+                   command, I2C_SMBUS_BLOCK_DATA, &data) < 0) {
+    return -1;
+  }
+  // block[0] holds the length:
+  memcpy(rx_buffer, &data.block[1], data.block[0]);
+  return data.block[0];
+}
+
+int SMBus_writeBlockData(int i2c_fd, uint8_t command, const void *tx_buffer,
+                         int n_bytes) {
+  union i2c_smbus_data data;
+  if (n_bytes < 0 || n_bytes > SMBUS_BLOCK_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  data.block[0] = n_bytes;
+  memcpy(&data.block[1], tx_buffer, n_bytes);
+  return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_WRITE_BLOCK_DATA, 
+                      I2C_SMBUS_WRITE, command, I2C_SMBUS_BLOCK_DATA, &data);
+}
+
+int SMBus_blockProcessCall(int i2c_fd, uint8_t command, const void *tx_buffer,
+                           int n_bytes, void *rx_buffer) {
+  union i2c_smbus_data data;
+  if (n_bytes < 0 || n_bytes > SMBUS_BLOCK_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  data.block[0] = n_bytes;
+  memcpy(&data.block[1], tx_buffer, n_bytes);
+  if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_BLOCK_PROC_CALL, I2C_SMBUS_WRITE,
+                   command, I2C_SMBUS_BLOCK_PROC_CALL, &data) < 0) {
+    return -1;
+  }
+  memcpy(rx_buffer, &data.block[1], data.block[0]);
+  return data.block[0];
+}
+
+int SMBus_readI2CBlockData(int i2c_fd, uint8_t command, void *rx_buffer,
+                           int n_bytes) {
+  union i2c_smbus_data data;
+  if (n_bytes < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n_bytes <= SMBUS_BLOCK_MAX && 
+      SMBus_supports(i2c_fd, I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+    // block[0] gives the number of bytes to read:
+    data.block[0] = n_bytes;
+    if (SMBus_access(i2c_fd, I2C_FUNC_SMBUS_READ_I2C_BLOCK, I2C_SMBUS_READ, 
+                     command, I2C_SMBUS_I2C_BLOCK_DATA, &data) < 0) {
+      return -1;
+    }
+    memcpy(rx_buffer, &data.block[1], n_bytes);
+    return 0;
+  }
+  if (!SMBus_supports(i2c_fd, I2C_FUNC_I2C)) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  return I2C_readTransaction(i2c_fd, command, rx_buffer, n_bytes);
+}
+
+int SMBus_writeI2CBlockData(int i2c_fd, uint8_t command, const void *tx_buffer,
+                            int n_bytes) {
+  union i2c_smbus_data data;
+  uint8_t *buffer;
+  int ret;
+  if (n_bytes < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (n_bytes <= SMBUS_BLOCK_MAX && 
+      SMBus_supports(i2c_fd, I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)) {
+    data.block[0] = n_bytes;
+    memcpy(&data.block[1], tx_buffer, n_bytes);
+    return SMBus_access(i2c_fd, I2C_FUNC_SMBUS_WRITE_I2C_BLOCK, 
+                        I2C_SMBUS_WRITE, command, I2C_SMBUS_I2C_BLOCK_DATA, 
+                        &data);
+  }
+  if (!SMBus_supports(i2c_fd, I2C_FUNC_I2C)) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  // The command has to go out in the same write as the data:
+  buffer = I2C_allocBuffer(n_bytes + 1);
+  if (!buffer) return -1;
+  buffer[0] = command;
+  memcpy(&buffer[1], tx_buffer, n_bytes);
+  ret = I2C_write(i2c_fd, buffer, n_bytes + 1);
+  I2C_releaseBuffer(buffer);
+  return ret;
+}
@@ -0,0 +1,356 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file spicapture.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Background continuous capture from SPI devices.
+ *
+ * The ring has n_blocks + 1 slots so that a full ring can be told apart from
+ * an empty one, plus one scratch block that the capture thread reads into 
+ * while the ring is full. The producer only ever writes head and the 
+ * consumer only ever writes tail, so neither needs a lock. The eventfd is 
+ * only signalled when a block lands in an empty ring, which is the only time
+ * the consumer can be waiting on it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "spicapture.h"
+#include "spipack.h"
+
+/// Alignment of each block, enough for any of the SPI_unpack kernels
+#define SPI_CAPTURE_ALIGN 64
+
+struct SPI_capture {
+  SPI_handle *handle;
+  SPI_capture_config config;
+  int event_fd;           ///< Signalled when the ring becomes non-empty
+  uint32_t frame_size;    ///< Bytes per frame
+  uint32_t block_size;    ///< Bytes per block
+  uint32_t slot_size;     ///< block_size rounded up to SPI_CAPTURE_ALIGN
+  uint32_t n_slots;       ///< config.n_blocks + 1
+  uint8_t *blocks;        ///< n_slots ring blocks then the scratch block
+  void *tx_frame;         ///< Copy of config.tx_frame, or NULL
+  /// The message reading a block, with one transfer per frame, built once
+  /// by SPI_captureCreate and given new rx buffers for each block
+  struct spi_ioc_transfer *transfers;
+  uint32_t head;          ///< Next slot to fill, only written by the producer
+  uint32_t tail;          ///< Next slot to consume, only written by consumer
+  int running;            ///< Cleared to stop the capture thread
+  int thread_active;      ///< Set while the capture thread needs joining
+  pthread_t thread;
+  pthread_mutex_t stats_lock;
+  SPI_capture_stats stats;
+};
+
+static void SPI_captureSignal(SPI_capture *capture) {
+  uint64_t one = 1;
+  // Can only fail if the counter would overflow, in which case it's readable
+  // already:
+  if (write(capture->event_fd, &one, sizeof(one)) < 0) return;
+}
+
+static void *SPI_captureThread(void *arg) {
+  SPI_capture *capture = (SPI_capture*) arg;
+  uint32_t head, next, i;
+  uint8_t *block;
+  int full;
+
+  while (__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+    head = capture->head;
+    next = head + 1 == capture->n_slots ? 0 : head + 1;
+    full = next == __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+    block = capture->blocks + (full ? capture->n_slots : head) * 
+      capture->slot_size;
+    for (i=0; i<capture->config.frames_per_block; i++) {
+      capture->transfers[i].rx_buf = 
+        (uintptr_t) (block + i * capture->frame_size);
+    }
+    if (SPI_handleSendMessage(capture->handle, capture->transfers,
+                              capture->config.frames_per_block) < 0) {
+      pthread_mutex_lock(&capture->stats_lock);
+      capture->stats.error = errno ? errno : EIO;
+      pthread_mutex_unlock(&capture->stats_lock);
+      break;
+    }
+    if (full) {
+      pthread_mutex_lock(&capture->stats_lock);
+      capture->stats.overruns++;
+      pthread_mutex_unlock(&capture->stats_lock);
+      continue;
+    }
+    // Publish the block then check whether the consumer may be waiting for
+    // it; both need to be sequentially consistent with the consumer's 
+    // release-then-check in SPI_captureRelease/SPI_captureAcquire:
+    __atomic_store_n(&capture->head, next, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&capture->tail, __ATOMIC_SEQ_CST) == head) {
+      SPI_captureSignal(capture);
+    }
+    pthread_mutex_lock(&capture->stats_lock);
+    capture->stats.blocks++;
+    pthread_mutex_unlock(&capture->stats_lock);
+  }
+  __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+  SPI_captureSignal(capture);
+  return NULL;
+}
+
+SPI_capture *SPI_captureCreate(SPI_handle *handle, 
+                               const SPI_capture_config *config) {
+  SPI_capture *capture;
+  SPI_segment *segments;
+  uint32_t frame_size, aligned_size, i;
+  int bits_per_word, n_transfers;
+  void *blocks;
+
+  if (config->frame_words == 0 || config->frames_per_block == 0 ||
+      config->n_blocks < 2) {
+    errno = EINVAL;
+    return NULL;
+  }
+  bits_per_word = SPI_getBitsPerWord(SPI_handleFd(handle));
+  if (bits_per_word < 0) return NULL;
+  frame_size = SPI_bufferSize(bits_per_word, config->frame_words, 0);
+  // Each block is one message, and spidev counts every frame against the 
+  // bufsiz at its DMA-aligned size:
+  aligned_size = (frame_size + SPI_DMA_ALIGN - 1) & 
+    ~(uint32_t) (SPI_DMA_ALIGN - 1);
+  if (config->frames_per_block > SPI_MAX_SEGMENTS || 
+      (uint64_t) aligned_size * config->frames_per_block > 
+      SPI_getBufferSize()) {
+    errno = EMSGSIZE;
+    return NULL;
+  }
+  if ((uint64_t) frame_size * config->frames_per_block * 
+      (config->n_blocks + 2) > UINT32_MAX) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  capture = calloc(1, sizeof(SPI_capture));
+  if (!capture) return NULL;
+  capture->handle = handle;
+  capture->config = *config;
+  capture->n_slots = config->n_blocks + 1;
+  capture->frame_size = frame_size;
+  capture->block_size = frame_size * config->frames_per_block;
+  capture->slot_size = (capture->block_size + SPI_CAPTURE_ALIGN - 1) & 
+    ~(SPI_CAPTURE_ALIGN - 1);
+  pthread_mutex_init(&capture->stats_lock, NULL);
+  capture->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (capture->event_fd < 0) {
+    pthread_mutex_destroy(&capture->stats_lock);
+    free(capture);
+    return NULL;
+  }
+  // Ring slots plus the scratch block:
+  if (posix_memalign(&blocks, SPI_CAPTURE_ALIGN, 
+                     (size_t) capture->slot_size * (capture->n_slots + 1))) {
+    close(capture->event_fd);
+    pthread_mutex_destroy(&capture->stats_lock);
+    free(capture);
+    errno = ENOMEM;
+    return NULL;
+  }
+  capture->blocks = blocks;
+  segments = calloc(config->frames_per_block, sizeof(SPI_segment));
+  capture->transfers = calloc(config->frames_per_block, 
+                              sizeof(struct spi_ioc_transfer));
+  if (config->tx_frame) {
+    capture->tx_frame = malloc(frame_size);
+    if (capture->tx_frame) {
+      memcpy(capture->tx_frame, config->tx_frame, frame_size);
+    }
+  }
+  if (!segments || !capture->transfers || 
+      (config->tx_frame && !capture->tx_frame)) {
+    free(segments);
+    SPI_captureDestroy(capture);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // The rx buffers are filled in for each block by the capture thread:
+  for (i=0; i<config->frames_per_block; i++) {
+    segments[i].tx_buffer = capture->tx_frame;
+    segments[i].n_words = config->frame_words;
+    segments[i].speed_hz = config->speed_hz;
+    segments[i].delay_usecs = config->delay_usecs;
+    segments[i].bits_per_word = bits_per_word;
+    // Release CS between frames, but not after the last one in the block:
+    segments[i].cs_change = i + 1 < config->frames_per_block;
+  }
+  // Frames too long for a single transfer would need more than the one
+  // transfer each:
+  n_transfers = SPI_handleBuildMessage(handle, segments, 
+                                       config->frames_per_block,
+                                       capture->transfers, 
+                                       config->frames_per_block);
+  free(segments);
+  if (n_transfers < 0) {
+    SPI_captureDestroy(capture);
+    errno = EMSGSIZE;
+    return NULL;
+  }
+  return capture;
+}
+
+void SPI_captureDestroy(SPI_capture *capture) {
+  if (!capture) return;
+  SPI_captureStop(capture);
+  close(capture->event_fd);
+  free(capture->blocks);
+  free(capture->transfers);
+  free(capture->tx_frame);
+  pthread_mutex_destroy(&capture->stats_lock);
+  free(capture);
+}
+
+int SPI_captureStart(SPI_capture *capture) {
+  int err;
+  if (__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+    errno = EBUSY;
+    return -1;
+  }
+  // Reap the thread if it stopped on its own after an error:
+  if (capture->thread_active) {
+    pthread_join(capture->thread, NULL);
+    capture->thread_active = 0;
+  }
+  pthread_mutex_lock(&capture->stats_lock);
+  capture->stats.error = 0;
+  pthread_mutex_unlock(&capture->stats_lock);
+  __atomic_store_n(&capture->running, 1, __ATOMIC_RELEASE);
+  err = pthread_create(&capture->thread, NULL, SPI_captureThread, capture);
+  if (err) {
+    __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+    errno = err;
+    return -1;
+  }
+  capture->thread_active = 1;
+  return 0;
+}
+
+int SPI_captureStop(SPI_capture *capture) {
+  int err;
+  __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+  if (!capture->thread_active) return 0;
+  capture->thread_active = 0;
+  err = pthread_join(capture->thread, NULL);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+const void *SPI_captureAcquire(SPI_capture *capture, int timeout_ms) {
+  struct pollfd pfd;
+  struct timespec now, deadline;
+  uint64_t count;
+  uint32_t tail;
+  int wait_ms, error;
+
+  if (timeout_ms > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  tail = capture->tail;
+  pfd.fd = capture->event_fd;
+  pfd.events = POLLIN;
+  while (1) {
+    if (__atomic_load_n(&capture->head, __ATOMIC_SEQ_CST) != tail) {
+      return capture->blocks + tail * capture->slot_size;
+    }
+    if (!__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+      pthread_mutex_lock(&capture->stats_lock);
+      error = capture->stats.error;
+      pthread_mutex_unlock(&capture->stats_lock);
+      // Catch a block published just before the thread stopped:
+      if (__atomic_load_n(&capture->head, __ATOMIC_SEQ_CST) != tail) continue;
+      errno = error ? error : EAGAIN;
+      return NULL;
+    }
+    wait_ms = timeout_ms;
+    if (timeout_ms > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 + 
+        (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+      if (wait_ms < 0) wait_ms = 0;
+    }
+    if (poll(&pfd, 1, wait_ms) < 0) {
+      if (errno == EINTR) continue;
+      return NULL;
+    }
+    // Clear the eventfd, then recheck the ring before deciding it timed out:
+    if (read(capture->event_fd, &count, sizeof(count)) < 0 && wait_ms == 0) {
+      if (__atomic_load_n(&capture->head, __ATOMIC_SEQ_CST) != tail) continue;
+      errno = EAGAIN;
+      return NULL;
+    }
+  }
+}
+
+void SPI_captureRelease(SPI_capture *capture) {
+  uint32_t tail;
+  tail = capture->tail;
+  if (__atomic_load_n(&capture->head, __ATOMIC_ACQUIRE) == tail) return;
+  tail = tail + 1 == capture->n_slots ? 0 : tail + 1;
+  __atomic_store_n(&capture->tail, tail, __ATOMIC_SEQ_CST);
+}
+
+int SPI_captureDrain(SPI_capture *capture) {
+  uint32_t head, tail;
+  head = __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE);
+  tail = capture->tail;
+  __atomic_store_n(&capture->tail, head, __ATOMIC_SEQ_CST);
+  return head >= tail ? head - tail : head + capture->n_slots - tail;
+}
+
+uint32_t SPI_captureBlockSize(SPI_capture *capture) {
+  return capture->block_size;
+}
+
+int SPI_captureFd(SPI_capture *capture) {
+  return capture->event_fd;
+}
+
+void SPI_captureGetStats(SPI_capture *capture, SPI_capture_stats *stats) {
+  pthread_mutex_lock(&capture->stats_lock);
+  *stats = capture->stats;
+  pthread_mutex_unlock(&capture->stats_lock);
+}
@@ -33,6 +33,9 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -40,242 +43,869 @@
 #include <linux/types.h>
 #include <linux/spi/spidev.h>
 #include "spidriver.h"
+#include "spipack.h"
+#include "fdmap.h"
+#include "bufpool.h"
+#include "transport.h"
 
 /// Buffer size at least large enough to fit the max length of "/dev/spidevX.Y"
 #define SPIDEV_PATH_LEN 20
- /// Maximum transfer size set to standard page size of 4096 bytes
-#define MAX_TRANSFER_SIZE 4096
+/// Where the spidev driver exposes its per-message buffer size
+#define SPIDEV_BUFSIZ_PATH "/sys/module/spidev/parameters/bufsiz"
+/// spidev's default bufsiz, used if it can't be read from sysfs
+#define SPIDEV_DEFAULT_BUFSIZ 4096
+/// Messages up to this many transfers are built on the stack
+#define SPI_STACK_SEGMENTS 8
+
+/**
+ * Shadow copy of an spidev interface's settings, kept for every interface 
+ * opened with #SPI_open so that reading them never needs an ioctl, and so 
+ * that read-modify-write changes to the mode can't race. Also serves as the
+ * #SPI_handle.
+ */
+struct SPI_handle {
+  int fd;                ///< spidev file descriptor
+  pthread_mutex_t lock;  ///< Serialises access to the settings below
+  uint32_t mode;         ///< Full SPI mode, including SPI_LSB_FIRST
+  uint32_t speed_hz;     ///< Max clock frequency
+  uint8_t bits_per_word; ///< Bits per word (never 0)
+};
+
+/// Shadows of the interfaces opened with SPI_open, indexed by fd
+static FDMap SPI_handles = FDMAP_INITIALIZER;
+
+/// The spidev bufsiz module parameter, read once by the first SPI_open
+static uint32_t SPI_bufsiz = SPIDEV_DEFAULT_BUFSIZ;
+static pthread_once_t SPI_bufsiz_once = PTHREAD_ONCE_INIT;
+
+static void SPI_readBufsiz(void) {
+  FILE *bufsiz_file;
+  unsigned int bufsiz;
+  bufsiz_file = fopen(SPIDEV_BUFSIZ_PATH, "r");
+  if (!bufsiz_file) return;
+  // Must fit at least one 32-bit word:
+  if (fscanf(bufsiz_file, "%u", &bufsiz) == 1 && bufsiz >= 4) {
+    SPI_bufsiz = bufsiz;
+  }
+  fclose(bufsiz_file);
+}
+
+uint32_t SPI_getBufferSize(void) {
+  pthread_once(&SPI_bufsiz_once, SPI_readBufsiz);
+  return SPI_bufsiz;
+}
+
+/// Pool of transfer buffers sized to the spidev bufsiz
+static BufPool SPI_buffers = BUFPOOL_INITIALIZER;
+
+void *SPI_allocBuffer(uint32_t n_bytes) {
+  return BufPool_alloc(&SPI_buffers, SPI_getBufferSize(), n_bytes);
+}
+
+void SPI_releaseBuffer(void *buffer) {
+  BufPool_release(&SPI_buffers, buffer);
+}
+
+/**
+ * Reads the full SPI mode, using the 32-bit ioctl when the kernel has it.
+ */
+static int SPI_readMode(int spidev_fd, uint32_t *mode) {
+  uint8_t mode8;
+#ifdef SPI_IOC_RD_MODE32
+  if (Transport_ioctl(spidev_fd, SPI_IOC_RD_MODE32, mode) == 0) return 0;
+#endif
+  if (Transport_ioctl(spidev_fd, SPI_IOC_RD_MODE, &mode8) < 0) return -1;
+  *mode = mode8;
+  return 0;
+}
+
+/**
+ * Writes the full SPI mode, only using the 32-bit ioctl if needed.
+ */
+static int SPI_writeMode(int spidev_fd, uint32_t mode) {
+  uint8_t mode8;
+  if (mode > 0xff) {
+#ifdef SPI_IOC_WR_MODE32
+    return Transport_ioctl(spidev_fd, SPI_IOC_WR_MODE32, &mode) < 0 ? -1 : 0;
+#else
+    errno = EINVAL;
+    return -1;
+#endif
+  }
+  mode8 = mode;
+  return Transport_ioctl(spidev_fd, SPI_IOC_WR_MODE, &mode8) < 0 ? -1 : 0;
+}
+
+/**
+ * Fills in the settings of the given shadow from the kernel.
+ */
+static int SPI_readShadow(int spidev_fd, SPI_handle *shadow) {
+  uint8_t bits_per_word;
+  if (SPI_readMode(spidev_fd, &shadow->mode) < 0 ||
+      Transport_ioctl(spidev_fd, SPI_IOC_RD_BITS_PER_WORD,
+                      &bits_per_word) < 0 ||
+      Transport_ioctl(spidev_fd, SPI_IOC_RD_MAX_SPEED_HZ,
+                      &shadow->speed_hz) < 0) {
+    return -1;
+  }
+  shadow->fd = spidev_fd;
+  shadow->bits_per_word = bits_per_word == 0 ? 8 : bits_per_word;
+  return 0;
+}
+
+static void SPI_freeShadow(SPI_handle *shadow) {
+  if (!shadow) return;
+  pthread_mutex_destroy(&shadow->lock);
+  free(shadow);
+}
+
+static uint8_t SPI_shadowBitsPerWord(SPI_handle *shadow) {
+  uint8_t bits_per_word;
+  pthread_mutex_lock(&shadow->lock);
+  bits_per_word = shadow->bits_per_word;
+  pthread_mutex_unlock(&shadow->lock);
+  return bits_per_word;
+}
 
 int SPI_open(uint8_t bus, uint8_t cs) {
   char device[SPIDEV_PATH_LEN];
+  SPI_handle *shadow;
+  int fd;
+  pthread_once(&SPI_bufsiz_once, SPI_readBufsiz);
   sprintf(device, "/dev/spidev%d.%d", bus, cs);
-  return open(device, O_RDWR, 0);
+  fd = Transport_open(device, O_RDWR);
+  if (fd < 0) return fd;
+  // Drop any shadow left from an fd that wasn't closed with SPI_close:
+  SPI_freeShadow(FDMap_remove(&SPI_handles, fd));
+  // Without a shadow the interface still works, just through ioctls:
+  shadow = malloc(sizeof(SPI_handle));
+  if (!shadow) return fd;
+  if (SPI_readShadow(fd, shadow) < 0) {
+    free(shadow);
+    return fd;
+  }
+  pthread_mutex_init(&shadow->lock, NULL);
+  if (FDMap_set(&SPI_handles, fd, shadow) < 0) SPI_freeShadow(shadow);
+  return fd;
 }
 
 void SPI_close(int spidev_fd) {
-  close(spidev_fd);
+  SPI_freeShadow(FDMap_remove(&SPI_handles, spidev_fd));
+  Transport_close(spidev_fd);
 }
 
-int SPI_read(int spidev_fd, void *rx_buffer, int n_words) {
-  uint8_t bits_per_word;
-  uint32_t n_bytes;
+SPI_handle *SPI_openHandle(uint8_t bus, uint8_t cs) {
+  SPI_handle *handle;
+  int fd;
+  fd = SPI_open(bus, cs);
+  if (fd < 0) return NULL;
+  handle = FDMap_get(&SPI_handles, fd);
+  if (!handle) {
+    SPI_close(fd);
+    return NULL;
+  }
+  return handle;
+}
+
+void SPI_closeHandle(SPI_handle *handle) {
+  if (!handle) return;
+  SPI_close(handle->fd);
+}
+
+int SPI_handleFd(SPI_handle *handle) {
+  return handle->fd;
+}
+
+/**
+ * @brief Sets the delay between words of the given transfer.
+ *
+ * word_delay_usecs is only named in kernel headers from 5.1 on; older ones 
+ * have the same byte as padding, so it's set by its fixed offset in the ABI
+ * (right after rx_nbits). Controllers without support ignore it.
+ */
+static void SPI_setWordDelay(struct spi_ioc_transfer *transfer, 
+                             uint8_t word_delay_usecs) {
+  uint8_t *fields = (uint8_t *) &transfer->rx_nbits;
+  fields[1] = word_delay_usecs;
+}
+
+/**
+ * @brief Gets the room spidev takes in its buffer for a transfer of the 
+ *        given length.
+ */
+static uint32_t SPI_alignLength(uint32_t len) {
+  return (len + SPI_DMA_ALIGN - 1) & ~(uint32_t) (SPI_DMA_ALIGN - 1);
+}
+
+/// Pool of transfer arrays big enough for the largest SPI_IOC_MESSAGE
+static BufPool SPI_transfer_arrays = BUFPOOL_INITIALIZER;
+
+static struct spi_ioc_transfer *SPI_allocTransfers(void) {
+  return BufPool_alloc(&SPI_transfer_arrays, 
+                       SPI_MAX_SEGMENTS * sizeof(struct spi_ioc_transfer),
+                       SPI_MAX_SEGMENTS * sizeof(struct spi_ioc_transfer));
+}
+
+/**
+ * Transfers being gathered into SPI_IOC_MESSAGEs. Each message is sent as 
+ * soon as the next transfer won't fit in it, so the transfers array only 
+ * ever needs room for one message.
+ */
+typedef struct {
+  int fd;                             ///< Interface, or -1 to only build
+  struct spi_ioc_transfer *transfers; ///< The message being gathered
+  int max_transfers;                  ///< Room in transfers
+  int n_transfers;                    ///< Transfers gathered so far
+  uint32_t bufsiz;                    ///< The spidev bufsiz
+  uint32_t max_len;                   ///< Longest single transfer
+  uint32_t tx_total;                  ///< Aligned tx bytes gathered
+  uint32_t rx_total;                  ///< Aligned rx bytes gathered
+} SPI_batch;
+
+static void SPI_batchInit(SPI_batch *batch, int spidev_fd, 
+                          struct spi_ioc_transfer *transfers, 
+                          int max_transfers) {
+  memset((void *) batch, 0, sizeof(SPI_batch));
+  batch->fd = spidev_fd;
+  batch->transfers = transfers;
+  batch->max_transfers = max_transfers;
+  batch->bufsiz = SPI_getBufferSize();
+  // Keep every transfer a whole number of words, whatever the word size, 
+  // and short enough to fit the bufsiz once aligned:
+  batch->max_len = batch->bufsiz & ~(SPI_DMA_ALIGN - 1);
+  if (!batch->max_len) batch->max_len = batch->bufsiz & ~0x3;
+}
+
+/**
+ * @brief Sends the gathered transfers as one SPI_IOC_MESSAGE.
+ *
+ * If \p more is set, more transfers of the same sequence follow in another
+ * message. cs_change on the last transfer of a message means keep CS 
+ * active, so it's inverted for the ioctl to hold CS between the messages.
+ */
+static int SPI_batchSend(SPI_batch *batch, int more) {
+  struct spi_ioc_transfer *last;
+  int ret;
+  if (!batch->n_transfers) return 0;
+  if (batch->fd < 0) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  last = &batch->transfers[batch->n_transfers - 1];
+  if (more) last->cs_change = !last->cs_change;
+  ret = Transport_ioctl(batch->fd, SPI_IOC_MESSAGE(batch->n_transfers),
+                        batch->transfers);
+  batch->n_transfers = 0;
+  batch->tx_total = 0;
+  batch->rx_total = 0;
+  return ret < 0 ? -1 : 0;
+}
+
+static int SPI_batchAdd(SPI_batch *batch, 
+                        const struct spi_ioc_transfer *transfer) {
+  uint32_t len;
+  // spidev reserves each transfer's length aligned to DMA. A transfer that
+  // can't fit even on its own (bufsiz < SPI_DMA_ALIGN) still gets a 
+  // message, so the kernel can decide:
+  len = SPI_alignLength(transfer->len);
+  if (batch->n_transfers == batch->max_transfers ||
+      (batch->n_transfers && transfer->tx_buf && 
+       batch->tx_total + len > batch->bufsiz) ||
+      (batch->n_transfers && transfer->rx_buf && 
+       batch->rx_total + len > batch->bufsiz)) {
+    if (SPI_batchSend(batch, 1) < 0) return -1;
+  }
+  batch->transfers[batch->n_transfers++] = *transfer;
+  if (transfer->tx_buf) batch->tx_total += len;
+  if (transfer->rx_buf) batch->rx_total += len;
+  return 0;
+}
+
+/**
+ * @brief Adds the transfers of the given segment, which uses 
+ *        \p bits_per_word if it doesn't set its own.
+ *
+ * Segments longer than the batch's max_len are split into multiple 
+ * transfers. Segments of 0 words become a single 0-length transfer, so their
+ * delay and CS change still happen.
+ */
+static int SPI_batchAddSegment(SPI_batch *batch, uint8_t bits_per_word,
+                               const SPI_segment *segment) {
   struct spi_ioc_transfer transfer;
-  bits_per_word = SPI_getBitsPerWord(spidev_fd);
-  if (bits_per_word < 0) return bits_per_word;
-  // Round up to the next biggest number of bytes:
-  n_bytes = (uint32_t) (((float) (bits_per_word * n_words)) / 8.0 + 0.5);
-  if (!n_bytes) return 0;
-  if (n_bytes > MAX_TRANSFER_SIZE) n_bytes = MAX_TRANSFER_SIZE;
-
-  memset((void *) &transfer, 0, sizeof(struct spi_ioc_transfer));
-  transfer.tx_buf = 0;
-  transfer.rx_buf = (uintptr_t) rx_buffer;
-  transfer.len = n_bytes;
-  transfer.speed_hz = 0;
-  transfer.delay_usecs = 0;
-  transfer.bits_per_word = bits_per_word;
-  transfer.cs_change = 0;
-  if (ioctl(spidev_fd, SPI_IOC_MESSAGE(1), &transfer) < 0) return -1;
-  return (n_bytes<<3) / bits_per_word;
+  uint32_t n_bytes, offset, len;
+  uint8_t bpw;
+  bpw = segment->bits_per_word ? segment->bits_per_word : bits_per_word;
+  n_bytes = SPI_bufferSize(bpw, segment->n_words, 0);
+  offset = 0;
+  do {
+    len = n_bytes - offset;
+    if (len > batch->max_len) len = batch->max_len;
+    memset((void *) &transfer, 0, sizeof(struct spi_ioc_transfer));
+    if (segment->tx_buffer) {
+      transfer.tx_buf = (uintptr_t) segment->tx_buffer + offset;
+    }
+    if (segment->rx_buffer) {
+      transfer.rx_buf = (uintptr_t) segment->rx_buffer + offset;
+    }
+    transfer.len = len;
+    transfer.speed_hz = segment->speed_hz;
+    transfer.bits_per_word = segment->bits_per_word;
+    // The delay and CS change only apply at the end of the segment:
+    if (offset + len == n_bytes) {
+      transfer.delay_usecs = segment->delay_usecs;
+      transfer.cs_change = segment->cs_change;
+    }
+    SPI_setWordDelay(&transfer, segment->word_delay_usecs);
+    transfer.tx_nbits = segment->tx_nbits;
+    transfer.rx_nbits = segment->rx_nbits;
+    if (SPI_batchAdd(batch, &transfer) < 0) return -1;
+    offset += len;
+  } while (offset < n_bytes);
+  return 0;
 }
 
-int SPI_write(int spidev_fd, void *tx_buffer, int n_words) {
-  uint8_t bits_per_word;
+/**
+ * @brief Checks the word size of each of the given segments, and counts the
+ *        transfers #SPI_batchAddSegment will split them into.
+ *
+ * @return Returns the number of transfers, or -1 if error
+ */
+static int SPI_countTransfers(const SPI_batch *batch, uint8_t bits_per_word,
+                              const SPI_segment *segments, int n_segments) {
   uint32_t n_bytes;
-  struct spi_ioc_transfer transfer;
-  bits_per_word = SPI_getBitsPerWord(spidev_fd);
-  if (bits_per_word < 0) return bits_per_word;
-  n_bytes = (uint32_t) (((float) (bits_per_word * n_words)) / 8.0 + 0.5);
-  if (!n_bytes) return 0;
-  if (n_bytes > MAX_TRANSFER_SIZE) n_bytes = MAX_TRANSFER_SIZE;
-
-  memset((void *) &transfer, 0, sizeof(struct spi_ioc_transfer));
-  transfer.tx_buf = (uintptr_t) tx_buffer;
-  transfer.rx_buf = 0;
-  transfer.len = n_bytes;
-  transfer.speed_hz = 0;
-  transfer.delay_usecs = 0;
-  transfer.bits_per_word = bits_per_word;
-  transfer.cs_change = 0;
-  if (ioctl(spidev_fd, SPI_IOC_MESSAGE(1), &transfer) < 0) return -1;
-  return (n_bytes<<3) / bits_per_word;
+  uint8_t bpw;
+  int i, n_transfers;
+  if (n_segments < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  n_transfers = 0;
+  for (i=0; i<n_segments; i++) {
+    bpw = segments[i].bits_per_word ? segments[i].bits_per_word : bits_per_word;
+    if (!SPI_wordBytes(bpw)) {
+      errno = EINVAL;
+      return -1;
+    }
+    n_bytes = SPI_bufferSize(bpw, segments[i].n_words, 0);
+    n_transfers += n_bytes ? (n_bytes + batch->max_len - 1) / batch->max_len
+                           : 1;
+  }
+  return n_transfers;
+}
+
+/**
+ * @brief Submits the given segments in as few SPI_IOC_MESSAGEs as possible.
+ *
+ * Shared by all the fd and #SPI_handle transfer functions, which differ only 
+ * in where \p bits_per_word comes from. Segments with a bits_per_word of 0 
+ * use \p bits_per_word.
+ *
+ * The segments' transfers are grouped into messages that stay within the 
+ * kernel's per-message transfer count and tx and rx limits (see 
+ * #SPI_batchAdd). CS is held active between the messages.
+ *
+ * @return Returns the total number of words transferred, or -1 if error
+ */
+static int SPI_doMessage(int spidev_fd, uint8_t bits_per_word, 
+                         const SPI_segment *segments, int n_segments) {
+  struct spi_ioc_transfer stack_transfers[SPI_STACK_SEGMENTS];
+  SPI_batch batch;
+  int i, n_transfers, n_words;
+  SPI_batchInit(&batch, spidev_fd, stack_transfers, SPI_STACK_SEGMENTS);
+  n_transfers = SPI_countTransfers(&batch, bits_per_word, segments, 
+                                   n_segments);
+  if (n_transfers <= 0) return n_transfers;
+  if (n_transfers > SPI_STACK_SEGMENTS) {
+    batch.transfers = SPI_allocTransfers();
+    batch.max_transfers = SPI_MAX_SEGMENTS;
+    if (!batch.transfers) return -1;
+  }
+
+  n_words = 0;
+  for (i=0; i<n_segments; i++) {
+    if (SPI_batchAddSegment(&batch, bits_per_word, &segments[i]) < 0) break;
+    n_words += segments[i].n_words;
+  }
+  if (i < n_segments || SPI_batchSend(&batch, 0) < 0) n_words = -1;
+  if (batch.transfers != stack_transfers) {
+    BufPool_release(&SPI_transfer_arrays, batch.transfers);
+  }
+  return n_words;
+}
+
+/**
+ * @brief Sets the given segment's per-transfer overrides from \p options, 
+ *        which may be NULL. The segment's buffers must already be set.
+ */
+static void SPI_applyOptions(SPI_segment *segment, 
+                             const SPI_options *options) {
+  if (!options) return;
+  segment->speed_hz = options->speed_hz;
+  segment->bits_per_word = options->bits_per_word;
+  segment->word_delay_usecs = options->word_delay_usecs;
+  // Lane widths only apply in the directions the segment transfers:
+  if (segment->tx_buffer) segment->tx_nbits = options->tx_nbits;
+  if (segment->rx_buffer) segment->rx_nbits = options->rx_nbits;
+}
+
+/**
+ * @brief Gets the word size a transfer with the given options will use.
+ */
+static int SPI_optionsBitsPerWord(int spidev_fd, const SPI_options *options) {
+  if (options && options->bits_per_word) return options->bits_per_word;
+  return SPI_getBitsPerWord(spidev_fd);
+}
+
+/**
+ * @brief Submits a single read, write or full-duplex transfer.
+ */
+static int SPI_doTransfer(int spidev_fd, uint8_t bits_per_word, 
+                          void *tx_buffer, void *rx_buffer, int n_words,
+                          const SPI_options *options) {
+  SPI_segment segment;
+  // Without any words there's nothing to select the device for:
+  if (!n_words) return 0;
+  memset((void *) &segment, 0, sizeof(SPI_segment));
+  segment.tx_buffer = tx_buffer;
+  segment.rx_buffer = rx_buffer;
+  segment.n_words = n_words;
+  SPI_applyOptions(&segment, options);
+  return SPI_doMessage(spidev_fd, bits_per_word, &segment, 1);
+}
+
+/**
+ * @brief Submits a write followed by a read in a single message.
+ */
+static int SPI_doTransaction(int spidev_fd, uint8_t bits_per_word, 
+                             void *tx_buffer, int n_tx_words, 
+                             void *rx_buffer, int n_rx_words,
+                             const SPI_options *options) {
+  SPI_segment segments[2];
+  int n_words;
+  memset((void *) segments, 0, sizeof(segments));
+  segments[0].tx_buffer = tx_buffer;
+  segments[0].n_words = n_tx_words;
+  segments[1].rx_buffer = rx_buffer;
+  segments[1].n_words = n_rx_words;
+  SPI_applyOptions(&segments[0], options);
+  SPI_applyOptions(&segments[1], options);
+  n_words = SPI_doMessage(spidev_fd, bits_per_word, segments, 2);
+  if (n_words < 0) return n_words;
+  // Only report the words read:
+  return n_words - n_tx_words;
+}
+
+int SPI_read(int spidev_fd, void *rx_buffer, int n_words) {
+  return SPI_readEx(spidev_fd, rx_buffer, n_words, NULL);
+}
+
+int SPI_write(int spidev_fd, void *tx_buffer, int n_words) {
+  return SPI_writeEx(spidev_fd, tx_buffer, n_words, NULL);
 }
 
 int SPI_transaction(int spidev_fd, void *tx_buffer, int n_tx_words, 
                     void *rx_buffer, int n_rx_words) {
-  uint8_t bits_per_word;
-  uint32_t n_tx_bytes, n_rx_bytes;
-  struct spi_ioc_transfer transfers[2];
-  int n_transfers;
-  bits_per_word = SPI_getBitsPerWord(spidev_fd);
+  return SPI_transactionEx(spidev_fd, tx_buffer, n_tx_words, rx_buffer, 
+                           n_rx_words, NULL);
+}
+
+int SPI_transfer(int spidev_fd, void *tx_buffer, void *rx_buffer, int n_words) {
+  return SPI_transferEx(spidev_fd, tx_buffer, rx_buffer, n_words, NULL);
+}
+
+int SPI_readEx(int spidev_fd, void *rx_buffer, int n_words, 
+               const SPI_options *options) {
+  int bits_per_word;
+  bits_per_word = SPI_optionsBitsPerWord(spidev_fd, options);
   if (bits_per_word < 0) return bits_per_word;
-  // Round up to the next biggest number of bytes:
-  n_tx_bytes = (uint32_t) (((float) (bits_per_word * n_tx_words)) / 8.0 + 0.5);
-  n_rx_bytes = (uint32_t) (((float) (bits_per_word * n_rx_words)) / 8.0 + 0.5);
-  if (!n_rx_bytes && !n_tx_bytes) return 0;
-  if (n_rx_bytes > MAX_TRANSFER_SIZE) n_rx_bytes = MAX_TRANSFER_SIZE;
-  if (n_tx_bytes > MAX_TRANSFER_SIZE) n_tx_bytes = MAX_TRANSFER_SIZE;
+  return SPI_doTransfer(spidev_fd, bits_per_word, NULL, rx_buffer, n_words, 
+                        options);
+}
 
-  n_transfers = 0;
-  if (n_tx_bytes) {
-      memset((void *) &transfers[n_transfers], 0, 
-             sizeof(struct spi_ioc_transfer));
+int SPI_writeEx(int spidev_fd, void *tx_buffer, int n_words, 
+                const SPI_options *options) {
+  int bits_per_word;
+  bits_per_word = SPI_optionsBitsPerWord(spidev_fd, options);
+  if (bits_per_word < 0) return bits_per_word;
+  return SPI_doTransfer(spidev_fd, bits_per_word, tx_buffer, NULL, n_words, 
+                        options);
+}
+
+int SPI_transactionEx(int spidev_fd, void *tx_buffer, int n_tx_words, 
+                      void *rx_buffer, int n_rx_words, 
+                      const SPI_options *options) {
+  int bits_per_word;
+  bits_per_word = SPI_optionsBitsPerWord(spidev_fd, options);
+  if (bits_per_word < 0) return bits_per_word;
+  return SPI_doTransaction(spidev_fd, bits_per_word, tx_buffer, n_tx_words, 
+                           rx_buffer, n_rx_words, options);
+}
 
-      transfers[n_transfers].tx_buf = (uintptr_t) tx_buffer;
-      transfers[n_transfers].rx_buf = 0;
-      transfers[n_transfers].len = n_tx_bytes;
-      transfers[n_transfers].speed_hz = 0;
-      transfers[n_transfers].delay_usecs = 0;
-      transfers[n_transfers].bits_per_word = bits_per_word;
-      transfers[n_transfers].cs_change = 0;
+int SPI_transferEx(int spidev_fd, void *tx_buffer, void *rx_buffer, 
+                   int n_words, const SPI_options *options) {
+  int bits_per_word;
+  bits_per_word = SPI_optionsBitsPerWord(spidev_fd, options);
+  if (bits_per_word < 0) return bits_per_word;
+  return SPI_doTransfer(spidev_fd, bits_per_word, tx_buffer, rx_buffer, 
+                        n_words, options);
+}
 
-      ++n_transfers;
+int SPI_message(int spidev_fd, const SPI_segment *segments, int n_segments) {
+  int bits_per_word;
+  bits_per_word = SPI_getBitsPerWord(spidev_fd);
+  if (bits_per_word < 0) return bits_per_word;
+  return SPI_doMessage(spidev_fd, bits_per_word, segments, n_segments);
+}
+
+int SPI_readFrames(int spidev_fd, void *rx_buffer, int n_words, int n_frames) {
+  SPI_segment segment;
+  SPI_batch batch;
+  uint32_t frame_bytes;
+  int bits_per_word, i, ret;
+  if (n_words < 0 || n_frames < 0) {
+    errno = EINVAL;
+    return -1;
   }
+  if (!n_words || !n_frames) return 0;
+  bits_per_word = SPI_getBitsPerWord(spidev_fd);
+  if (bits_per_word < 0) return bits_per_word;
+  frame_bytes = SPI_bufferSize(bits_per_word, n_words, 0);
+  SPI_batchInit(&batch, spidev_fd, SPI_allocTransfers(), SPI_MAX_SEGMENTS);
+  if (!batch.transfers) return -1;
+  // The frames are added one at a time straight into the batch, so no 
+  // segment array is needed:
+  memset((void *) &segment, 0, sizeof(SPI_segment));
+  segment.n_words = n_words;
+  ret = 0;
+  for (i=0; i<n_frames && ret == 0; i++) {
+    segment.rx_buffer = (uint8_t *) rx_buffer + (size_t) i * frame_bytes;
+    // Deselect between frames, but not after the last one, where cs_change
+    // would leave CS active:
+    segment.cs_change = i < n_frames - 1;
+    ret = SPI_batchAddSegment(&batch, bits_per_word, &segment);
+  }
+  if (ret == 0) ret = SPI_batchSend(&batch, 0);
+  BufPool_release(&SPI_transfer_arrays, batch.transfers);
+  return ret < 0 ? -1 : n_words * n_frames;
+}
 
-  if (n_rx_bytes) {
-      memset((void *) &transfers[n_transfers], 0, 
-             sizeof(struct spi_ioc_transfer));
+int SPI_handleRead(SPI_handle *handle, void *rx_buffer, int n_words) {
+  return SPI_doTransfer(handle->fd, SPI_shadowBitsPerWord(handle), NULL, 
+                        rx_buffer, n_words, NULL);
+}
 
-      transfers[n_transfers].tx_buf = 0;
-      transfers[n_transfers].rx_buf = (uintptr_t) rx_buffer;
-      transfers[n_transfers].len = n_rx_bytes + 1;
-      transfers[n_transfers].speed_hz = 0;
-      transfers[n_transfers].delay_usecs = 0;
-      transfers[n_transfers].bits_per_word = bits_per_word;
-      transfers[n_transfers].cs_change = 0;
+int SPI_handleWrite(SPI_handle *handle, void *tx_buffer, int n_words) {
+  return SPI_doTransfer(handle->fd, SPI_shadowBitsPerWord(handle), tx_buffer,
+                        NULL, n_words, NULL);
+}
 
-      ++n_transfers;
-  }
+int SPI_handleTransaction(SPI_handle *handle, void *tx_buffer, int n_tx_words,
+                          void *rx_buffer, int n_rx_words) {
+  return SPI_doTransaction(handle->fd, SPI_shadowBitsPerWord(handle), 
+                           tx_buffer, n_tx_words, rx_buffer, n_rx_words, NULL);
+}
 
-  if (ioctl(spidev_fd, SPI_IOC_MESSAGE(n_transfers), transfers) < 0) return -1;
-  return (n_rx_bytes << 3) / bits_per_word;
+int SPI_handleTransfer(SPI_handle *handle, void *tx_buffer, void *rx_buffer, 
+                       int n_words) {
+  return SPI_doTransfer(handle->fd, SPI_shadowBitsPerWord(handle), tx_buffer, 
+                        rx_buffer, n_words, NULL);
 }
 
-int SPI_transfer(int spidev_fd, void *tx_buffer, void *rx_buffer, int n_words) {
+int SPI_handleMessage(SPI_handle *handle, const SPI_segment *segments, 
+                      int n_segments) {
+  return SPI_doMessage(handle->fd, SPI_shadowBitsPerWord(handle), 
+                       segments, n_segments);
+}
+
+int SPI_handleBuildMessage(SPI_handle *handle, const SPI_segment *segments,
+                           int n_segments, struct spi_ioc_transfer *transfers,
+                           int max_transfers) {
+  SPI_batch batch;
   uint8_t bits_per_word;
-  uint32_t n_bytes;
-  struct spi_ioc_transfer transfer;
-  bits_per_word = SPI_getBitsPerWord(spidev_fd);
-  if (bits_per_word < 0) return bits_per_word;
-  n_bytes = (uint32_t) (((float) (bits_per_word * n_words)) / 8.0 + 0.5);
-  if (!n_bytes) return 0;
-  if (n_bytes > MAX_TRANSFER_SIZE) n_bytes = MAX_TRANSFER_SIZE;
-
-  memset((void *) &transfer, 0, sizeof(struct spi_ioc_transfer));
-  transfer.tx_buf = (uintptr_t) tx_buffer;
-  transfer.rx_buf = (uintptr_t) rx_buffer;
-  transfer.len = n_bytes;
-  transfer.speed_hz = 0;
-  transfer.delay_usecs = 0;
-  transfer.bits_per_word = bits_per_word;
-  transfer.cs_change = 0;
-  if (ioctl(spidev_fd, SPI_IOC_MESSAGE(1), &transfer) < 0) return -1;
-  return (n_bytes<<3) / bits_per_word;
+  int i;
+  if (max_transfers > SPI_MAX_SEGMENTS) max_transfers = SPI_MAX_SEGMENTS;
+  bits_per_word = SPI_shadowBitsPerWord(handle);
+  // With no fd the batch fails with EMSGSIZE instead of sending a message:
+  SPI_batchInit(&batch, -1, transfers, max_transfers);
+  if (SPI_countTransfers(&batch, bits_per_word, segments, n_segments) < 0) {
+    return -1;
+  }
+  for (i=0; i<n_segments; i++) {
+    if (SPI_batchAddSegment(&batch, bits_per_word, &segments[i]) < 0) {
+      return -1;
+    }
+  }
+  return batch.n_transfers;
+}
+
+int SPI_handleSendMessage(SPI_handle *handle, 
+                          const struct spi_ioc_transfer *transfers,
+                          int n_transfers) {
+  if (n_transfers <= 0 || n_transfers > SPI_MAX_SEGMENTS) {
+    errno = EINVAL;
+    return -1;
+  }
+  return Transport_ioctl(handle->fd, SPI_IOC_MESSAGE(n_transfers), 
+                         (void *) transfers);
+}
+
+/**
+ * Clears then sets the given bits of the interface's mode, only writing the 
+ * mode if it changes.
+ */
+static int SPI_updateMode(int spidev_fd, uint32_t clear, uint32_t set) {
+  SPI_handle *shadow;
+  uint32_t mode;
+  int ret;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (!shadow) {
+    if (SPI_readMode(spidev_fd, &mode) < 0) return -1;
+    return SPI_writeMode(spidev_fd, (mode & ~clear) | set);
+  }
+  ret = 0;
+  pthread_mutex_lock(&shadow->lock);
+  mode = (shadow->mode & ~clear) | set;
+  if (mode != shadow->mode) {
+    ret = SPI_writeMode(spidev_fd, mode);
+    if (ret == 0) shadow->mode = mode;
+  }
+  pthread_mutex_unlock(&shadow->lock);
+  return ret;
 }
 
 int SPI_setBitOrder(int spidev_fd, SPI_bit_order bit_order) {
-  uint8_t order = (uint8_t) bit_order; // Just to be safe
-  if (ioctl(spidev_fd, SPI_IOC_WR_LSB_FIRST, &order) < 0) return -1;
-  return 0;
+  return SPI_updateMode(spidev_fd, SPI_LSB_FIRST, 
+                        bit_order == SPI_LSBFIRST ? SPI_LSB_FIRST : 0);
 }
 
 int SPI_setBitsPerWord(int spidev_fd, uint8_t bits_per_word) {
-  if (ioctl(spidev_fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) < 0) {
-    return -1;
+  SPI_handle *shadow;
+  int ret;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (!shadow) {
+    return Transport_ioctl(spidev_fd, SPI_IOC_WR_BITS_PER_WORD,
+                           &bits_per_word) < 0 ? -1 : 0;
   }
-  return 0;
+  ret = 0;
+  pthread_mutex_lock(&shadow->lock);
+  if ((bits_per_word == 0 ? 8 : bits_per_word) != shadow->bits_per_word) {
+    ret = Transport_ioctl(spidev_fd, SPI_IOC_WR_BITS_PER_WORD,
+                          &bits_per_word) < 0 ? -1 : 0;
+    if (ret == 0) shadow->bits_per_word = bits_per_word == 0 ? 8 : 
+                    bits_per_word;
+  }
+  pthread_mutex_unlock(&shadow->lock);
+  return ret;
 }
 
 int SPI_getBitsPerWord(int spidev_fd) {
+  SPI_handle *shadow;
   uint8_t bits_per_word;
-  if (ioctl(spidev_fd, SPI_IOC_RD_BITS_PER_WORD, &bits_per_word) < 0) {
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (shadow) return SPI_shadowBitsPerWord(shadow);
+  if (Transport_ioctl(spidev_fd, SPI_IOC_RD_BITS_PER_WORD,
+                      &bits_per_word) < 0) {
     return -1;
   } 
   return bits_per_word == 0 ? 8 : bits_per_word;
 }
 
 int SPI_setMaxFrequency(int spidev_fd, uint32_t frequency) {
-  if (ioctl(spidev_fd, SPI_IOC_WR_MAX_SPEED_HZ, &frequency) < 0) return -1;
-  return 0;
+  SPI_handle *shadow;
+  int ret;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (!shadow) {
+    return Transport_ioctl(spidev_fd, SPI_IOC_WR_MAX_SPEED_HZ,
+                           &frequency) < 0 ? -1 : 0;
+  }
+  ret = 0;
+  pthread_mutex_lock(&shadow->lock);
+  if (frequency != shadow->speed_hz) {
+    ret = Transport_ioctl(spidev_fd, SPI_IOC_WR_MAX_SPEED_HZ,
+                          &frequency) < 0 ? -1 : 0;
+    if (ret == 0) shadow->speed_hz = frequency;
+  }
+  pthread_mutex_unlock(&shadow->lock);
+  return ret;
 }
 
 int SPI_getMaxFrequency(int spidev_fd) {
+  SPI_handle *shadow;
   uint32_t frequency;
-  if (ioctl(spidev_fd, SPI_IOC_RD_MAX_SPEED_HZ, &frequency) < 0) return -1;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (shadow) {
+    pthread_mutex_lock(&shadow->lock);
+    frequency = shadow->speed_hz;
+    pthread_mutex_unlock(&shadow->lock);
+    return frequency;
+  }
+  if (Transport_ioctl(spidev_fd, SPI_IOC_RD_MAX_SPEED_HZ, &frequency) < 0) {
+    return -1;
+  }
   return frequency;
 }
 
 int SPI_setClockMode(int spidev_fd, uint8_t clock_mode) {
-  uint8_t mode;
-  mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return mode;
-  mode &= ~0x3;
-  mode |= clock_mode & 0x3;
-  return SPI_setMode(spidev_fd, mode);
+  return SPI_updateMode(spidev_fd, 0x3, clock_mode & 0x3);
 }
 
 int SPI_getClockMode(int spidev_fd) {
-  uint8_t clock_mode;
-  clock_mode = SPI_getMode(spidev_fd);
-  if (clock_mode < 0) return clock_mode;
-  return clock_mode & 0x3;
+  int mode;
+  mode = SPI_getMode(spidev_fd);
+  if (mode < 0) return mode;
+  return mode & 0x3;
 }
 
 int SPI_setCSActiveLow(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode & ~SPI_CS_HIGH);
+  return SPI_updateMode(spidev_fd, SPI_CS_HIGH, 0);
 }
 
 int SPI_setCSActiveHigh(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode | SPI_CS_HIGH);
+  return SPI_updateMode(spidev_fd, 0, SPI_CS_HIGH);
 }
 
 int SPI_enableCS(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode & ~SPI_NO_CS);
+  return SPI_updateMode(spidev_fd, SPI_NO_CS, 0);
 }
 
 int SPI_disableCS(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode | SPI_NO_CS);
+  return SPI_updateMode(spidev_fd, 0, SPI_NO_CS);
 }
 
 int SPI_enableLoopback(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode | SPI_LOOP);
+  return SPI_updateMode(spidev_fd, 0, SPI_LOOP);
 }
 
 int SPI_disableLoopback(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode & ~SPI_LOOP);
+  return SPI_updateMode(spidev_fd, SPI_LOOP, 0);
 }
 
 int SPI_enable3Wire(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode | SPI_3WIRE);
+  return SPI_updateMode(spidev_fd, 0, SPI_3WIRE);
 }
 
 int SPI_disable3Wire(int spidev_fd) {
-  int mode = SPI_getMode(spidev_fd);
-  if (mode < 0) return -1;
-  return SPI_setMode(spidev_fd, mode & ~SPI_3WIRE);
+  return SPI_updateMode(spidev_fd, SPI_3WIRE, 0);
 }
 
 int SPI_setMode(int spidev_fd, uint8_t mode) {
-  if (ioctl(spidev_fd, SPI_IOC_WR_MODE, &mode) < 0) return -1;
-  return 0;
+  // The 8-bit mode ioctl clears the upper mode bits, so clear them all:
+  return SPI_updateMode(spidev_fd, 0xffffffff, mode);
 }
 
 int SPI_getMode(int spidev_fd) {
-  uint8_t mode;
-  if (ioctl(spidev_fd, SPI_IOC_RD_MODE, &mode) < 0) return -1;
-  return mode;
-}
\ No newline at end of file
+  SPI_handle *shadow;
+  uint32_t mode;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (shadow) {
+    pthread_mutex_lock(&shadow->lock);
+    mode = shadow->mode;
+    pthread_mutex_unlock(&shadow->lock);
+  }
+  else if (SPI_readMode(spidev_fd, &mode) < 0) {
+    return -1;
+  }
+  return mode & 0xff;
+}
+
+int SPI_setMode32(int spidev_fd, uint32_t mode) {
+  return SPI_updateMode(spidev_fd, 0xffffffff, mode);
+}
+
+int SPI_getMode32(int spidev_fd, uint32_t *mode) {
+  SPI_handle *shadow;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (!shadow) return SPI_readMode(spidev_fd, mode);
+  pthread_mutex_lock(&shadow->lock);
+  *mode = shadow->mode;
+  pthread_mutex_unlock(&shadow->lock);
+  return 0;
+}
+
+/**
+ * Gets the mode flags for the given number of lanes, or -1 if it's invalid.
+ */
+static int64_t SPI_laneFlags(uint8_t lanes, uint32_t dual, uint32_t quad) {
+  switch (lanes) {
+    case 1: return 0;
+    case 2: return dual;
+    case 4: return quad;
+    default: return -1;
+  }
+}
+
+int SPI_setLanes(int spidev_fd, uint8_t tx_lanes, uint8_t rx_lanes) {
+  int64_t tx_flags, rx_flags;
+  tx_flags = SPI_laneFlags(tx_lanes, SPI_TX_DUAL, SPI_TX_QUAD);
+  rx_flags = SPI_laneFlags(rx_lanes, SPI_RX_DUAL, SPI_RX_QUAD);
+  if (tx_flags < 0 || rx_flags < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return SPI_updateMode(spidev_fd, 
+                        SPI_TX_DUAL | SPI_TX_QUAD | SPI_RX_DUAL | SPI_RX_QUAD,
+                        tx_flags | rx_flags);
+}
+
+int SPI_getConfig(int spidev_fd, SPI_config *config) {
+  SPI_handle *shadow, current;
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (shadow) {
+    // Just the settings; the shadow's mutex mustn't be copied:
+    pthread_mutex_lock(&shadow->lock);
+    current.mode = shadow->mode;
+    current.speed_hz = shadow->speed_hz;
+    current.bits_per_word = shadow->bits_per_word;
+    pthread_mutex_unlock(&shadow->lock);
+  }
+  else if (SPI_readShadow(spidev_fd, &current) < 0) {
+    return -1;
+  }
+  config->mode = current.mode & 0x3;
+  config->mode_flags = current.mode & ~(0x3 | SPI_LSB_FIRST);
+  config->speed_hz = current.speed_hz;
+  config->bits_per_word = current.bits_per_word;
+  config->bit_order = current.mode & SPI_LSB_FIRST ? SPI_LSBFIRST : 
+    SPI_MSBFIRST;
+  return 0;
+}
+
+int SPI_setConfig(int spidev_fd, const SPI_config *config) {
+  SPI_handle *shadow, current;
+  uint32_t mode, speed_hz;
+  uint8_t bits_per_word;
+  int ret;
+
+  mode = (config->mode & 0x3) | (config->mode_flags & ~(0x3 | SPI_LSB_FIRST));
+  if (config->bit_order == SPI_LSBFIRST) mode |= SPI_LSB_FIRST;
+  bits_per_word = config->bits_per_word == 0 ? 8 : config->bits_per_word;
+  speed_hz = config->speed_hz;
+
+  shadow = FDMap_get(&SPI_handles, spidev_fd);
+  if (!shadow) {
+    // No shadow, so get the current settings to compare against:
+    if (SPI_readShadow(spidev_fd, &current) < 0) return -1;
+    shadow = &current;
+  }
+  else {
+    pthread_mutex_lock(&shadow->lock);
+  }
+
+  ret = 0;
+  if (mode != shadow->mode) {
+    ret = SPI_writeMode(spidev_fd, mode);
+    if (ret == 0) shadow->mode = mode;
+  }
+  if (ret == 0 && bits_per_word != shadow->bits_per_word) {
+    ret = Transport_ioctl(spidev_fd, SPI_IOC_WR_BITS_PER_WORD,
+                          &bits_per_word) < 0 ? -1 : 0;
+    if (ret == 0) shadow->bits_per_word = bits_per_word;
+  }
+  if (ret == 0 && speed_hz != shadow->speed_hz) {
+    ret = Transport_ioctl(spidev_fd, SPI_IOC_WR_MAX_SPEED_HZ,
+                          &speed_hz) < 0 ? -1 : 0;
+    if (ret == 0) shadow->speed_hz = speed_hz;
+  }
+  if (shadow != &current) pthread_mutex_unlock(&shadow->lock);
+  return ret;
+}
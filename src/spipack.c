@@ -0,0 +1,1084 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+/**
+ * @file spipack.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Conversion between SPI bus buffers and native word arrays.
+ *
+ * Each vectorized kernel converts as many whole vectors as it can and returns
+ * the number of words it handled; the portable C code finishes the rest. The
+ * kernels are picked once at runtime based on the CPU's features.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "spipack.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPI_PACK_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SPI_PACK_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Unpacks whole vectors of words, returning the number of words converted. 
+ * \p flags has SPI_PACK_SIGNED set whenever the words should be sign extended.
+ */
+typedef uint32_t (*SPI_unpack_kernel)(const uint8_t *src, void *dst, 
+                                      uint32_t n_words, uint8_t bits_per_word,
+                                      int flags);
+
+/**
+ * The set of vectorized kernels for one instruction set; NULL entries fall 
+ * back to the portable C code.
+ *
+ * Kernel names give the bus layout then the native type: wN is the spidev 
+ * layout with N-bit storage, pN is an N-bit packed bitstream.
+ */
+typedef struct {
+  SPI_unpack_kernel w8_u16;
+  SPI_unpack_kernel w8_u32;
+  SPI_unpack_kernel w16_u16;
+  SPI_unpack_kernel w16_u32;
+  SPI_unpack_kernel w32_u32;
+  SPI_unpack_kernel p12_u16;
+  SPI_unpack_kernel p12_u32;
+  SPI_unpack_kernel p16_u16;
+  SPI_unpack_kernel p16_u32;
+  SPI_unpack_kernel p24_u32;
+  /// Converts int32_t words to floats in place
+  uint32_t (*i32_f32)(void *words, uint32_t n_words);
+  /// Packs uint16_t words into a big-endian 16-bit bitstream
+  uint32_t (*u16_p16)(const uint16_t *words, uint8_t *dst, uint32_t n_words);
+} SPI_pack_kernels;
+
+/// The kernels selected for this CPU
+static SPI_pack_kernels SPI_kernels;
+static pthread_once_t SPI_kernels_once = PTHREAD_ONCE_INIT;
+
+#ifdef SPI_PACK_X86
+
+#define SPI_SSSE3 __attribute__((target("ssse3")))
+#define SPI_AVX2  __attribute__((target("avx2")))
+
+/**
+ * @brief Masks (or sign extends) 16-bit lanes to their low bits, given the 
+ *        number of unused high bits in \p shift.
+ */
+SPI_SSSE3 static inline __m128i SPI_extend16SSE(__m128i v, __m128i shift, 
+                                                int sign) {
+  v = _mm_sll_epi16(v, shift);
+  return sign ? _mm_sra_epi16(v, shift) : _mm_srl_epi16(v, shift);
+}
+
+/**
+ * @brief Same as SPI_extend16SSE for 32-bit lanes.
+ */
+SPI_SSSE3 static inline __m128i SPI_extend32SSE(__m128i v, __m128i shift, 
+                                                int sign) {
+  v = _mm_sll_epi32(v, shift);
+  return sign ? _mm_sra_epi32(v, shift) : _mm_srl_epi32(v, shift);
+}
+
+/**
+ * @brief Shuffles 8 packed 12-bit words into 16-bit lanes, left-justified.
+ */
+SPI_SSSE3 static inline __m128i SPI_p12LeftSSE(const uint8_t *src) {
+  __m128i v;
+  v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src),
+                       _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 
+                                     7, 6, 8, 7, 10, 9, 11, 10));
+  // Even words are already left-justified, odd words need shifting up:
+  return _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0x0000ffff)),
+                      _mm_and_si128(_mm_slli_epi16(v, 4), 
+                                    _mm_set1_epi32(0xffff0000)));
+}
+
+SPI_SSSE3 static uint32_t SPI_w8U16SSE(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m128i v, shift, zero;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  zero = _mm_setzero_si128();
+  shift = _mm_cvtsi32_si128(16 - bits_per_word);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm_loadu_si128((const __m128i *) (src + i));
+    _mm_storeu_si128((__m128i *) (out + i), 
+                     SPI_extend16SSE(_mm_unpacklo_epi8(v, zero), shift, sign));
+    _mm_storeu_si128((__m128i *) (out + i + 8), 
+                     SPI_extend16SSE(_mm_unpackhi_epi8(v, zero), shift, sign));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_w8U32SSE(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, lo, hi, shift, zero;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  zero = _mm_setzero_si128();
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm_loadu_si128((const __m128i *) (src + i));
+    lo = _mm_unpacklo_epi8(v, zero);
+    hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_si128((__m128i *) (out + i), 
+                     SPI_extend32SSE(_mm_unpacklo_epi16(lo, zero), shift, sign));
+    _mm_storeu_si128((__m128i *) (out + i + 4), 
+                     SPI_extend32SSE(_mm_unpackhi_epi16(lo, zero), shift, sign));
+    _mm_storeu_si128((__m128i *) (out + i + 8), 
+                     SPI_extend32SSE(_mm_unpacklo_epi16(hi, zero), shift, sign));
+    _mm_storeu_si128((__m128i *) (out + i + 12), 
+                     SPI_extend32SSE(_mm_unpackhi_epi16(hi, zero), shift, sign));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_w16U16SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m128i v, shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(16 - bits_per_word);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_loadu_si128((const __m128i *) (src + 2*i));
+    _mm_storeu_si128((__m128i *) (out + i), SPI_extend16SSE(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_w16U32SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, shift, zero;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  zero = _mm_setzero_si128();
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_loadu_si128((const __m128i *) (src + 2*i));
+    _mm_storeu_si128((__m128i *) (out + i), 
+                     SPI_extend32SSE(_mm_unpacklo_epi16(v, zero), shift, sign));
+    _mm_storeu_si128((__m128i *) (out + i + 4), 
+                     SPI_extend32SSE(_mm_unpackhi_epi16(v, zero), shift, sign));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_w32U32SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+4<=n_words; i+=4) {
+    v = _mm_loadu_si128((const __m128i *) (src + 4*i));
+    _mm_storeu_si128((__m128i *) (out + i), SPI_extend32SSE(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_p12U16SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  uint32_t i, n_bytes;
+  __m128i v;
+  n_bytes = SPI_bufferSize(12, n_words, SPI_PACK_BITSTREAM);
+  // Each 16-byte load is used for 8 words (12 bytes):
+  for (i=0; i+8<=n_words && (i/2)*3+16<=n_bytes; i+=8) {
+    v = SPI_p12LeftSSE(src + (i/2)*3);
+    v = (flags & SPI_PACK_SIGNED) ? _mm_srai_epi16(v, 4) : _mm_srli_epi16(v, 4);
+    _mm_storeu_si128((__m128i *) (out + i), v);
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_p12U32SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint32_t i, n_bytes;
+  __m128i v, lo, hi, zero;
+  zero = _mm_setzero_si128();
+  n_bytes = SPI_bufferSize(12, n_words, SPI_PACK_BITSTREAM);
+  for (i=0; i+8<=n_words && (i/2)*3+16<=n_bytes; i+=8) {
+    v = SPI_p12LeftSSE(src + (i/2)*3);
+    // Move each word to the top of a 32-bit lane then shift back down:
+    lo = _mm_unpacklo_epi16(zero, v);
+    hi = _mm_unpackhi_epi16(zero, v);
+    if (flags & SPI_PACK_SIGNED) {
+      lo = _mm_srai_epi32(lo, 20);
+      hi = _mm_srai_epi32(hi, 20);
+    }
+    else {
+      lo = _mm_srli_epi32(lo, 20);
+      hi = _mm_srli_epi32(hi, 20);
+    }
+    _mm_storeu_si128((__m128i *) (out + i), lo);
+    _mm_storeu_si128((__m128i *) (out + i + 4), hi);
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_p16U16SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m128i v, swap;
+  uint32_t i;
+  swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_loadu_si128((const __m128i *) (src + 2*i));
+    _mm_storeu_si128((__m128i *) (out + i), _mm_shuffle_epi8(v, swap));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_p16U32SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, lo, hi, swap, zero;
+  uint32_t i;
+  zero = _mm_setzero_si128();
+  swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 2*i)), swap);
+    lo = _mm_unpacklo_epi16(zero, v);
+    hi = _mm_unpackhi_epi16(zero, v);
+    if (flags & SPI_PACK_SIGNED) {
+      lo = _mm_srai_epi32(lo, 16);
+      hi = _mm_srai_epi32(hi, 16);
+    }
+    else {
+      lo = _mm_srli_epi32(lo, 16);
+      hi = _mm_srli_epi32(hi, 16);
+    }
+    _mm_storeu_si128((__m128i *) (out + i), lo);
+    _mm_storeu_si128((__m128i *) (out + i + 4), hi);
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_p24U32SSE(const uint8_t *src, void *dst, 
+                                        uint32_t n_words, 
+                                        uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, order;
+  uint32_t i, n_bytes;
+  // Place each word in the top 24 bits of its lane:
+  if (flags & SPI_PACK_LSBYTE_FIRST) {
+    order = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, 
+                          -1, 6, 7, 8, -1, 9, 10, 11);
+  }
+  else {
+    order = _mm_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, 
+                          -1, 8, 7, 6, -1, 11, 10, 9);
+  }
+  n_bytes = 3 * n_words;
+  for (i=0; i+4<=n_words && 3*i+16<=n_bytes; i+=4) {
+    v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 3*i)), 
+                         order);
+    v = (flags & SPI_PACK_SIGNED) ? _mm_srai_epi32(v, 8) : _mm_srli_epi32(v, 8);
+    _mm_storeu_si128((__m128i *) (out + i), v);
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_i32F32SSE(void *words, uint32_t n_words) {
+  uint32_t i;
+  __m128i v;
+  for (i=0; i+4<=n_words; i+=4) {
+    v = _mm_loadu_si128((const __m128i *) ((int32_t *) words + i));
+    _mm_storeu_ps((float *) words + i, _mm_cvtepi32_ps(v));
+  }
+  return i;
+}
+
+SPI_SSSE3 static uint32_t SPI_u16P16SSE(const uint16_t *words, uint8_t *dst, 
+                                        uint32_t n_words) {
+  __m128i v, swap;
+  uint32_t i;
+  swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_loadu_si128((const __m128i *) (words + i));
+    _mm_storeu_si128((__m128i *) (dst + 2*i), _mm_shuffle_epi8(v, swap));
+  }
+  return i;
+}
+
+static const SPI_pack_kernels SPI_kernelsSSE = {
+  SPI_w8U16SSE, SPI_w8U32SSE, SPI_w16U16SSE, SPI_w16U32SSE, SPI_w32U32SSE,
+  SPI_p12U16SSE, SPI_p12U32SSE, SPI_p16U16SSE, SPI_p16U32SSE, SPI_p24U32SSE,
+  SPI_i32F32SSE, SPI_u16P16SSE
+};
+
+SPI_AVX2 static inline __m256i SPI_extend16AVX(__m256i v, __m128i shift, 
+                                               int sign) {
+  v = _mm256_sll_epi16(v, shift);
+  return sign ? _mm256_sra_epi16(v, shift) : _mm256_srl_epi16(v, shift);
+}
+
+SPI_AVX2 static inline __m256i SPI_extend32AVX(__m256i v, __m128i shift, 
+                                               int sign) {
+  v = _mm256_sll_epi32(v, shift);
+  return sign ? _mm256_sra_epi32(v, shift) : _mm256_srl_epi32(v, shift);
+}
+
+/**
+ * @brief Loads the two 12-byte groups at \p src and \p src + 12 into the two 
+ *        128-bit lanes.
+ */
+SPI_AVX2 static inline __m256i SPI_load12x2AVX(const uint8_t *src) {
+  return _mm256_inserti128_si256(
+    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) src)),
+    _mm_loadu_si128((const __m128i *) (src + 12)), 1);
+}
+
+/**
+ * @brief Shuffles 16 packed 12-bit words into 16-bit lanes, left-justified.
+ */
+SPI_AVX2 static inline __m256i SPI_p12LeftAVX(const uint8_t *src) {
+  __m256i v;
+  v = _mm256_shuffle_epi8(SPI_load12x2AVX(src),
+                          _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 
+                                           7, 6, 8, 7, 10, 9, 11, 10,
+                                           1, 0, 2, 1, 4, 3, 5, 4, 
+                                           7, 6, 8, 7, 10, 9, 11, 10));
+  return _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi32(0x0000ffff)),
+                         _mm256_and_si256(_mm256_slli_epi16(v, 4), 
+                                          _mm256_set1_epi32(0xffff0000)));
+}
+
+SPI_AVX2 static uint32_t SPI_w8U16AVX(const uint8_t *src, void *dst, 
+                                      uint32_t n_words, uint8_t bits_per_word,
+                                      int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m256i v;
+  __m128i shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(16 - bits_per_word);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (src + i)));
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        SPI_extend16AVX(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_w8U32AVX(const uint8_t *src, void *dst, 
+                                      uint32_t n_words, uint8_t bits_per_word,
+                                      int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m256i v;
+  __m128i shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)));
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        SPI_extend32AVX(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_w16U16AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m256i v;
+  __m128i shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(16 - bits_per_word);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm256_loadu_si256((const __m256i *) (src + 2*i));
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        SPI_extend16AVX(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_w16U32AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m256i v;
+  __m128i shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + 2*i)));
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        SPI_extend32AVX(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_w32U32AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m256i v;
+  __m128i shift;
+  int sign = flags & SPI_PACK_SIGNED;
+  uint32_t i;
+  shift = _mm_cvtsi32_si128(32 - bits_per_word);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm256_loadu_si256((const __m256i *) (src + 4*i));
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        SPI_extend32AVX(v, shift, sign));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_p12U16AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  uint32_t i, n_bytes;
+  __m256i v;
+  n_bytes = SPI_bufferSize(12, n_words, SPI_PACK_BITSTREAM);
+  // Each pair of 16-byte loads is used for 16 words (24 bytes):
+  for (i=0; i+16<=n_words && (i/2)*3+28<=n_bytes; i+=16) {
+    v = SPI_p12LeftAVX(src + (i/2)*3);
+    v = (flags & SPI_PACK_SIGNED) ? _mm256_srai_epi16(v, 4) : 
+                                    _mm256_srli_epi16(v, 4);
+    _mm256_storeu_si256((__m256i *) (out + i), v);
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_p12U32AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint32_t i, n_bytes;
+  __m256i v, lo, hi, zero;
+  zero = _mm256_setzero_si256();
+  n_bytes = SPI_bufferSize(12, n_words, SPI_PACK_BITSTREAM);
+  for (i=0; i+16<=n_words && (i/2)*3+28<=n_bytes; i+=16) {
+    v = SPI_p12LeftAVX(src + (i/2)*3);
+    lo = _mm256_unpacklo_epi16(zero, v);
+    hi = _mm256_unpackhi_epi16(zero, v);
+    if (flags & SPI_PACK_SIGNED) {
+      lo = _mm256_srai_epi32(lo, 20);
+      hi = _mm256_srai_epi32(hi, 20);
+    }
+    else {
+      lo = _mm256_srli_epi32(lo, 20);
+      hi = _mm256_srli_epi32(hi, 20);
+    }
+    // The unpacks work within each 128-bit lane, so put the halves in order:
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *) (out + i + 8), 
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_p16U16AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  __m256i v, swap;
+  uint32_t i;
+  swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm256_loadu_si256((const __m256i *) (src + 2*i));
+    _mm256_storeu_si256((__m256i *) (out + i), _mm256_shuffle_epi8(v, swap));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_p16U32AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m128i v, swap;
+  uint32_t i;
+  swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 2*i)), swap);
+    _mm256_storeu_si256((__m256i *) (out + i), 
+                        (flags & SPI_PACK_SIGNED) ? _mm256_cvtepi16_epi32(v) : 
+                                                    _mm256_cvtepu16_epi32(v));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_p24U32AVX(const uint8_t *src, void *dst, 
+                                       uint32_t n_words, uint8_t bits_per_word,
+                                       int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  __m256i v, order;
+  uint32_t i, n_bytes;
+  if (flags & SPI_PACK_LSBYTE_FIRST) {
+    order = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, 
+                             -1, 6, 7, 8, -1, 9, 10, 11,
+                             -1, 0, 1, 2, -1, 3, 4, 5, 
+                             -1, 6, 7, 8, -1, 9, 10, 11);
+  }
+  else {
+    order = _mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, 
+                             -1, 8, 7, 6, -1, 11, 10, 9,
+                             -1, 2, 1, 0, -1, 5, 4, 3, 
+                             -1, 8, 7, 6, -1, 11, 10, 9);
+  }
+  n_bytes = 3 * n_words;
+  for (i=0; i+8<=n_words && 3*i+28<=n_bytes; i+=8) {
+    v = _mm256_shuffle_epi8(SPI_load12x2AVX(src + 3*i), order);
+    v = (flags & SPI_PACK_SIGNED) ? _mm256_srai_epi32(v, 8) : 
+                                    _mm256_srli_epi32(v, 8);
+    _mm256_storeu_si256((__m256i *) (out + i), v);
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_i32F32AVX(void *words, uint32_t n_words) {
+  uint32_t i;
+  __m256i v;
+  for (i=0; i+8<=n_words; i+=8) {
+    v = _mm256_loadu_si256((const __m256i *) ((int32_t *) words + i));
+    _mm256_storeu_ps((float *) words + i, _mm256_cvtepi32_ps(v));
+  }
+  return i;
+}
+
+SPI_AVX2 static uint32_t SPI_u16P16AVX(const uint16_t *words, uint8_t *dst, 
+                                       uint32_t n_words) {
+  __m256i v, swap;
+  uint32_t i;
+  swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (i=0; i+16<=n_words; i+=16) {
+    v = _mm256_loadu_si256((const __m256i *) (words + i));
+    _mm256_storeu_si256((__m256i *) (dst + 2*i), _mm256_shuffle_epi8(v, swap));
+  }
+  return i;
+}
+
+static const SPI_pack_kernels SPI_kernelsAVX2 = {
+  SPI_w8U16AVX, SPI_w8U32AVX, SPI_w16U16AVX, SPI_w16U32AVX, SPI_w32U32AVX,
+  SPI_p12U16AVX, SPI_p12U32AVX, SPI_p16U16AVX, SPI_p16U32AVX, SPI_p24U32AVX,
+  SPI_i32F32AVX, SPI_u16P16AVX
+};
+
+#endif // SPI_PACK_X86
+
+#ifdef SPI_PACK_NEON
+
+/**
+ * @brief Masks (or sign extends) 16-bit lanes to their low bits, given the 
+ *        number of unused high bits in \p shift.
+ */
+static inline uint16x8_t SPI_extend16NEON(uint16x8_t v, int shift, int sign) {
+  v = vshlq_u16(v, vdupq_n_s16(shift));
+  if (sign) {
+    return vreinterpretq_u16_s16(vshlq_s16(vreinterpretq_s16_u16(v), 
+                                           vdupq_n_s16(-shift)));
+  }
+  return vshlq_u16(v, vdupq_n_s16(-shift));
+}
+
+/**
+ * @brief Same as SPI_extend16NEON for 32-bit lanes.
+ */
+static inline uint32x4_t SPI_extend32NEON(uint32x4_t v, int shift, int sign) {
+  v = vshlq_u32(v, vdupq_n_s32(shift));
+  if (sign) {
+    return vreinterpretq_u32_s32(vshlq_s32(vreinterpretq_s32_u32(v), 
+                                           vdupq_n_s32(-shift)));
+  }
+  return vshlq_u32(v, vdupq_n_s32(-shift));
+}
+
+/**
+ * @brief Loads 16 packed 12-bit words as left-justified even and odd words.
+ */
+static inline uint16x8x2_t SPI_p12LeftNEON(const uint8_t *src) {
+  uint8x8x3_t b;
+  uint16x8x2_t words;
+  b = vld3_u8(src);
+  words.val[0] = vorrq_u16(vshll_n_u8(b.val[0], 8), vmovl_u8(b.val[1]));
+  words.val[1] = vshlq_n_u16(vorrq_u16(vshll_n_u8(b.val[1], 8), 
+                                       vmovl_u8(b.val[2])), 4);
+  return words;
+}
+
+static uint32_t SPI_w8U16NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                              uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  uint8x16_t v;
+  int sign = flags & SPI_PACK_SIGNED;
+  int shift = 16 - bits_per_word;
+  uint32_t i;
+  for (i=0; i+16<=n_words; i+=16) {
+    v = vld1q_u8(src + i);
+    vst1q_u16(out + i, SPI_extend16NEON(vmovl_u8(vget_low_u8(v)), shift, sign));
+    vst1q_u16(out + i + 8, 
+              SPI_extend16NEON(vmovl_u8(vget_high_u8(v)), shift, sign));
+  }
+  return i;
+}
+
+static uint32_t SPI_w8U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                              uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint16x8_t v;
+  int sign = flags & SPI_PACK_SIGNED;
+  int shift = 32 - bits_per_word;
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    v = vmovl_u8(vld1_u8(src + i));
+    vst1q_u32(out + i, 
+              SPI_extend32NEON(vmovl_u16(vget_low_u16(v)), shift, sign));
+    vst1q_u32(out + i + 4, 
+              SPI_extend32NEON(vmovl_u16(vget_high_u16(v)), shift, sign));
+  }
+  return i;
+}
+
+static uint32_t SPI_w16U16NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  int sign = flags & SPI_PACK_SIGNED;
+  int shift = 16 - bits_per_word;
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    vst1q_u16(out + i, SPI_extend16NEON(vld1q_u16((const uint16_t *) src + i),
+                                        shift, sign));
+  }
+  return i;
+}
+
+static uint32_t SPI_w16U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint16x8_t v;
+  int sign = flags & SPI_PACK_SIGNED;
+  int shift = 32 - bits_per_word;
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    v = vld1q_u16((const uint16_t *) src + i);
+    vst1q_u32(out + i, 
+              SPI_extend32NEON(vmovl_u16(vget_low_u16(v)), shift, sign));
+    vst1q_u32(out + i + 4, 
+              SPI_extend32NEON(vmovl_u16(vget_high_u16(v)), shift, sign));
+  }
+  return i;
+}
+
+static uint32_t SPI_w32U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  int sign = flags & SPI_PACK_SIGNED;
+  int shift = 32 - bits_per_word;
+  uint32_t i;
+  for (i=0; i+4<=n_words; i+=4) {
+    vst1q_u32(out + i, SPI_extend32NEON(vld1q_u32((const uint32_t *) src + i),
+                                        shift, sign));
+  }
+  return i;
+}
+
+static uint32_t SPI_p12U16NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  uint16x8x2_t words;
+  uint32_t i;
+  // vld3_u8 loads exactly 24 bytes, which hold 16 words:
+  for (i=0; i+16<=n_words; i+=16) {
+    words = SPI_p12LeftNEON(src + (i/2)*3);
+    if (flags & SPI_PACK_SIGNED) {
+      words.val[0] = vreinterpretq_u16_s16(
+        vshrq_n_s16(vreinterpretq_s16_u16(words.val[0]), 4));
+      words.val[1] = vreinterpretq_u16_s16(
+        vshrq_n_s16(vreinterpretq_s16_u16(words.val[1]), 4));
+    }
+    else {
+      words.val[0] = vshrq_n_u16(words.val[0], 4);
+      words.val[1] = vshrq_n_u16(words.val[1], 4);
+    }
+    // Interleave the even and odd words back into order:
+    vst2q_u16(out + i, words);
+  }
+  return i;
+}
+
+static uint32_t SPI_p12U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint16x8x2_t words, ordered;
+  uint32x4_t v;
+  uint32_t i;
+  int j;
+  for (i=0; i+16<=n_words; i+=16) {
+    words = SPI_p12LeftNEON(src + (i/2)*3);
+    ordered = vzipq_u16(words.val[0], words.val[1]);
+    for (j=0; j<4; j++) {
+      if (j & 1) v = vshll_n_u16(vget_high_u16(ordered.val[j>>1]), 16);
+      else v = vshll_n_u16(vget_low_u16(ordered.val[j>>1]), 16);
+      if (flags & SPI_PACK_SIGNED) {
+        v = vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(v), 20));
+      }
+      else {
+        v = vshrq_n_u32(v, 20);
+      }
+      vst1q_u32(out + i + 4*j, v);
+    }
+  }
+  return i;
+}
+
+static uint32_t SPI_p16U16NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint16_t *out = (uint16_t *) dst;
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    vst1q_u16(out + i, vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2*i))));
+  }
+  return i;
+}
+
+static uint32_t SPI_p16U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint16x8_t v;
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    v = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2*i)));
+    if (flags & SPI_PACK_SIGNED) {
+      vst1q_s32((int32_t *) out + i, 
+                vmovl_s16(vget_low_s16(vreinterpretq_s16_u16(v))));
+      vst1q_s32((int32_t *) out + i + 4, 
+                vmovl_s16(vget_high_s16(vreinterpretq_s16_u16(v))));
+    }
+    else {
+      vst1q_u32(out + i, vmovl_u16(vget_low_u16(v)));
+      vst1q_u32(out + i + 4, vmovl_u16(vget_high_u16(v)));
+    }
+  }
+  return i;
+}
+
+static uint32_t SPI_p24U32NEON(const uint8_t *src, void *dst, uint32_t n_words,
+                               uint8_t bits_per_word, int flags) {
+  uint32_t *out = (uint32_t *) dst;
+  uint8x8x3_t b;
+  uint8x8_t msb, lsb;
+  uint16x8x2_t halves;
+  uint32x4_t v;
+  uint32_t i;
+  int j;
+  for (i=0; i+8<=n_words; i+=8) {
+    b = vld3_u8(src + 3*i);
+    msb = (flags & SPI_PACK_LSBYTE_FIRST) ? b.val[2] : b.val[0];
+    lsb = (flags & SPI_PACK_LSBYTE_FIRST) ? b.val[0] : b.val[2];
+    // Build each word in the top 24 bits of a 32-bit lane:
+    halves = vzipq_u16(vshll_n_u8(lsb, 8), 
+                       vorrq_u16(vshll_n_u8(msb, 8), vmovl_u8(b.val[1])));
+    for (j=0; j<2; j++) {
+      v = vreinterpretq_u32_u16(halves.val[j]);
+      if (flags & SPI_PACK_SIGNED) {
+        v = vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(v), 8));
+      }
+      else {
+        v = vshrq_n_u32(v, 8);
+      }
+      vst1q_u32(out + i + 4*j, v);
+    }
+  }
+  return i;
+}
+
+static uint32_t SPI_i32F32NEON(void *words, uint32_t n_words) {
+  uint32_t i;
+  for (i=0; i+4<=n_words; i+=4) {
+    vst1q_f32((float *) words + i, 
+              vcvtq_f32_s32(vld1q_s32((const int32_t *) words + i)));
+  }
+  return i;
+}
+
+static uint32_t SPI_u16P16NEON(const uint16_t *words, uint8_t *dst, 
+                               uint32_t n_words) {
+  uint32_t i;
+  for (i=0; i+8<=n_words; i+=8) {
+    vst1q_u8(dst + 2*i, vrev16q_u8(vreinterpretq_u8_u16(vld1q_u16(words + i))));
+  }
+  return i;
+}
+
+static const SPI_pack_kernels SPI_kernelsNEON = {
+  SPI_w8U16NEON, SPI_w8U32NEON, SPI_w16U16NEON, SPI_w16U32NEON, SPI_w32U32NEON,
+  SPI_p12U16NEON, SPI_p12U32NEON, SPI_p16U16NEON, SPI_p16U32NEON, 
+  SPI_p24U32NEON, SPI_i32F32NEON, SPI_u16P16NEON
+};
+
+#endif // SPI_PACK_NEON
+
+static void SPI_selectKernels(void) {
+#ifdef SPI_PACK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) SPI_kernels = SPI_kernelsAVX2;
+  else if (__builtin_cpu_supports("ssse3")) SPI_kernels = SPI_kernelsSSE;
+#elif defined(SPI_PACK_NEON)
+  SPI_kernels = SPI_kernelsNEON;
+#endif
+}
+
+uint32_t SPI_wordBytes(uint8_t bits_per_word) {
+  if (bits_per_word == 0 || bits_per_word > 32) return 0;
+  if (bits_per_word <= 8) return 1;
+  if (bits_per_word <= 16) return 2;
+  return 4;
+}
+
+uint32_t SPI_bufferSize(uint8_t bits_per_word, uint32_t n_words, int flags) {
+  if (flags & SPI_PACK_BITSTREAM) {
+    return (uint32_t) (((uint64_t) bits_per_word * n_words + 7) >> 3);
+  }
+  return n_words * SPI_wordBytes(bits_per_word);
+}
+
+/**
+ * @brief Checks the arguments shared by SPI_pack and SPI_unpack.
+ */
+static int SPI_checkPackArgs(SPI_word_type type, uint8_t bits_per_word, 
+                             int flags) {
+  if (bits_per_word == 0 || bits_per_word > 32 ||
+      type < SPI_WORD_UINT16 || type > SPI_WORD_FLOAT ||
+      (type == SPI_WORD_UINT16 && bits_per_word > 16) ||
+      ((flags & SPI_PACK_BITSTREAM) && (flags & SPI_PACK_LSBYTE_FIRST) && 
+       (bits_per_word & 0x7))) {
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Portable version of the unpack kernels, for any word size.
+ */
+static void SPI_unpackScalar(const uint8_t *src, void *dst, uint32_t n_words,
+                             uint8_t bits_per_word, int flags, int wide) {
+  uint32_t i, j, value, mask, word_bytes;
+  uint64_t bits;
+  uint8_t n_bits;
+  uint16_t value16;
+  mask = bits_per_word == 32 ? 0xffffffff : (1u << bits_per_word) - 1;
+  word_bytes = SPI_wordBytes(bits_per_word);
+  bits = 0;
+  n_bits = 0;
+  for (i=0; i<n_words; i++) {
+    if (!(flags & SPI_PACK_BITSTREAM)) {
+      switch (word_bytes) {
+      case 1:
+        value = *src;
+        break;
+      case 2:
+        memcpy((void *) &value16, src, 2);
+        value = value16;
+        break;
+      default:
+        memcpy((void *) &value, src, 4);
+        break;
+      }
+      src += word_bytes;
+    }
+    else if (flags & SPI_PACK_LSBYTE_FIRST) {
+      value = 0;
+      for (j=0; j<bits_per_word; j+=8) value |= (uint32_t) *src++ << j;
+    }
+    else {
+      while (n_bits < bits_per_word) {
+        bits = (bits << 8) | *src++;
+        n_bits += 8;
+      }
+      n_bits -= bits_per_word;
+      value = (uint32_t) (bits >> n_bits);
+    }
+    value &= mask;
+    if ((flags & SPI_PACK_SIGNED) && (value >> (bits_per_word - 1))) {
+      value |= ~mask;
+    }
+    if (wide) ((uint32_t *) dst)[i] = value;
+    else ((uint16_t *) dst)[i] = (uint16_t) value;
+  }
+}
+
+int SPI_unpack(const void *bus_buffer, void *words, SPI_word_type type,
+               uint32_t n_words, uint8_t bits_per_word, int flags) {
+  const uint8_t *src = (const uint8_t *) bus_buffer;
+  SPI_unpack_kernel kernel;
+  uint32_t done, i;
+  int wide;
+  if (SPI_checkPackArgs(type, bits_per_word, flags) < 0) return -1;
+  pthread_once(&SPI_kernels_once, SPI_selectKernels);
+  if (type == SPI_WORD_INT32) flags |= SPI_PACK_SIGNED;
+  wide = type != SPI_WORD_UINT16;
+
+  kernel = NULL;
+  if (flags & SPI_PACK_BITSTREAM) {
+    if (bits_per_word == 12 && !(flags & SPI_PACK_LSBYTE_FIRST)) {
+      kernel = wide ? SPI_kernels.p12_u32 : SPI_kernels.p12_u16;
+    }
+    else if (bits_per_word == 16 && !(flags & SPI_PACK_LSBYTE_FIRST)) {
+      kernel = wide ? SPI_kernels.p16_u32 : SPI_kernels.p16_u16;
+    }
+    else if (bits_per_word == 24) {
+      kernel = SPI_kernels.p24_u32;
+    }
+  }
+  else {
+    switch (SPI_wordBytes(bits_per_word)) {
+    case 1:
+      kernel = wide ? SPI_kernels.w8_u32 : SPI_kernels.w8_u16;
+      break;
+    case 2:
+      kernel = wide ? SPI_kernels.w16_u32 : SPI_kernels.w16_u16;
+      break;
+    default:
+      kernel = SPI_kernels.w32_u32;
+      break;
+    }
+  }
+  done = kernel ? kernel(src, words, n_words, bits_per_word, flags) : 0;
+
+  // Kernels always stop on a byte boundary:
+  src += (flags & SPI_PACK_BITSTREAM) ? 
+         ((uint64_t) done * bits_per_word) >> 3 : 
+         done * SPI_wordBytes(bits_per_word);
+  SPI_unpackScalar(src, wide ? (void *) ((uint32_t *) words + done) : 
+                               (void *) ((uint16_t *) words + done),
+                   n_words - done, bits_per_word, flags, wide);
+
+  if (type == SPI_WORD_FLOAT) {
+    if ((flags & SPI_PACK_SIGNED) || bits_per_word < 32) {
+      // Every value fits in an int32_t:
+      done = SPI_kernels.i32_f32 ? SPI_kernels.i32_f32(words, n_words) : 0;
+      for (i=done; i<n_words; i++) {
+        ((float *) words)[i] = (float) ((int32_t *) words)[i];
+      }
+    }
+    else {
+      for (i=0; i<n_words; i++) {
+        ((float *) words)[i] = (float) ((uint32_t *) words)[i];
+      }
+    }
+  }
+  return 0;
+}
+
+int SPI_pack(const void *words, SPI_word_type type, void *bus_buffer,
+             uint32_t n_words, uint8_t bits_per_word, int flags) {
+  uint8_t *dst = (uint8_t *) bus_buffer;
+  uint32_t i, j, value, mask, word_bytes;
+  uint64_t bits;
+  uint8_t n_bits;
+  uint16_t value16;
+  float f;
+  if (SPI_checkPackArgs(type, bits_per_word, flags) < 0) return -1;
+  pthread_once(&SPI_kernels_once, SPI_selectKernels);
+
+  i = 0;
+  if (type == SPI_WORD_UINT16 && bits_per_word == 16 && 
+      (flags & SPI_PACK_BITSTREAM) && !(flags & SPI_PACK_LSBYTE_FIRST) &&
+      SPI_kernels.u16_p16) {
+    i = SPI_kernels.u16_p16((const uint16_t *) words, dst, n_words);
+    dst += 2*i;
+  }
+
+  mask = bits_per_word == 32 ? 0xffffffff : (1u << bits_per_word) - 1;
+  word_bytes = SPI_wordBytes(bits_per_word);
+  bits = 0;
+  n_bits = 0;
+  for (; i<n_words; i++) {
+    switch (type) {
+    case SPI_WORD_UINT16:
+      value = ((const uint16_t *) words)[i];
+      break;
+    case SPI_WORD_FLOAT:
+      // Round to nearest without pulling in libm (in double precision so the
+      // +/-0.5 can't round up large floats):
+      f = ((const float *) words)[i];
+      value = (uint32_t) (int64_t) (f < 0 ? f - 0.5 : f + 0.5);
+      break;
+    default:
+      value = ((const uint32_t *) words)[i];
+      break;
+    }
+    value &= mask;
+    if (!(flags & SPI_PACK_BITSTREAM)) {
+      switch (word_bytes) {
+      case 1:
+        *dst = (uint8_t) value;
+        break;
+      case 2:
+        value16 = (uint16_t) value;
+        memcpy(dst, (void *) &value16, 2);
+        break;
+      default:
+        memcpy(dst, (void *) &value, 4);
+        break;
+      }
+      dst += word_bytes;
+    }
+    else if (flags & SPI_PACK_LSBYTE_FIRST) {
+      for (j=0; j<bits_per_word; j+=8) *dst++ = (uint8_t) (value >> j);
+    }
+    else {
+      bits = (bits << bits_per_word) | value;
+      n_bits += bits_per_word;
+      while (n_bits >= 8) {
+        n_bits -= 8;
+        *dst++ = (uint8_t) (bits >> n_bits);
+      }
+    }
+  }
+  // Pad out the last partial byte of a bitstream with zeros:
+  if (n_bits) *dst = (uint8_t) (bits << (8 - n_bits));
+  return 0;
+}
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright (c) 2015 - Gray Cat Labs - https://graycat.io
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+
+
+/**
+ * @file transport.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Pluggable backends for the file operations behind the bus drivers.
+ *
+ * Only files opened with a transport other than #Transport_dev are recorded
+ * in the fd table, and the table isn't consulted at all while there are none,
+ * so the real hardware path costs no more than calling the system calls 
+ * directly.
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "transport.h"
+#include "fdmap.h"
+
+static int Transport_devOpen(const char *path, int flags) {
+  return open(path, flags, 0);
+}
+
+static int Transport_devClose(int fd) {
+  return close(fd);
+}
+
+static int Transport_devIoctl(int fd, unsigned long request, void *arg) {
+  return ioctl(fd, request, arg);
+}
+
+static ssize_t Transport_devRead(int fd, void *buffer, size_t n_bytes) {
+  return read(fd, buffer, n_bytes);
+}
+
+static ssize_t Transport_devWrite(int fd, const void *buffer, 
+                                  size_t n_bytes) {
+  return write(fd, buffer, n_bytes);
+}
+
+const Transport Transport_dev = {
+  "dev",
+  Transport_devOpen,
+  Transport_devClose,
+  Transport_devIoctl,
+  Transport_devRead,
+  Transport_devWrite
+};
+
+/// Set by Transport_select, or NULL to use Transport_default
+static const Transport *Transport_current = NULL;
+
+/// The transport used until Transport_select is called, from the environment
+static const Transport *Transport_default = &Transport_dev;
+static pthread_once_t Transport_default_once = PTHREAD_ONCE_INIT;
+
+/// Files opened with transports other than Transport_dev, indexed by fd
+static FDMap Transport_files = FDMAP_INITIALIZER;
+/// Number of files in Transport_files
+static int Transport_n_files = 0;
+
+static void Transport_readEnvironment(void) {
+  const char *name;
+  name = getenv("SERBUS_TRANSPORT");
+  if (name && strcmp(name, Transport_sim.name) == 0) {
+    Transport_default = &Transport_sim;
+  }
+}
+
+/**
+ * Gets the transport the given file was opened with.
+ */
+static const Transport *Transport_ofFile(int fd) {
+  const Transport *transport;
+  if (!__atomic_load_n(&Transport_n_files, __ATOMIC_ACQUIRE)) {
+    return &Transport_dev;
+  }
+  transport = FDMap_get(&Transport_files, fd);
+  return transport ? transport : &Transport_dev;
+}
+
+void Transport_select(const Transport *transport) {
+  __atomic_store_n(&Transport_current, transport, __ATOMIC_RELEASE);
+}
+
+const Transport *Transport_selected(void) {
+  const Transport *transport;
+  transport = __atomic_load_n(&Transport_current, __ATOMIC_ACQUIRE);
+  if (transport) return transport;
+  pthread_once(&Transport_default_once, Transport_readEnvironment);
+  return Transport_default;
+}
+
+int Transport_open(const char *path, int flags) {
+  const Transport *transport;
+  int fd;
+  transport = Transport_selected();
+  fd = transport->open(path, flags);
+  if (fd < 0 || transport == &Transport_dev) return fd;
+  if (FDMap_set(&Transport_files, fd, (void *) transport) < 0) {
+    transport->close(fd);
+    errno = ENOMEM;
+    return -1;
+  }
+  __atomic_add_fetch(&Transport_n_files, 1, __ATOMIC_RELEASE);
+  return fd;
+}
+
+int Transport_close(int fd) {
+  const Transport *transport;
+  transport = Transport_ofFile(fd);
+  if (transport != &Transport_dev) {
+    FDMap_remove(&Transport_files, fd);
+    __atomic_sub_fetch(&Transport_n_files, 1, __ATOMIC_RELEASE);
+  }
+  return transport->close(fd);
+}
+
+int Transport_ioctl(int fd, unsigned long request, ...) {
+  va_list args;
+  void *arg;
+  va_start(args, request);
+  arg = va_arg(args, void *);
+  va_end(args);
+  return Transport_ofFile(fd)->ioctl(fd, request, arg);
+}
+
+ssize_t Transport_read(int fd, void *buffer, size_t n_bytes) {
+  return Transport_ofFile(fd)->read(fd, buffer, n_bytes);
+}
+
+ssize_t Transport_write(int fd, const void *buffer, size_t n_bytes) {
+  return Transport_ofFile(fd)->write(fd, buffer, n_bytes);
+}
@@ -0,0 +1,38 @@
+/**
+ * @file check.h
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Minimal helpers shared by the check programs.
+ *
+ * Each check program runs against the simulated bus (see simbus.h), so no
+ * hardware is needed. Failed checks are printed as they happen, and the 
+ * program exits with a nonzero status if any failed.
+ */
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+/// Number of checks that have failed so far
+static int Check_failures = 0;
+
+/**
+ * Prints the failed condition and its location if \p condition is false.
+ */
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      Check_failures++; \
+    } \
+  } while (0)
+
+/**
+ * Prints a summary for the given program and gives its exit status.
+ */
+#define CHECK_RESULT(name) \
+  (printf("%s: %s\n", name, Check_failures ? "FAILED" : "passed"), \
+   Check_failures ? 1 : 0)
+
+#endif // _CHECK_H_
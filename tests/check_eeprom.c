@@ -0,0 +1,227 @@
+/**
+ * @file check_eeprom.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks EEPROM page splitting, ACK polling and chunked reads against
+ *        simulated 24Cxx EEPROMs.
+ */
+
+#include "i2cdriver.h"
+#include "eeprom.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHECK_BUS      1    // Simulated /dev/i2c-1
+#define EEPROM_ADDR    0x50 // EEPROM slave address
+#define MAX_TRANSFERS  32   // Most page writes recorded per check
+
+/**
+ * The I2C transfers recorded since the last #resetTransfers.
+ */
+static struct {
+  int n_transfers;                 ///< Number of transfers seen
+  int n_polls;                     ///< Address-only writes seen
+  int n_writes;                    ///< Writes with data seen
+  uint32_t write_addr[MAX_TRANSFERS]; ///< Memory address of each write
+  uint32_t write_len[MAX_TRANSFERS];  ///< Data bytes in each write
+  int read_messages;               ///< Messages in the last read transfer
+  uint16_t read_slaves;            ///< Bit n set if 0x50+n was read
+} recorded;
+
+/// Memory address bytes of the EEPROM being checked
+static int addr_bytes;
+
+static void recordTransfer(void *context, uint8_t bus,
+                           const struct i2c_msg *messages, int n_messages) {
+  int i, n;
+  recorded.n_transfers++;
+  if (n_messages == 1 && !(messages[0].flags & I2C_M_RD)) {
+    if (messages[0].len == 0) {
+      recorded.n_polls++;
+      return;
+    }
+    n = recorded.n_writes++;
+    if (n >= MAX_TRANSFERS || messages[0].len <= addr_bytes) return;
+    recorded.write_addr[n] = addr_bytes == 2 ?
+      (messages[0].buf[0] << 8) | messages[0].buf[1] : messages[0].buf[0];
+    recorded.write_addr[n] |= (messages[0].addr - EEPROM_ADDR) << 8;
+    recorded.write_len[n] = messages[0].len - addr_bytes;
+    return;
+  }
+  recorded.read_messages = n_messages;
+  for (i=0; i<n_messages; i++) {
+    if (messages[i].flags & I2C_M_RD) {
+      recorded.read_slaves |= 1 << (messages[i].addr - EEPROM_ADDR);
+    }
+  }
+}
+
+static void resetTransfers(void) {
+  memset((void *) &recorded, 0, sizeof(recorded));
+}
+
+static void fillPattern(uint8_t *buffer, uint32_t n_bytes, uint8_t seed) {
+  uint32_t i;
+  for (i=0; i<n_bytes; i++) buffer[i] = (i * 7 + seed) ^ (i >> 8);
+}
+
+/**
+ * @brief Checks writes are split at page boundaries, with each page's write
+ *        cycle waited out by ACK polling.
+ */
+static void checkPageWrites(void) {
+  EEPROM_config config = { EEPROM_ADDR, 4096, 32, 2, 0 };
+  uint8_t tx[100], rx[100];
+  I2C_message message;
+  int i2c_fd;
+
+  Sim_reset();
+  // A 24C32 with a 2ms write cycle:
+  Sim_attachI2C(CHECK_BUS, EEPROM_ADDR, SimDevice_eeprom24c(4096, 32, 2000));
+  addr_bytes = 2;
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return;
+
+  fillPattern(tx, sizeof(tx), 1);
+  resetTransfers();
+  CHECK(EEPROM_write(i2c_fd, &config, 20, tx, sizeof(tx)) == 0);
+  CHECK(recorded.n_writes == 4);
+  CHECK(recorded.write_addr[0] == 20 && recorded.write_len[0] == 12);
+  CHECK(recorded.write_addr[1] == 32 && recorded.write_len[1] == 32);
+  CHECK(recorded.write_addr[2] == 64 && recorded.write_len[2] == 32);
+  CHECK(recorded.write_addr[3] == 96 && recorded.write_len[3] == 24);
+  // Every write cycle was polled until it finished:
+  CHECK(recorded.n_polls > 4);
+
+  // Done once it returns:
+  CHECK(EEPROM_read(i2c_fd, &config, 20, rx, sizeof(rx)) == 0);
+  CHECK(memcmp(tx, rx, sizeof(tx)) == 0);
+
+  // A write cycle still running when a write starts is waited for:
+  message.addr = EEPROM_ADDR;
+  message.flags = 0;
+  message.n_bytes = 3;
+  message.buffer = tx;
+  tx[0] = 0x0f;
+  tx[1] = 0x00;
+  CHECK(I2C_transfer(i2c_fd, &message, 1) == 0);
+  fillPattern(tx, sizeof(tx), 2);
+  CHECK(EEPROM_write(i2c_fd, &config, 0, tx, 8) == 0);
+  CHECK(EEPROM_read(i2c_fd, &config, 0, rx, 8) == 0);
+  CHECK(memcmp(tx, rx, 8) == 0);
+
+  // Write cycles longer than the timeout fail:
+  config.write_timeout_us = 500;
+  Sim_attachI2C(CHECK_BUS, EEPROM_ADDR, SimDevice_eeprom24c(4096, 32, 20000));
+  errno = 0;
+  CHECK(EEPROM_write(i2c_fd, &config, 0, tx, 40) == -1);
+  CHECK(errno == ETIMEDOUT);
+
+  I2C_close(i2c_fd);
+}
+
+/**
+ * @brief Checks parts that take the upper address bits in the slave address,
+ *        simulating a 24C16 with a 24C02 at each of its 8 addresses.
+ */
+static void checkBlockAddressing(void) {
+  EEPROM_config config = { EEPROM_ADDR, 2048, 16, 1, 0 };
+  uint8_t tx[600], rx[2048], byte;
+  int i2c_fd, i, errors;
+
+  Sim_reset();
+  for (i=0; i<8; i++) {
+    Sim_attachI2C(CHECK_BUS, EEPROM_ADDR + i,
+                  SimDevice_eeprom24c(256, 16, 0));
+  }
+  addr_bytes = 1;
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return;
+
+  fillPattern(tx, sizeof(tx), 3);
+  resetTransfers();
+  CHECK(EEPROM_write(i2c_fd, &config, 200, tx, sizeof(tx)) == 0);
+  // 8 bytes up to the page boundary at 208 then 37 pages of 16:
+  CHECK(recorded.n_writes == 38);
+  CHECK(recorded.write_addr[0] == 200 && recorded.write_len[0] == 8);
+  CHECK(recorded.write_addr[4] == 256 && recorded.write_len[4] == 16);
+
+  // The second part holds 256 onwards:
+  CHECK(I2C_setSlaveAddress(i2c_fd, EEPROM_ADDR + 1) == 0);
+  CHECK(I2C_readTransaction(i2c_fd, 0, &byte, 1) == 0);
+  CHECK(byte == tx[56]);
+
+  resetTransfers();
+  CHECK(EEPROM_read(i2c_fd, &config, 0, rx, sizeof(rx)) == 0);
+  // One sequential read per part, all in one transfer:
+  CHECK(recorded.n_transfers == 1);
+  CHECK(recorded.read_messages == 16);
+  CHECK(recorded.read_slaves == 0xff);
+  errors = 0;
+  for (i=0; i<2048; i++) {
+    if (i >= 200 && i < 800) {
+      if (rx[i] != tx[i-200]) errors++;
+    }
+    else if (rx[i] != 0xff) errors++;
+  }
+  CHECK(errors == 0);
+
+  I2C_close(i2c_fd);
+}
+
+/**
+ * @brief Checks a read longer than one I2C message is done as sequential
+ *        reads in a single transfer.
+ */
+static void checkLongRead(void) {
+  EEPROM_config config = { EEPROM_ADDR, 65536, 128, 2, 0 };
+  uint8_t *tx, *rx;
+  int i2c_fd;
+
+  Sim_reset();
+  // A 24C512:
+  Sim_attachI2C(CHECK_BUS, EEPROM_ADDR,
+                SimDevice_eeprom24c(65536, 128, 0));
+  addr_bytes = 2;
+  i2c_fd = I2C_open(CHECK_BUS);
+  tx = malloc(65536);
+  rx = malloc(65536);
+  CHECK(i2c_fd >= 0 && tx && rx);
+  if (i2c_fd >= 0 && tx && rx) {
+    fillPattern(tx, 65536, 4);
+    CHECK(EEPROM_write(i2c_fd, &config, 0, tx, 65536) == 0);
+    resetTransfers();
+    CHECK(EEPROM_read(i2c_fd, &config, 100, rx, 60000) == 0);
+    // 7 full 8192 byte reads then the rest:
+    CHECK(recorded.n_transfers == 1);
+    CHECK(recorded.read_messages == 16);
+    CHECK(memcmp(tx + 100, rx, 60000) == 0);
+  }
+  free(tx);
+  free(rx);
+  if (i2c_fd >= 0) I2C_close(i2c_fd);
+}
+
+int main() {
+  SimRecorder recorder;
+
+  Transport_select(&Transport_sim);
+  memset((void *) &recorder, 0, sizeof(recorder));
+  recorder.i2c_transfer = recordTransfer;
+  Sim_setRecorder(&recorder);
+
+  checkPageWrites();
+  checkBlockAddressing();
+  checkLongRead();
+
+  Sim_setRecorder(NULL);
+  Sim_reset();
+  return CHECK_RESULT("check_eeprom");
+}
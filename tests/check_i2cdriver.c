@@ -0,0 +1,77 @@
+/**
+ * @file check_i2cdriver.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks i2cdriver's CRC checking against the simulated HTU21D.
+ */
+
+#include "i2cdriver.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHECK_BUS       1    // Simulated /dev/i2c-1
+#define HTU21D_ADDR     0x40 // Simulated HTU21D address
+#define HTU21D_CMD_TEMP 0xe3 // Command to read temperature
+
+/// Number of I2C transfers seen on the simulated bus
+static int n_transfers;
+
+static void recordTransfer(void *context, uint8_t bus,
+                           const struct i2c_msg *messages, int n_messages) {
+  n_transfers++;
+}
+
+/**
+ * @brief Checks reads are CRC checked, and reads that can't be are refused.
+ */
+static void checkCRC(int i2c_fd) {
+  I2C_crc_check check = { I2C_CRC8, CRC8_HTU21D_INIT, 2 };
+  I2C_crc_stats stats;
+  uint8_t rx_buffer[6];
+
+  CHECK(I2C_setSlaveAddress(i2c_fd, HTU21D_ADDR) == 0);
+  CHECK(I2C_setCRCCheck(i2c_fd, &check) == 0);
+  CHECK(I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, rx_buffer, 3) == 0);
+  CHECK(I2C_getCRCStats(i2c_fd, &stats) == 0);
+  CHECK(stats.checked == 1 && stats.errors == 0);
+
+  // Lengths that aren't whole words and CRCs fail without a transfer:
+  n_transfers = 0;
+  errno = 0;
+  CHECK(I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, rx_buffer, 2) == -1);
+  CHECK(errno == EINVAL);
+  errno = 0;
+  CHECK(I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, rx_buffer, 4) == -1);
+  CHECK(errno == EINVAL);
+  CHECK(n_transfers == 0);
+  CHECK(I2C_getCRCStats(i2c_fd, &stats) == 0);
+  CHECK(stats.checked == 1 && stats.errors == 0);
+
+  // Without a check any length goes:
+  CHECK(I2C_setCRCCheck(i2c_fd, NULL) == 0);
+  CHECK(I2C_readTransaction(i2c_fd, HTU21D_CMD_TEMP, rx_buffer, 2) == 0);
+}
+
+int main() {
+  SimRecorder recorder;
+  int i2c_fd;
+
+  Transport_select(&Transport_sim);
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return CHECK_RESULT("check_i2cdriver");
+
+  memset((void *) &recorder, 0, sizeof(recorder));
+  recorder.i2c_transfer = recordTransfer;
+  Sim_setRecorder(&recorder);
+
+  checkCRC(i2c_fd);
+
+  Sim_setRecorder(NULL);
+  I2C_close(i2c_fd);
+  return CHECK_RESULT("check_i2cdriver");
+}
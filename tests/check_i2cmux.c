@@ -0,0 +1,222 @@
+/**
+ * @file check_i2cmux.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks the order and stop conditions of I2C mux selects, using
+ *        simulated PCA9548 muxes that only switch at a stop like the real
+ *        parts.
+ *
+ * The simulated bus 1 has mux A at 0x70 and mux B at 0x71 behind channel 3
+ * of A. Identical devices at 0x50 sit behind channels 2 and 5 of A and
+ * channel 0 of B.
+ */
+
+#include "i2cdriver.h"
+#include "i2cmux.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHECK_BUS        1
+#define MUX_A_ADDR       0x70
+#define MUX_B_ADDR       0x71
+#define MUX_B_CHANNEL    3    // Channel of mux A that mux B is on
+#define DEVICE_ADDR      0x50
+#define MAX_TRANSFERS    8    // Most I2C transfers recorded per access
+#define MAX_MESSAGES     8    // Most messages recorded per transfer
+
+/**
+ * The I2C transfers recorded since the last #resetTransfers.
+ */
+static struct {
+  int n_transfers;                             ///< Number of transfers seen
+  int n_messages[MAX_TRANSFERS];               ///< Messages in each
+  uint16_t addr[MAX_TRANSFERS][MAX_MESSAGES];  ///< Address of each message
+  uint16_t flags[MAX_TRANSFERS][MAX_MESSAGES]; ///< Flags of each message
+} recorded;
+
+static void recordTransfer(void *context, uint8_t bus,
+                           const struct i2c_msg *messages, int n_messages) {
+  int i, n;
+  n = recorded.n_transfers++;
+  if (n >= MAX_TRANSFERS) return;
+  recorded.n_messages[n] = n_messages;
+  for (i=0; i<n_messages && i<MAX_MESSAGES; i++) {
+    recorded.addr[n][i] = messages[i].addr;
+    recorded.flags[n][i] = messages[i].flags;
+  }
+}
+
+static void resetTransfers(void) {
+  memset((void *) &recorded, 0, sizeof(recorded));
+}
+
+/**
+ * @brief Attaches the muxes and devices, with the given I2C_FUNCS.
+ */
+static void attachTopology(unsigned long funcs) {
+  SimDevice *mux_a, *mux_b;
+  Sim_reset();
+  Sim_setI2CFunctionality(funcs);
+  mux_a = SimDevice_pca9548();
+  mux_b = SimDevice_pca9548();
+  Sim_attachI2C(CHECK_BUS, MUX_A_ADDR, mux_a);
+  Sim_attachI2CMuxed(CHECK_BUS, mux_a, MUX_B_CHANNEL, MUX_B_ADDR, mux_b);
+  Sim_attachI2CMuxed(CHECK_BUS, mux_a, 2, DEVICE_ADDR,
+                     SimDevice_eeprom24c(256, 8, 0));
+  Sim_attachI2CMuxed(CHECK_BUS, mux_a, 5, DEVICE_ADDR,
+                     SimDevice_eeprom24c(256, 8, 0));
+  Sim_attachI2CMuxed(CHECK_BUS, mux_b, 0, DEVICE_ADDR,
+                     SimDevice_eeprom24c(256, 8, 0));
+}
+
+/**
+ * @brief Writes a byte to the device behind the given mux channel, then
+ *        reads it back.
+ */
+static int writeRead(I2C_mux_tree *tree, int mux, uint8_t channel,
+                     uint8_t value) {
+  uint8_t tx[2], rx;
+  tx[0] = 0;
+  tx[1] = value;
+  if (I2C_muxWrite(tree, mux, channel, DEVICE_ADDR, tx, 2) < 0) return -1;
+  if (I2C_muxReadTransaction(tree, mux, channel, DEVICE_ADDR, 0, &rx, 1) < 0) {
+    return -1;
+  }
+  return rx;
+}
+
+/**
+ * @brief Checks selects are flagged I2C_M_STOP and share the access's
+ *        I2C_RDWR when the adapter supports it.
+ */
+static void checkStopFlag(void) {
+  I2C_mux_tree *tree;
+  int i2c_fd, a, b;
+  uint8_t rx;
+
+  attachTopology(I2C_FUNC_I2C | I2C_FUNC_PROTOCOL_MANGLING);
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return;
+  tree = I2C_muxTreeCreate(i2c_fd);
+  a = I2C_muxAdd(tree, I2C_MUX_ROOT, 0, MUX_A_ADDR, I2C_MUX_PCA9548);
+  b = I2C_muxAdd(tree, a, MUX_B_CHANNEL, MUX_B_ADDR, I2C_MUX_PCA9548);
+
+  // Mux A first, then B once it's reachable, then the device:
+  resetTransfers();
+  CHECK(I2C_muxRead(tree, b, 0, DEVICE_ADDR, &rx, 1) == 0);
+  CHECK(recorded.n_transfers == 1);
+  CHECK(recorded.n_messages[0] == 3);
+  CHECK(recorded.addr[0][0] == MUX_A_ADDR);
+  CHECK(recorded.flags[0][0] & I2C_M_STOP);
+  CHECK(recorded.addr[0][1] == MUX_B_ADDR);
+  CHECK(recorded.flags[0][1] & I2C_M_STOP);
+  CHECK(recorded.addr[0][2] == DEVICE_ADDR);
+  CHECK(!(recorded.flags[0][2] & I2C_M_STOP));
+
+  // Nothing needs selecting the second time:
+  resetTransfers();
+  CHECK(I2C_muxRead(tree, b, 0, DEVICE_ADDR, &rx, 1) == 0);
+  CHECK(recorded.n_transfers == 1);
+  CHECK(recorded.n_messages[0] == 1);
+
+  // Each device only sees its own data:
+  CHECK(writeRead(tree, a, 2, 0x22) == 0x22);
+  CHECK(writeRead(tree, a, 5, 0x55) == 0x55);
+  CHECK(writeRead(tree, b, 0, 0xb0) == 0xb0);
+  CHECK(writeRead(tree, a, 2, 0x23) == 0x23);
+
+  I2C_muxTreeDestroy(tree);
+  I2C_close(i2c_fd);
+}
+
+/**
+ * @brief Checks each select gets an I2C_RDWR of its own, ahead of the
+ *        access, when the adapter can't send I2C_M_STOP.
+ */
+static void checkSeparateSelects(void) {
+  I2C_mux_tree *tree;
+  int i2c_fd, a, b, i;
+  uint8_t rx;
+
+  attachTopology(I2C_FUNC_I2C);
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return;
+  tree = I2C_muxTreeCreate(i2c_fd);
+  a = I2C_muxAdd(tree, I2C_MUX_ROOT, 0, MUX_A_ADDR, I2C_MUX_PCA9548);
+  b = I2C_muxAdd(tree, a, MUX_B_CHANNEL, MUX_B_ADDR, I2C_MUX_PCA9548);
+
+  resetTransfers();
+  CHECK(I2C_muxRead(tree, b, 0, DEVICE_ADDR, &rx, 1) == 0);
+  CHECK(recorded.n_transfers == 3);
+  CHECK(recorded.addr[0][0] == MUX_A_ADDR);
+  CHECK(recorded.addr[1][0] == MUX_B_ADDR);
+  CHECK(recorded.addr[2][0] == DEVICE_ADDR);
+  for (i=0; i<recorded.n_transfers && i<MAX_TRANSFERS; i++) {
+    CHECK(recorded.n_messages[i] == 1);
+    CHECK(!(recorded.flags[i][0] & I2C_M_STOP));
+  }
+
+  CHECK(writeRead(tree, a, 2, 0x22) == 0x22);
+  CHECK(writeRead(tree, a, 5, 0x55) == 0x55);
+  CHECK(writeRead(tree, b, 0, 0xb0) == 0xb0);
+
+  I2C_muxTreeDestroy(tree);
+  I2C_close(i2c_fd);
+}
+
+/**
+ * @brief Checks selects in a failed access are all sent again by the next
+ *        one, since they may not have taken effect.
+ */
+static void checkFailedSelect(void) {
+  I2C_mux_tree *tree;
+  int i2c_fd, a, missing;
+  uint8_t rx;
+
+  attachTopology(I2C_FUNC_I2C | I2C_FUNC_PROTOCOL_MANGLING);
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return;
+  tree = I2C_muxTreeCreate(i2c_fd);
+  a = I2C_muxAdd(tree, I2C_MUX_ROOT, 0, MUX_A_ADDR, I2C_MUX_PCA9548);
+  // A mux that isn't there, so every select to it fails:
+  missing = I2C_muxAdd(tree, a, 6, MUX_A_ADDR + 7, I2C_MUX_PCA9548);
+
+  CHECK(I2C_muxRead(tree, missing, 0, DEVICE_ADDR, &rx, 1) == -1);
+  CHECK(errno == ENXIO);
+  resetTransfers();
+  CHECK(I2C_muxRead(tree, missing, 0, DEVICE_ADDR, &rx, 1) == -1);
+  CHECK(recorded.n_transfers == 1);
+  CHECK(recorded.n_messages[0] == 2);
+  CHECK(recorded.addr[0][0] == MUX_A_ADDR);
+  CHECK(recorded.addr[0][1] == MUX_A_ADDR + 7);
+
+  // Mux A is still usable:
+  CHECK(writeRead(tree, a, 2, 0x24) == 0x24);
+
+  I2C_muxTreeDestroy(tree);
+  I2C_close(i2c_fd);
+}
+
+int main() {
+  SimRecorder recorder;
+
+  Transport_select(&Transport_sim);
+  memset((void *) &recorder, 0, sizeof(recorder));
+  recorder.i2c_transfer = recordTransfer;
+  Sim_setRecorder(&recorder);
+
+  checkStopFlag();
+  checkSeparateSelects();
+  checkFailedSelect();
+
+  Sim_setRecorder(NULL);
+  Sim_reset();
+  return CHECK_RESULT("check_i2cmux");
+}
@@ -0,0 +1,119 @@
+/**
+ * @file check_i2csched.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks the I2C scheduler against the simulated HTU21D, including 
+ *        tasks that replace themselves from their own callbacks.
+ */
+
+#include "i2cdriver.h"
+#include "i2csched.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <string.h>
+
+#define CHECK_BUS       1    // Simulated /dev/i2c-1
+#define HTU21D_ADDR     0x40 // Simulated HTU21D address
+#define HTU21D_CMD_TEMP 0xf3 // Command to measure temperature, no hold
+#define HTU21D_CMD_RH   0xf5 // Command to measure humidity, no hold
+#define CONVERSION_US   1000 // Conversion time given to the tasks
+#define MAX_RUNS        100  // Most scheduler runs to wait for the results
+
+/**
+ * What the callbacks saw.
+ */
+static struct {
+  I2C_scheduler *sched;
+  int temp_id;          ///< Id of the temperature task
+  int rh_id;            ///< Id of the humidity task added in its place
+  int n_temp;           ///< Temperature results seen
+  int n_rh;             ///< Humidity results seen
+  int result_changed;   ///< Set if a result changed during its callback
+  uint8_t temp[3];      ///< Last temperature result
+  uint8_t rh[3];        ///< Last humidity result
+} seen;
+
+static void setTask(I2C_sched_task *task, const uint8_t *cmd,
+                    I2C_sched_callback callback) {
+  memset((void *) task, 0, sizeof(I2C_sched_task));
+  task->addr = HTU21D_ADDR;
+  task->trigger = cmd;
+  task->n_trigger_bytes = 1;
+  task->conversion_us = CONVERSION_US;
+  task->n_result_bytes = 3;
+  task->callback = callback;
+}
+
+static void onRH(void *context, const uint8_t *result, int n_bytes, 
+                 int error) {
+  seen.n_rh++;
+  if (!error && n_bytes == 3) memcpy(seen.rh, result, 3);
+}
+
+/**
+ * Replaces the temperature task with a humidity task, then checks its own
+ * result is still intact.
+ */
+static void onTemp(void *context, const uint8_t *result, int n_bytes, 
+                   int error) {
+  static const uint8_t rh_cmd = HTU21D_CMD_RH;
+  I2C_sched_task task;
+  seen.n_temp++;
+  if (error || n_bytes != 3) return;
+  memcpy(seen.temp, result, 3);
+  CHECK(I2C_schedRemove(seen.sched, seen.temp_id) == 0);
+  setTask(&task, &rh_cmd, onRH);
+  seen.rh_id = I2C_schedAdd(seen.sched, &task);
+  if (memcmp(seen.temp, result, 3) != 0) seen.result_changed = 1;
+}
+
+static void checkReplaceInCallback(int i2c_fd) {
+  static const uint8_t temp_cmd = HTU21D_CMD_TEMP;
+  I2C_sched_task task;
+  int i, id;
+
+  seen.sched = I2C_schedCreate(i2c_fd);
+  CHECK(seen.sched != NULL);
+  if (!seen.sched) return;
+  setTask(&task, &temp_cmd, onTemp);
+  seen.temp_id = I2C_schedAdd(seen.sched, &task);
+  seen.rh_id = -1;
+  CHECK(seen.temp_id >= 0);
+
+  for (i=0; i<MAX_RUNS && !seen.n_rh; i++) {
+    CHECK(I2C_schedRun(seen.sched, 100) >= 0);
+  }
+  CHECK(seen.n_temp == 1);
+  CHECK(seen.n_rh >= 1);
+  CHECK(!seen.result_changed);
+  // The removed task's slot still had its result in use, so the humidity 
+  // task got another:
+  CHECK(seen.rh_id >= 0 && seen.rh_id != seen.temp_id);
+  // Different measurements, each with the HTU21D's status bits:
+  CHECK(memcmp(seen.temp, seen.rh, 2) != 0);
+  CHECK((seen.temp[1] & 0x2) == 0 && (seen.rh[1] & 0x2) == 0x2);
+
+  // Outside of a callback the freed slot is reused:
+  setTask(&task, &temp_cmd, onRH);
+  id = I2C_schedAdd(seen.sched, &task);
+  CHECK(id == seen.temp_id);
+
+  I2C_schedDestroy(seen.sched);
+}
+
+int main() {
+  int i2c_fd;
+
+  Transport_select(&Transport_sim);
+  Sim_reset();
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return CHECK_RESULT("check_i2csched");
+
+  checkReplaceInCallback(i2c_fd);
+
+  I2C_close(i2c_fd);
+  return CHECK_RESULT("check_i2csched");
+}
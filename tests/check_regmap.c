@@ -0,0 +1,153 @@
+/**
+ * @file check_regmap.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks register map caching against a simulated device, comparing
+ *        the cache with what actually reaches the device.
+ *
+ * A 24C02 EEPROM stands in for a device with 256 8-bit registers, as in the
+ * i2c_regmap_sim example, but with no write cycle time and a single 256-byte
+ * page so that long writes don't wrap.
+ */
+
+#include "i2cdriver.h"
+#include "regmap.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHECK_BUS       1    // Simulated /dev/i2c-1
+#define DEVICE_ADDR     0x50 // Device slave address
+#define REG_STATUS      0x00 // Volatile register
+#define REG_ID          0x01 // Read-only register
+#define REG_CTRL        0x02 // Cached register
+#define REG_TABLE       0x10 // First of a table of cached registers
+#define TABLE_LEN       40   // More registers than one bus transfer holds
+
+/**
+ * @brief Creates the map, with its ranges only in scope for the call.
+ */
+static Regmap *createMap(int i2c_fd) {
+  Regmap_range ranges[] = {
+    { REG_STATUS, REG_STATUS, REGMAP_VOLATILE },
+    { REG_ID, REG_ID, REGMAP_READ_ONLY },
+  };
+  Regmap_config config;
+  memset((void *) &config, 0, sizeof(config));
+  config.reg_bytes = 1;
+  config.val_bytes = 1;
+  config.max_register = 0xff;
+  config.ranges = ranges;
+  config.n_ranges = 2;
+  return Regmap_createI2C(i2c_fd, DEVICE_ADDR, &config);
+}
+
+/**
+ * @brief Reads a register straight from the device, bypassing the map.
+ */
+static int deviceRegister(int i2c_fd, uint8_t reg) {
+  uint8_t value;
+  if (I2C_setSlaveAddress(i2c_fd, DEVICE_ADDR) < 0 ||
+      I2C_readTransaction(i2c_fd, reg, &value, 1) < 0) {
+    return -1;
+  }
+  return value;
+}
+
+static void checkCaching(int i2c_fd, Regmap *map) {
+  Regmap_stats stats;
+  uint32_t value;
+  int i;
+
+  // One bus read, then the cache:
+  for (i=0; i<3; i++) CHECK(Regmap_read(map, REG_CTRL, &value) == 0);
+  Regmap_getStats(map, &stats);
+  CHECK(stats.misses == 1 && stats.hits == 2 && stats.bus_reads == 1);
+
+  // Volatile registers always go to the bus:
+  for (i=0; i<3; i++) CHECK(Regmap_read(map, REG_STATUS, &value) == 0);
+  Regmap_getStats(map, &stats);
+  CHECK(stats.bus_reads == 4);
+
+  // Unchanged writes are skipped:
+  CHECK(Regmap_write(map, REG_CTRL, 0x5a) == 0);
+  CHECK(Regmap_update(map, REG_CTRL, 0x0f, 0x0a) == 0);
+  Regmap_getStats(map, &stats);
+  CHECK(stats.bus_writes == 1 && stats.skipped_writes == 1);
+  CHECK(deviceRegister(i2c_fd, REG_CTRL) == 0x5a);
+
+  errno = 0;
+  CHECK(Regmap_write(map, REG_ID, 1) == -1 && errno == EINVAL);
+}
+
+/**
+ * @brief Checks values too wide for the registers are rejected rather than
+ *        cached, since only their low bytes would reach the device.
+ */
+static void checkValueWidth(int i2c_fd, Regmap *map) {
+  uint32_t values[2] = { 0x12, 0x1ff }, value;
+
+  errno = 0;
+  CHECK(Regmap_write(map, REG_CTRL, 0x1ff) == -1 && errno == EINVAL);
+  CHECK(Regmap_read(map, REG_CTRL, &value) == 0 && value == 0x5a);
+  errno = 0;
+  CHECK(Regmap_update(map, REG_CTRL, 0x100, 0x100) == -1 && errno == EINVAL);
+  errno = 0;
+  CHECK(Regmap_bulkWrite(map, REG_TABLE, values, 2) == -1 && errno == EINVAL);
+  CHECK(Regmap_write(map, REG_CTRL, 0xff) == 0);
+  CHECK(deviceRegister(i2c_fd, REG_CTRL) == 0xff);
+}
+
+/**
+ * @brief Checks a bulk write and read of more registers than fit in one 
+ *        transfer, and that cache-only writes reach the device on sync.
+ */
+static void checkBulkAndSync(int i2c_fd, Regmap *map) {
+  uint32_t table[TABLE_LEN];
+  int i, errors;
+
+  for (i=0; i<TABLE_LEN; i++) table[i] = i * 3;
+  CHECK(Regmap_bulkWrite(map, REG_TABLE, table, TABLE_LEN) == 0);
+  Regmap_invalidate(map, REG_TABLE, REG_TABLE + TABLE_LEN - 1);
+  memset((void *) table, 0, sizeof(table));
+  CHECK(Regmap_bulkRead(map, REG_TABLE, table, TABLE_LEN) == 0);
+  errors = 0;
+  for (i=0; i<TABLE_LEN; i++) {
+    if (table[i] != (uint32_t) (i * 3)) errors++;
+  }
+  CHECK(errors == 0);
+
+  Regmap_setCacheOnly(map, 1);
+  CHECK(Regmap_write(map, REG_CTRL, 0x33) == 0);
+  CHECK(deviceRegister(i2c_fd, REG_CTRL) == 0xff);
+  Regmap_setCacheOnly(map, 0);
+  CHECK(Regmap_sync(map) == 0);
+  CHECK(deviceRegister(i2c_fd, REG_CTRL) == 0x33);
+}
+
+int main() {
+  Regmap *map;
+  int i2c_fd;
+
+  Transport_select(&Transport_sim);
+  Sim_reset();
+  Sim_attachI2C(CHECK_BUS, DEVICE_ADDR, SimDevice_eeprom24c(256, 256, 0));
+  i2c_fd = I2C_open(CHECK_BUS);
+  CHECK(i2c_fd >= 0);
+  if (i2c_fd < 0) return CHECK_RESULT("check_regmap");
+  map = createMap(i2c_fd);
+  CHECK(map != NULL);
+  if (!map) return CHECK_RESULT("check_regmap");
+
+  checkCaching(i2c_fd, map);
+  checkValueWidth(i2c_fd, map);
+  checkBulkAndSync(i2c_fd, map);
+
+  Regmap_destroy(map);
+  I2C_close(i2c_fd);
+  Sim_reset();
+  return CHECK_RESULT("check_regmap");
+}
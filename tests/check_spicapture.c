@@ -0,0 +1,120 @@
+/**
+ * @file check_spicapture.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks which capture settings are accepted and that a capture reads
+ *        each block in a single SPI_IOC_MESSAGE, on the simulated bus.
+ */
+
+#include "spidriver.h"
+#include "spicapture.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define CHECK_BUS        0   // Simulated loopback on /dev/spidev0.0
+#define CHECK_CS         0
+#define CHECK_BLOCKS     4   // Blocks to read from the running capture
+
+/// Number of transfers in the largest SPI_IOC_MESSAGE seen
+static int max_transfers;
+
+static void recordMessage(void *context, uint8_t bus, uint8_t cs,
+                          uint32_t mode,
+                          const struct spi_ioc_transfer *transfers,
+                          int n_transfers) {
+  if (n_transfers > max_transfers) max_transfers = n_transfers;
+}
+
+/**
+ * @brief Tries to create a capture of 1-byte frames, returning the errno it
+ *        failed with or 0 if it was created.
+ */
+static int tryCreate(SPI_handle *handle, uint32_t frames_per_block) {
+  SPI_capture_config config;
+  SPI_capture *capture;
+  memset((void *) &config, 0, sizeof(config));
+  config.frame_words = 1;
+  config.frames_per_block = frames_per_block;
+  config.n_blocks = 2;
+  errno = 0;
+  capture = SPI_captureCreate(handle, &config);
+  if (!capture) return errno;
+  SPI_captureDestroy(capture);
+  return 0;
+}
+
+/**
+ * @brief Checks the block size limits from the segment count and bufsiz.
+ */
+static void checkLimits(SPI_handle *handle) {
+  uint32_t max_frames;
+  // Each 1-byte frame takes SPI_DMA_ALIGN bytes of the bufsiz:
+  max_frames = SPI_getBufferSize() / SPI_DMA_ALIGN;
+  if (max_frames > SPI_MAX_SEGMENTS) max_frames = SPI_MAX_SEGMENTS;
+  CHECK(tryCreate(handle, max_frames) == 0);
+  CHECK(tryCreate(handle, max_frames + 1) == EMSGSIZE);
+  CHECK(tryCreate(handle, SPI_MAX_SEGMENTS + 1) == EMSGSIZE);
+  CHECK(tryCreate(handle, 0) == EINVAL);
+}
+
+/**
+ * @brief Runs the largest capture the bufsiz allows and checks its data.
+ */
+static void checkCapture(SPI_handle *handle) {
+  SPI_capture_config config;
+  SPI_capture *capture;
+  uint8_t tx_frame[2] = { 0xa5, 0x3c };
+  const uint8_t *block;
+  uint32_t i;
+  int n_blocks;
+
+  memset((void *) &config, 0, sizeof(config));
+  config.frame_words = sizeof(tx_frame);
+  config.frames_per_block = SPI_getBufferSize() / SPI_DMA_ALIGN;
+  config.n_blocks = 2;
+  config.tx_frame = tx_frame;
+  capture = SPI_captureCreate(handle, &config);
+  CHECK(capture != NULL);
+  if (!capture) return;
+
+  max_transfers = 0;
+  CHECK(SPI_captureStart(capture) == 0);
+  for (n_blocks=0; n_blocks<CHECK_BLOCKS; n_blocks++) {
+    block = SPI_captureAcquire(capture, 1000);
+    CHECK(block != NULL);
+    if (!block) break;
+    for (i=0; i<SPI_captureBlockSize(capture); i++) {
+      if (block[i] != tx_frame[i % sizeof(tx_frame)]) break;
+    }
+    CHECK(i == SPI_captureBlockSize(capture));
+    SPI_captureRelease(capture);
+  }
+  SPI_captureStop(capture);
+  CHECK(max_transfers == (int) config.frames_per_block);
+  SPI_captureDestroy(capture);
+}
+
+int main() {
+  SimRecorder recorder;
+  SPI_handle *handle;
+
+  Transport_select(&Transport_sim);
+  handle = SPI_openHandle(CHECK_BUS, CHECK_CS);
+  CHECK(handle != NULL);
+  if (!handle) return CHECK_RESULT("check_spicapture");
+
+  memset((void *) &recorder, 0, sizeof(recorder));
+  recorder.spi_message = recordMessage;
+  Sim_setRecorder(&recorder);
+
+  checkLimits(handle);
+  checkCapture(handle);
+
+  Sim_setRecorder(NULL);
+  SPI_closeHandle(handle);
+  return CHECK_RESULT("check_spicapture");
+}
@@ -0,0 +1,297 @@
+/**
+ * @file check_spidriver.c
+ * @author Alex Hiam - <alex@graycat.io>
+ *
+ * @brief Checks how spidriver splits transfers into SPI_IOC_MESSAGEs, using
+ *        the simulated bus to record each message.
+ */
+
+#include "spidriver.h"
+#include "simbus.h"
+#include "transport.h"
+#include "check.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#define CHECK_BUS        0   // Simulated loopback on /dev/spidev0.0
+#define CHECK_CS         0
+#define ADC_BUS          0   // Simulated 12-bit ramp ADC on /dev/spidev0.1
+#define ADC_CS           1
+#define ADC_FRAMES       1000 // More frames than one message can hold
+#define MAX_MESSAGES     16  // Most messages recorded per check
+
+/**
+ * The SPI_IOC_MESSAGEs recorded since the last #resetMessages.
+ */
+static struct {
+  int n_messages;                 ///< Number of messages seen
+  int n_total;                    ///< Transfers in all messages seen
+  int max_transfers;              ///< Most transfers in one message
+  int n_transfers[MAX_MESSAGES];  ///< Transfers in each message
+  uint32_t tx_total[MAX_MESSAGES]; ///< Aligned bytes transmitted by each
+  uint32_t rx_total[MAX_MESSAGES]; ///< Aligned bytes received by each
+  uint32_t delay_total[MAX_MESSAGES]; ///< Microseconds of delay in each
+  int n_cs_changes[MAX_MESSAGES]; ///< Transfers with cs_change in each
+} recorded;
+
+/**
+ * Rounds the given length up the way spidev does when totalling a message.
+ */
+static uint32_t alignLength(uint32_t len) {
+  return (len + SPI_DMA_ALIGN - 1) / SPI_DMA_ALIGN * SPI_DMA_ALIGN;
+}
+
+static void recordMessage(void *context, uint8_t bus, uint8_t cs,
+                          uint32_t mode,
+                          const struct spi_ioc_transfer *transfers,
+                          int n_transfers) {
+  int i, n;
+  n = recorded.n_messages++;
+  recorded.n_total += n_transfers;
+  if (n_transfers > recorded.max_transfers) {
+    recorded.max_transfers = n_transfers;
+  }
+  if (n >= MAX_MESSAGES) return;
+  recorded.n_transfers[n] = n_transfers;
+  for (i=0; i<n_transfers; i++) {
+    recorded.delay_total[n] += transfers[i].delay_usecs;
+    if (transfers[i].cs_change) recorded.n_cs_changes[n]++;
+    if (transfers[i].tx_buf) {
+      recorded.tx_total[n] += alignLength(transfers[i].len);
+    }
+    if (transfers[i].rx_buf) {
+      recorded.rx_total[n] += alignLength(transfers[i].len);
+    }
+  }
+}
+
+static void resetMessages(void) {
+  memset((void *) &recorded, 0, sizeof(recorded));
+}
+
+/**
+ * @brief Checks messages are split at the largest transfer count the ioctl
+ *        number can encode.
+ */
+static void checkSegmentCounts(int spidev_fd) {
+  static SPI_segment segments[SPI_MAX_SEGMENTS + 1];
+  struct spi_ioc_transfer transfer;
+  int i;
+
+  // 512 transfers would take the whole 14-bit size field and wrap to 0:
+  CHECK(SPI_MAX_SEGMENTS == 511);
+  memset((void *) &transfer, 0, sizeof(transfer));
+  errno = 0;
+  CHECK(Transport_ioctl(spidev_fd, SPI_IOC_MESSAGE(SPI_MAX_SEGMENTS + 1),
+                        &transfer) == -1);
+  CHECK(errno == EINVAL);
+
+  // Segments without buffers don't count towards bufsiz, so only the
+  // transfer count limits these:
+  memset((void *) segments, 0, sizeof(segments));
+  for (i=0; i<SPI_MAX_SEGMENTS+1; i++) segments[i].n_words = 1;
+
+  resetMessages();
+  CHECK(SPI_message(spidev_fd, segments, SPI_MAX_SEGMENTS) ==
+        SPI_MAX_SEGMENTS);
+  CHECK(recorded.n_messages == 1);
+  CHECK(recorded.n_transfers[0] == SPI_MAX_SEGMENTS);
+
+  resetMessages();
+  CHECK(SPI_message(spidev_fd, segments, SPI_MAX_SEGMENTS + 1) ==
+        SPI_MAX_SEGMENTS + 1);
+  CHECK(recorded.n_messages == 2);
+  CHECK(recorded.n_transfers[0] == SPI_MAX_SEGMENTS);
+  CHECK(recorded.n_transfers[1] == 1);
+}
+
+/**
+ * @brief Checks messages are split where the DMA-aligned transfer lengths
+ *        fill the bufsiz, not the raw lengths.
+ */
+static void checkBufferSplitting(int spidev_fd) {
+  SPI_segment *segments;
+  uint32_t bufsiz, segment_len, n_bytes, i;
+  int n_segments, n_aligned;
+  uint8_t *tx, *rx;
+
+  bufsiz = SPI_getBufferSize();
+  // Short segments whose raw lengths fit in the bufsiz, but whose aligned
+  // lengths take one more message:
+  segment_len = SPI_DMA_ALIGN / 2 + 8;
+  n_aligned = bufsiz / SPI_DMA_ALIGN;
+  n_segments = n_aligned + 1;
+  n_bytes = n_segments * segment_len;
+  CHECK(n_bytes <= bufsiz);
+  segments = calloc(n_segments, sizeof(SPI_segment));
+  tx = malloc(3 * bufsiz + 50);
+  rx = malloc(3 * bufsiz + 50);
+  CHECK(segments && tx && rx);
+  if (!segments || !tx || !rx) {
+    free(segments);
+    free(tx);
+    free(rx);
+    return;
+  }
+  for (i=0; i<3*bufsiz+50; i++) tx[i] = i * 7;
+
+  memset(rx, 0, n_bytes);
+  for (i=0; i<(uint32_t) n_segments; i++) {
+    segments[i].tx_buffer = tx + i * segment_len;
+    segments[i].rx_buffer = rx + i * segment_len;
+    segments[i].n_words = segment_len;
+  }
+  resetMessages();
+  CHECK(SPI_message(spidev_fd, segments, n_segments) == (int) n_bytes);
+  CHECK(recorded.n_messages == 2);
+  CHECK(recorded.n_transfers[0] == n_aligned);
+  CHECK(recorded.n_transfers[1] == 1);
+  CHECK(recorded.tx_total[0] <= bufsiz && recorded.rx_total[0] <= bufsiz);
+  CHECK(memcmp(tx, rx, n_bytes) == 0);
+
+  // A long transfer is cut into pieces that each fill a message:
+  n_bytes = 3 * bufsiz + 50;
+  memset(rx, 0, n_bytes);
+  resetMessages();
+  CHECK(SPI_transfer(spidev_fd, tx, rx, n_bytes) == (int) n_bytes);
+  CHECK(recorded.n_messages == 4);
+  for (i=0; i<(uint32_t) recorded.n_messages && i<MAX_MESSAGES; i++) {
+    CHECK(recorded.n_transfers[i] == 1);
+    CHECK(recorded.tx_total[i] <= bufsiz && recorded.rx_total[i] <= bufsiz);
+  }
+  CHECK(memcmp(tx, rx, n_bytes) == 0);
+
+  free(segments);
+  free(tx);
+  free(rx);
+}
+
+/**
+ * @brief Checks segments of 0 words still delay and change CS.
+ */
+static void checkEmptySegments(int spidev_fd) {
+  SPI_segment segments[3];
+  uint8_t tx[2] = { 0x12, 0x34 }, rx[2];
+
+  // Write, wait, then read:
+  memset((void *) segments, 0, sizeof(segments));
+  segments[0].tx_buffer = tx;
+  segments[0].n_words = 2;
+  segments[1].delay_usecs = 100;
+  segments[2].rx_buffer = rx;
+  segments[2].n_words = 2;
+  resetMessages();
+  CHECK(SPI_message(spidev_fd, segments, 3) == 4);
+  CHECK(recorded.n_messages == 1);
+  CHECK(recorded.n_transfers[0] == 3);
+  CHECK(recorded.delay_total[0] == 100);
+
+  // Just a CS toggle and a delay:
+  memset((void *) segments, 0, sizeof(segments));
+  segments[0].cs_change = 1;
+  segments[1].delay_usecs = 50;
+  resetMessages();
+  CHECK(SPI_message(spidev_fd, segments, 2) == 0);
+  CHECK(recorded.n_messages == 1);
+  CHECK(recorded.n_transfers[0] == 2);
+  CHECK(recorded.delay_total[0] == 50);
+  CHECK(recorded.n_cs_changes[0] == 1);
+
+  // A plain transfer of nothing doesn't touch the bus:
+  resetMessages();
+  CHECK(SPI_transfer(spidev_fd, tx, rx, 0) == 0);
+  CHECK(recorded.n_messages == 0);
+}
+
+/**
+ * @brief Checks a message built once can be sent repeatedly, with new 
+ *        buffers each time.
+ */
+static void checkBuiltMessage(void) {
+  struct spi_ioc_transfer transfers[4];
+  SPI_segment segments[5];
+  SPI_handle *handle;
+  uint8_t tx[4] = { 1, 2, 3, 4 }, rx[2][4];
+  int i;
+
+  handle = SPI_openHandle(CHECK_BUS, CHECK_CS);
+  CHECK(handle != NULL);
+  if (!handle) return;
+  memset((void *) segments, 0, sizeof(segments));
+  for (i=0; i<5; i++) {
+    segments[i].tx_buffer = tx + (i % 4);
+    segments[i].rx_buffer = rx[0] + (i % 4);
+    segments[i].n_words = 1;
+  }
+  CHECK(SPI_handleBuildMessage(handle, segments, 5, transfers, 4) == -1);
+  CHECK(errno == EMSGSIZE);
+  CHECK(SPI_handleBuildMessage(handle, segments, 4, transfers, 4) == 4);
+
+  memset((void *) rx, 0, sizeof(rx));
+  resetMessages();
+  CHECK(SPI_handleSendMessage(handle, transfers, 4) == 4);
+  for (i=0; i<4; i++) transfers[i].rx_buf = (uintptr_t) (rx[1] + i);
+  CHECK(SPI_handleSendMessage(handle, transfers, 4) == 4);
+  CHECK(recorded.n_messages == 2);
+  CHECK(memcmp(rx[0], tx, 4) == 0);
+  CHECK(memcmp(rx[1], tx, 4) == 0);
+
+  SPI_closeHandle(handle);
+}
+
+/**
+ * @brief Checks every frame of a read of more frames than one message can
+ *        hold is filled in.
+ */
+static void checkReadFrames(void) {
+  static uint16_t rx[ADC_FRAMES][2];
+  int adc_fd, i, errors;
+
+  adc_fd = SPI_open(ADC_BUS, ADC_CS);
+  CHECK(adc_fd >= 0);
+  if (adc_fd < 0) return;
+  CHECK(SPI_setBitsPerWord(adc_fd, 16) == 0);
+
+  // The ADC restarts its ramp each time it's selected, so every frame
+  // should read the same two samples:
+  memset((void *) rx, 0xff, sizeof(rx));
+  resetMessages();
+  CHECK(SPI_readFrames(adc_fd, rx, 2, ADC_FRAMES) == 2 * ADC_FRAMES);
+  CHECK(recorded.n_messages > 1);
+  CHECK(recorded.n_total == ADC_FRAMES);
+  CHECK(recorded.max_transfers <= SPI_MAX_SEGMENTS);
+  errors = 0;
+  for (i=0; i<ADC_FRAMES; i++) {
+    if (rx[i][0] != 0 || rx[i][1] != 1) errors++;
+  }
+  CHECK(errors == 0);
+
+  SPI_close(adc_fd);
+}
+
+int main() {
+  SimRecorder recorder;
+  int spidev_fd;
+
+  Transport_select(&Transport_sim);
+  spidev_fd = SPI_open(CHECK_BUS, CHECK_CS);
+  CHECK(spidev_fd >= 0);
+  if (spidev_fd < 0) return CHECK_RESULT("check_spidriver");
+
+  memset((void *) &recorder, 0, sizeof(recorder));
+  recorder.spi_message = recordMessage;
+  Sim_setRecorder(&recorder);
+
+  checkSegmentCounts(spidev_fd);
+  checkBufferSplitting(spidev_fd);
+  checkEmptySegments(spidev_fd);
+  checkBuiltMessage();
+  checkReadFrames();
+
+  Sim_setRecorder(NULL);
+  SPI_close(spidev_fd);
+  return CHECK_RESULT("check_spidriver");
+}